@@ -0,0 +1,29 @@
+include(FindPackageHandleStandardArgs)
+
+find_path(ZSTD_INCLUDE_DIR
+    NAMES
+        zstd.h
+)
+
+find_library(ZSTD_LIBRARY
+    NAMES
+        zstd
+)
+
+set(ZSTD_INCLUDE_DIRS ${ZSTD_INCLUDE_DIR})
+set(ZSTD_LIBRARIES ${ZSTD_LIBRARY})
+
+find_package_handle_standard_args(Zstd DEFAULT_MSG
+    ZSTD_INCLUDE_DIR
+    ZSTD_LIBRARY
+)
+
+mark_as_advanced(ZSTD_INCLUDE_DIR ZSTD_LIBRARY)
+
+if(Zstd_FOUND AND NOT TARGET 3rdparty::zstd)
+    add_library(3rdparty::zstd UNKNOWN IMPORTED)
+    set_target_properties(3rdparty::zstd PROPERTIES
+        IMPORTED_LOCATION "${ZSTD_LIBRARY}"
+        INTERFACE_INCLUDE_DIRECTORIES "${ZSTD_INCLUDE_DIR}"
+    )
+endif()
@@ -0,0 +1,435 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <asio.hpp>
+
+#include "benchmark_runner.hpp"
+#include "defs.hpp"
+#include "deserializer.hpp"
+#include "file_io.hpp"
+#include "log.hpp"
+#include "memory_io.hpp"
+#include "netascii_io.hpp"
+#include "packet.hpp"
+#include "packet_builder.hpp"
+#include "packet_parser.hpp"
+#include "string_utils.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Benchmarks of the packet codec and the I/O hot paths, results printed as a
+// table or as JSON to be compared across releases.
+class bench_app
+{
+public:
+    static const std::size_t NETASCII_INPUT_SIZE = 1024 * 1024;
+    static const std::size_t FILE_SIZE = 4 * 1024 * 1024;
+
+    bench_app(int argc, char* argv[])
+        : m_program_name(argv[0])
+        , m_argc(argc)
+        , m_argv(argv)
+    {
+        // noop
+    }
+
+    int run()
+    {
+        std::string filter;
+        std::string format = "text";
+        std::uint64_t min_time_ms = 200;
+        std::uint64_t repetitions = 3;
+
+        for (int i = 1; i < m_argc; ++i)
+        {
+            std::string arg = m_argv[i];
+
+            if ((arg == "-h") || (arg == "--help"))
+            {
+                print_usage(std::cout);
+                return EXIT_SUCCESS;
+            }
+            if ((arg == "--filter") || (arg == "--format") || (arg == "--min-time") || (arg == "--repetitions"))
+            {
+                if (i + 1 >= m_argc)
+                {
+                    log_error() << "missing value for: " << arg << std::endl;
+                    print_usage(std::cerr);
+                    return EXIT_FAILURE;
+                }
+
+                std::string value = m_argv[++i];
+                bool valid = true;
+                if (arg == "--filter")
+                {
+                    filter = value;
+                }
+                else if (arg == "--format")
+                {
+                    format = value;
+                    valid = (value == "text") || (value == "json");
+                }
+                else if (arg == "--min-time")
+                {
+                    valid = parse_uint64(value, min_time_ms);
+                }
+                else
+                {
+                    valid = parse_uint64(value, repetitions) && (repetitions > 0);
+                }
+
+                if (!valid)
+                {
+                    log_error() << "invalid value for " << arg << ": " << value << std::endl;
+                    return EXIT_FAILURE;
+                }
+                continue;
+            }
+
+            log_error() << "unknown option: " << arg << std::endl;
+            print_usage(std::cerr);
+            return EXIT_FAILURE;
+        }
+
+        benchmark_runner runner(std::chrono::milliseconds(min_time_ms), repetitions, filter);
+
+        run_parser_benchmarks(runner);
+        run_builder_benchmarks(runner);
+        run_netascii_benchmarks(runner);
+        if (!run_file_benchmarks(runner))
+        {
+            return EXIT_FAILURE;
+        }
+        run_string_benchmarks(runner);
+
+        if (format == "json")
+        {
+            runner.write_json(std::cout);
+        }
+        else
+        {
+            runner.write_text(std::cout);
+        }
+        return EXIT_SUCCESS;
+    }
+
+private:
+    // Discards the written data, so only the writer on top of it is measured.
+    class discard_writer : public writer
+    {
+    public:
+        bool close() final
+        {
+            return true;
+        }
+
+        bool is_open() const final
+        {
+            return true;
+        }
+
+        bool write(const void* buffer, const std::size_t /*bytes_count*/) final
+        {
+            benchmark_runner::keep(buffer);
+            return true;
+        }
+    };
+
+    static packet_file_req make_request()
+    {
+        packet_file_req packet;
+        packet.m_op = OP_RRQ;
+        packet.m_filename = "pxelinux.cfg/01-52-54-00-12-34-56";
+        packet.m_mode = "octet";
+        packet.m_options[OPTION_BLKSIZE] = "1428";
+        packet.m_options[OPTION_WINDOWSIZE] = "8";
+        packet.m_options[OPTION_TSIZE] = "0";
+        packet.m_options[OPTION_TIMEOUT] = "1";
+        return packet;
+    }
+
+    static packet_data make_data()
+    {
+        packet_data packet;
+        packet.m_op = OP_DATA;
+        packet.m_block_no = 1234;
+        packet.m_data.assign(DEFAULT_DATA_SIZE, 0x5A);
+        return packet;
+    }
+
+    static packet_error make_error()
+    {
+        packet_error packet;
+        packet.m_op = OP_ERROR;
+        packet.m_error_code = ERRCODE_FILE_NOT_FOUND;
+        packet.m_error_message = "file not found";
+        return packet;
+    }
+
+    static packet_oack make_oack()
+    {
+        packet_oack packet;
+        packet.m_op = OP_OACK;
+        packet.m_options[OPTION_BLKSIZE] = "1428";
+        packet.m_options[OPTION_WINDOWSIZE] = "8";
+        packet.m_options[OPTION_TSIZE] = "7340032";
+        return packet;
+    }
+
+    static void run_parse_benchmark(
+        benchmark_runner& runner, const std::string& name, const std::vector<std::uint8_t>& data)
+    {
+        runner.run("parse_packet/" + name, data.size(), [&data](std::uint64_t iterations) {
+            for (std::uint64_t i = 0; i < iterations; ++i)
+            {
+                auto packet = packet_parser::parse_packet(asio::const_buffer(data.data(), data.size()));
+                benchmark_runner::keep(packet);
+            }
+        });
+    }
+
+    static void run_parser_benchmarks(benchmark_runner& runner)
+    {
+        auto request = make_request();
+        run_parse_benchmark(runner, "rrq", packet_builder::build_packet(request));
+        request.m_op = OP_WRQ;
+        run_parse_benchmark(runner, "wrq", packet_builder::build_packet(request));
+        run_parse_benchmark(runner, "data", packet_builder::build_packet(make_data()));
+
+        packet_ack ack;
+        ack.m_op = OP_ACK;
+        ack.m_block_no = 1234;
+        run_parse_benchmark(runner, "ack", packet_builder::build_packet(ack));
+        run_parse_benchmark(runner, "error", packet_builder::build_packet(make_error()));
+        run_parse_benchmark(runner, "oack", packet_builder::build_packet(make_oack()));
+
+        // strings of the request after the opcode: filename, mode and the options
+        auto request_data = packet_builder::build_packet(make_request());
+        runner.run("deserializer/read_string", request_data.size() - 2, [&request_data](std::uint64_t iterations) {
+            for (std::uint64_t i = 0; i < iterations; ++i)
+            {
+                deserializer deserializer(asio::const_buffer(request_data.data() + 2, request_data.size() - 2));
+                while (deserializer.has_more_bytes())
+                {
+                    auto str = deserializer.read_string();
+                    benchmark_runner::keep(str);
+                }
+            }
+        });
+    }
+
+    template <class packet_T>
+    static void run_build_benchmark(benchmark_runner& runner, const std::string& name, const packet_T& packet)
+    {
+        auto size = packet_builder::build_packet(packet).size();
+        runner.run("build_packet/" + name, size, [&packet](std::uint64_t iterations) {
+            for (std::uint64_t i = 0; i < iterations; ++i)
+            {
+                auto data = packet_builder::build_packet(packet);
+                benchmark_runner::keep(data);
+            }
+        });
+    }
+
+    static void run_builder_benchmarks(benchmark_runner& runner)
+    {
+        run_build_benchmark(runner, "rrq", make_request());
+        run_build_benchmark(runner, "data", make_data());
+        run_build_benchmark(runner, "error", make_error());
+        run_build_benchmark(runner, "oack", make_oack());
+
+        packet_ack ack;
+        ack.m_op = OP_ACK;
+        ack.m_block_no = 1234;
+        run_build_benchmark(runner, "ack", ack);
+
+        // as the ACKs of the receivers, into a reused buffer
+        std::vector<std::uint8_t> buffer;
+        auto ack_size = packet_builder::build_packet(ack).size();
+        runner.run("build_packet/ack_reused", ack_size, [&ack, &buffer](std::uint64_t iterations) {
+            for (std::uint64_t i = 0; i < iterations; ++i)
+            {
+                packet_builder::build_packet(ack, buffer);
+                benchmark_runner::keep(buffer);
+            }
+        });
+    }
+
+    static std::vector<std::uint8_t> make_text(std::size_t size)
+    {
+        static const char line[] = "LABEL linux\n  KERNEL vmlinuz\n  APPEND initrd=initrd.img console=ttyS0,115200\n";
+
+        std::vector<std::uint8_t> text(size);
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            text[i] = static_cast<std::uint8_t>(line[i % (sizeof(line) - 1)]);
+        }
+        return text;
+    }
+
+    static std::vector<std::uint8_t> make_binary(std::size_t size)
+    {
+        std::mt19937 random(1);
+        std::vector<std::uint8_t> binary(size);
+        for (auto& byte : binary)
+        {
+            byte = static_cast<std::uint8_t>(random());
+        }
+        return binary;
+    }
+
+    // Input is read and written in blocks of the default size, as by the transfers.
+    static void run_netascii_benchmark(
+        benchmark_runner& runner, const std::string& name, std::shared_ptr<const std::vector<std::uint8_t>> input)
+    {
+        std::vector<std::uint8_t> encoded;
+        std::vector<std::uint8_t> block(DEFAULT_DATA_SIZE);
+
+        netascii_encoder<memory_reader> encoder(input);
+        std::size_t bytes_read = 0;
+        while (encoder.read(block.data(), block.size(), bytes_read) && (bytes_read > 0))
+        {
+            encoded.insert(encoded.end(), block.begin(), block.begin() + bytes_read);
+        }
+
+        runner.run("netascii_reader/" + name, input->size(), [&input, &block](std::uint64_t iterations) {
+            for (std::uint64_t i = 0; i < iterations; ++i)
+            {
+                netascii_encoder<memory_reader> encoder(input);
+                std::size_t bytes_read = 0;
+                while (encoder.read(block.data(), block.size(), bytes_read) && (bytes_read > 0))
+                {
+                    benchmark_runner::keep(block);
+                }
+            }
+        });
+
+        runner.run("netascii_writer/" + name, encoded.size(), [&encoded](std::uint64_t iterations) {
+            for (std::uint64_t i = 0; i < iterations; ++i)
+            {
+                netascii_decoder<discard_writer> decoder;
+                for (std::size_t pos = 0; pos < encoded.size(); pos += DEFAULT_DATA_SIZE)
+                {
+                    decoder.write(encoded.data() + pos, std::min(DEFAULT_DATA_SIZE, encoded.size() - pos));
+                }
+                decoder.close();
+            }
+        });
+    }
+
+    static void run_netascii_benchmarks(benchmark_runner& runner)
+    {
+        run_netascii_benchmark(
+            runner, "text", std::make_shared<const std::vector<std::uint8_t>>(make_text(NETASCII_INPUT_SIZE)));
+        run_netascii_benchmark(
+            runner, "binary", std::make_shared<const std::vector<std::uint8_t>>(make_binary(NETASCII_INPUT_SIZE)));
+    }
+
+    // Whole file is read sequentially from the page cache.
+    static bool run_file_benchmarks(benchmark_runner& runner)
+    {
+        auto tmp_dir = std::getenv("TMPDIR");
+        std::string path = std::string(tmp_dir ? tmp_dir : "/tmp") + "/octnet-tftp-bench-XXXXXX";
+
+        int fd = ::mkstemp(&path[0]);
+        if (fd < 0)
+        {
+            log_error() << "cannot create file: " << path << std::endl;
+            return false;
+        }
+        auto content = make_binary(FILE_SIZE);
+        bool written = (::write(fd, content.data(), content.size()) == static_cast<ssize_t>(content.size()));
+        ::close(fd);
+        if (!written)
+        {
+            log_error() << "cannot write file: " << path << std::endl;
+            ::unlink(path.c_str());
+            return false;
+        }
+
+        for (std::size_t block_size : { DEFAULT_DATA_SIZE, std::size_t(1428), std::size_t(8192), MAX_DATA_SIZE })
+        {
+            file_reader reader(path);
+            std::vector<std::uint8_t> block(block_size);
+            runner.run("file_reader/read/" + std::to_string(block_size), FILE_SIZE,
+                [&reader, &block](std::uint64_t iterations) {
+                    for (std::uint64_t i = 0; i < iterations; ++i)
+                    {
+                        reader.seek(0);
+                        std::size_t bytes_read = 0;
+                        while (reader.read(block.data(), block.size(), bytes_read) && (bytes_read > 0))
+                        {
+                            benchmark_runner::keep(block);
+                        }
+                    }
+                });
+        }
+
+        ::unlink(path.c_str());
+        return true;
+    }
+
+    static void run_string_benchmarks(benchmark_runner& runner)
+    {
+        // mode and option names as sent by the clients
+        struct string_pair
+        {
+            const char* m_name;
+            std::string m_first;
+            std::string m_second;
+        };
+        const string_pair pairs[] = {
+            { "equal", "octet", "octet" },
+            { "case_differs", "windowsize", "WindowSize" },
+            { "differs", "netascii", "octet" },
+        };
+
+        for (const auto& pair : pairs)
+        {
+            runner.run(std::string("equal_ignore_case/") + pair.m_name, 0, [&pair](std::uint64_t iterations) {
+                for (std::uint64_t i = 0; i < iterations; ++i)
+                {
+                    auto equal = equal_ignore_case(pair.m_first, pair.m_second);
+                    benchmark_runner::keep(equal);
+                }
+            });
+        }
+    }
+
+    void print_usage(std::ostream& stream) const
+    {
+        stream << "Usage: " << m_program_name << " [options]\n"
+               << "\n"
+               << "Options:\n"
+               << "  -h, --help                  print this message\n"
+               << "  --filter TEXT               run only the benchmarks whose name contains the text\n"
+               << "  --format FORMAT             text or json (default: text)\n"
+               << "  --min-time MILLISECONDS     minimum duration of a run (default: 200)\n"
+               << "  --repetitions COUNT         runs of a benchmark, the fastest is reported (default: 3)\n";
+    }
+
+    const char* m_program_name;
+    int m_argc;
+    char** m_argv;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
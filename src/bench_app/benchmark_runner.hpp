@@ -0,0 +1,159 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+struct benchmark_result
+{
+    benchmark_result()
+        : m_name()
+        , m_iterations(0)
+        , m_ns_per_op(0.0)
+        , m_bytes_per_op(0)
+    {
+        // noop
+    }
+
+    std::string m_name;
+    std::uint64_t m_iterations;
+    double m_ns_per_op;
+    // processed by an operation, zero if throughput is not meaningful
+    std::uint64_t m_bytes_per_op;
+};
+
+// Runs each benchmark with enough iterations to last at least the minimum
+// time, repeated and the fastest run reported. The benchmark function runs the
+// given number of iterations itself, so the loop costs no indirect call.
+class benchmark_runner
+{
+public:
+    typedef std::function<void(std::uint64_t iterations)> benchmark_function;
+
+    benchmark_runner(std::chrono::nanoseconds min_time, std::size_t repetitions, const std::string& filter)
+        : m_min_time(min_time)
+        , m_repetitions(std::max<std::size_t>(repetitions, 1))
+        , m_filter(filter)
+    {
+        // noop
+    }
+
+    // Value is considered used, so its computation is not optimized away.
+    template <class T>
+    static void keep(const T& value)
+    {
+        asm volatile("" : : "g"(&value) : "memory");
+    }
+
+    void run(const std::string& name, std::uint64_t bytes_per_op, const benchmark_function& function)
+    {
+        if (name.find(m_filter) == std::string::npos)
+        {
+            return;
+        }
+
+        // iterations grow until a run lasts the minimum time
+        std::uint64_t iterations = 1;
+        auto elapsed = measure(function, iterations);
+        while (elapsed < m_min_time)
+        {
+            auto estimate = static_cast<double>(iterations) * m_min_time.count()
+                * 1.2 / std::max<std::chrono::nanoseconds::rep>(elapsed.count(), 1);
+            iterations = static_cast<std::uint64_t>(
+                std::min(std::max(estimate, iterations * 2.0), iterations * 100.0));
+            elapsed = measure(function, iterations);
+        }
+
+        for (std::size_t i = 1; i < m_repetitions; ++i)
+        {
+            elapsed = std::min(elapsed, measure(function, iterations));
+        }
+
+        benchmark_result result;
+        result.m_name = name;
+        result.m_iterations = iterations;
+        result.m_ns_per_op = static_cast<double>(elapsed.count()) / iterations;
+        result.m_bytes_per_op = bytes_per_op;
+        m_results.push_back(result);
+    }
+
+    const std::vector<benchmark_result>& get_results() const
+    {
+        return m_results;
+    }
+
+    void write_text(std::ostream& stream) const
+    {
+        stream << std::left << std::setw(40) << "benchmark" << std::right << std::setw(14) << "ns/op"
+               << std::setw(14) << "MiB/s" << std::setw(14) << "iterations" << "\n";
+        for (const auto& result : m_results)
+        {
+            stream << std::left << std::setw(40) << result.m_name << std::right << std::fixed << std::setprecision(1)
+                   << std::setw(14) << result.m_ns_per_op << std::setw(14);
+            if (result.m_bytes_per_op > 0)
+            {
+                stream << get_bytes_per_second(result) / (1024 * 1024);
+            }
+            else
+            {
+                stream << "-";
+            }
+            stream << std::setw(14) << result.m_iterations << "\n";
+        }
+        stream.flush();
+    }
+
+    void write_json(std::ostream& stream) const
+    {
+        stream << "{\n  \"benchmarks\": [";
+        for (std::size_t i = 0; i < m_results.size(); ++i)
+        {
+            const auto& result = m_results[i];
+            stream << ((i > 0) ? "," : "") << "\n    { \"name\": \"" << result.m_name
+                   << "\", \"iterations\": " << result.m_iterations << ", \"ns_per_op\": " << std::fixed
+                   << std::setprecision(3) << result.m_ns_per_op;
+            if (result.m_bytes_per_op > 0)
+            {
+                stream << ", \"bytes_per_op\": " << result.m_bytes_per_op << ", \"bytes_per_second\": "
+                       << std::setprecision(0) << get_bytes_per_second(result);
+            }
+            stream << " }";
+        }
+        stream << "\n  ]\n}" << std::endl;
+    }
+
+private:
+    static std::chrono::nanoseconds measure(const benchmark_function& function, std::uint64_t iterations)
+    {
+        auto start_time = std::chrono::steady_clock::now();
+        function(iterations);
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time);
+    }
+
+    static double get_bytes_per_second(const benchmark_result& result)
+    {
+        return (result.m_ns_per_op > 0) ? result.m_bytes_per_op * 1e9 / result.m_ns_per_op : 0.0;
+    }
+
+    const std::chrono::nanoseconds m_min_time;
+    const std::size_t m_repetitions;
+    const std::string m_filter;
+
+    std::vector<benchmark_result> m_results;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
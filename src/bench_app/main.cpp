@@ -0,0 +1,7 @@
+#include "bench_app.hpp"
+
+int main(int argc, char* argv[])
+{
+    oct::net::tftp::bench_app app(argc, argv);
+    return app.run();
+}
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "background_executor.hpp"
+#include "client_get.hpp"
+#include "client_parallel_get.hpp"
+#include "client_put.hpp"
+#include "client_transfer.hpp"
+#include "io.hpp"
+#include "request.hpp"
+#include "transfer_result.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Entry point of the client library, starts transfers on the given io_context.
+// Any number of transfers could run concurrently, the returned transfer could
+// be used to cancel it. The client keeps the transfers until they are drained,
+// so it must not be destroyed while the io_context still runs any of them.
+// Its methods could be called from any thread, the transfers are started and
+// cancelled by the thread running the io_context (a single one).
+class client
+{
+public:
+    client(const client&) = delete;
+    client& operator=(const client&) = delete;
+
+    // Executor writes downloaded files in the background, it must outlive the transfers.
+    client(asio::io_context& io_context, background_executor& executor)
+        : m_io_context(io_context)
+        , m_executor(executor)
+    {
+        // noop
+    }
+
+    // Transfers the local file of the request.
+    std::shared_ptr<client_transfer> start(const request& request, client_transfer::completion_handler handler,
+        client_transfer::progress_handler progress = nullptr)
+    {
+        std::shared_ptr<client_transfer> transfer;
+        if ((request.m_type == request_type::GET) && (request.m_streams_count > 1))
+        {
+            transfer = std::make_shared<client_parallel_get>(m_io_context, m_executor, request);
+        }
+        else if (request.m_type == request_type::GET)
+        {
+            transfer = std::make_shared<client_get>(m_io_context, m_executor, request);
+        }
+        else
+        {
+            transfer = std::make_shared<client_put>(m_io_context, request);
+        }
+        return start_transfer(transfer, std::move(handler), std::move(progress));
+    }
+
+    // Downloads the remote file of the request into the sink.
+    std::shared_ptr<client_transfer> start_get(const request& request, std::unique_ptr<writer> sink,
+        client_transfer::completion_handler handler, client_transfer::progress_handler progress = nullptr)
+    {
+        auto transfer = std::make_shared<client_get>(m_io_context, m_executor, request);
+        transfer->set_writer(std::move(sink));
+        return start_transfer(transfer, std::move(handler), std::move(progress));
+    }
+
+    // Uploads data of the source as the remote file of the request.
+    std::shared_ptr<client_transfer> start_put(const request& request, std::unique_ptr<reader> source,
+        client_transfer::completion_handler handler, client_transfer::progress_handler progress = nullptr)
+    {
+        auto transfer = std::make_shared<client_put>(m_io_context, request);
+        transfer->set_reader(std::move(source));
+        return start_transfer(transfer, std::move(handler), std::move(progress));
+    }
+
+    // Cancels the transfer, unless completed already.
+    void cancel(std::shared_ptr<client_transfer> transfer)
+    {
+        asio::post(m_io_context, [transfer]() { transfer->cancel(); });
+    }
+
+    // Cancels the running transfers, e.g. to let the io_context run out of work.
+    void cancel_all()
+    {
+        asio::post(m_io_context, [this]() {
+            std::vector<std::shared_ptr<client_transfer>> transfers;
+            {
+                std::lock_guard<std::mutex> lock(m_transfers_mutex);
+                for (auto& registered_transfer : m_transfers)
+                {
+                    transfers.push_back(registered_transfer.second);
+                }
+            }
+
+            for (auto& transfer : transfers)
+            {
+                transfer->cancel();
+            }
+        });
+    }
+
+    // Transfers the local file of the request, the io_context must be run by
+    // another thread for the future to become ready.
+    std::future<transfer_result> start(const request& request)
+    {
+        auto promise = std::make_shared<std::promise<transfer_result>>();
+        auto future = promise->get_future();
+
+        start(request, [promise](const transfer_result& result) { promise->set_value(result); });
+        return future;
+    }
+
+private:
+    std::shared_ptr<client_transfer> start_transfer(std::shared_ptr<client_transfer> transfer,
+        client_transfer::completion_handler handler, client_transfer::progress_handler progress)
+    {
+        transfer->set_completion_handler(std::move(handler));
+        if (progress)
+        {
+            transfer->set_progress_handler(std::move(progress));
+        }
+        transfer->set_release_handler(std::bind(&client::transfer_released, this, std::placeholders::_1));
+        {
+            std::lock_guard<std::mutex> lock(m_transfers_mutex);
+            m_transfers.emplace(transfer.get(), transfer);
+        }
+
+        // transfer is started from the io_context thread, as all its handlers
+        asio::post(m_io_context, [transfer]() {
+            if (!transfer->is_completed())
+            {
+                transfer->start();
+            }
+        });
+        return transfer;
+    }
+
+    void transfer_released(client_transfer& transfer)
+    {
+        std::shared_ptr<client_transfer> released;
+        {
+            std::lock_guard<std::mutex> lock(m_transfers_mutex);
+            auto iter = m_transfers.find(&transfer);
+            if (iter != m_transfers.end())
+            {
+                released = std::move(iter->second);
+                m_transfers.erase(iter);
+            }
+        }
+    }
+
+    asio::io_context& m_io_context;
+    background_executor& m_executor;
+
+    std::mutex m_transfers_mutex;
+    // owns the transfers, their handlers reference them by a raw pointer
+    std::map<const client_transfer*, std::shared_ptr<client_transfer>> m_transfers;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,558 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <sys/stat.h>
+
+#include <asio.hpp>
+
+#include "background_executor.hpp"
+#include "block_receiver.hpp"
+#include "client_transfer.hpp"
+#include "file_io.hpp"
+#include "log.hpp"
+#include "make_unique.hpp"
+#include "netascii_io.hpp"
+#include "packet.hpp"
+#include "packet_builder.hpp"
+#include "packet_parser.hpp"
+#include "request.hpp"
+#include "string_utils.hpp"
+#include "transport.hpp"
+#include "write_behind_io.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Downloads a file into the local file or a custom sink.
+class client_get : public client_transfer
+{
+public:
+    client_get(asio::io_context& io_context, background_executor& executor, const request& request)
+        : m_io_context(io_context)
+        , m_executor(executor)
+        , m_resolver(io_context)
+        , m_socket(io_context)
+        , m_request(request)
+        , m_request_complete(false)
+        , m_block_offset(0)
+        , m_block_size(DEFAULT_DATA_SIZE)
+        , m_window_size(DEFAULT_WINDOW_SIZE)
+        , m_has_range(false)
+        , m_block_count(0)
+        , m_size_probe(false)
+        , m_has_transfer_size(false)
+        , m_transfer_size(0)
+        , m_error(transfer_error::NONE)
+        , m_writer_waiting(false)
+        , m_writer_closing(false)
+        , m_receiver(*this, io_context, m_socket, m_server_endpoint)
+    {
+        // noop
+    }
+
+    // Received data are written to the sink instead of the local file, in
+    // netascii mode after the line endings conversion.
+    void set_writer(std::unique_ptr<writer> sink)
+    {
+        m_sink = std::move(sink);
+    }
+
+    // Downloads only the range of blocks into the writer instead of the local file.
+    void set_range(std::uint64_t block_offset, std::uint64_t block_count, std::unique_ptr<writer> range_writer)
+    {
+        m_has_range = true;
+        m_block_offset = block_offset;
+        m_block_count = block_count;
+        m_writer = std::move(range_writer);
+    }
+
+    // Ends the transfer as soon as the server reports the file size.
+    void set_size_probe()
+    {
+        m_size_probe = true;
+    }
+
+    bool get_transfer_size(std::uint64_t& size) const
+    {
+        size = m_transfer_size;
+        return m_has_transfer_size;
+    }
+
+    void start() final
+    {
+        start_clock();
+
+        // numeric address needs no resolver, whose queries run in another thread
+        asio::error_code ec;
+        auto address = asio::ip::make_address(m_request.m_host, ec);
+        if (!ec)
+        {
+            m_server_endpoint = asio::ip::udp::endpoint(address, m_request.m_port);
+            send_request();
+            return;
+        }
+
+        m_resolver.async_resolve(m_request.m_host, std::to_string(m_request.m_port),
+            track([this](const asio::error_code& ec, asio::ip::udp::resolver::results_type results) {
+                on_resolve_query(ec, results);
+            }));
+    }
+
+    void cancel() final
+    {
+        terminate(transfer_error::CANCELLED, "cancelled");
+    }
+
+    void stop()
+    {
+        m_resolver.cancel();
+
+        m_receiver.stop();
+
+        asio::error_code ec;
+        if (m_socket.is_open())
+        {
+            m_socket.close(ec);
+            if (ec)
+            {
+                log_error() << "Socket close failed: " << ec << std::endl;
+            }
+        }
+    }
+
+private:
+    friend class block_receiver<client_get>;
+
+    void on_resolve_query(const asio::error_code& ec, asio::ip::udp::resolver::results_type results)
+    {
+        if (ec == asio::error::operation_aborted)
+        {
+            // ignore, cancelled
+            return;
+        }
+
+        if (ec || (results.size() == 0))
+        {
+            terminate(transfer_error::RESOLVE_FAILED, "cannot resolve address: " + m_request.m_host);
+            return;
+        }
+
+        // first address of a family the host supports, e.g. an IPv4 one with IPv6 disabled
+        m_server_endpoint = *results.cbegin();
+        for (const auto& result : results)
+        {
+            asio::error_code socket_ec;
+            open_socket(m_socket, result.endpoint(), socket_ec);
+            if (!socket_ec)
+            {
+                m_server_endpoint = result.endpoint();
+                break;
+            }
+        }
+
+        send_request();
+    }
+
+    // Socket is opened once the address family of the server is known.
+    void send_request()
+    {
+        asio::error_code ec;
+        if (!m_socket.is_open())
+        {
+            open_socket(m_socket, m_server_endpoint, ec);
+        }
+        if (ec)
+        {
+            terminate(transfer_error::NETWORK_ERROR, "network error: " + ec.message());
+            return;
+        }
+
+        packet_file_req packet;
+        packet.m_op = OP_RRQ;
+        packet.m_filename = m_request.m_remote_filename;
+        packet.m_mode = m_request.m_mode;
+
+        if (m_request.m_block_size != DEFAULT_DATA_SIZE)
+        {
+            packet.m_options[OPTION_BLKSIZE] = std::to_string(m_request.m_block_size);
+        }
+        if (m_request.m_window_size != DEFAULT_WINDOW_SIZE)
+        {
+            packet.m_options[OPTION_WINDOWSIZE] = std::to_string(m_request.m_window_size);
+        }
+        if (m_request.m_timeout_sec != DEFAULT_RETRY_TIMEOUT_SEC)
+        {
+            packet.m_options[OPTION_TIMEOUT] = std::to_string(m_request.m_timeout_sec);
+        }
+        if (m_size_probe || has_progress_handler())
+        {
+            packet.m_options[OPTION_TSIZE] = "0";
+        }
+
+        // netascii local file size does not match the remote one
+        if (m_request.m_resume && !m_has_range && !m_sink && equal_ignore_case(m_request.m_mode, "octet"))
+        {
+            struct stat file_stat;
+            if ((::stat(m_request.m_local_path.c_str(), &file_stat) == 0) && S_ISREG(file_stat.st_mode))
+            {
+                m_block_offset = static_cast<std::uint64_t>(file_stat.st_size) / m_request.m_block_size;
+            }
+        }
+        if (m_block_offset > 0)
+        {
+            packet.m_options[OPTION_OFFSET] = std::to_string(m_block_offset);
+        }
+        if (m_has_range)
+        {
+            packet.m_options[OPTION_COUNT] = std::to_string(m_block_count);
+        }
+
+        m_receiver.start(false, packet_builder::build_packet(packet), m_request.m_retry_count,
+            std::chrono::seconds(m_request.m_timeout_sec));
+    }
+
+    std::unique_ptr<writer> open_writer(std::uint64_t offset)
+    {
+        bool netascii = equal_ignore_case(m_request.m_mode, "netascii");
+        if (!netascii && !equal_ignore_case(m_request.m_mode, "octet"))
+        {
+            return nullptr;
+        }
+
+        if (m_sink)
+        {
+            if (netascii)
+            {
+                return stdext::make_unique<netascii_writer>(std::move(m_sink));
+            }
+            return std::move(m_sink);
+        }
+
+        // received data are acknowledged without waiting for the disk
+        auto local_file = stdext::make_unique<file_writer>(m_request.m_local_path, offset);
+        if (netascii)
+        {
+            return stdext::make_unique<netascii_decoder<write_behind_writer>>(
+                std::move(local_file), m_executor, DEFAULT_WRITE_BEHIND_SIZE);
+        }
+        return stdext::make_unique<write_behind_writer>(std::move(local_file), m_executor, DEFAULT_WRITE_BEHIND_SIZE);
+    }
+
+    // Data are referenced in the receive buffer.
+    bool write_block(const std::uint8_t* data, std::size_t size, bool last_block)
+    {
+        if (!m_request_complete)
+        {
+            m_receiver.confirm_peer();
+
+            // options not supported by the server, whole file is sent
+            if (m_has_range || m_size_probe)
+            {
+                send_error(ERRCODE_OPTION_NEGOTIATION, "options not supported", transfer_error::OPTION_NEGOTIATION);
+                return false;
+            }
+            if (!start_transfer(0))
+            {
+                return false;
+            }
+        }
+
+        // failures of earlier buffered writes are reported here too
+        if (!m_writer->write(data, size))
+        {
+            send_error(ERRCODE_DISK_FULL, "cannot write file", transfer_error::LOCAL_IO);
+            return false;
+        }
+
+        add_bytes(size);
+
+        if (last_block)
+        {
+            // final ACK is sent once the buffered data are written
+            m_writer_closing = true;
+            m_receiver.hold_ack();
+            m_writer->async_close(track_posted(m_io_context, [this](bool closed) { on_writer_done(closed); }));
+        }
+        else if (!m_writer_waiting && !m_writer->is_ready())
+        {
+            // server sends the next window once the buffered data are written
+            m_writer_waiting = true;
+            m_receiver.hold_ack();
+            m_writer->async_wait_ready(track_posted(m_io_context, [this](bool ready) { on_writer_ready(ready); }));
+        }
+        return true;
+    }
+
+    void on_writer_ready(bool ready)
+    {
+        m_writer_waiting = false;
+
+        if (!m_writer_closing)
+        {
+            // ACK is held until closed otherwise
+            on_writer_done(ready);
+        }
+    }
+
+    // Held ACK is sent, unless the writer failed.
+    void on_writer_done(bool ok)
+    {
+        if (is_completed())
+        {
+            return;
+        }
+
+        if (!ok)
+        {
+            send_error(ERRCODE_DISK_FULL, "cannot write file", transfer_error::LOCAL_IO);
+            return;
+        }
+
+        m_receiver.release_ack();
+    }
+
+    bool process_other_packet(const asio::const_buffer& buffer)
+    {
+        auto packet = packet_parser::parse_packet(buffer);
+        if (!packet)
+        {
+            log_warning() << "Invalid packet received of size: " << buffer.size() << std::endl;
+            return false;
+        }
+
+        switch (packet->m_op)
+        {
+        case OP_OACK:
+            return process_oack_received(std::static_pointer_cast<packet_oack>(packet));
+
+        case OP_ERROR:
+            process_error_received(std::static_pointer_cast<packet_error>(packet));
+            return false;
+
+        default:
+            log_warning() << "Unexpected packet type: " << packet->m_op << std::endl;
+            return false;
+        }
+    }
+
+    void on_receiver_done(block_receiver<client_get>::status status)
+    {
+        typedef block_receiver<client_get>::status receiver_status;
+
+        switch (status)
+        {
+        case receiver_status::COMPLETE:
+            // reported now, the socket is kept while dallying
+            add_retransmits(m_receiver.get_retransmits());
+            complete(transfer_error::NONE);
+            return;
+
+        case receiver_status::DALLIED:
+            terminate(transfer_error::NONE);
+            return;
+
+        case receiver_status::TIMEOUT:
+            terminate(transfer_error::TIMEOUT, "no more retries");
+            return;
+
+        case receiver_status::NETWORK_ERROR:
+            terminate(transfer_error::NETWORK_ERROR, "network error: " + m_receiver.get_error().message());
+            return;
+        }
+    }
+
+    // True if the OACK is to be answered by ACK 0.
+    bool process_oack_received(std::shared_ptr<packet_oack> packet)
+    {
+        if (m_request_complete)
+        {
+            log_warning() << "Unexpected OACK" << std::endl;
+            return false;
+        }
+
+        m_receiver.confirm_peer();
+
+        // server could lower the block size
+        std::uint64_t number = 0;
+        if (find_option(*packet, OPTION_BLKSIZE, number) && (number >= MIN_DATA_SIZE)
+            && (number <= m_request.m_block_size))
+        {
+            m_block_size = static_cast<std::size_t>(number);
+        }
+        if (find_option(*packet, OPTION_WINDOWSIZE, number) && (number >= 1)
+            && (number <= m_request.m_window_size))
+        {
+            m_window_size = static_cast<std::uint16_t>(number);
+        }
+        m_receiver.set_block_size(m_block_size);
+        m_receiver.set_window_size(m_window_size);
+
+        if (find_option(*packet, OPTION_TSIZE, number))
+        {
+            m_has_transfer_size = true;
+            m_transfer_size = number;
+            set_total_size(number);
+        }
+        if (m_size_probe)
+        {
+            send_error(ERRCODE_UNDEFINED, "size probe",
+                m_has_transfer_size ? transfer_error::NONE : transfer_error::OPTION_NEGOTIATION);
+            return false;
+        }
+
+        bool offset_acked = (m_block_offset == 0)
+            || (find_option(*packet, OPTION_OFFSET, number) && (number == m_block_offset));
+        bool count_acked = find_option(*packet, OPTION_COUNT, number) && (number == m_block_count);
+        if (m_has_range && (!offset_acked || !count_acked))
+        {
+            send_error(ERRCODE_OPTION_NEGOTIATION, "range not supported", transfer_error::OPTION_NEGOTIATION);
+            return false;
+        }
+        // offset and count are given in blocks of the requested size
+        if ((m_has_range || (m_block_offset > 0)) && offset_acked && (m_block_size != m_request.m_block_size))
+        {
+            send_error(
+                ERRCODE_OPTION_NEGOTIATION, "block size not supported", transfer_error::OPTION_NEGOTIATION);
+            return false;
+        }
+        if (!m_has_range && (m_block_offset > 0))
+        {
+            log_debug() << "Resume from block " << m_block_offset << (offset_acked ? "" : " refused") << std::endl;
+        }
+
+        return start_transfer(offset_acked ? m_block_offset * m_block_size : 0);
+    }
+
+    // Opens the local file on the first server response, false if an error was sent.
+    bool start_transfer(std::uint64_t offset)
+    {
+        m_request_complete = true;
+
+        if (!m_has_range)
+        {
+            m_writer = open_writer(offset);
+        }
+        if (!m_writer)
+        {
+            send_error(ERRCODE_UNDEFINED, "cannot open file for writing", transfer_error::LOCAL_IO);
+            return false;
+        }
+        if (!m_writer->is_open())
+        {
+            send_error(ERRCODE_ACCESS_VIOLATION, "cannot open file for writing", transfer_error::LOCAL_IO);
+            return false;
+        }
+        return true;
+    }
+
+    // Transfer is completed with the local error once the packet is sent.
+    void send_error(std::uint16_t error_code, const std::string& error_message, transfer_error local_error)
+    {
+        m_error = local_error;
+        m_error_message = error_message;
+
+        packet_error packet;
+        packet.m_op = OP_ERROR;
+        packet.m_error_code = error_code;
+        packet.m_error_message = error_message;
+
+        m_error_packet_data = packet_builder::build_packet(packet);
+
+        m_socket.async_send_to(asio::const_buffer(m_error_packet_data.data(), m_error_packet_data.size()),
+            m_server_endpoint, track([this](const asio::error_code& ec, std::size_t bytes_transferred) {
+                on_error_sent(ec, bytes_transferred);
+            }));
+    }
+
+    void on_error_sent(const asio::error_code& ec, std::size_t /*bytes_transferred*/)
+    {
+        if (ec == asio::error::operation_aborted)
+        {
+            // ignore, cancelled
+            return;
+        }
+
+        if (ec)
+        {
+            log_debug() << "Packet send failed: " << ec << std::endl;
+        }
+
+        terminate(m_error, m_error_message);
+    }
+
+    static bool find_option(const packet_oack& packet, const char* name, std::uint64_t& value)
+    {
+        for (const auto& option : packet.m_options)
+        {
+            if (equal_ignore_case(option.first, name))
+            {
+                return parse_uint64(option.second, value);
+            }
+        }
+        return false;
+    }
+
+    void process_error_received(std::shared_ptr<packet_error> packet)
+    {
+        log_debug() << "ERROR received: " << packet->m_error_code << ' ' << packet->m_error_message << std::endl;
+        terminate(transfer_error::SERVER_ERROR, packet->m_error_message, packet->m_error_code);
+    }
+
+    void terminate(
+        transfer_error error, const std::string& message = std::string(), std::uint16_t server_error_code = 0)
+    {
+        stop();
+        if (!is_completed())
+        {
+            add_retransmits(m_receiver.get_retransmits());
+        }
+        complete(error, message, server_error_code);
+    }
+
+    asio::io_context& m_io_context;
+    background_executor& m_executor;
+
+    asio::ip::udp::resolver m_resolver;
+    udp_socket m_socket;
+
+    const request m_request;
+
+    // request endpoint, replaced by the transfer one when the receiver confirms the peer
+    asio::ip::udp::endpoint m_server_endpoint;
+
+    bool m_request_complete;
+    // blocks already present in the local file or the range start
+    std::uint64_t m_block_offset;
+    std::size_t m_block_size;
+    std::uint16_t m_window_size;
+    bool m_has_range;
+    std::uint64_t m_block_count;
+
+    bool m_size_probe;
+    bool m_has_transfer_size;
+    std::uint64_t m_transfer_size;
+
+    // reported when the ERROR packet is sent
+    transfer_error m_error;
+    std::string m_error_message;
+
+    std::unique_ptr<writer> m_sink;
+    std::unique_ptr<writer> m_writer;
+    // ACK is held meanwhile
+    bool m_writer_waiting;
+    bool m_writer_closing;
+
+    std::vector<std::uint8_t> m_error_packet_data;
+
+    block_receiver<client_get> m_receiver;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
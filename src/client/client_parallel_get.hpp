@@ -0,0 +1,235 @@
+#pragma once
+
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <asio.hpp>
+
+#include "background_executor.hpp"
+#include "client_get.hpp"
+#include "client_transfer.hpp"
+#include "file_io.hpp"
+#include "log.hpp"
+#include "make_unique.hpp"
+#include "request.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Downloads a file over several concurrent transfers, each requesting a range
+// of blocks with the offset and count options. The file size is obtained by
+// a transfer ended right after the OACK, the local file is preallocated and
+// the ranges are written into it in place.
+class client_parallel_get : public client_transfer
+{
+public:
+    client_parallel_get(asio::io_context& io_context, background_executor& executor, const request& request)
+        : m_io_context(io_context)
+        , m_executor(executor)
+        , m_request(request)
+        , m_fd(-1)
+        , m_file_size(0)
+        , m_pending_count(0)
+        , m_error(transfer_error::NONE)
+        , m_server_error_code(0)
+    {
+        // noop
+    }
+
+    ~client_parallel_get()
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+        }
+    }
+
+    void start() final
+    {
+        start_clock();
+
+        m_probe = std::make_shared<client_get>(m_io_context, m_executor, m_request);
+        m_probe->set_size_probe();
+        m_probe->set_completion_handler([this](const transfer_result& result) { on_probe_complete(result); });
+        start_part(*m_probe);
+    }
+
+    void cancel() final
+    {
+        fail(transfer_error::CANCELLED, "cancelled");
+        if (m_ranges.empty())
+        {
+            complete(m_error, m_message);
+        }
+    }
+
+private:
+    struct range
+    {
+        std::shared_ptr<client_get> m_transfer;
+        std::uint64_t m_expected_size;
+        std::uint64_t m_bytes;
+    };
+
+    // Parts are kept until this transfer is released, which waits for them to be released.
+    void start_part(client_get& part)
+    {
+        operation_started();
+        part.set_release_handler([this](client_transfer&) { operation_completed(); });
+        part.start();
+    }
+
+    void on_probe_complete(const transfer_result& result)
+    {
+        if (m_error != transfer_error::NONE)
+        {
+            // cancelled
+            complete(m_error, m_message);
+            return;
+        }
+        if (!result.is_success() || !m_probe->get_transfer_size(m_file_size))
+        {
+            complete(result.is_success() ? transfer_error::OPTION_NEGOTIATION : result.m_error,
+                "cannot get file size: " + result.m_message, result.m_server_error_code);
+            return;
+        }
+        set_total_size(m_file_size);
+
+        m_fd = ::open(m_request.m_local_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (m_fd < 0)
+        {
+            complete(transfer_error::LOCAL_IO, "cannot open file: " + std::string(std::strerror(errno)));
+            return;
+        }
+        if ((m_file_size > 0) && (::posix_fallocate(m_fd, 0, static_cast<off_t>(m_file_size)) != 0)
+            && (::ftruncate(m_fd, static_cast<off_t>(m_file_size)) != 0))
+        {
+            complete(transfer_error::LOCAL_IO, "cannot allocate file: " + std::string(std::strerror(errno)));
+            return;
+        }
+
+        // a range ending at the end of file ends with a short block, others with an empty one
+        std::uint64_t block_size = m_request.m_block_size;
+        std::uint64_t blocks_count = m_file_size / block_size + 1;
+        std::uint64_t streams_count = std::max<std::uint64_t>(m_request.m_streams_count, 1);
+        std::uint64_t range_blocks_count = (blocks_count + streams_count - 1) / streams_count;
+
+        for (std::uint64_t offset = 0; offset < blocks_count; offset += range_blocks_count)
+        {
+            auto count = std::min(range_blocks_count, blocks_count - offset);
+
+            range new_range;
+            new_range.m_transfer = std::make_shared<client_get>(m_io_context, m_executor, m_request);
+            new_range.m_expected_size = std::min(count * block_size, m_file_size - offset * block_size);
+            new_range.m_bytes = 0;
+            new_range.m_transfer->set_range(
+                offset, count, stdext::make_unique<file_range_writer>(m_fd, offset * block_size, count * block_size));
+            auto index = m_ranges.size();
+            new_range.m_transfer->set_completion_handler(
+                [this, index](const transfer_result& result) { on_range_complete(index, result); });
+            new_range.m_transfer->set_progress_handler(
+                [this, index](std::uint64_t bytes, std::uint64_t /*total_size*/) { on_range_progress(index, bytes); });
+            m_ranges.push_back(std::move(new_range));
+        }
+
+        log_debug() << "Downloading " << m_file_size << " bytes in " << m_ranges.size() << " ranges" << std::endl;
+
+        m_pending_count = m_ranges.size();
+        for (auto& range : m_ranges)
+        {
+            start_part(*range.m_transfer);
+        }
+    }
+
+    void on_range_progress(std::size_t index, std::uint64_t bytes)
+    {
+        // reported as the sum of all ranges
+        add_bytes(bytes - m_ranges[index].m_bytes);
+        m_ranges[index].m_bytes = bytes;
+    }
+
+    void on_range_complete(std::size_t index, const transfer_result& result)
+    {
+        const auto& range = m_ranges[index];
+        add_retransmits(result.m_retransmits);
+
+        if (!result.is_success())
+        {
+            fail(result.m_error, "range " + std::to_string(index) + ": " + result.m_message,
+                result.m_server_error_code);
+        }
+        else if (result.m_bytes != range.m_expected_size)
+        {
+            fail(transfer_error::SERVER_ERROR, "range " + std::to_string(index) + " incomplete");
+        }
+
+        if (--m_pending_count == 0)
+        {
+            finish();
+        }
+    }
+
+    // Cancels the remaining ranges, file is incomplete anyway. Completion of
+    // cancelled ranges is handled recursively.
+    void fail(transfer_error error, const std::string& message, std::uint16_t server_error_code = 0)
+    {
+        if (m_error != transfer_error::NONE)
+        {
+            return;
+        }
+
+        m_error = error;
+        m_message = message;
+        m_server_error_code = server_error_code;
+
+        if (m_probe && !m_probe->is_completed())
+        {
+            m_probe->cancel();
+        }
+        for (auto& range : m_ranges)
+        {
+            range.m_transfer->cancel();
+        }
+    }
+
+    void finish()
+    {
+        if ((m_error == transfer_error::NONE) && (::fsync(m_fd) != 0))
+        {
+            fail(transfer_error::LOCAL_IO, "cannot write file: " + std::string(std::strerror(errno)));
+        }
+        ::close(m_fd);
+        m_fd = -1;
+
+        complete(m_error, m_message, m_server_error_code);
+    }
+
+    asio::io_context& m_io_context;
+    background_executor& m_executor;
+    const request m_request;
+
+    std::shared_ptr<client_get> m_probe;
+
+    int m_fd;
+    std::uint64_t m_file_size;
+    std::vector<range> m_ranges;
+    std::size_t m_pending_count;
+
+    // first failure, reported when all ranges are completed
+    transfer_error m_error;
+    std::string m_message;
+    std::uint16_t m_server_error_code;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,456 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "client_transfer.hpp"
+#include "file_io.hpp"
+#include "log.hpp"
+#include "make_unique.hpp"
+#include "netascii_io.hpp"
+#include "packet.hpp"
+#include "packet_builder.hpp"
+#include "packet_parser.hpp"
+#include "packet_window.hpp"
+#include "request.hpp"
+#include "string_utils.hpp"
+#include "transport.hpp"
+#include "window_sender.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Uploads the local file or data of a custom source.
+class client_put : public client_transfer
+{
+public:
+    client_put(asio::io_context& io_context, const request& request)
+        : m_io_context(io_context)
+        , m_resolver(io_context)
+        , m_socket(io_context)
+        , m_request(request)
+        , m_request_complete(false)
+        , m_block_size(DEFAULT_DATA_SIZE)
+        , m_window_size(DEFAULT_WINDOW_SIZE)
+        , m_last_read_packet_id(0)
+        , m_last_acked_packet_id(0)
+        , m_last_packet_read(false)
+        , m_error(transfer_error::NONE)
+        , m_window_packets()
+        , m_sender(*this, io_context, m_socket, m_window_packets, m_server_endpoint)
+    {
+        // noop
+    }
+
+    // Data are read from the source instead of the local file, in netascii
+    // mode before the line endings conversion.
+    void set_reader(std::unique_ptr<reader> source)
+    {
+        m_source = std::move(source);
+    }
+
+    void start() final
+    {
+        start_clock();
+
+        m_reader = open_reader();
+        if (!m_reader)
+        {
+            terminate(transfer_error::LOCAL_IO, "invalid mode: " + m_request.m_mode);
+            return;
+        }
+        if (!m_reader->is_open())
+        {
+            terminate(transfer_error::LOCAL_IO, "cannot open file for reading");
+            return;
+        }
+
+        std::uint64_t size = 0;
+        if (m_reader->get_size(size))
+        {
+            set_total_size(size);
+        }
+
+        // numeric address needs no resolver, whose queries run in another thread
+        asio::error_code ec;
+        auto address = asio::ip::make_address(m_request.m_host, ec);
+        if (!ec)
+        {
+            m_server_endpoint = asio::ip::udp::endpoint(address, m_request.m_port);
+            send_request();
+            return;
+        }
+
+        m_resolver.async_resolve(m_request.m_host, std::to_string(m_request.m_port),
+            track([this](const asio::error_code& ec, asio::ip::udp::resolver::results_type results) {
+                on_resolve_query(ec, results);
+            }));
+    }
+
+    void cancel() final
+    {
+        terminate(transfer_error::CANCELLED, "cancelled");
+    }
+
+    void stop()
+    {
+        m_resolver.cancel();
+
+        m_sender.stop();
+
+        asio::error_code ec;
+        if (m_socket.is_open())
+        {
+            m_socket.close(ec);
+            if (ec)
+            {
+                log_error() << "Socket close failed: " << ec << std::endl;
+            }
+        }
+    }
+
+private:
+    friend class window_sender<client_put>;
+
+    std::unique_ptr<reader> open_reader()
+    {
+        bool netascii = equal_ignore_case(m_request.m_mode, "netascii");
+        if (!netascii && !equal_ignore_case(m_request.m_mode, "octet"))
+        {
+            return nullptr;
+        }
+
+        if (m_source)
+        {
+            if (netascii)
+            {
+                return stdext::make_unique<netascii_reader>(std::move(m_source));
+            }
+            return std::move(m_source);
+        }
+
+        if (netascii)
+        {
+            return stdext::make_unique<netascii_encoder<file_reader>>(m_request.m_local_path);
+        }
+        return stdext::make_unique<file_reader>(m_request.m_local_path);
+    }
+
+    void on_resolve_query(const asio::error_code& ec, asio::ip::udp::resolver::results_type results)
+    {
+        if (ec == asio::error::operation_aborted)
+        {
+            // ignore, cancelled
+            return;
+        }
+
+        if (ec || (results.size() == 0))
+        {
+            terminate(transfer_error::RESOLVE_FAILED, "cannot resolve address: " + m_request.m_host);
+            return;
+        }
+
+        // first address of a family the host supports, e.g. an IPv4 one with IPv6 disabled
+        m_server_endpoint = *results.cbegin();
+        for (const auto& result : results)
+        {
+            asio::error_code socket_ec;
+            open_socket(m_socket, result.endpoint(), socket_ec);
+            if (!socket_ec)
+            {
+                m_server_endpoint = result.endpoint();
+                break;
+            }
+        }
+
+        send_request();
+    }
+
+    // Socket is opened once the address family of the server is known.
+    void send_request()
+    {
+        asio::error_code ec;
+        if (!m_socket.is_open())
+        {
+            open_socket(m_socket, m_server_endpoint, ec);
+        }
+        if (ec)
+        {
+            terminate(transfer_error::NETWORK_ERROR, "network error: " + ec.message());
+            return;
+        }
+
+        packet_file_req packet;
+        packet.m_op = OP_WRQ;
+        packet.m_filename = m_request.m_remote_filename;
+        packet.m_mode = m_request.m_mode;
+
+        if (m_request.m_block_size != DEFAULT_DATA_SIZE)
+        {
+            packet.m_options[OPTION_BLKSIZE] = std::to_string(m_request.m_block_size);
+        }
+        if (m_request.m_window_size != DEFAULT_WINDOW_SIZE)
+        {
+            packet.m_options[OPTION_WINDOWSIZE] = std::to_string(m_request.m_window_size);
+        }
+        if (m_request.m_timeout_sec != DEFAULT_RETRY_TIMEOUT_SEC)
+        {
+            packet.m_options[OPTION_TIMEOUT] = std::to_string(m_request.m_timeout_sec);
+        }
+        std::uint64_t size = 0;
+        if (m_reader->get_size(size))
+        {
+            packet.m_options[OPTION_TSIZE] = std::to_string(size);
+        }
+
+        // request is resent like a single packet window until the server responds
+        m_window_packets.add() = packet_builder::build_packet(packet);
+
+        m_sender.start(false, m_request.m_retry_count, std::chrono::seconds(m_request.m_timeout_sec));
+    }
+
+    bool fill_window()
+    {
+        while (!m_last_packet_read && (m_window_packets.size() < m_window_size))
+        {
+            // data are read in place after the header
+            auto& packet = m_window_packets.add();
+            packet_builder::build_data_header(++m_last_read_packet_id, packet);
+            packet.resize(DATA_HEADER_SIZE + m_block_size);
+
+            std::size_t bytes_read = 0;
+            if (!m_reader->read(packet.data() + DATA_HEADER_SIZE, m_block_size, bytes_read))
+            {
+                send_error(ERRCODE_UNDEFINED, "cannot read data", transfer_error::LOCAL_IO);
+                return false;
+            }
+            packet.resize(DATA_HEADER_SIZE + bytes_read);
+
+            if (bytes_read < m_block_size)
+            {
+                m_last_packet_read = true;
+            }
+        }
+        return true;
+    }
+
+    // Transfer is completed with the local error once the packet is sent.
+    void send_error(std::uint16_t error_code, const std::string& error_message, transfer_error local_error)
+    {
+        m_error = local_error;
+        m_error_message = error_message;
+
+        packet_error packet;
+        packet.m_op = OP_ERROR;
+        packet.m_error_code = error_code;
+        packet.m_error_message = error_message;
+
+        m_error_packet_data = packet_builder::build_packet(packet);
+
+        m_socket.async_send_to(asio::const_buffer(m_error_packet_data.data(), m_error_packet_data.size()),
+            m_server_endpoint, track([this](const asio::error_code& ec, std::size_t bytes_transferred) {
+                on_error_sent(ec, bytes_transferred);
+            }));
+    }
+
+    void on_error_sent(const asio::error_code& ec, std::size_t /*bytes_transferred*/)
+    {
+        if (ec == asio::error::operation_aborted)
+        {
+            // ignore, cancelled
+            return;
+        }
+
+        if (ec)
+        {
+            log_debug() << "Packet send failed: " << ec << std::endl;
+        }
+
+        terminate(m_error, m_error_message);
+    }
+
+    void on_sender_done(window_sender<client_put>::status status)
+    {
+        typedef window_sender<client_put>::status sender_status;
+
+        switch (status)
+        {
+        case sender_status::COMPLETE:
+            terminate(transfer_error::NONE);
+            return;
+
+        case sender_status::STOPPED:
+            // cancelled, or the error is being sent
+            return;
+
+        case sender_status::TIMEOUT:
+            terminate(transfer_error::TIMEOUT, "no more retries");
+            return;
+
+        case sender_status::NETWORK_ERROR:
+            terminate(transfer_error::NETWORK_ERROR, "network error: " + m_sender.get_error().message());
+            return;
+        }
+    }
+
+    ack_result process_other_packet(const asio::const_buffer& buffer)
+    {
+        auto packet = packet_parser::parse_packet(buffer);
+        if (!packet)
+        {
+            log_warning() << "Invalid packet received of size: " << buffer.size() << std::endl;
+            return ack_result::IGNORED;
+        }
+
+        switch (packet->m_op)
+        {
+        case OP_OACK:
+            return process_oack_received(std::static_pointer_cast<packet_oack>(packet));
+
+        case OP_ERROR:
+            process_error_received(std::static_pointer_cast<packet_error>(packet));
+            return ack_result::IGNORED;
+
+        default:
+            log_warning() << "Unexpected packet type: " << packet->m_op << std::endl;
+            return ack_result::IGNORED;
+        }
+    }
+
+    void process_error_received(std::shared_ptr<packet_error> packet)
+    {
+        log_debug() << "ERROR received: " << packet->m_error_code << ' ' << packet->m_error_message << std::endl;
+        terminate(transfer_error::SERVER_ERROR, packet->m_error_message, packet->m_error_code);
+    }
+
+    ack_result process_oack_received(std::shared_ptr<packet_oack> packet)
+    {
+        if (m_request_complete || m_sender.is_sending())
+        {
+            log_warning() << "Unexpected OACK" << std::endl;
+            return ack_result::IGNORED;
+        }
+
+        // server could lower the block and window size
+        std::uint64_t number = 0;
+        if (find_option(*packet, OPTION_BLKSIZE, number) && (number >= MIN_DATA_SIZE)
+            && (number <= m_request.m_block_size))
+        {
+            m_block_size = static_cast<std::size_t>(number);
+        }
+        if (find_option(*packet, OPTION_WINDOWSIZE, number) && (number >= 1)
+            && (number <= m_request.m_window_size))
+        {
+            m_window_size = static_cast<std::uint16_t>(number);
+        }
+
+        return start_transfer();
+    }
+
+    // Request window is replaced by the data one on the server response.
+    ack_result start_transfer()
+    {
+        m_request_complete = true;
+        m_sender.confirm_peer();
+
+        m_window_packets.clear();
+
+        return fill_window() ? ack_result::ADVANCED : ack_result::FAILED;
+    }
+
+    // Removes the acknowledged packets from the window and fills it again.
+    ack_result acknowledge(std::uint16_t block_no)
+    {
+        if (!m_request_complete)
+        {
+            // options not supported by the server
+            return (block_no == 0) ? start_transfer() : ack_result::IGNORED;
+        }
+
+        // block numbers wrap around, so compare distance from the last acked one
+        std::size_t acked_count = static_cast<std::uint16_t>(block_no - m_last_acked_packet_id);
+        if ((acked_count == 0) || (acked_count > m_window_packets.size()))
+        {
+            log_debug() << "ACK with bad block no received: " << block_no << std::endl;
+            return ack_result::IGNORED;
+        }
+
+        std::uint64_t acked_bytes = 0;
+        for (std::size_t i = 0; i < acked_count; ++i)
+        {
+            acked_bytes += m_window_packets[i].size() - DATA_HEADER_SIZE;
+        }
+        m_window_packets.remove_front(acked_count);
+        m_last_acked_packet_id = block_no;
+        add_bytes(acked_bytes);
+
+        if (m_window_packets.empty() && m_last_packet_read)
+        {
+            return ack_result::COMPLETE;
+        }
+        return fill_window() ? ack_result::ADVANCED : ack_result::FAILED;
+    }
+
+    static bool find_option(const packet_oack& packet, const char* name, std::uint64_t& value)
+    {
+        for (const auto& option : packet.m_options)
+        {
+            if (equal_ignore_case(option.first, name))
+            {
+                return parse_uint64(option.second, value);
+            }
+        }
+        return false;
+    }
+
+    void terminate(
+        transfer_error error, const std::string& message = std::string(), std::uint16_t server_error_code = 0)
+    {
+        stop();
+        if (!is_completed())
+        {
+            add_retransmits(m_sender.get_retransmits());
+        }
+        complete(error, message, server_error_code);
+    }
+
+    asio::io_context& m_io_context;
+
+    asio::ip::udp::resolver m_resolver;
+    udp_socket m_socket;
+
+    const request m_request;
+
+    // request endpoint, replaced by the transfer one when the sender confirms the peer
+    asio::ip::udp::endpoint m_server_endpoint;
+
+    bool m_request_complete;
+    std::size_t m_block_size;
+    std::uint16_t m_window_size;
+
+    std::uint16_t m_last_read_packet_id;
+    std::uint16_t m_last_acked_packet_id;
+    bool m_last_packet_read;
+    // reported when the ERROR packet is sent
+    transfer_error m_error;
+    std::string m_error_message;
+
+    std::unique_ptr<reader> m_source;
+    std::unique_ptr<reader> m_reader;
+
+    std::vector<std::uint8_t> m_error_packet_data;
+
+    packet_window m_window_packets;
+    window_sender<client_put> m_sender;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,174 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include <asio.hpp>
+
+#include "handler_owner.hpp"
+#include "transfer_result.hpp"
+#include "transport.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Base of the client transfers, run asynchronously on an io_context. The
+// completion handler is called exactly once (also when cancelled), handlers
+// are called on the io_context thread. Handlers of the transfer reference it
+// by a raw pointer, its owner keeps it until the release handler is called.
+class client_transfer : public handler_owner
+{
+public:
+    typedef std::function<void(const transfer_result& result)> completion_handler;
+    // total_size is 0 if not known
+    typedef std::function<void(std::uint64_t bytes, std::uint64_t total_size)> progress_handler;
+    typedef std::function<void(client_transfer& transfer)> release_handler;
+
+    client_transfer()
+        : handler_owner()
+        , m_completed(false)
+        , m_total_size(0)
+    {
+        // noop
+    }
+
+    void set_completion_handler(completion_handler handler)
+    {
+        m_completion_handler = std::move(handler);
+    }
+
+    // Called once the transfer is completed and none of its handlers is
+    // pending, the transfer could be destroyed then.
+    void set_release_handler(release_handler handler)
+    {
+        m_release_handler = std::move(handler);
+    }
+
+    void set_progress_handler(progress_handler handler)
+    {
+        m_progress_handler = std::move(handler);
+    }
+
+    // Run on the io_context thread (see client), setup failures complete the transfer.
+    virtual void start() = 0;
+
+    // Stops the transfer, completed with CANCELLED unless completed already.
+    // Run on the io_context thread, client::cancel() posts it from other threads.
+    virtual void cancel() = 0;
+
+    bool is_completed() const
+    {
+        return m_completed;
+    }
+
+    const transfer_result& get_result() const
+    {
+        return m_result;
+    }
+
+protected:
+    void start_clock()
+    {
+        m_start_time = std::chrono::steady_clock::now();
+    }
+
+    // Opens the socket of the server's address family, bound to any address of
+    // it. The socket is left closed on failure.
+    static void open_socket(
+        udp_socket& socket, const asio::ip::udp::endpoint& server_endpoint, asio::error_code& ec)
+    {
+        socket.open(server_endpoint.protocol(), ec);
+        if (!ec)
+        {
+            socket.set_option(asio::socket_base::reuse_address(true), ec);
+        }
+        if (!ec)
+        {
+            socket.bind(asio::ip::udp::endpoint(server_endpoint.protocol(), 0), ec);
+        }
+        if (ec && socket.is_open())
+        {
+            asio::error_code ignored;
+            socket.close(ignored);
+        }
+    }
+
+    bool has_progress_handler() const
+    {
+        return static_cast<bool>(m_progress_handler);
+    }
+
+    void set_total_size(std::uint64_t size)
+    {
+        m_total_size = size;
+    }
+
+    void add_bytes(std::uint64_t bytes)
+    {
+        m_result.m_bytes += bytes;
+        if (m_progress_handler)
+        {
+            m_progress_handler(m_result.m_bytes, m_total_size);
+        }
+    }
+
+    void add_retransmits(std::size_t count)
+    {
+        m_result.m_retransmits += count;
+    }
+
+    void complete(transfer_error error, const std::string& message = std::string(), std::uint16_t server_error_code = 0)
+    {
+        if (m_completed)
+        {
+            return;
+        }
+        m_completed = true;
+
+        m_result.m_error = error;
+        m_result.m_message = message;
+        m_result.m_server_error_code = server_error_code;
+        m_result.m_duration = std::chrono::steady_clock::now() - m_start_time;
+
+        if (m_completion_handler)
+        {
+            auto handler = std::move(m_completion_handler);
+            m_completion_handler = nullptr;
+            m_progress_handler = nullptr;
+            handler(m_result);
+        }
+
+        // could release the transfer
+        finish();
+    }
+
+private:
+    void release() final
+    {
+        if (m_release_handler)
+        {
+            auto handler = std::move(m_release_handler);
+            m_release_handler = nullptr;
+            handler(*this);
+        }
+    }
+
+    completion_handler m_completion_handler;
+    progress_handler m_progress_handler;
+    release_handler m_release_handler;
+    bool m_completed;
+    std::uint64_t m_total_size;
+    std::chrono::steady_clock::time_point m_start_time;
+    transfer_result m_result;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "defs.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+enum class request_type
+{
+    GET,
+    PUT,
+};
+
+struct request
+{
+    request()
+        : m_type(request_type::GET)
+        , m_port(0)
+        , m_block_size(DEFAULT_DATA_SIZE)
+        , m_window_size(DEFAULT_WINDOW_SIZE)
+        , m_timeout_sec(DEFAULT_RETRY_TIMEOUT_SEC)
+        , m_retry_count(DEFAULT_RETRY_COUNTER)
+        , m_resume(false)
+        , m_streams_count(1)
+    {
+        // noop
+    }
+
+    request_type m_type;
+    std::string m_host;
+    std::uint16_t m_port;
+    std::string m_remote_filename;
+    std::string m_local_path;
+    std::string m_mode;
+    // options requested if not default
+    std::size_t m_block_size;
+    std::uint16_t m_window_size;
+    int m_timeout_sec;
+    int m_retry_count;
+    // continue download into existing partial local file
+    bool m_resume;
+    // download ranges of the file in parallel (octet mode only)
+    std::size_t m_streams_count;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
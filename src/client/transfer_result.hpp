@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <string>
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+enum class transfer_error
+{
+    NONE,
+    CANCELLED,
+    RESOLVE_FAILED,
+    NETWORK_ERROR,
+    // no response after all retransmissions
+    TIMEOUT,
+    // ERROR packet received, see m_server_error_code
+    SERVER_ERROR,
+    // server does not support the requested options (e.g. range)
+    OPTION_NEGOTIATION,
+    // local file, sink or source failed
+    LOCAL_IO,
+};
+
+struct transfer_result
+{
+    transfer_result()
+        : m_error(transfer_error::NONE)
+        , m_server_error_code(0)
+        , m_message()
+        , m_bytes(0)
+        , m_duration()
+        , m_retransmits(0)
+    {
+        // noop
+    }
+
+    bool is_success() const
+    {
+        return m_error == transfer_error::NONE;
+    }
+
+    transfer_error m_error;
+    std::uint16_t m_server_error_code;
+    std::string m_message;
+    // data bytes received or acknowledged by the server
+    std::uint64_t m_bytes;
+    std::chrono::steady_clock::duration m_duration;
+    // packets resent after a timeout
+    std::size_t m_retransmits;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -1,13 +1,17 @@
 #pragma once
 
+#include <chrono>
 #include <functional>
+#include <iomanip>
 #include <iostream>
 #include <memory>
 
 #include <asio.hpp>
 
-#include "client_get.hpp"
-#include "client_put.hpp"
+#include "background_executor.hpp"
+#include "client.hpp"
+#include "client_settings_loader.hpp"
+#include "log.hpp"
 
 namespace oct
 {
@@ -16,77 +20,196 @@ namespace net
 namespace tftp
 {
 
+// Runs the transfers given on the command line, at most the configured number
+// concurrently on one io_context, and prints their throughput.
 class client_app
 {
 public:
-    client_app(int /*argc*/, char* /*argv*/[])
-        : m_io_context()
-        , m_signals(m_io_context, SIGTERM)
+    client_app(int argc, char* argv[])
+        : m_program_name(argv[0])
+        , m_argc(argc)
+        , m_argv(argv)
+        , m_io_context()
+        , m_signals(m_io_context, SIGTERM, SIGINT)
+        , m_background_executor(1)
+        , m_client(m_io_context, m_background_executor)
+        , m_terminating(false)
+        , m_next_request_index(0)
+        , m_active_count(0)
+        , m_failed_count(0)
+        , m_total_bytes(0)
     {
-        // m_server = stdext::make_unique<server>(m_io_context, *m_settings, *m_io_manager);
+        // noop
     }
 
     int run()
     {
-        request this_request;
+        try
+        {
+            client_settings_loader loader(m_argc, m_argv);
+            if (loader.is_help_requested())
+            {
+                client_settings_loader::print_usage(std::cout, m_program_name);
+                return EXIT_SUCCESS;
+            }
 
-        this_request.m_type = request_type::GET;
-        // this_request.m_type = request_type::PUT;
-        this_request.m_host = "localhost";
-        this_request.m_port = 9999;
-        this_request.m_remote_filename = "file1.txt";
-        this_request.m_local_path = "testdata/client2.txt";
-        this_request.m_mode = "octet";
+            m_settings = loader.load();
+        }
+        catch (const client_settings_error& e)
+        {
+            log_error() << e.what() << std::endl;
+            client_settings_loader::print_usage(std::cerr, m_program_name);
+            return EXIT_FAILURE;
+        }
 
         try
         {
+            logger::set_level(m_settings->m_log_level);
+
             m_signals.async_wait(std::bind(&client_app::on_signal, this, std::placeholders::_1, std::placeholders::_2));
 
-            if (this_request.m_type == request_type::GET)
-            {
-                auto test_client1 = std::make_shared<client_get>(m_io_context, this_request);
-                test_client1->start();
-            }
-            else
-            {
-                auto test_client2 = std::make_shared<client_put>(m_io_context, this_request);
-                test_client2->start();
-            }
+            m_start_time = std::chrono::steady_clock::now();
+            m_end_time = m_start_time;
+            start_next_transfers();
 
             m_io_context.run();
 
-            return EXIT_SUCCESS;
+            if (m_settings->m_requests.size() > 1)
+            {
+                auto duration = m_end_time - m_start_time;
+                print_result("total", m_failed_count == 0 ? std::string() : std::to_string(m_failed_count) + " failed",
+                    m_total_bytes, std::chrono::duration<double>(duration).count());
+            }
+
+            // interrupted transfers are failed too
+            bool all_complete = (m_active_count == 0) && (m_next_request_index == m_settings->m_requests.size());
+            return (all_complete && (m_failed_count == 0)) ? EXIT_SUCCESS : EXIT_FAILURE;
         }
         catch (const std::exception& e)
         {
-            std::cerr << e.what() << std::endl;
+            log_error() << e.what() << std::endl;
             return EXIT_FAILURE;
         }
     }
 
 private:
+    void start_next_transfers()
+    {
+        while (!m_terminating && (m_active_count < m_settings->m_parallel_count)
+            && (m_next_request_index < m_settings->m_requests.size()))
+        {
+            start_transfer(m_next_request_index++);
+        }
+
+        if (m_active_count == 0)
+        {
+            // nothing left, let the io_context run out of work (downloads dally meanwhile)
+            m_end_time = std::chrono::steady_clock::now();
+            asio::error_code ec;
+            m_signals.cancel(ec);
+        }
+    }
+
+    void start_transfer(std::size_t index)
+    {
+        ++m_active_count;
+
+        m_client.start(m_settings->m_requests[index],
+            std::bind(&client_app::on_transfer_complete, this, index, std::placeholders::_1));
+    }
+
+    void on_transfer_complete(std::size_t index, const transfer_result& result)
+    {
+        const auto& transfer_request = m_settings->m_requests[index];
+
+        --m_active_count;
+        m_total_bytes += result.m_bytes;
+        if (!result.is_success())
+        {
+            ++m_failed_count;
+        }
+
+        auto direction = (transfer_request.m_type == request_type::GET) ? " -> " : " <- ";
+        auto duration = std::chrono::duration<double>(result.m_duration).count();
+        print_result(format_server(transfer_request) + ' ' + transfer_request.m_remote_filename + direction
+                + transfer_request.m_local_path,
+            result.is_success() ? std::string() : result.m_message, result.m_bytes, duration);
+
+        start_next_transfers();
+    }
+
+    // HOST:PORT, IPv6 address in brackets as given on the command line.
+    static std::string format_server(const request& transfer_request)
+    {
+        auto port = std::to_string(transfer_request.m_port);
+        if (transfer_request.m_host.find(':') != std::string::npos)
+        {
+            return '[' + transfer_request.m_host + "]:" + port;
+        }
+        return transfer_request.m_host + ':' + port;
+    }
+
+    static void print_result(const std::string& name, const std::string& error, std::uint64_t bytes, double duration)
+    {
+        std::cout << name << ": ";
+        if (!error.empty())
+        {
+            std::cout << "FAILED (" << error << "), ";
+        }
+        std::cout << bytes << " bytes in " << std::fixed << std::setprecision(3) << duration << " s";
+        if (duration > 0)
+        {
+            std::cout << " (" << std::setprecision(2) << bytes / duration / (1024 * 1024) << " MiB/s)";
+        }
+        std::cout << std::defaultfloat << std::endl;
+    }
+
     void on_signal(const asio::error_code& ec, int signal_number)
     {
+        if (ec == asio::error::operation_aborted)
+        {
+            // ignore, cancelled
+            return;
+        }
+
         if (ec)
         {
-            std::cerr << "Signal error: " << ec << std::endl;
+            log_error() << "Signal error: " << ec << std::endl;
             return;
         }
 
-        if (signal_number == SIGTERM)
+        if ((signal_number == SIGTERM) || (signal_number == SIGINT))
         {
-            std::cout << "Terminate requested" << std::endl;
-            m_io_context.stop();
+            log_info() << "Terminate requested" << std::endl;
+
+            // io_context runs out of work once the cancelled transfers are drained
+            m_terminating = true;
+            m_client.cancel_all();
         }
         else
         {
-            std::cerr << "Unexpected signal: " << signal_number << std::endl;
+            log_warning() << "Unexpected signal: " << signal_number << std::endl;
         }
     }
 
+    const char* m_program_name;
+    int m_argc;
+    char** m_argv;
+
     asio::io_context m_io_context;
     asio::signal_set m_signals;
-    // std::unique_ptr<server> m_server;
+    background_executor m_background_executor;
+    client m_client;
+
+    std::unique_ptr<client_settings> m_settings;
+
+    bool m_terminating;
+    std::size_t m_next_request_index;
+    std::size_t m_active_count;
+    std::size_t m_failed_count;
+    std::uint64_t m_total_bytes;
+    std::chrono::steady_clock::time_point m_start_time;
+    std::chrono::steady_clock::time_point m_end_time;
 };
 
 } // namespace tftp
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "defs.hpp"
+#include "log.hpp"
+#include "request.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+struct client_settings
+{
+    client_settings()
+        : m_requests()
+        , m_parallel_count(DEFAULT_PARALLEL_TRANSFERS)
+        , m_log_level(log_level::WARNING)
+    {
+        // noop
+    }
+
+    // single transfer from the command line or the batch manifest transfers
+    std::vector<request> m_requests;
+    // transfers run concurrently at most
+    std::size_t m_parallel_count;
+    log_level m_log_level;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,376 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "client_settings.hpp"
+#include "defs.hpp"
+#include "log.hpp"
+#include "make_unique.hpp"
+#include "request.hpp"
+#include "string_utils.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+class client_settings_error : public std::runtime_error
+{
+public:
+    client_settings_error(const std::string& message)
+        : std::runtime_error(message)
+    {
+        // noop
+    }
+};
+
+// Builds client settings from the command line, either a single transfer
+// "get|put HOST[:PORT] REMOTE [LOCAL]" or a batch manifest containing one
+// transfer in the same form per line, '#' starts a comment. Transfer options
+// given on the command line apply to all transfers of the manifest.
+class client_settings_loader
+{
+public:
+    client_settings_loader(int argc, char* argv[])
+        : m_help_requested(false)
+    {
+        parse_command_line(argc, argv);
+    }
+
+    bool is_help_requested() const
+    {
+        return m_help_requested;
+    }
+
+    std::unique_ptr<client_settings> load() const
+    {
+        auto settings = stdext::make_unique<client_settings>();
+
+        request defaults;
+        defaults.m_port = DEFAULT_TFTP_PORT;
+        defaults.m_mode = "octet";
+
+        for (auto& option : m_options)
+        {
+            apply_option(*settings, defaults, option.first, option.second);
+        }
+
+        if (!m_manifest_path.empty())
+        {
+            if (!m_arguments.empty())
+            {
+                throw client_settings_error("transfer cannot be given together with --batch");
+            }
+            read_manifest(m_manifest_path, defaults, settings->m_requests);
+        }
+        else if (!m_arguments.empty())
+        {
+            settings->m_requests.push_back(parse_transfer(m_arguments, defaults, "command line"));
+        }
+        else
+        {
+            throw client_settings_error("transfer not specified");
+        }
+
+        return settings;
+    }
+
+    static void print_usage(std::ostream& stream, const char* program_name)
+    {
+        stream << "Usage: " << program_name << " [options] get|put HOST[:PORT] REMOTE [LOCAL]\n"
+               << "       " << program_name << " [options] --batch MANIFEST\n"
+               << "\n"
+               << "Options:\n"
+               << "  -h, --help                  print this message\n"
+               << "  -p, --port PORT             server port if not given with the host (default: 69)\n"
+               << "  -m, --mode MODE             octet or netascii (default: octet)\n"
+               << "  --blksize BYTES             requested block size (default: 512)\n"
+               << "  --windowsize BLOCKS         requested window size (default: 1)\n"
+               << "  --timeout SECONDS           retransmission timeout (default: 1)\n"
+               << "  --retries COUNT             retransmission count (default: 5)\n"
+               << "  --resume                    continue download into existing partial local file\n"
+               << "  --streams COUNT             download ranges of the file over COUNT transfers\n"
+               << "                              (default: 1)\n"
+               << "  --batch PATH                run transfers listed in the manifest file, one\n"
+               << "                              'get|put HOST[:PORT] REMOTE [LOCAL]' per line\n"
+               << "  --parallel COUNT            transfers run concurrently in batch mode (default: 8)\n"
+               << "  --log-level LEVEL           error, warning, info or debug (default: warning)\n"
+               << "\n"
+               << "LOCAL defaults to the last component of REMOTE.\n";
+    }
+
+private:
+    typedef std::vector<std::pair<std::string, std::string>> option_list;
+
+    void parse_command_line(int argc, char* argv[])
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+
+            if ((arg == "-h") || (arg == "--help"))
+            {
+                m_help_requested = true;
+                continue;
+            }
+            if (arg == "--resume")
+            {
+                m_options.emplace_back("resume", "yes");
+                continue;
+            }
+
+            std::string name;
+
+            if ((arg == "-p") || (arg == "-m"))
+            {
+                name = (arg == "-p") ? "port" : "mode";
+            }
+            else if (arg.compare(0, 2, "--") == 0)
+            {
+                name = arg.substr(2);
+
+                auto separator_pos = name.find('=');
+                if (separator_pos != std::string::npos)
+                {
+                    add_option(name.substr(0, separator_pos), name.substr(separator_pos + 1));
+                    continue;
+                }
+            }
+            else
+            {
+                m_arguments.push_back(arg);
+                continue;
+            }
+
+            if (i + 1 >= argc)
+            {
+                throw client_settings_error("missing value for: " + arg);
+            }
+            add_option(name, argv[++i]);
+        }
+    }
+
+    void add_option(const std::string& name, const std::string& value)
+    {
+        if (name == "batch")
+        {
+            m_manifest_path = value;
+        }
+        else
+        {
+            m_options.emplace_back(name, value);
+        }
+    }
+
+    static void apply_option(
+        client_settings& settings, request& defaults, const std::string& name, const std::string& value)
+    {
+        if (name == "port")
+        {
+            defaults.m_port = parse_number<std::uint16_t>(name, value, 1);
+        }
+        else if (name == "mode")
+        {
+            if (!equal_ignore_case(value, "octet") && !equal_ignore_case(value, "netascii"))
+            {
+                throw client_settings_error("invalid value for " + name + ": " + value);
+            }
+            defaults.m_mode = value;
+        }
+        else if (name == "blksize")
+        {
+            defaults.m_block_size = parse_number<std::size_t>(name, value, MIN_DATA_SIZE, MAX_DATA_SIZE);
+        }
+        else if (name == "windowsize")
+        {
+            defaults.m_window_size = parse_number<std::uint16_t>(name, value, 1);
+        }
+        else if (name == "timeout")
+        {
+            defaults.m_timeout_sec = parse_number<int>(name, value, MIN_RETRY_TIMEOUT_SEC, MAX_RETRY_TIMEOUT_SEC);
+        }
+        else if (name == "retries")
+        {
+            defaults.m_retry_count = parse_number<int>(name, value, 1);
+        }
+        else if (name == "resume")
+        {
+            defaults.m_resume = true;
+        }
+        else if (name == "streams")
+        {
+            defaults.m_streams_count = parse_number<std::size_t>(name, value, 1);
+        }
+        else if (name == "parallel")
+        {
+            settings.m_parallel_count = parse_number<std::size_t>(name, value, 1);
+        }
+        else if (name == "log-level")
+        {
+            if (!logger::parse_level(value, settings.m_log_level))
+            {
+                throw client_settings_error("invalid value for " + name + ": " + value);
+            }
+        }
+        else
+        {
+            throw client_settings_error("unknown option: " + name);
+        }
+    }
+
+    static void read_manifest(const std::string& path, const request& defaults, std::vector<request>& requests)
+    {
+        std::ifstream stream(path);
+        if (!stream)
+        {
+            throw client_settings_error("cannot open manifest: " + path);
+        }
+
+        std::string line;
+        std::size_t line_no = 0;
+        while (std::getline(stream, line))
+        {
+            ++line_no;
+
+            auto comment_pos = line.find('#');
+            if (comment_pos != std::string::npos)
+            {
+                line.resize(comment_pos);
+            }
+
+            std::istringstream fields(line);
+            std::vector<std::string> field_list(
+                (std::istream_iterator<std::string>(fields)), std::istream_iterator<std::string>());
+            if (field_list.empty())
+            {
+                continue;
+            }
+
+            requests.push_back(parse_transfer(field_list, defaults, path + ':' + std::to_string(line_no)));
+        }
+    }
+
+    // "get|put HOST[:PORT] REMOTE [LOCAL]"
+    static request parse_transfer(
+        const std::vector<std::string>& fields, const request& defaults, const std::string& location)
+    {
+        if ((fields.size() < 3) || (fields.size() > 4))
+        {
+            throw client_settings_error(location + ": expected 'get|put HOST[:PORT] REMOTE [LOCAL]'");
+        }
+
+        request transfer = defaults;
+
+        if (fields[0] == "get")
+        {
+            transfer.m_type = request_type::GET;
+        }
+        else if (fields[0] == "put")
+        {
+            transfer.m_type = request_type::PUT;
+        }
+        else
+        {
+            throw client_settings_error(location + ": unknown transfer type: " + fields[0]);
+        }
+
+        parse_host(fields[1], transfer);
+
+        transfer.m_remote_filename = fields[2];
+        if (fields.size() > 3)
+        {
+            transfer.m_local_path = fields[3];
+        }
+        else
+        {
+            auto separator_pos = transfer.m_remote_filename.find_last_of("/\\");
+            transfer.m_local_path = (separator_pos == std::string::npos)
+                ? transfer.m_remote_filename
+                : transfer.m_remote_filename.substr(separator_pos + 1);
+        }
+        if (transfer.m_local_path.empty())
+        {
+            throw client_settings_error(location + ": local path not specified");
+        }
+
+        return transfer;
+    }
+
+    // HOST, HOST:PORT, [IPV6] or [IPV6]:PORT, IPv6 address without brackets has no port
+    static void parse_host(const std::string& value, request& transfer)
+    {
+        std::string port;
+
+        if (!value.empty() && (value.front() == '['))
+        {
+            auto end_pos = value.find(']');
+            if (end_pos == std::string::npos)
+            {
+                throw client_settings_error("invalid host: " + value);
+            }
+            transfer.m_host = value.substr(1, end_pos - 1);
+            if ((end_pos + 1 < value.size()) && (value[end_pos + 1] == ':'))
+            {
+                port = value.substr(end_pos + 2);
+            }
+            else if (end_pos + 1 != value.size())
+            {
+                throw client_settings_error("invalid host: " + value);
+            }
+        }
+        else if (value.find(':') == value.rfind(':'))
+        {
+            auto separator_pos = value.find(':');
+            transfer.m_host = value.substr(0, separator_pos);
+            if (separator_pos != std::string::npos)
+            {
+                port = value.substr(separator_pos + 1);
+            }
+        }
+        else
+        {
+            transfer.m_host = value;
+        }
+
+        if (transfer.m_host.empty())
+        {
+            throw client_settings_error("invalid host: " + value);
+        }
+        if (!port.empty())
+        {
+            transfer.m_port = parse_number<std::uint16_t>("port", port, 1);
+        }
+    }
+
+    template <class value_T>
+    static value_T parse_number(const std::string& name, const std::string& value, std::uint64_t min_value = 0,
+        std::uint64_t max_value = std::numeric_limits<value_T>::max())
+    {
+        std::uint64_t number = 0;
+        if (!parse_uint64(value, number) || (number < min_value) || (number > max_value))
+        {
+            throw client_settings_error("invalid value for " + name + ": " + value);
+        }
+        return static_cast<value_T>(number);
+    }
+
+    bool m_help_requested;
+    std::string m_manifest_path;
+    option_list m_options;
+    std::vector<std::string> m_arguments;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Counts the heap allocations of the process and the bytes they keep, updated
+// by an application replacing operator new and delete (e.g. the simulation
+// tool), zero otherwise. Allocations made within an uncounted scope of the
+// thread are not counted, e.g. those of the simulated network standing in for
+// the kernel.
+class allocation_counter
+{
+public:
+    class uncounted
+    {
+    public:
+        uncounted(const uncounted&) = delete;
+        uncounted& operator=(const uncounted&) = delete;
+
+        uncounted()
+        {
+            ++get_uncounted_depth();
+        }
+
+        ~uncounted()
+        {
+            --get_uncounted_depth();
+        }
+    };
+
+    // Returns whether the allocation is counted, its size is then removed once
+    // it is freed.
+    static bool add(std::size_t size)
+    {
+        if (get_uncounted_depth() > 0)
+        {
+            return false;
+        }
+
+        get_counter().fetch_add(1, std::memory_order_relaxed);
+        get_bytes_counter().fetch_add(size, std::memory_order_relaxed);
+        return true;
+    }
+
+    static void remove(std::size_t size)
+    {
+        get_bytes_counter().fetch_sub(size, std::memory_order_relaxed);
+    }
+
+    static std::uint64_t get_count()
+    {
+        return get_counter().load(std::memory_order_relaxed);
+    }
+
+    // Bytes of the counted allocations not freed yet.
+    static std::uint64_t get_bytes()
+    {
+        return get_bytes_counter().load(std::memory_order_relaxed);
+    }
+
+private:
+    static std::atomic<std::uint64_t>& get_counter()
+    {
+        static std::atomic<std::uint64_t> counter(0);
+        return counter;
+    }
+
+    static std::atomic<std::uint64_t>& get_bytes_counter()
+    {
+        static std::atomic<std::uint64_t> counter(0);
+        return counter;
+    }
+
+    static int& get_uncounted_depth()
+    {
+        static thread_local int depth = 0;
+        return depth;
+    }
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
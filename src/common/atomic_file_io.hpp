@@ -0,0 +1,371 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "io.hpp"
+#include "log.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+enum class fsync_policy
+{
+    NONE,
+    // file and directory synced before the file is replaced
+    CLOSE,
+    // as CLOSE, also synced each time the interval worth of data is written
+    PERIODIC,
+};
+
+inline bool parse_fsync_policy(const std::string& name, fsync_policy& policy)
+{
+    if (name == "none")
+    {
+        policy = fsync_policy::NONE;
+    }
+    else if (name == "close")
+    {
+        policy = fsync_policy::CLOSE;
+    }
+    else if (name == "periodic")
+    {
+        policy = fsync_policy::PERIODIC;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+// Writes to a temporary file in the destination directory, which replaces the
+// destination on successful close, so the destination is either the old or
+// the new complete file. The temporary file is unnamed (O_TMPFILE) until it is
+// complete where supported, otherwise it is named as matched by is_temp_name.
+// The temporary file is removed if not closed.
+// Small writes are coalesced to reduce number of syscalls. With direct I/O
+// (if supported by the filesystem) the file is written bypassing the page cache.
+class atomic_file_writer : public writer
+{
+public:
+    static const std::size_t WRITE_BUFFER_SIZE = 256 * 1024;
+    static const std::size_t DIRECT_IO_ALIGNMENT = 4096;
+
+    atomic_file_writer(const atomic_file_writer&) = delete;
+    atomic_file_writer& operator=(const atomic_file_writer&) = delete;
+
+    // Takes ownership of the directory descriptor, name must not contain '/'.
+    atomic_file_writer(int dir_fd, const std::string& name, fsync_policy policy, std::uint64_t fsync_interval,
+        bool direct_io = false)
+        : m_dir_fd(dir_fd)
+        , m_name(name)
+        , m_temp_name()
+        , m_fd(-1)
+        , m_policy(policy)
+        , m_fsync_interval(fsync_interval)
+        , m_unsynced_size(0)
+        , m_failed(false)
+        , m_direct_io(direct_io)
+        , m_buffer(nullptr, &std::free)
+        , m_buffer_size(0)
+    {
+        if (m_dir_fd >= 0)
+        {
+            open_temp_file();
+        }
+    }
+
+    ~atomic_file_writer()
+    {
+        if (m_fd >= 0)
+        {
+            ::close(m_fd);
+            remove_temp_file();
+        }
+        if (m_dir_fd >= 0)
+        {
+            ::close(m_dir_fd);
+        }
+    }
+
+    // True for the name of a temporary file being written, e.g. ".name.1234.5.tmp",
+    // so it is not served as an incomplete file.
+    static bool is_temp_name(const std::string& name)
+    {
+        static const std::string TEMP_SUFFIX = ".tmp";
+
+        if ((name.size() <= TEMP_SUFFIX.size()) || (name[0] != '.')
+            || (name.compare(name.size() - TEMP_SUFFIX.size(), TEMP_SUFFIX.size(), TEMP_SUFFIX) != 0))
+        {
+            return false;
+        }
+
+        // ".<pid>.<counter>" precedes the suffix
+        auto pos = name.size() - TEMP_SUFFIX.size();
+        for (int number = 0; number < 2; ++number)
+        {
+            auto digits_end = pos;
+            while ((pos > 0) && (name[pos - 1] >= '0') && (name[pos - 1] <= '9'))
+            {
+                --pos;
+            }
+            if ((pos == digits_end) || (pos <= 1) || (name[pos - 1] != '.'))
+            {
+                return false;
+            }
+            --pos;
+        }
+        return true;
+    }
+
+    bool is_open() const final
+    {
+        return m_fd >= 0;
+    }
+
+    bool write(const void* buffer, const std::size_t bytes_count) final
+    {
+        if ((m_fd < 0) || m_failed)
+        {
+            return false;
+        }
+
+        auto data = reinterpret_cast<const std::uint8_t*>(buffer);
+        auto size = bytes_count;
+
+        if (!m_direct_io && (m_buffer_size == 0) && (size >= WRITE_BUFFER_SIZE))
+        {
+            return write_fully(data, size);
+        }
+
+        while (size > 0)
+        {
+            auto copy_size = std::min(size, WRITE_BUFFER_SIZE - m_buffer_size);
+            std::memcpy(m_buffer.get() + m_buffer_size, data, copy_size);
+            m_buffer_size += copy_size;
+            data += copy_size;
+            size -= copy_size;
+
+            if ((m_buffer_size == WRITE_BUFFER_SIZE) && !flush())
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool close() final
+    {
+        if (m_fd < 0)
+        {
+            return false;
+        }
+
+        if (m_direct_io && (m_buffer_size % DIRECT_IO_ALIGNMENT != 0))
+        {
+            // unaligned tail cannot be written directly
+            m_direct_io = false;
+            ::fcntl(m_fd, F_SETFL, ::fcntl(m_fd, F_GETFL) & ~O_DIRECT);
+        }
+
+        bool rv = !m_failed && flush();
+        if (rv && (m_policy != fsync_policy::NONE))
+        {
+            rv = (::fsync(m_fd) == 0);
+        }
+        if (rv && m_temp_name.empty())
+        {
+            // unnamed file gets a name only now, as renameat replaces the destination and linkat does not
+            rv = link_temp_file();
+        }
+        rv &= (::close(m_fd) == 0);
+        m_fd = -1;
+
+        if (rv)
+        {
+            rv = (::renameat(m_dir_fd, m_temp_name.c_str(), m_dir_fd, m_name.c_str()) == 0);
+        }
+        if (!rv)
+        {
+            log_error() << "Cannot store file " << m_name << ": " << std::strerror(errno) << std::endl;
+            remove_temp_file();
+            return false;
+        }
+
+        if (m_policy != fsync_policy::NONE)
+        {
+            // make the rename durable
+            ::fsync(m_dir_fd);
+        }
+        return true;
+    }
+
+private:
+    void open_temp_file()
+    {
+        // keep the permissions of the replaced file
+        mode_t mode = 0666;
+        struct stat file_stat;
+        if ((::fstatat(m_dir_fd, m_name.c_str(), &file_stat, 0) == 0) && S_ISREG(file_stat.st_mode))
+        {
+            mode = file_stat.st_mode & 07777;
+        }
+
+#ifdef O_TMPFILE
+        m_fd = ::openat(m_dir_fd, ".", O_WRONLY | O_TMPFILE | O_CLOEXEC, mode);
+        if (m_fd < 0)
+        {
+            // not supported by the kernel or the filesystem
+            log_debug() << "Unnamed temporary file not supported for " << m_name << std::endl;
+        }
+#endif
+        for (int attempt = 0; (m_fd < 0) && (attempt < 100); ++attempt)
+        {
+            m_temp_name = create_temp_name();
+            m_fd = ::openat(m_dir_fd, m_temp_name.c_str(), O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+            if ((m_fd < 0) && (errno != EEXIST))
+            {
+                break;
+            }
+        }
+        if (m_fd < 0)
+        {
+            m_temp_name.clear();
+            return;
+        }
+        if (mode != 0666)
+        {
+            // umask does not apply to the replaced file permissions
+            ::fchmod(m_fd, mode);
+        }
+
+        void* buffer = nullptr;
+        if (::posix_memalign(&buffer, DIRECT_IO_ALIGNMENT, WRITE_BUFFER_SIZE) != 0)
+        {
+            ::close(m_fd);
+            remove_temp_file();
+            m_fd = -1;
+            return;
+        }
+        m_buffer.reset(reinterpret_cast<std::uint8_t*>(buffer));
+
+        if (m_direct_io && (::fcntl(m_fd, F_SETFL, ::fcntl(m_fd, F_GETFL) | O_DIRECT) != 0))
+        {
+            log_debug() << "Direct I/O not supported for " << m_name << std::endl;
+            m_direct_io = false;
+        }
+    }
+
+    std::string create_temp_name() const
+    {
+        static std::atomic<unsigned> counter(0);
+
+        return '.' + m_name + '.' + std::to_string(::getpid()) + '.' + std::to_string(counter++) + ".tmp";
+    }
+
+    // Links the complete unnamed file into the directory.
+    bool link_temp_file()
+    {
+        auto fd_path = "/proc/self/fd/" + std::to_string(m_fd);
+        for (int attempt = 0; attempt < 100; ++attempt)
+        {
+            m_temp_name = create_temp_name();
+            if (::linkat(AT_FDCWD, fd_path.c_str(), m_dir_fd, m_temp_name.c_str(), AT_SYMLINK_FOLLOW) == 0)
+            {
+                return true;
+            }
+            if (errno != EEXIST)
+            {
+                break;
+            }
+        }
+        m_temp_name.clear();
+        return false;
+    }
+
+    void remove_temp_file()
+    {
+        if (!m_temp_name.empty())
+        {
+            ::unlinkat(m_dir_fd, m_temp_name.c_str(), 0);
+        }
+    }
+
+    bool flush()
+    {
+        if (m_buffer_size == 0)
+        {
+            return true;
+        }
+
+        bool rv = write_fully(m_buffer.get(), m_buffer_size);
+        m_buffer_size = 0;
+        return rv;
+    }
+
+    bool write_fully(const std::uint8_t* data, std::size_t size)
+    {
+        m_unsynced_size += size;
+
+        while (size > 0)
+        {
+            auto bytes_written = ::write(m_fd, data, size);
+            if (bytes_written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                m_failed = true;
+                return false;
+            }
+            data += bytes_written;
+            size -= static_cast<std::size_t>(bytes_written);
+        }
+
+        if ((m_policy == fsync_policy::PERIODIC) && (m_unsynced_size >= m_fsync_interval))
+        {
+            m_unsynced_size = 0;
+            if (::fdatasync(m_fd) != 0)
+            {
+                m_failed = true;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    const int m_dir_fd;
+    const std::string m_name;
+    std::string m_temp_name;
+    int m_fd;
+
+    const fsync_policy m_policy;
+    const std::uint64_t m_fsync_interval;
+    std::uint64_t m_unsynced_size;
+    bool m_failed;
+
+    bool m_direct_io;
+    // aligned as required for direct I/O
+    std::unique_ptr<std::uint8_t, decltype(&std::free)> m_buffer;
+    std::size_t m_buffer_size;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
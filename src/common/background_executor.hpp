@@ -0,0 +1,70 @@
+#pragma once
+
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "log.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Threads running blocking jobs (e.g. disk writes) off the network workers.
+// Queued jobs are completed before destruction.
+class background_executor
+{
+public:
+    background_executor(const background_executor&) = delete;
+    background_executor& operator=(const background_executor&) = delete;
+
+    background_executor(std::size_t threads_count)
+        : m_io_context()
+        , m_work_guard(asio::make_work_guard(m_io_context))
+    {
+        for (std::size_t i = 0; i < std::max<std::size_t>(threads_count, 1); ++i)
+        {
+            m_threads.emplace_back([this]() { run(); });
+        }
+    }
+
+    ~background_executor()
+    {
+        m_work_guard.reset();
+        for (auto& thread : m_threads)
+        {
+            thread.join();
+        }
+    }
+
+    void post(std::function<void()> job)
+    {
+        asio::post(m_io_context, std::move(job));
+    }
+
+private:
+    void run()
+    {
+        try
+        {
+            m_io_context.run();
+        }
+        catch (const std::exception& e)
+        {
+            log_error() << "Background job failed: " << e.what() << std::endl;
+        }
+    }
+
+    asio::io_context m_io_context;
+    asio::executor_work_guard<asio::io_context::executor_type> m_work_guard;
+    std::vector<std::thread> m_threads;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,575 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "defs.hpp"
+#include "log.hpp"
+#include "packet.hpp"
+#include "packet_builder.hpp"
+#include "packet_parser.hpp"
+#include "receive_buffer.hpp"
+#include "round_trip_stats.hpp"
+#include "transport.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Receives the blocks of a transfer in order and acknowledges them once per
+// window (RFC 7440, a window of one block for RFC 1350), resending the last
+// ACK on timeout. It is the receive state machine of the server uploads and
+// the client downloads, the host stores the data and provides:
+//
+//   bool write_block(const std::uint8_t* data, std::size_t size, bool last_block);
+//   bool process_other_packet(const asio::const_buffer& packet);
+//   void on_receiver_done(block_receiver::status status);
+//
+// write_block() returns false if the transfer failed and the host reports the
+// error, process_other_packet() returns true if the packet is answered by the
+// ACK of the last block (e.g. the OACK by ACK 0). Once the final ACK is sent
+// the receiver dallies, resending it if DATA are received again, until none is
+// received for DALLY_TIMEOUTS_COUNT timeouts. A host whose writer cannot take
+// more data holds the ACK, so the peer waits for it instead of the worker
+// waiting for the disk. The host is a handler_owner tracking the handlers of
+// the receiver (befriended if its track() is not visible).
+template <class host_T>
+class block_receiver
+{
+public:
+    // The peer resends the final DATA a timeout after it sent it, so about a
+    // timeout after the final ACK, dallying lasts longer not to race with it.
+    static const int DALLY_TIMEOUTS_COUNT = 2;
+
+    enum class status
+    {
+        // final ACK sent, the receiver dallies
+        COMPLETE,
+        // dallying is over (reported after COMPLETE)
+        DALLIED,
+        TIMEOUT,
+        NETWORK_ERROR
+    };
+
+    // The peer endpoint is owned by the host, set before the start and by
+    // confirm_peer().
+    block_receiver(host_T& host, asio::io_context& io_context, udp_socket& socket, asio::ip::udp::endpoint& peer)
+        : m_host(host)
+        , m_socket(socket)
+        , m_timer(io_context)
+        , m_peer(peer)
+        , m_peer_confirmed(false)
+        , m_block_size(DEFAULT_DATA_SIZE)
+        , m_window_size(DEFAULT_WINDOW_SIZE)
+        , m_retry_count(0)
+        , m_timeout(0)
+        , m_retry_counter(0)
+        , m_last_block_no(0)
+        , m_window_received_count(0)
+        , m_out_of_order_acked(false)
+        , m_ack_prepared(false)
+        , m_response_expected(false)
+        , m_sending(false)
+        , m_ack_deferred(false)
+        , m_ack_held(false)
+        , m_held_ack_due(false)
+        , m_dallying(false)
+        , m_timer_pending(false)
+        , m_timeout_deadline()
+        , m_receive_pending(false)
+        , m_stopped(false)
+        , m_retransmits(0)
+        , m_ignored_blocks(0)
+        , m_round_trip_start()
+        , m_round_trip_pending(false)
+        , m_round_trips()
+        , m_error()
+    {
+        // noop
+    }
+
+    // Size of the blocks, a shorter one is the last. Could be changed once
+    // started (e.g. by the OACK).
+    void set_block_size(std::size_t block_size)
+    {
+        m_block_size = block_size;
+    }
+
+    std::size_t get_block_size() const
+    {
+        return m_block_size;
+    }
+
+    void set_window_size(std::uint16_t window_size)
+    {
+        m_window_size = window_size;
+    }
+
+    // Sends the first packet (the request, OACK or ACK 0) and receives the
+    // blocks answering it. Unless the peer is confirmed, packets from any
+    // source are processed until the host calls confirm_peer().
+    void start(
+        bool peer_confirmed, std::vector<std::uint8_t> first_packet, int retry_count, std::chrono::seconds timeout)
+    {
+        m_peer_confirmed = peer_confirmed;
+        m_retry_count = retry_count;
+        m_retry_counter = retry_count;
+        m_timeout = timeout;
+        m_out_packet_data = std::move(first_packet);
+        m_response_expected = true;
+
+        start_round_trip();
+        send_prepared_packet();
+    }
+
+    // Pending operations are cancelled by closing the socket.
+    void stop()
+    {
+        m_stopped = true;
+        m_timer.cancel();
+    }
+
+    // No ACK is sent until release_ack(), also on timeout, the blocks of the
+    // current window are still received.
+    void hold_ack()
+    {
+        m_ack_held = true;
+    }
+
+    // Sends the ACK which became due while held.
+    void release_ack()
+    {
+        m_ack_held = false;
+        if (m_held_ack_due && !m_stopped)
+        {
+            m_held_ack_due = false;
+            start_round_trip();
+            send_ack();
+        }
+    }
+
+    // Packets from other sources than the one of the packet being processed
+    // are ignored from now on.
+    void confirm_peer()
+    {
+        m_peer = m_in_packet_endpoint;
+        m_peer_confirmed = true;
+    }
+
+    std::size_t get_retransmits() const
+    {
+        return m_retransmits;
+    }
+
+    // DATA not received in order, e.g. duplicated or following a lost block.
+    std::size_t get_ignored_blocks() const
+    {
+        return m_ignored_blocks;
+    }
+
+    // From the packet requesting a window to its first block.
+    const round_trip_stats& get_round_trips() const
+    {
+        return m_round_trips;
+    }
+
+    // Error of the failed send or receive.
+    const asio::error_code& get_error() const
+    {
+        return m_error;
+    }
+
+private:
+    // Last block received in order is acknowledged, after the pending send
+    // completes as its buffer is referenced.
+    void send_ack()
+    {
+        if (m_ack_held)
+        {
+            m_held_ack_due = true;
+            return;
+        }
+
+        if (m_sending)
+        {
+            m_ack_deferred = true;
+            return;
+        }
+
+        log_debug() << "Sending ACK: " << m_last_block_no << std::endl;
+
+        packet_ack packet;
+        packet.m_op = OP_ACK;
+        packet.m_block_no = m_last_block_no;
+
+        // buffer memory is reused
+        packet_builder::build_packet(packet, m_out_packet_data);
+        m_ack_prepared = true;
+
+        send_prepared_packet();
+    }
+
+    void send_prepared_packet()
+    {
+        m_sending = true;
+        m_socket.async_send_to(asio::const_buffer(m_out_packet_data.data(), m_out_packet_data.size()), m_peer,
+            m_host.track([this](const asio::error_code& ec, std::size_t bytes_transferred) {
+                on_packet_sent(ec, bytes_transferred);
+            }));
+    }
+
+    void on_packet_sent(const asio::error_code& ec, std::size_t bytes_transferred)
+    {
+        m_sending = false;
+
+        if ((ec == asio::error::operation_aborted) || m_stopped)
+        {
+            // ignore, cancelled or completed before the stop
+            return;
+        }
+
+        if (ec)
+        {
+            finish(status::NETWORK_ERROR, ec);
+            return;
+        }
+
+        log_debug() << "Packet sent: " << bytes_transferred << std::endl;
+
+        if (m_ack_deferred)
+        {
+            m_ack_deferred = false;
+            send_ack();
+            return;
+        }
+
+        if (m_response_expected)
+        {
+            start_timeout_timer();
+            receive_packets();
+        }
+        else if (m_ack_held)
+        {
+            // final ACK is sent once released
+        }
+        else if (!m_dallying)
+        {
+            // RFC 1350: the final ACK could be lost, the peer then resends the
+            // final DATA until it times out
+            m_dallying = true;
+            finish(status::COMPLETE, asio::error_code());
+            if (!m_stopped)
+            {
+                start_timeout_timer();
+                receive_packets();
+            }
+        }
+        else if (!m_timer_pending)
+        {
+            // final ACK resent as the dallying ended
+            finish(status::DALLIED, asio::error_code());
+        }
+    }
+
+    // Timer is restarted for every block, so only the deadline of a pending
+    // wait is moved and the wait is resumed if it expires before it.
+    void start_timeout_timer()
+    {
+        auto timeout = m_dallying ? std::chrono::seconds(m_timeout.count() * DALLY_TIMEOUTS_COUNT) : m_timeout;
+        m_timeout_deadline = transfer_timer::clock_type::now() + timeout;
+        if (!m_timer_pending)
+        {
+            wait_for_timeout();
+        }
+    }
+
+    void wait_for_timeout()
+    {
+        m_timer_pending = true;
+        m_timer.expires_at(m_timeout_deadline);
+        m_timer.async_wait(m_host.track([this](const asio::error_code& ec) { on_timeout(ec); }));
+    }
+
+    void on_timeout(const asio::error_code& ec)
+    {
+        m_timer_pending = false;
+
+        if ((ec == asio::error::operation_aborted) || m_stopped)
+        {
+            // ignore, cancelled
+            return;
+        }
+
+        if (ec)
+        {
+            log_error() << "Timer error: " << ec << std::endl;
+            return;
+        }
+
+        if (transfer_timer::clock_type::now() < m_timeout_deadline)
+        {
+            wait_for_timeout();
+            return;
+        }
+
+        if (m_dallying)
+        {
+            if (!m_sending)
+            {
+                finish(status::DALLIED, asio::error_code());
+            }
+            return;
+        }
+
+        if (m_sending)
+        {
+            // timer is restarted when the send completes
+            return;
+        }
+
+        if (m_ack_held)
+        {
+            // peer waits for the ACK, timer is restarted once it is sent
+            m_held_ack_due = true;
+            return;
+        }
+
+        if (--m_retry_counter > 0)
+        {
+            // part of the window is lost, what was received so far is acknowledged
+            ++m_retransmits;
+            m_round_trip_pending = false;
+            if (m_ack_prepared)
+            {
+                send_ack();
+            }
+            else
+            {
+                send_prepared_packet();
+            }
+        }
+        else
+        {
+            finish(status::TIMEOUT, asio::error_code());
+        }
+    }
+
+    // Processes the pending packets and waits for the socket to become
+    // readable, no receive buffer is held while waiting.
+    void receive_packets()
+    {
+        while ((m_response_expected || m_dallying) && !m_receive_pending && !m_stopped)
+        {
+            asio::error_code ec;
+            auto bytes_received = receive_buffer::receive(m_socket, m_in_packet_endpoint, ec);
+            if (ec == asio::error::would_block)
+            {
+                wait_readable();
+                return;
+            }
+
+            if (ec)
+            {
+                finish(status::NETWORK_ERROR, ec);
+                return;
+            }
+
+            log_debug() << "Packet received: " << bytes_received << std::endl;
+
+            process_received_packet(bytes_received);
+        }
+    }
+
+    void wait_readable()
+    {
+        m_receive_pending = true;
+        m_socket.async_wait(asio::socket_base::wait_read,
+            m_host.track([this](const asio::error_code& ec) { on_socket_readable(ec); }));
+    }
+
+    void on_socket_readable(const asio::error_code& ec)
+    {
+        m_receive_pending = false;
+
+        if ((ec == asio::error::operation_aborted) || m_stopped)
+        {
+            // ignore, cancelled or completed before the stop
+            return;
+        }
+
+        if (ec)
+        {
+            finish(status::NETWORK_ERROR, ec);
+            return;
+        }
+
+        receive_packets();
+    }
+
+    // Packet is referenced in the receive buffer of the thread.
+    void process_received_packet(std::size_t bytes_received)
+    {
+        if (m_peer_confirmed && (m_peer != m_in_packet_endpoint))
+        {
+            log_warning() << "Received packet from unexpected source: " << m_in_packet_endpoint << std::endl;
+            return;
+        }
+
+        auto data = receive_buffer::data();
+        asio::const_buffer buffer(data, bytes_received);
+
+        // DATA are parsed in place
+        std::uint16_t op = 0;
+        std::uint16_t block_no = 0;
+        bool is_data = packet_parser::parse_block_header(buffer, op, block_no) && (op == OP_DATA);
+
+        if (m_dallying)
+        {
+            // peer resending the final window did not receive the final ACK
+            if (is_data)
+            {
+                log_debug() << "Data received while dallying: " << block_no << std::endl;
+                ++m_retransmits;
+                start_timeout_timer();
+                send_ack();
+            }
+            return;
+        }
+
+        if (is_data)
+        {
+            process_data_received(block_no, data + DATA_HEADER_SIZE, bytes_received - DATA_HEADER_SIZE);
+            return;
+        }
+
+        if (m_host.process_other_packet(buffer))
+        {
+            m_retry_counter = m_retry_count;
+            start_round_trip();
+            send_ack();
+        }
+    }
+
+    // Data are referenced in the receive buffer.
+    void process_data_received(std::uint16_t block_no, const std::uint8_t* data, std::size_t size)
+    {
+        if (static_cast<std::uint16_t>(m_last_block_no + 1) != block_no)
+        {
+            log_debug() << "Data with bad block no received: " << block_no << std::endl;
+            ++m_ignored_blocks;
+
+            // RFC 7440: last block received in order is acknowledged, once per window
+            if (m_peer_confirmed && !m_out_of_order_acked)
+            {
+                m_out_of_order_acked = true;
+                m_window_received_count = 0;
+                m_round_trip_pending = false;
+                send_ack();
+            }
+            return;
+        }
+
+        log_debug() << "Data received: " << block_no << " with bytes: " << size << std::endl;
+
+        if (m_round_trip_pending)
+        {
+            m_round_trip_pending = false;
+            m_round_trips.add(std::chrono::duration_cast<std::chrono::microseconds>(
+                transfer_timer::clock_type::now() - m_round_trip_start));
+        }
+
+        bool last_block = (size < m_block_size);
+        if (!m_host.write_block(data, size, last_block))
+        {
+            return;
+        }
+
+        m_last_block_no = block_no;
+        m_out_of_order_acked = false;
+        m_retry_counter = m_retry_count;
+
+        if (last_block || (++m_window_received_count >= m_window_size))
+        {
+            m_window_received_count = 0;
+            m_response_expected = !last_block;
+            start_round_trip();
+            send_ack();
+        }
+        else
+        {
+            // acknowledged at the end of the window, or on timeout if the rest of the window is lost
+            m_ack_prepared = true;
+            start_timeout_timer();
+        }
+    }
+
+    // Measured unless the packet is resent before the answer.
+    void start_round_trip()
+    {
+        m_round_trip_start = transfer_timer::clock_type::now();
+        m_round_trip_pending = true;
+    }
+
+    void finish(status result, const asio::error_code& ec)
+    {
+        m_error = ec;
+        m_host.on_receiver_done(result);
+    }
+
+    host_T& m_host;
+    udp_socket& m_socket;
+
+    transfer_timer m_timer;
+
+    asio::ip::udp::endpoint& m_peer;
+    bool m_peer_confirmed;
+
+    std::size_t m_block_size;
+    std::uint16_t m_window_size;
+
+    int m_retry_count;
+    std::chrono::seconds m_timeout;
+    int m_retry_counter;
+
+    std::uint16_t m_last_block_no;
+    std::uint16_t m_window_received_count;
+    bool m_out_of_order_acked;
+    // first packet is resent until a block is received, the ACK afterwards
+    bool m_ack_prepared;
+    bool m_response_expected;
+
+    bool m_sending;
+    bool m_ack_deferred;
+    bool m_ack_held;
+    bool m_held_ack_due;
+    // final ACK sent, resent until the dallying ends
+    bool m_dallying;
+
+    bool m_timer_pending;
+    transfer_timer::time_point m_timeout_deadline;
+    bool m_receive_pending;
+    bool m_stopped;
+
+    std::size_t m_retransmits;
+    std::size_t m_ignored_blocks;
+    transfer_timer::time_point m_round_trip_start;
+    bool m_round_trip_pending;
+    round_trip_stats m_round_trips;
+    asio::error_code m_error;
+
+    std::vector<std::uint8_t> m_out_packet_data;
+
+    // source of the packet being processed
+    asio::ip::udp::endpoint m_in_packet_endpoint;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,310 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#ifdef OCTNET_TFTP_WITH_ZLIB
+#include <zlib.h>
+#endif
+#ifdef OCTNET_TFTP_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+#include "io.hpp"
+#include "make_unique.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+class decompressor
+{
+public:
+    virtual ~decompressor() = default;
+
+    // Decompresses as much of the input as fits the output, finished is set
+    // at the end of the compressed stream.
+    virtual bool decompress(const std::uint8_t* input, std::size_t input_size, std::size_t& input_used,
+        std::uint8_t* output, std::size_t output_size, std::size_t& output_produced, bool& finished)
+        = 0;
+
+    // Prepares for the next stream concatenated to the finished one.
+    virtual bool reset() = 0;
+};
+
+#ifdef OCTNET_TFTP_WITH_ZLIB
+class gzip_decompressor : public decompressor
+{
+public:
+    gzip_decompressor(const gzip_decompressor&) = delete;
+    gzip_decompressor& operator=(const gzip_decompressor&) = delete;
+
+    gzip_decompressor()
+        : m_stream()
+        , m_initialized(false)
+    {
+        // 32 enables gzip and zlib header detection
+        m_initialized = (::inflateInit2(&m_stream, 15 + 32) == Z_OK);
+    }
+
+    ~gzip_decompressor()
+    {
+        if (m_initialized)
+        {
+            ::inflateEnd(&m_stream);
+        }
+    }
+
+    bool decompress(const std::uint8_t* input, std::size_t input_size, std::size_t& input_used,
+        std::uint8_t* output, std::size_t output_size, std::size_t& output_produced, bool& finished) final
+    {
+        if (!m_initialized)
+        {
+            return false;
+        }
+
+        m_stream.next_in = const_cast<Bytef*>(input);
+        m_stream.avail_in = static_cast<uInt>(input_size);
+        m_stream.next_out = output;
+        m_stream.avail_out = static_cast<uInt>(output_size);
+
+        auto rv = ::inflate(&m_stream, Z_NO_FLUSH);
+
+        input_used = input_size - m_stream.avail_in;
+        output_produced = output_size - m_stream.avail_out;
+        finished = (rv == Z_STREAM_END);
+
+        // Z_BUF_ERROR only means no progress was possible
+        return (rv == Z_OK) || (rv == Z_STREAM_END) || (rv == Z_BUF_ERROR);
+    }
+
+    bool reset() final
+    {
+        return m_initialized && (::inflateReset(&m_stream) == Z_OK);
+    }
+
+private:
+    z_stream m_stream;
+    bool m_initialized;
+};
+#endif
+
+#ifdef OCTNET_TFTP_WITH_ZSTD
+class zstd_decompressor : public decompressor
+{
+public:
+    zstd_decompressor(const zstd_decompressor&) = delete;
+    zstd_decompressor& operator=(const zstd_decompressor&) = delete;
+
+    zstd_decompressor()
+        : m_stream(::ZSTD_createDStream())
+    {
+        if (m_stream)
+        {
+            ::ZSTD_initDStream(m_stream);
+        }
+    }
+
+    ~zstd_decompressor()
+    {
+        ::ZSTD_freeDStream(m_stream);
+    }
+
+    bool decompress(const std::uint8_t* input, std::size_t input_size, std::size_t& input_used,
+        std::uint8_t* output, std::size_t output_size, std::size_t& output_produced, bool& finished) final
+    {
+        if (!m_stream)
+        {
+            return false;
+        }
+
+        ZSTD_inBuffer in_buffer = { input, input_size, 0 };
+        ZSTD_outBuffer out_buffer = { output, output_size, 0 };
+
+        auto rv = ::ZSTD_decompressStream(m_stream, &out_buffer, &in_buffer);
+
+        input_used = in_buffer.pos;
+        output_produced = out_buffer.pos;
+        // end of frame, following frames are decoded without reset
+        finished = (rv == 0);
+
+        return ::ZSTD_isError(rv) == 0;
+    }
+
+    bool reset() final
+    {
+        return true;
+    }
+
+private:
+    ZSTD_DStream* m_stream;
+};
+#endif
+
+// Suffixes of compressed files decompressing_reader could read, in order of preference.
+inline std::vector<std::string> get_compressed_suffixes()
+{
+    std::vector<std::string> suffixes;
+#ifdef OCTNET_TFTP_WITH_ZSTD
+    suffixes.push_back(".zst");
+#endif
+#ifdef OCTNET_TFTP_WITH_ZLIB
+    suffixes.push_back(".gz");
+#endif
+    return suffixes;
+}
+
+inline std::unique_ptr<decompressor> create_decompressor(const std::string& suffix)
+{
+#ifdef OCTNET_TFTP_WITH_ZSTD
+    if (suffix == ".zst")
+    {
+        return stdext::make_unique<zstd_decompressor>();
+    }
+#endif
+#ifdef OCTNET_TFTP_WITH_ZLIB
+    if (suffix == ".gz")
+    {
+        return stdext::make_unique<gzip_decompressor>();
+    }
+#endif
+    (void)suffix;
+    return nullptr;
+}
+
+// Decompresses peer reader data. Each read() decompresses directly into the
+// caller buffer, so only a block worth of data is decompressed at a time.
+class decompressing_reader : public reader
+{
+public:
+    static const std::size_t INPUT_BUFFER_SIZE = 16 * 1024;
+
+    // Decompressed size is not stored in the compressed files reliably, it is
+    // reported by get_size() only if given (has_size).
+    decompressing_reader(std::unique_ptr<reader> peer_reader, std::unique_ptr<decompressor> decompressor,
+        bool has_size = false, std::uint64_t size = 0)
+        : m_peer_reader(std::move(peer_reader))
+        , m_decompressor(std::move(decompressor))
+        , m_has_size(has_size)
+        , m_size(size)
+        , m_input(INPUT_BUFFER_SIZE)
+        , m_input_pos(0)
+        , m_input_size(0)
+        , m_input_end(false)
+        , m_stream_finished(false)
+    {
+        // noop
+    }
+
+    bool close() final
+    {
+        return m_peer_reader->close();
+    }
+
+    bool is_open() const final
+    {
+        return m_peer_reader->is_open();
+    }
+
+    bool read(void* buffer, const std::size_t buffer_size, std::size_t& bytes_read) final
+    {
+        bytes_read = 0;
+
+        auto output = reinterpret_cast<std::uint8_t*>(buffer);
+        while (bytes_read < buffer_size)
+        {
+            if ((m_input_pos == m_input_size) && !m_input_end)
+            {
+                if (!fill_input())
+                {
+                    return false;
+                }
+            }
+
+            if (m_stream_finished)
+            {
+                if ((m_input_pos == m_input_size) && m_input_end)
+                {
+                    break;
+                }
+
+                // concatenated stream follows
+                if (!m_decompressor->reset())
+                {
+                    return false;
+                }
+                m_stream_finished = false;
+            }
+
+            if ((m_input_pos == m_input_size) && m_input_end)
+            {
+                // compressed stream truncated
+                return false;
+            }
+
+            std::size_t input_used = 0;
+            std::size_t output_produced = 0;
+            if (!m_decompressor->decompress(m_input.data() + m_input_pos, m_input_size - m_input_pos, input_used,
+                    output + bytes_read, buffer_size - bytes_read, output_produced, m_stream_finished))
+            {
+                return false;
+            }
+
+            m_input_pos += input_used;
+            bytes_read += output_produced;
+        }
+        return true;
+    }
+
+    bool get_size(std::uint64_t& size) final
+    {
+        if (!m_has_size)
+        {
+            return false;
+        }
+
+        size = m_size;
+        return true;
+    }
+
+    bool seek(std::uint64_t /*position*/) final
+    {
+        // would require decompressing the data up to the position
+        return false;
+    }
+
+private:
+    bool fill_input()
+    {
+        std::size_t input_size = 0;
+        if (!m_peer_reader->read(m_input.data(), m_input.size(), input_size))
+        {
+            return false;
+        }
+
+        m_input_pos = 0;
+        m_input_size = input_size;
+        m_input_end = (input_size == 0);
+        return true;
+    }
+
+    std::unique_ptr<reader> m_peer_reader;
+    std::unique_ptr<decompressor> m_decompressor;
+    const bool m_has_size;
+    const std::uint64_t m_size;
+
+    std::vector<std::uint8_t> m_input;
+    std::size_t m_input_pos;
+    std::size_t m_input_size;
+    bool m_input_end;
+    bool m_stream_finished;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -14,6 +14,7 @@ const std::uint16_t OP_WRQ = 2;
 const std::uint16_t OP_DATA = 3;
 const std::uint16_t OP_ACK = 4;
 const std::uint16_t OP_ERROR = 5;
+const std::uint16_t OP_OACK = 6;
 
 const std::uint16_t ERRCODE_UNDEFINED = 0;
 const std::uint16_t ERRCODE_FILE_NOT_FOUND = 1;
@@ -23,6 +24,7 @@ const std::uint16_t ERRCODE_ILLEGAL_OP = 4;
 const std::uint16_t ERRCODE_UNKNOWN_TRANSFER_ID = 5;
 const std::uint16_t ERRCODE_FILE_ALREADY_EXISTS = 6;
 const std::uint16_t ERRCODE_FILE_NO_SUCH_USER = 7;
+const std::uint16_t ERRCODE_OPTION_NEGOTIATION = 8;
 
 const std::uint16_t DEFAULT_TFTP_PORT = 69;
 
@@ -30,11 +32,50 @@ const std::size_t MAX_PACKET_SIZE = 4096;
 
 const std::size_t DEFAULT_DATA_SIZE = 512;
 
+const std::size_t MIN_DATA_SIZE = 8;
+
+const std::size_t MAX_DATA_SIZE = 65464;
+
+const std::uint16_t DEFAULT_WINDOW_SIZE = 1;
+
+const std::uint16_t MAX_WINDOW_SIZE = 65535;
+
+const std::uint16_t DEFAULT_MAX_WINDOW_SIZE = 16;
+
+const std::uint64_t DEFAULT_FILE_CACHE_SIZE = 64 * 1024 * 1024;
+
+const std::uint32_t DEFAULT_PROVIDER_TTL_SEC = 60;
+
+const std::uint32_t DEFAULT_HOT_LIST_INTERVAL_SEC = 300;
+
+const std::uint32_t DEFAULT_DRAIN_TIMEOUT_SEC = 30;
+
+const std::uint32_t CONNECTION_SWEEP_INTERVAL_SEC = 1;
+
+const std::uint64_t DEFAULT_FSYNC_INTERVAL = 8 * 1024 * 1024;
+
+const std::size_t DEFAULT_WRITE_BEHIND_SIZE = 4 * 1024 * 1024;
+
+const std::size_t DEFAULT_PARALLEL_TRANSFERS = 8;
+
 const int DEFAULT_RETRY_TIMEOUT_SEC = 1;
 
+const int MIN_RETRY_TIMEOUT_SEC = 1;
+
+const int MAX_RETRY_TIMEOUT_SEC = 255;
+
 const int DEFAULT_RETRY_COUNTER = 5;
 
-const std::size_t MAX_RECV_PACKET_SIZE = 1024;
+const std::size_t DATA_HEADER_SIZE = 4;
+
+const char* const OPTION_BLKSIZE = "blksize";
+const char* const OPTION_TIMEOUT = "timeout";
+const char* const OPTION_TSIZE = "tsize";
+const char* const OPTION_WINDOWSIZE = "windowsize";
+// transfer starts at the given block, the first block sent is still numbered 1
+const char* const OPTION_OFFSET = "offset";
+// transfer ends after the given number of blocks, with offset gives a range of the file
+const char* const OPTION_COUNT = "count";
 
 } // namespace tftp
 } // namespace net
@@ -1,8 +1,18 @@
 #pragma once
 
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
 #include <cstdio>
+#include <limits>
+#include <memory>
 #include <string>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
 #include "io.hpp"
 
 namespace oct
@@ -23,6 +33,20 @@ public:
         m_handle = std::fopen(path.c_str(), mode.c_str());
     }
 
+    // Takes ownership of the descriptor, negative descriptor gives a closed file.
+    file_wrapper(int fd, const std::string& mode)
+        : m_handle(nullptr)
+    {
+        if (fd >= 0)
+        {
+            m_handle = ::fdopen(fd, mode.c_str());
+            if (!m_handle)
+            {
+                ::close(fd);
+            }
+        }
+    }
+
     ~file_wrapper()
     {
         if (is_open())
@@ -58,59 +82,215 @@ private:
     FILE* m_handle;
 };
 
+// Descriptor of a file read by several readers, closed with the last of them.
+class shared_descriptor
+{
+public:
+    shared_descriptor(const shared_descriptor&) = delete;
+    shared_descriptor& operator=(const shared_descriptor&) = delete;
+
+    // Takes ownership of the descriptor.
+    explicit shared_descriptor(int fd)
+        : m_fd(fd)
+    {
+        // noop
+    }
+
+    ~shared_descriptor()
+    {
+        ::close(m_fd);
+    }
+
+    int get() const
+    {
+        return m_fd;
+    }
+
+private:
+    const int m_fd;
+};
+
+// Reads the descriptor with pread at its own position, a window of blocks is
+// read by a single preadv. Readers of the same file can share the descriptor.
 class file_reader : public reader
 {
 public:
+    file_reader(const file_reader&) = delete;
+    file_reader& operator=(const file_reader&) = delete;
+
     file_reader(const std::string& path)
-        : m_file_wrapper(path, "rb")
+        : m_fd(::open(path.c_str(), O_RDONLY | O_CLOEXEC))
+        , m_position(0)
+        , m_descriptor()
     {
         // noop
     }
 
+    // Takes ownership of the descriptor, negative descriptor gives a closed file.
+    file_reader(int fd)
+        : m_fd(fd)
+        , m_position(0)
+        , m_descriptor()
+    {
+        // noop
+    }
+
+    // Null descriptor gives a closed file.
+    file_reader(std::shared_ptr<const shared_descriptor> descriptor)
+        : m_fd(descriptor ? descriptor->get() : -1)
+        , m_position(0)
+        , m_descriptor(std::move(descriptor))
+    {
+        // noop
+    }
+
+    ~file_reader()
+    {
+        close();
+    }
+
     bool close() final
     {
-        return m_file_wrapper.close();
+        if (m_fd < 0)
+        {
+            return true;
+        }
+
+        // shared descriptor is closed by its last reader
+        bool rv = m_descriptor || (::close(m_fd) == 0);
+        m_descriptor.reset();
+        m_fd = -1;
+        return rv;
     }
 
     bool is_open() const final
     {
-        return m_file_wrapper.is_open();
+        return m_fd >= 0;
     }
 
     bool read(void* buffer, const std::size_t buffer_size, std::size_t& bytes_read) final
     {
-        if (!m_file_wrapper.is_open())
-        {
-            return false;
-        }
+        iovec block = { buffer, buffer_size };
+        return read_vector(&block, 1, bytes_read);
+    }
+
+    bool read_blocks(
+        void* const* buffers, std::size_t blocks_count, std::size_t block_size, std::size_t& bytes_read) final
+    {
+        bytes_read = 0;
 
-        if (buffer_size == 1)
+        iovec blocks[MAX_BLOCKS_PER_READ];
+        while (blocks_count > 0)
         {
-            auto c = std::fgetc(m_file_wrapper.get_handle());
-            if (c != EOF)
+            auto count = std::min(blocks_count, static_cast<std::size_t>(MAX_BLOCKS_PER_READ));
+            for (std::size_t i = 0; i < count; ++i)
             {
-                *(reinterpret_cast<char*>(buffer)) = static_cast<char>(c);
-                bytes_read = 1;
+                blocks[i].iov_base = buffers[i];
+                blocks[i].iov_len = block_size;
             }
-            else
+
+            std::size_t vector_bytes_read = 0;
+            if (!read_vector(blocks, count, vector_bytes_read))
+            {
+                return false;
+            }
+
+            bytes_read += vector_bytes_read;
+            if (vector_bytes_read < count * block_size)
             {
-                bytes_read = 0;
+                break;
             }
+
+            buffers += count;
+            blocks_count -= count;
         }
-        else
+        return true;
+    }
+
+    bool get_size(std::uint64_t& size) final
+    {
+        if (m_fd < 0)
         {
-            bytes_read = std::fread(buffer, 1, buffer_size, m_file_wrapper.get_handle());
+            return false;
         }
 
-        if (std::ferror(m_file_wrapper.get_handle()))
+        struct stat file_stat;
+        if (::fstat(m_fd, &file_stat) != 0)
+        {
+            return false;
+        }
+        if (!S_ISREG(file_stat.st_mode))
         {
             return false;
         }
+
+        size = static_cast<std::uint64_t>(file_stat.st_size);
+        return true;
+    }
+
+    bool seek(std::uint64_t position) final
+    {
+        if ((m_fd < 0) || (position > static_cast<std::uint64_t>(std::numeric_limits<off_t>::max())))
+        {
+            return false;
+        }
+
+        m_position = static_cast<off_t>(position);
         return true;
     }
 
 private:
-    file_wrapper m_file_wrapper;
+    static const std::size_t MAX_BLOCKS_PER_READ = 64;
+
+    // Fills the buffers unless the end of file is reached, the array is modified.
+    bool read_vector(iovec* blocks, std::size_t count, std::size_t& bytes_read)
+    {
+        bytes_read = 0;
+
+        if (m_fd < 0)
+        {
+            return false;
+        }
+
+        while (count > 0)
+        {
+            auto rv = ::preadv(m_fd, blocks, static_cast<int>(count), m_position);
+            if (rv < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            if (rv == 0)
+            {
+                break;
+            }
+
+            auto length = static_cast<std::size_t>(rv);
+            bytes_read += length;
+            m_position += static_cast<off_t>(length);
+
+            // skip what was read, short read is retried
+            while ((count > 0) && (length >= blocks->iov_len))
+            {
+                length -= blocks->iov_len;
+                ++blocks;
+                --count;
+            }
+            if (count > 0)
+            {
+                blocks->iov_base = reinterpret_cast<std::uint8_t*>(blocks->iov_base) + length;
+                blocks->iov_len -= length;
+            }
+        }
+        return true;
+    }
+
+    int m_fd;
+    off_t m_position;
+    std::shared_ptr<const shared_descriptor> m_descriptor;
 };
 
 class file_writer : public writer
@@ -122,6 +302,29 @@ public:
         // noop
     }
 
+    file_writer(int fd)
+        : m_file_wrapper(fd, "wb")
+    {
+        // noop
+    }
+
+    // Keeps the first offset bytes of the file (created if missing), data are written after them.
+    file_writer(const std::string& path, std::uint64_t offset)
+        : m_file_wrapper(::open(path.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0666), "wb")
+    {
+        if (!m_file_wrapper.is_open())
+        {
+            return;
+        }
+
+        if ((offset > static_cast<std::uint64_t>(std::numeric_limits<off_t>::max()))
+            || (::ftruncate(::fileno(m_file_wrapper.get_handle()), static_cast<off_t>(offset)) != 0)
+            || (::fseeko(m_file_wrapper.get_handle(), static_cast<off_t>(offset), SEEK_SET) != 0))
+        {
+            m_file_wrapper.close();
+        }
+    }
+
     bool close() final
     {
         return m_file_wrapper.close();
@@ -151,6 +354,66 @@ private:
     file_wrapper m_file_wrapper;
 };
 
+// Writes a range of a file shared by several writers (e.g. parallel download)
+// with pwrite, so the writers do not share a file position.
+class file_range_writer : public writer
+{
+public:
+    // The descriptor is not owned, it must outlive the writer.
+    file_range_writer(int fd, std::uint64_t offset, std::uint64_t max_size)
+        : m_fd(fd)
+        , m_position(offset)
+        , m_remaining_size(max_size)
+    {
+        // noop
+    }
+
+    bool close() final
+    {
+        m_fd = -1;
+        return true;
+    }
+
+    bool is_open() const final
+    {
+        return m_fd >= 0;
+    }
+
+    bool write(const void* buffer, const std::size_t bytes_count) final
+    {
+        if ((m_fd < 0) || (bytes_count > m_remaining_size))
+        {
+            return false;
+        }
+
+        auto data = reinterpret_cast<const char*>(buffer);
+        auto size = bytes_count;
+        while (size > 0)
+        {
+            auto bytes_written = ::pwrite(m_fd, data, size, static_cast<off_t>(m_position));
+            if (bytes_written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return false;
+            }
+            data += bytes_written;
+            size -= static_cast<std::size_t>(bytes_written);
+            m_position += static_cast<std::uint64_t>(bytes_written);
+        }
+
+        m_remaining_size -= bytes_count;
+        return true;
+    }
+
+private:
+    int m_fd;
+    std::uint64_t m_position;
+    std::uint64_t m_remaining_size;
+};
+
 } // namespace tftp
 } // namespace net
 } // namespace oct
@@ -0,0 +1,188 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Memory of the pending asynchronous operations of the thread, blocks of
+// completed operations are reused by the following ones. A steady transfer
+// allocates no memory for its handlers and an idle one holds only the blocks
+// of its pending operations (a socket wait and a timer wait fit the small
+// ones). Larger operations or blocks beyond the free limit fall back to the
+// heap. A block could be released by another thread than the allocating one
+// (e.g. when an io_context is destroyed), it is kept by the releasing one then.
+class handler_memory
+{
+public:
+    static const std::size_t SMALL_BLOCK_SIZE = 128;
+    static const std::size_t BLOCK_SIZE = 256;
+    static const std::size_t MAX_FREE_BLOCKS = 4096;
+
+    handler_memory(const handler_memory&) = delete;
+    handler_memory& operator=(const handler_memory&) = delete;
+
+    handler_memory()
+        : m_free_small_blocks()
+        , m_free_blocks()
+    {
+        // freed blocks are kept without allocating
+        m_free_small_blocks.reserve(MAX_FREE_BLOCKS);
+        m_free_blocks.reserve(MAX_FREE_BLOCKS);
+    }
+
+    ~handler_memory()
+    {
+        for (auto block : m_free_small_blocks)
+        {
+            ::operator delete(block);
+        }
+        for (auto block : m_free_blocks)
+        {
+            ::operator delete(block);
+        }
+    }
+
+    static handler_memory& get_thread_memory()
+    {
+        static thread_local handler_memory memory;
+        return memory;
+    }
+
+    void* allocate(std::size_t size)
+    {
+        if (size > BLOCK_SIZE)
+        {
+            return ::operator new(size);
+        }
+
+        auto& free_blocks = get_free_blocks(size);
+        if (free_blocks.empty())
+        {
+            return ::operator new((size <= SMALL_BLOCK_SIZE) ? SMALL_BLOCK_SIZE : BLOCK_SIZE);
+        }
+
+        auto block = free_blocks.back();
+        free_blocks.pop_back();
+        return block;
+    }
+
+    void deallocate(void* pointer, std::size_t size)
+    {
+        if ((size > BLOCK_SIZE) || (get_free_blocks(size).size() >= MAX_FREE_BLOCKS))
+        {
+            ::operator delete(pointer);
+            return;
+        }
+        get_free_blocks(size).push_back(pointer);
+    }
+
+private:
+    std::vector<void*>& get_free_blocks(std::size_t size)
+    {
+        return (size <= SMALL_BLOCK_SIZE) ? m_free_small_blocks : m_free_blocks;
+    }
+
+    std::vector<void*> m_free_small_blocks;
+    std::vector<void*> m_free_blocks;
+};
+
+// Allocator of the handler memory, associated with the allocating_handler.
+template <class T>
+class handler_allocator
+{
+public:
+    typedef T value_type;
+
+    handler_allocator() noexcept
+    {
+        // noop
+    }
+
+    template <class U>
+    handler_allocator(const handler_allocator<U>& /*other*/) noexcept
+    {
+        // noop
+    }
+
+    T* allocate(std::size_t n) const
+    {
+        return static_cast<T*>(handler_memory::get_thread_memory().allocate(sizeof(T) * n));
+    }
+
+    void deallocate(T* pointer, std::size_t n) const
+    {
+        handler_memory::get_thread_memory().deallocate(pointer, sizeof(T) * n);
+    }
+
+    bool operator==(const handler_allocator& /*other*/) const noexcept
+    {
+        return true;
+    }
+
+    bool operator!=(const handler_allocator& /*other*/) const noexcept
+    {
+        return false;
+    }
+};
+
+// Handler whose operation is allocated in the handler memory: by the associated
+// allocator, or by the allocation hooks of the asio versions using them.
+template <class handler_T>
+class allocating_handler
+{
+public:
+    typedef handler_allocator<handler_T> allocator_type;
+
+    allocating_handler(handler_T handler)
+        : m_handler(std::move(handler))
+    {
+        // noop
+    }
+
+    allocator_type get_allocator() const noexcept
+    {
+        return allocator_type();
+    }
+
+    template <class... args_T>
+    void operator()(args_T&&... args)
+    {
+        m_handler(std::forward<args_T>(args)...);
+    }
+
+#if !defined(ASIO_NO_DEPRECATED) || (ASIO_VERSION < 101700)
+    friend void* asio_handler_allocate(std::size_t size, allocating_handler* /*handler*/)
+    {
+        return handler_memory::get_thread_memory().allocate(size);
+    }
+
+    friend void asio_handler_deallocate(void* pointer, std::size_t size, allocating_handler* /*handler*/)
+    {
+        handler_memory::get_thread_memory().deallocate(pointer, size);
+    }
+#endif
+
+private:
+    handler_T m_handler;
+};
+
+template <class handler_T>
+allocating_handler<typename std::decay<handler_T>::type> make_allocating_handler(handler_T&& handler)
+{
+    return allocating_handler<typename std::decay<handler_T>::type>(std::forward<handler_T>(handler));
+}
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
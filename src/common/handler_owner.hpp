@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <utility>
+
+#include <asio.hpp>
+
+#include "handler_allocator.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Base of objects referenced by their handlers by a raw pointer. Pending
+// handlers are counted, once the object is finished and none of them is
+// pending or running, release() lets the owner destroy it. Used only from the
+// thread running the handlers.
+class handler_owner
+{
+public:
+    handler_owner(const handler_owner&) = delete;
+    handler_owner& operator=(const handler_owner&) = delete;
+
+    handler_owner()
+        : m_pending_count(0)
+        , m_running_count(0)
+        , m_finished(false)
+    {
+        // noop
+    }
+
+    virtual ~handler_owner() = default;
+
+    bool is_finished() const
+    {
+        return m_finished;
+    }
+
+protected:
+    template <class handler_T>
+    class tracked_handler
+    {
+    public:
+        tracked_handler(handler_owner& owner, handler_T handler)
+            : m_owner(&owner)
+            , m_handler(std::move(handler))
+        {
+            // noop
+        }
+
+        template <class... args_T>
+        void operator()(args_T&&... args)
+        {
+            auto owner = m_owner;
+            --owner->m_pending_count;
+            ++owner->m_running_count;
+            m_handler(std::forward<args_T>(args)...);
+            --owner->m_running_count;
+            // owner could be destroyed by the call
+            owner->release_if_done();
+        }
+
+    private:
+        handler_owner* m_owner;
+        handler_T m_handler;
+    };
+
+    // Handler of one asynchronous operation, allocated in the handler memory of the thread.
+    template <class handler_T>
+    allocating_handler<tracked_handler<handler_T>> track(handler_T handler)
+    {
+        ++m_pending_count;
+        return allocating_handler<tracked_handler<handler_T>>(tracked_handler<handler_T>(*this, std::move(handler)));
+    }
+
+    // Handler completing an operation run by another thread (e.g. a background
+    // job), posted to the io_context as a tracked one. Called exactly once, the
+    // io_context does not run out of work meanwhile.
+    template <class handler_T>
+    std::function<void(bool)> track_posted(asio::io_context& io_context, handler_T handler)
+    {
+        auto tracked = track(std::move(handler));
+        auto work = asio::make_work_guard(io_context);
+        return [work, tracked](bool result) { asio::post(work.get_executor(), std::bind(tracked, result)); };
+    }
+
+    // Operation not completed by a tracked handler (e.g. run by another handler owner).
+    void operation_started()
+    {
+        ++m_pending_count;
+    }
+
+    void operation_completed()
+    {
+        --m_pending_count;
+        release_if_done();
+    }
+
+    // Object is released when the pending handlers complete, immediately if
+    // called outside of a handler with none pending.
+    void finish()
+    {
+        m_finished = true;
+        release_if_done();
+    }
+
+    // Called once, the object must not be used by the owner after the call.
+    virtual void release() = 0;
+
+private:
+    void release_if_done()
+    {
+        if (m_finished && (m_pending_count == 0) && (m_running_count == 0))
+        {
+            m_running_count = 1;
+            release();
+        }
+    }
+
+    std::size_t m_pending_count;
+    std::size_t m_running_count;
+    bool m_finished;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -1,6 +1,9 @@
 #pragma once
 
+#include <cstdint>
 #include <cstdio>
+#include <functional>
+#include <memory>
 #include <string>
 
 namespace oct
@@ -17,7 +20,34 @@ public:
 
     virtual bool is_open() const = 0;
     virtual bool read(void* buffer, const std::size_t buffer_size, std::size_t& bytes_read) = 0;
+    virtual bool get_size(std::uint64_t& size) = 0;
+    // Sets the position of the next read, false if not supported.
+    virtual bool seek(std::uint64_t position) = 0;
     virtual bool close() = 0;
+
+    // Reads consecutive blocks of block_size bytes, one into each buffer, bytes_read
+    // is their total. Only the end of data stops it early. Readers able to fill all
+    // the buffers at once (e.g. with preadv) override the per block fallback.
+    virtual bool read_blocks(
+        void* const* buffers, std::size_t blocks_count, std::size_t block_size, std::size_t& bytes_read)
+    {
+        bytes_read = 0;
+        for (std::size_t i = 0; i < blocks_count; ++i)
+        {
+            std::size_t block_bytes_read = 0;
+            if (!read(buffers[i], block_size, block_bytes_read))
+            {
+                return false;
+            }
+
+            bytes_read += block_bytes_read;
+            if (block_bytes_read < block_size)
+            {
+                break;
+            }
+        }
+        return true;
+    }
 };
 
 class writer
@@ -28,8 +58,51 @@ public:
     virtual bool is_open() const = 0;
     virtual bool write(const void* buffer, const std::size_t bytes_count) = 0;
     virtual bool close() = 0;
+
+    // Writers completing the writes in the background (e.g. write_behind_writer)
+    // are not ready while their memory is full, the caller stops receiving data
+    // then. The handlers are called once, either immediately or by a background
+    // thread, so they only post the completion to the caller's thread.
+
+    virtual bool is_ready() const
+    {
+        return true;
+    }
+
+    // Handler gets false if the writer failed.
+    virtual void async_wait_ready(std::function<void(bool)> handler)
+    {
+        handler(true);
+    }
+
+    // As close(), the handler gets its result.
+    virtual void async_close(std::function<void(bool)> handler)
+    {
+        handler(close());
+    }
 };
 
+// Peer of a composed reader or writer (e.g. netascii_encoder<memory_reader>).
+// Held by value its calls are resolved at compile time, held by pointer it is
+// chosen at run time.
+template <class peer_T>
+peer_T& peer_of(peer_T& peer)
+{
+    return peer;
+}
+
+template <class peer_T>
+peer_T& peer_of(std::unique_ptr<peer_T>& peer)
+{
+    return *peer;
+}
+
+template <class peer_T>
+const peer_T& peer_of(const std::unique_ptr<peer_T>& peer)
+{
+    return *peer;
+}
+
 } // namespace tftp
 } // namespace net
 } // namespace oct
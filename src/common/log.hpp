@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <iostream>
+#include <string>
+
+#include "string_utils.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+enum class log_level
+{
+    ERROR,
+    WARNING,
+    INFO,
+    DEBUG,
+};
+
+class logger
+{
+public:
+    static void set_level(log_level level)
+    {
+        get_level_storage().store(static_cast<int>(level), std::memory_order_relaxed);
+    }
+
+    static log_level get_level()
+    {
+        return static_cast<log_level>(get_level_storage().load(std::memory_order_relaxed));
+    }
+
+    static bool is_enabled(log_level level)
+    {
+        return static_cast<int>(level) <= get_level_storage().load(std::memory_order_relaxed);
+    }
+
+    static std::ostream& get_stream(log_level level)
+    {
+        if (!is_enabled(level))
+        {
+            // stream without buffer is always in bad state, so nothing is formatted
+            static thread_local std::ostream null_stream(nullptr);
+            return null_stream;
+        }
+
+        return (level <= log_level::WARNING) ? std::cerr : std::cout;
+    }
+
+    static bool parse_level(const std::string& name, log_level& level)
+    {
+        if (equal_ignore_case(name, "error"))
+        {
+            level = log_level::ERROR;
+        }
+        else if (equal_ignore_case(name, "warning"))
+        {
+            level = log_level::WARNING;
+        }
+        else if (equal_ignore_case(name, "info"))
+        {
+            level = log_level::INFO;
+        }
+        else if (equal_ignore_case(name, "debug"))
+        {
+            level = log_level::DEBUG;
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+
+private:
+    static std::atomic<int>& get_level_storage()
+    {
+        static std::atomic<int> level(static_cast<int>(log_level::INFO));
+        return level;
+    }
+};
+
+inline std::ostream& log_error()
+{
+    return logger::get_stream(log_level::ERROR);
+}
+
+inline std::ostream& log_warning()
+{
+    return logger::get_stream(log_level::WARNING);
+}
+
+inline std::ostream& log_info()
+{
+    return logger::get_stream(log_level::INFO);
+}
+
+inline std::ostream& log_debug()
+{
+    return logger::get_stream(log_level::DEBUG);
+}
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
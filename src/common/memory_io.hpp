@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "io.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Reads from a shared, immutable buffer (e.g. a file cache entry).
+class memory_reader : public reader
+{
+public:
+    memory_reader(std::shared_ptr<const std::vector<std::uint8_t>> content)
+        : m_owner(content)
+        , m_data(content ? content->data() : nullptr)
+        , m_size(content ? content->size() : 0)
+        , m_position(0)
+    {
+        // noop
+    }
+
+    // Reads size bytes at data, kept valid by the owner (e.g. a mapped file).
+    memory_reader(std::shared_ptr<const void> owner, const std::uint8_t* data, std::size_t size)
+        : m_owner(owner)
+        , m_data(data)
+        , m_size(size)
+        , m_position(0)
+    {
+        // noop
+    }
+
+    bool close() final
+    {
+        m_owner.reset();
+        return true;
+    }
+
+    bool is_open() const final
+    {
+        return m_owner != nullptr;
+    }
+
+    bool read(void* buffer, const std::size_t buffer_size, std::size_t& bytes_read) final
+    {
+        if (!m_owner)
+        {
+            return false;
+        }
+
+        bytes_read = std::min(buffer_size, m_size - m_position);
+        if (bytes_read > 0)
+        {
+            std::memcpy(buffer, m_data + m_position, bytes_read);
+            m_position += bytes_read;
+        }
+        return true;
+    }
+
+    bool read_blocks(
+        void* const* buffers, std::size_t blocks_count, std::size_t block_size, std::size_t& bytes_read) final
+    {
+        if (!m_owner)
+        {
+            return false;
+        }
+
+        bytes_read = 0;
+        for (std::size_t i = 0; (i < blocks_count) && (m_position < m_size); ++i)
+        {
+            auto length = std::min(block_size, m_size - m_position);
+            std::memcpy(buffers[i], m_data + m_position, length);
+            m_position += length;
+            bytes_read += length;
+        }
+        return true;
+    }
+
+    bool get_size(std::uint64_t& size) final
+    {
+        if (!m_owner)
+        {
+            return false;
+        }
+
+        size = m_size;
+        return true;
+    }
+
+    bool seek(std::uint64_t position) final
+    {
+        if (!m_owner)
+        {
+            return false;
+        }
+
+        m_position = static_cast<std::size_t>(std::min<std::uint64_t>(position, m_size));
+        return true;
+    }
+
+private:
+    std::shared_ptr<const void> m_owner;
+    const std::uint8_t* m_data;
+    std::size_t m_size;
+    std::size_t m_position;
+};
+
+// Growable buffer of fixed size chunks, appended data are never moved.
+class chunked_buffer
+{
+public:
+    static const std::size_t DEFAULT_CHUNK_SIZE = 64 * 1024;
+
+    chunked_buffer(std::size_t chunk_size = DEFAULT_CHUNK_SIZE)
+        : m_chunk_size(std::max<std::size_t>(chunk_size, 1))
+        , m_size(0)
+    {
+        // noop
+    }
+
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+    void append(const void* data, std::size_t size)
+    {
+        auto input = reinterpret_cast<const std::uint8_t*>(data);
+        while (size > 0)
+        {
+            auto chunk_pos = m_size % m_chunk_size;
+            if ((chunk_pos == 0) && (m_size / m_chunk_size == m_chunks.size()))
+            {
+                m_chunks.emplace_back(new std::uint8_t[m_chunk_size]);
+            }
+
+            auto length = std::min(size, m_chunk_size - chunk_pos);
+            std::memcpy(m_chunks[m_size / m_chunk_size].get() + chunk_pos, input, length);
+
+            input += length;
+            size -= length;
+            m_size += length;
+        }
+    }
+
+    // Copies up to size bytes from the position, returns the number of bytes copied.
+    std::size_t copy(std::size_t position, void* buffer, std::size_t size) const
+    {
+        auto output = reinterpret_cast<std::uint8_t*>(buffer);
+        std::size_t copied = 0;
+        while ((copied < size) && (position < m_size))
+        {
+            auto chunk_pos = position % m_chunk_size;
+            auto length = std::min({ size - copied, m_chunk_size - chunk_pos, m_size - position });
+            std::memcpy(output + copied, m_chunks[position / m_chunk_size].get() + chunk_pos, length);
+
+            copied += length;
+            position += length;
+        }
+        return copied;
+    }
+
+    std::vector<std::uint8_t> to_vector() const
+    {
+        std::vector<std::uint8_t> content(m_size);
+        copy(0, content.data(), content.size());
+        return content;
+    }
+
+    void clear()
+    {
+        m_chunks.clear();
+        m_size = 0;
+    }
+
+private:
+    const std::size_t m_chunk_size;
+    std::vector<std::unique_ptr<std::uint8_t[]>> m_chunks;
+    std::size_t m_size;
+};
+
+// Writes to a chunked buffer. The content is passed to the commit handler on
+// close, e.g. to publish an upload, failing the close if the handler does.
+class memory_writer : public writer
+{
+public:
+    typedef std::function<bool(const chunked_buffer& content)> commit_handler;
+
+    memory_writer(commit_handler handler = nullptr, std::size_t max_size = std::numeric_limits<std::size_t>::max())
+        : m_content(new chunked_buffer())
+        , m_commit_handler(std::move(handler))
+        , m_max_size(max_size)
+    {
+        // noop
+    }
+
+    bool close() final
+    {
+        if (!m_content)
+        {
+            return false;
+        }
+
+        bool success = !m_commit_handler || m_commit_handler(*m_content);
+        m_content.reset();
+        return success;
+    }
+
+    bool is_open() const final
+    {
+        return m_content != nullptr;
+    }
+
+    bool write(const void* buffer, const std::size_t bytes_count) final
+    {
+        if (!m_content || (bytes_count > m_max_size - m_content->size()))
+        {
+            return false;
+        }
+
+        m_content->append(buffer, bytes_count);
+        return true;
+    }
+
+    // Content written so far, null once closed.
+    const chunked_buffer* get_content() const
+    {
+        return m_content.get();
+    }
+
+private:
+    std::unique_ptr<chunked_buffer> m_content;
+    commit_handler m_commit_handler;
+    const std::size_t m_max_size;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
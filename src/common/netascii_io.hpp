@@ -1,5 +1,11 @@
 #pragma once
 
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <vector>
+
 #include "io.hpp"
 #include "make_unique.hpp"
 
@@ -10,197 +16,234 @@ namespace net
 namespace tftp
 {
 
-class netascii_reader : public reader
+// Encodes the content of the source to netascii, a line end becomes CR LF and
+// a bare CR becomes CR NUL. The source is held by value (e.g. memory_reader)
+// so the chunk reads are direct calls, see also netascii_reader.
+template <class source_T>
+class netascii_encoder : public reader
 {
 public:
-    netascii_reader(std::unique_ptr<reader> peer_reader)
-        : m_peer_reader(std::move(peer_reader))
+    static const std::size_t INPUT_BUFFER_SIZE = 4096;
+
+    template <class... args_T>
+    explicit netascii_encoder(args_T&&... args)
+        : m_source(std::forward<args_T>(args)...)
         , m_pending_char(0)
+        , m_input(INPUT_BUFFER_SIZE)
+        , m_input_pos(0)
+        , m_input_size(0)
     {
         // noop
     }
 
     bool close() final
     {
-        return m_peer_reader->close();
+        return peer_of(m_source).close();
     }
 
     bool is_open() const final
     {
-        return m_peer_reader->is_open();
+        return peer_of(m_source).is_open();
     }
 
     bool read(void* buffer, const std::size_t buffer_size, std::size_t& bytes_read) final
     {
         bytes_read = 0;
 
-        auto buffer_ptr = reinterpret_cast<char*>(buffer);
-        for (std::size_t i = 0; i < buffer_size; ++i)
+        auto output = reinterpret_cast<char*>(buffer);
+        while (bytes_read < buffer_size)
         {
-            char c;
-            int rv = read_char(c);
-            if (rv > 0)
+            if (m_pending_char != 0)
             {
-                *buffer_ptr++ = c;
-                ++bytes_read;
+                // second char of the CR LF or CR NUL pair
+                output[bytes_read++] = (m_pending_char == '\n') ? '\n' : '\0';
+                m_pending_char = 0;
+                continue;
+            }
+
+            if (m_input_pos == m_input_size)
+            {
+                // source is read in chunks, not a char at a time
+                std::size_t chars_read = 0;
+                if (!peer_of(m_source).read(m_input.data(), m_input.size(), chars_read))
+                {
+                    return false;
+                }
+                if (chars_read == 0)
+                {
+                    break;
+                }
+
+                m_input_pos = 0;
+                m_input_size = chars_read;
             }
-            else if (rv == 0)
+
+            // chars up to the next CR or LF are copied unchanged
+            auto input = m_input.data() + m_input_pos;
+            auto length = std::min(m_input_size - m_input_pos, buffer_size - bytes_read);
+            std::size_t run = 0;
+            while ((run < length) && (input[run] != '\n') && (input[run] != '\r'))
             {
-                break;
+                ++run;
             }
-            else
+            std::memcpy(output + bytes_read, input, run);
+            bytes_read += run;
+            m_input_pos += run;
+
+            if (run < length)
             {
-                return false;
+                m_pending_char = input[run];
+                output[bytes_read++] = '\r';
+                ++m_input_pos;
             }
         }
         return true;
     }
 
-private:
-    int read_char(char& c)
+    bool get_size(std::uint64_t& /*size*/) final
     {
-        if (m_pending_char == '\n')
-        {
-            c = '\n';
-            m_pending_char = 0;
-            return 1;
-        }
-
-        if (m_pending_char == '\r')
-        {
-            c = '\0';
-            m_pending_char = 0;
-            return 1;
-        }
-
-        std::size_t chars_read = 0;
-
-        if (!m_peer_reader->read(&c, 1, chars_read))
-        {
-            return false;
-        }
+        // size after conversion is not known without reading whole file
+        return false;
+    }
 
-        if (chars_read == 1)
-        {
-            if ((c == '\n') || (c == '\r'))
-            {
-                m_pending_char = c;
-                c = '\r';
-            }
-            return 1;
-        }
-        else if (chars_read == 0)
-        {
-            return 0;
-        }
-        else
-        {
-            // should not happen, report error
-            return -1;
-        }
+    bool seek(std::uint64_t /*position*/) final
+    {
+        // position after conversion is not known without reading whole file
+        return false;
     }
 
-    std::unique_ptr<reader> m_peer_reader;
+private:
+    source_T m_source;
     char m_pending_char;
+
+    std::vector<char> m_input;
+    std::size_t m_input_pos;
+    std::size_t m_input_size;
 };
 
-class netascii_writer : public writer
+// Decodes netascii written to the sink, CR LF becomes a line end and CR NUL a
+// bare CR. A block is decoded into a buffer written to the sink at once.
+template <class sink_T>
+class netascii_decoder : public writer
 {
 public:
-    netascii_writer(std::unique_ptr<writer> peer_writer)
-        : m_peer_writer(std::move(peer_writer))
+    template <class... args_T>
+    explicit netascii_decoder(args_T&&... args)
+        : m_sink(std::forward<args_T>(args)...)
         , m_pending_cr(false)
+        , m_output()
     {
         // noop
     }
 
     bool close() final
     {
-        bool rv = true;
+        bool rv = write_pending_cr();
+        rv &= peer_of(m_sink).close();
 
-        if (m_pending_cr)
+        return rv;
+    }
+
+    void async_close(std::function<void(bool)> handler) final
+    {
+        if (!write_pending_cr())
         {
-            rv &= write_cr();
+            handler(false);
+            return;
         }
 
-        rv &= m_peer_writer->close();
+        peer_of(m_sink).async_close(std::move(handler));
+    }
 
-        return rv;
+    bool is_ready() const final
+    {
+        return peer_of(m_sink).is_ready();
+    }
+
+    void async_wait_ready(std::function<void(bool)> handler) final
+    {
+        peer_of(m_sink).async_wait_ready(std::move(handler));
     }
 
     bool is_open() const final
     {
-        return m_peer_writer->is_open();
+        return peer_of(m_sink).is_open();
     }
 
     bool write(const void* buffer, const std::size_t bytes_count) final
     {
-        auto buffer_ptr = reinterpret_cast<const char*>(buffer);
-        for (std::size_t i = 0; i < bytes_count; ++i)
+        // output is longer than the input at most by a CR pending from the previous write
+        if (m_output.size() < bytes_count + 1)
         {
-            char curr_char = *buffer_ptr++;
+            m_output.resize(bytes_count + 1);
+        }
 
-            if (curr_char == '\r')
+        auto input = reinterpret_cast<const char*>(buffer);
+        auto input_end = input + bytes_count;
+        auto output = m_output.data();
+        std::size_t size = 0;
+        while (input < input_end)
+        {
+            if (m_pending_cr)
             {
-                if (m_pending_cr)
+                m_pending_cr = false;
+                if (*input == '\n')
                 {
-                    // cr cr, write the pending one
-                    if (!write_cr())
-                    {
-                        return false;
-                    }
+                    // cr lf -> lf
+                    output[size++] = *input++;
+                    continue;
                 }
-                m_pending_cr = true;
-
-                // pending '\r'
-                continue;
-            }
 
-            if (curr_char == '\n')
-            {
-                // if CR pending then silently skip it
-                m_pending_cr = false;
-
-                // write the '\n'
-            }
-            else if (curr_char == '\0')
-            {
-                if (m_pending_cr)
+                output[size++] = '\r';
+                if (*input == '\0')
                 {
                     // cr 0 -> cr
-                    if (!write_cr())
-                    {
-                        return false;
-                    }
-                    m_pending_cr = false;
-
-                    // \r written, skip the '\0'
+                    ++input;
                     continue;
                 }
-
-                // write the \0', not related to '\r'
             }
 
-            // write the char
-            if (!m_peer_writer->write(&curr_char, 1))
+            // chars up to the next CR are written unchanged
+            auto cr = reinterpret_cast<const char*>(std::memchr(input, '\r', input_end - input));
+            auto run_end = cr ? cr : input_end;
+            std::memcpy(output + size, input, run_end - input);
+            size += run_end - input;
+            input = run_end;
+
+            if (cr)
             {
-                return false;
+                m_pending_cr = true;
+                ++input;
             }
         }
-        return true;
+
+        return (size == 0) || peer_of(m_sink).write(output, size);
     }
 
 private:
-    bool write_cr()
+    // CR ending the data is written as it is
+    bool write_pending_cr()
     {
+        if (!m_pending_cr)
+        {
+            return true;
+        }
+
+        m_pending_cr = false;
         const char cr = '\r';
-        return m_peer_writer->write(&cr, 1);
+        return peer_of(m_sink).write(&cr, 1);
     }
 
-    std::unique_ptr<writer> m_peer_writer;
+    sink_T m_sink;
     bool m_pending_cr;
+
+    std::vector<char> m_output;
 };
 
+// Netascii over a peer chosen at run time.
+typedef netascii_encoder<std::unique_ptr<reader>> netascii_reader;
+typedef netascii_decoder<std::unique_ptr<writer>> netascii_writer;
+
 } // namespace tftp
 } // namespace net
 } // namespace oct
@@ -0,0 +1,402 @@
+#pragma once
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Read-only pack of files, all numbers are little endian:
+//
+//   header      magic, version, counts and offsets of the sections below
+//   buckets     buckets_count + 1 entry indices, entries of bucket B are
+//               [buckets[B], buckets[B + 1]), B = path hash % buckets_count
+//   entries     path hash, path, offsets and sizes of the file data and of
+//               its optional pre-encoded netascii variant, sorted by bucket
+//   strings     paths, normalized as the requested filenames
+//   data        file data, each aligned to ALIGNMENT
+namespace pack_format
+{
+
+const char MAGIC[8] = { 'O', 'C', 'T', 'P', 'A', 'C', 'K', '\0' };
+const std::uint32_t VERSION = 1;
+const std::uint64_t ALIGNMENT = 4096;
+
+const std::size_t HEADER_SIZE = 64;
+const std::size_t ENTRY_SIZE = 56;
+const std::size_t BUCKET_SIZE = 8;
+
+const std::uint32_t ENTRY_FLAG_NETASCII = 0x1;
+
+struct header
+{
+    header()
+        : m_version(VERSION)
+        , m_alignment(static_cast<std::uint32_t>(ALIGNMENT))
+        , m_entries_count(0)
+        , m_buckets_count(0)
+        , m_buckets_offset(0)
+        , m_entries_offset(0)
+        , m_strings_offset(0)
+        , m_strings_size(0)
+    {
+        // noop
+    }
+
+    std::uint32_t m_version;
+    std::uint32_t m_alignment;
+    std::uint64_t m_entries_count;
+    std::uint64_t m_buckets_count;
+    std::uint64_t m_buckets_offset;
+    std::uint64_t m_entries_offset;
+    std::uint64_t m_strings_offset;
+    std::uint64_t m_strings_size;
+};
+
+struct entry
+{
+    entry()
+        : m_hash(0)
+        , m_path_offset(0)
+        , m_path_size(0)
+        , m_flags(0)
+        , m_data_offset(0)
+        , m_data_size(0)
+        , m_netascii_offset(0)
+        , m_netascii_size(0)
+    {
+        // noop
+    }
+
+    std::uint64_t m_hash;
+    std::uint64_t m_path_offset;
+    std::uint32_t m_path_size;
+    std::uint32_t m_flags;
+    std::uint64_t m_data_offset;
+    std::uint64_t m_data_size;
+    std::uint64_t m_netascii_offset;
+    std::uint64_t m_netascii_size;
+};
+
+// FNV-1a
+inline std::uint64_t hash_path(const char* path, std::size_t size)
+{
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        hash ^= static_cast<std::uint8_t>(path[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+inline std::uint64_t load_uint(const std::uint8_t* data, std::size_t size)
+{
+    std::uint64_t value = 0;
+    for (std::size_t i = size; i > 0; --i)
+    {
+        value = (value << 8) | data[i - 1];
+    }
+    return value;
+}
+
+inline void store_uint(std::uint8_t* data, std::uint64_t value, std::size_t size)
+{
+    for (std::size_t i = 0; i < size; ++i)
+    {
+        data[i] = static_cast<std::uint8_t>(value >> (8 * i));
+    }
+}
+
+inline void encode_header(const header& pack_header, std::uint8_t* data)
+{
+    std::memset(data, 0, HEADER_SIZE);
+    std::memcpy(data, MAGIC, sizeof(MAGIC));
+    store_uint(data + 8, pack_header.m_version, 4);
+    store_uint(data + 12, pack_header.m_alignment, 4);
+    store_uint(data + 16, pack_header.m_entries_count, 8);
+    store_uint(data + 24, pack_header.m_buckets_count, 8);
+    store_uint(data + 32, pack_header.m_buckets_offset, 8);
+    store_uint(data + 40, pack_header.m_entries_offset, 8);
+    store_uint(data + 48, pack_header.m_strings_offset, 8);
+    store_uint(data + 56, pack_header.m_strings_size, 8);
+}
+
+inline bool decode_header(const std::uint8_t* data, header& pack_header)
+{
+    if (std::memcmp(data, MAGIC, sizeof(MAGIC)) != 0)
+    {
+        return false;
+    }
+
+    pack_header.m_version = static_cast<std::uint32_t>(load_uint(data + 8, 4));
+    pack_header.m_alignment = static_cast<std::uint32_t>(load_uint(data + 12, 4));
+    pack_header.m_entries_count = load_uint(data + 16, 8);
+    pack_header.m_buckets_count = load_uint(data + 24, 8);
+    pack_header.m_buckets_offset = load_uint(data + 32, 8);
+    pack_header.m_entries_offset = load_uint(data + 40, 8);
+    pack_header.m_strings_offset = load_uint(data + 48, 8);
+    pack_header.m_strings_size = load_uint(data + 56, 8);
+    return pack_header.m_version == VERSION;
+}
+
+inline void encode_entry(const entry& pack_entry, std::uint8_t* data)
+{
+    store_uint(data, pack_entry.m_hash, 8);
+    store_uint(data + 8, pack_entry.m_path_offset, 8);
+    store_uint(data + 16, pack_entry.m_path_size, 4);
+    store_uint(data + 20, pack_entry.m_flags, 4);
+    store_uint(data + 24, pack_entry.m_data_offset, 8);
+    store_uint(data + 32, pack_entry.m_data_size, 8);
+    store_uint(data + 40, pack_entry.m_netascii_offset, 8);
+    store_uint(data + 48, pack_entry.m_netascii_size, 8);
+}
+
+inline void decode_entry(const std::uint8_t* data, entry& pack_entry)
+{
+    pack_entry.m_hash = load_uint(data, 8);
+    pack_entry.m_path_offset = load_uint(data + 8, 8);
+    pack_entry.m_path_size = static_cast<std::uint32_t>(load_uint(data + 16, 4));
+    pack_entry.m_flags = static_cast<std::uint32_t>(load_uint(data + 20, 4));
+    pack_entry.m_data_offset = load_uint(data + 24, 8);
+    pack_entry.m_data_size = load_uint(data + 32, 8);
+    pack_entry.m_netascii_offset = load_uint(data + 40, 8);
+    pack_entry.m_netascii_size = load_uint(data + 48, 8);
+}
+
+} // namespace pack_format
+
+// Pack mapped into memory, a lookup is a single bucket probe. The pack must be
+// replaced by rename, not rewritten in place, while mapped.
+class pack_archive
+{
+public:
+    pack_archive(const pack_archive&) = delete;
+    pack_archive& operator=(const pack_archive&) = delete;
+
+    pack_archive()
+        : m_mapping()
+        , m_data(nullptr)
+        , m_size(0)
+        , m_header()
+    {
+        // noop
+    }
+
+    static bool is_pack(const std::string& path)
+    {
+        char magic[sizeof(pack_format::MAGIC)];
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return false;
+        }
+        bool rv = (::read(fd, magic, sizeof(magic)) == static_cast<ssize_t>(sizeof(magic)))
+            && (std::memcmp(magic, pack_format::MAGIC, sizeof(magic)) == 0);
+        ::close(fd);
+        return rv;
+    }
+
+    // Maps the pack and validates its index, false with errno set on I/O errors
+    // (EINVAL for an invalid pack).
+    bool open(const std::string& path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        struct stat pack_stat;
+        if ((::fstat(fd, &pack_stat) != 0) || !S_ISREG(pack_stat.st_mode)
+            || (static_cast<std::uint64_t>(pack_stat.st_size) < pack_format::HEADER_SIZE)
+            || (static_cast<std::uint64_t>(pack_stat.st_size) > std::numeric_limits<std::size_t>::max()))
+        {
+            ::close(fd);
+            errno = EINVAL;
+            return false;
+        }
+
+        auto size = static_cast<std::size_t>(pack_stat.st_size);
+        void* address = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (address == MAP_FAILED)
+        {
+            return false;
+        }
+
+        m_mapping = std::shared_ptr<const void>(address, [size](const void* mapped) {
+            ::munmap(const_cast<void*>(mapped), size);
+        });
+        m_data = reinterpret_cast<const std::uint8_t*>(address);
+        m_size = size;
+
+        if (!validate())
+        {
+            m_mapping.reset();
+            m_data = nullptr;
+            m_size = 0;
+            errno = EINVAL;
+            return false;
+        }
+        return true;
+    }
+
+    std::uint64_t get_files_count() const
+    {
+        return m_header.m_entries_count;
+    }
+
+    std::uint64_t get_size() const
+    {
+        return m_size;
+    }
+
+    // Keeps the mapping, and the data found, valid.
+    std::shared_ptr<const void> get_owner() const
+    {
+        return m_mapping;
+    }
+
+    // Path must be normalized. The netascii variant is returned only if stored.
+    bool find(const std::string& path, bool netascii, const std::uint8_t*& data, std::size_t& size) const
+    {
+        if (!m_data)
+        {
+            return false;
+        }
+
+        auto hash = pack_format::hash_path(path.data(), path.size());
+        auto bucket = hash % m_header.m_buckets_count;
+        auto first = get_bucket(bucket);
+        auto last = get_bucket(bucket + 1);
+
+        pack_format::entry entry;
+        for (auto index = first; index < last; ++index)
+        {
+            pack_format::decode_entry(get_entry_data(index), entry);
+            if ((entry.m_hash != hash) || (entry.m_path_size != path.size())
+                || (std::memcmp(m_data + m_header.m_strings_offset + entry.m_path_offset, path.data(), path.size())
+                    != 0))
+            {
+                continue;
+            }
+
+            if (netascii)
+            {
+                if (!(entry.m_flags & pack_format::ENTRY_FLAG_NETASCII))
+                {
+                    return false;
+                }
+                data = m_data + entry.m_netascii_offset;
+                size = static_cast<std::size_t>(entry.m_netascii_size);
+                return true;
+            }
+
+            data = m_data + entry.m_data_offset;
+            size = static_cast<std::size_t>(entry.m_data_size);
+            return true;
+        }
+        return false;
+    }
+
+    // Hints the kernel to read the range of the mapping ahead.
+    void advise_will_need(const std::uint8_t* data, std::size_t size) const
+    {
+        auto page_size = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        auto page_offset = static_cast<std::size_t>(data - m_data) % page_size;
+        ::madvise(const_cast<std::uint8_t*>(data - page_offset), size + page_offset, MADV_WILLNEED);
+    }
+
+    // Path must be normalized, true if stored in the pack.
+    bool contains(const std::string& path) const
+    {
+        const std::uint8_t* data = nullptr;
+        std::size_t size = 0;
+        return find(path, false, data, size);
+    }
+
+private:
+    std::uint64_t get_bucket(std::uint64_t index) const
+    {
+        return pack_format::load_uint(
+            m_data + m_header.m_buckets_offset + index * pack_format::BUCKET_SIZE, pack_format::BUCKET_SIZE);
+    }
+
+    const std::uint8_t* get_entry_data(std::uint64_t index) const
+    {
+        return m_data + m_header.m_entries_offset + index * pack_format::ENTRY_SIZE;
+    }
+
+    bool is_range_valid(std::uint64_t offset, std::uint64_t size) const
+    {
+        return (offset <= m_size) && (size <= m_size - offset);
+    }
+
+    // Checks all offsets once, lookups then need no bounds checks.
+    bool validate()
+    {
+        if (!pack_format::decode_header(m_data, m_header) || (m_header.m_buckets_count == 0)
+            || (m_header.m_buckets_count > m_size / pack_format::BUCKET_SIZE)
+            || (m_header.m_entries_count > m_size / pack_format::ENTRY_SIZE)
+            || !is_range_valid(m_header.m_buckets_offset, (m_header.m_buckets_count + 1) * pack_format::BUCKET_SIZE)
+            || !is_range_valid(m_header.m_entries_offset, m_header.m_entries_count * pack_format::ENTRY_SIZE)
+            || !is_range_valid(m_header.m_strings_offset, m_header.m_strings_size))
+        {
+            return false;
+        }
+
+        std::uint64_t previous = 0;
+        for (std::uint64_t bucket = 0; bucket <= m_header.m_buckets_count; ++bucket)
+        {
+            auto index = get_bucket(bucket);
+            if ((index < previous) || (index > m_header.m_entries_count))
+            {
+                return false;
+            }
+            previous = index;
+        }
+        if (previous != m_header.m_entries_count)
+        {
+            return false;
+        }
+
+        pack_format::entry entry;
+        for (std::uint64_t index = 0; index < m_header.m_entries_count; ++index)
+        {
+            pack_format::decode_entry(get_entry_data(index), entry);
+            if ((entry.m_path_offset > m_header.m_strings_size)
+                || (entry.m_path_size > m_header.m_strings_size - entry.m_path_offset)
+                || !is_range_valid(entry.m_data_offset, entry.m_data_size)
+                || ((entry.m_flags & pack_format::ENTRY_FLAG_NETASCII)
+                    && !is_range_valid(entry.m_netascii_offset, entry.m_netascii_size)))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::shared_ptr<const void> m_mapping;
+    const std::uint8_t* m_data;
+    std::size_t m_size;
+    pack_format::header m_header;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
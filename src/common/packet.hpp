@@ -41,6 +41,11 @@ struct packet_error : public packet
     std::string m_error_message;
 };
 
+struct packet_oack : public packet
+{
+    std::map<std::string, std::string> m_options;
+};
+
 } // namespace tftp
 } // namespace net
 } // namespace oct
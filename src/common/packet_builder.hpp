@@ -88,6 +88,18 @@ public:
         return buffer;
     }
 
+    // DATA header only, the data are then read in place after it. Buffer
+    // memory is reused.
+    static void build_data_header(std::uint16_t block_no, std::vector<std::uint8_t>& buffer)
+    {
+        buffer.clear();
+
+        serializer serializer(buffer);
+
+        serializer.write_uint16(OP_DATA);
+        serializer.write_uint16(block_no);
+    }
+
     static std::vector<std::uint8_t> build_packet(const packet_error& packet)
     {
         std::vector<std::uint8_t> buffer;
@@ -104,11 +116,33 @@ public:
     static std::vector<std::uint8_t> build_packet(const packet_ack& packet)
     {
         std::vector<std::uint8_t> buffer;
+        build_packet(packet, buffer);
+        return buffer;
+    }
+
+    // Buffer memory is reused, so acknowledging does not allocate.
+    static void build_packet(const packet_ack& packet, std::vector<std::uint8_t>& buffer)
+    {
+        buffer.clear();
 
         serializer serializer(buffer);
 
         serializer.write_uint16(packet.m_op);
         serializer.write_uint16(packet.m_block_no);
+    }
+
+    static std::vector<std::uint8_t> build_packet(const packet_oack& packet)
+    {
+        std::vector<std::uint8_t> buffer;
+
+        serializer serializer(buffer);
+
+        serializer.write_uint16(packet.m_op);
+        for (auto& option : packet.m_options)
+        {
+            serializer.write_string(option.first);
+            serializer.write_string(option.second);
+        }
 
         return buffer;
     }
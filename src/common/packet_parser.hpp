@@ -1,10 +1,10 @@
 #pragma once
 
 #include <asio.hpp>
-#include <iostream>
 
 #include "defs.hpp"
 #include "deserializer.hpp"
+#include "log.hpp"
 #include "packet.hpp"
 
 namespace oct
@@ -35,20 +35,36 @@ public:
                 return parse_ack(deserializer);
             case OP_ERROR:
                 return parse_error(deserializer);
+            case OP_OACK:
+                return parse_oack(deserializer);
             default:
-                // TODO: log message
-                std::cerr << "Cannot parse - unknown op: " << op << std::endl;
+                log_warning() << "Cannot parse - unknown op: " << op << std::endl;
                 return nullptr;
             }
         }
         catch (const deserialize_error& exc)
         {
-            // TODO: log message
-            std::cerr << "Packet deserialization failed: " << exc.what() << std::endl;
+            log_warning() << "Packet deserialization failed: " << exc.what() << std::endl;
             return nullptr;
         }
     }
 
+    // Parses the header of a DATA or an ACK packet in place, without allocating.
+    // Data of a DATA packet follow the header. False for other packets, to be
+    // parsed by parse_packet().
+    static bool parse_block_header(const asio::const_buffer& buffer, std::uint16_t& op, std::uint16_t& block_no)
+    {
+        if (buffer.size() < DATA_HEADER_SIZE)
+        {
+            return false;
+        }
+
+        auto data = static_cast<const std::uint8_t*>(buffer.data());
+        op = static_cast<std::uint16_t>((data[0] << 8) | data[1]);
+        block_no = static_cast<std::uint16_t>((data[2] << 8) | data[3]);
+        return (op == OP_DATA) || ((op == OP_ACK) && (buffer.size() == DATA_HEADER_SIZE));
+    }
+
 private:
     static std::shared_ptr<packet> parse_file_req(std::uint16_t op, deserializer& deserializer)
     {
@@ -124,6 +140,24 @@ private:
 
         return packet;
     }
+
+    static std::shared_ptr<packet> parse_oack(deserializer& deserializer)
+    {
+        auto packet = std::make_shared<packet_oack>();
+
+        packet->m_op = OP_OACK;
+
+        while (deserializer.has_more_bytes())
+        {
+            auto name = deserializer.read_string();
+            auto value = deserializer.read_string();
+
+            packet->m_options.emplace(name, value);
+        }
+        deserializer.ensure_all_read();
+
+        return packet;
+    }
 };
 
 } // namespace tftp
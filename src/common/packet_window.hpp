@@ -0,0 +1,93 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Packets of a send window. Buffers of the acknowledged packets are kept for
+// the following ones, so a steady transfer does not allocate.
+class packet_window
+{
+public:
+    typedef std::vector<std::uint8_t> packet_buffer;
+
+    packet_window()
+        : m_packets()
+        , m_spare_packets()
+    {
+        // noop
+    }
+
+    std::size_t size() const
+    {
+        return m_packets.size();
+    }
+
+    bool empty() const
+    {
+        return m_packets.empty();
+    }
+
+    packet_buffer& operator[](std::size_t index)
+    {
+        return m_packets[index];
+    }
+
+    const packet_buffer& operator[](std::size_t index) const
+    {
+        return m_packets[index];
+    }
+
+    // Appends an empty packet, reusing a spare buffer.
+    packet_buffer& add()
+    {
+        if (m_spare_packets.empty())
+        {
+            m_packets.emplace_back();
+        }
+        else
+        {
+            m_packets.push_back(std::move(m_spare_packets.back()));
+            m_spare_packets.pop_back();
+            m_packets.back().clear();
+        }
+        return m_packets.back();
+    }
+
+    // Removes the first count packets, e.g. the acknowledged ones.
+    void remove_front(std::size_t count)
+    {
+        std::rotate(m_packets.begin(), m_packets.begin() + count, m_packets.end());
+        truncate(m_packets.size() - count);
+    }
+
+    // Removes the packets after the first size ones.
+    void truncate(std::size_t size)
+    {
+        while (m_packets.size() > size)
+        {
+            m_spare_packets.push_back(std::move(m_packets.back()));
+            m_packets.pop_back();
+        }
+    }
+
+    void clear()
+    {
+        truncate(0);
+    }
+
+private:
+    std::vector<packet_buffer> m_packets;
+    std::vector<packet_buffer> m_spare_packets;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
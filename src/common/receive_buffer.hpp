@@ -0,0 +1,60 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include <asio.hpp>
+
+#include "defs.hpp"
+#include "transport.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Buffer receiving the packets of the transfers run by the thread. A transfer
+// waits for its socket to become readable and uses the buffer only to receive
+// and process a packet, so a waiting transfer holds no receive buffer.
+class receive_buffer
+{
+public:
+    // fits the largest DATA packet
+    static const std::size_t SIZE = DATA_HEADER_SIZE + MAX_DATA_SIZE;
+
+    // Receives a pending packet into the buffer of the thread, the error is
+    // would_block if none is pending. Readiness is reported only for packets
+    // arriving afterwards, so the socket is waited for once this fails.
+    static std::size_t receive(udp_socket& socket, asio::ip::udp::endpoint& source, asio::error_code& ec)
+    {
+        if (!socket.non_blocking())
+        {
+            socket.non_blocking(true, ec);
+            if (ec)
+            {
+                return 0;
+            }
+        }
+        return socket.receive_from(asio::buffer(get_thread_buffer()), source, 0, ec);
+    }
+
+    // Packet received by the last receive() of the thread.
+    static const std::uint8_t* data()
+    {
+        return get_thread_buffer().data();
+    }
+
+private:
+    static std::array<std::uint8_t, SIZE>& get_thread_buffer()
+    {
+        static thread_local std::array<std::uint8_t, SIZE> buffer;
+        return buffer;
+    }
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
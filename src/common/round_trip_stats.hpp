@@ -0,0 +1,67 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Round trips measured by a transfer, from a window sent to the packet
+// answering it. Windows resent on timeout are not measured, as the answer
+// could be to any of their copies (Karn's algorithm).
+class round_trip_stats
+{
+public:
+    round_trip_stats()
+        : m_count(0)
+        , m_total(0)
+        , m_min(0)
+        , m_max(0)
+    {
+        // noop
+    }
+
+    void add(std::chrono::microseconds round_trip)
+    {
+        m_min = (m_count > 0) ? std::min(m_min, round_trip) : round_trip;
+        m_max = std::max(m_max, round_trip);
+        m_total += round_trip;
+        ++m_count;
+    }
+
+    std::uint64_t get_count() const
+    {
+        return m_count;
+    }
+
+    // All zero if none measured.
+    std::chrono::microseconds get_min() const
+    {
+        return m_min;
+    }
+
+    std::chrono::microseconds get_average() const
+    {
+        return (m_count > 0) ? m_total / static_cast<std::chrono::microseconds::rep>(m_count) : m_total;
+    }
+
+    std::chrono::microseconds get_max() const
+    {
+        return m_max;
+    }
+
+private:
+    std::uint64_t m_count;
+    std::chrono::microseconds m_total;
+    std::chrono::microseconds m_min;
+    std::chrono::microseconds m_max;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
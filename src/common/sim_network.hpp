@@ -0,0 +1,715 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <map>
+#include <memory>
+#include <queue>
+#include <random>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "allocation_counter.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Virtual time of the simulated network, advanced only by sim_network::run_step().
+class sim_clock
+{
+public:
+    typedef std::chrono::nanoseconds duration;
+    typedef duration::rep rep;
+    typedef duration::period period;
+    typedef std::chrono::time_point<sim_clock> time_point;
+
+    static constexpr bool is_steady = true;
+
+    static time_point now()
+    {
+        return time_point(get_elapsed());
+    }
+
+    static void advance_to(time_point time)
+    {
+        get_elapsed() = std::max(get_elapsed(), time.time_since_epoch());
+    }
+
+private:
+    static duration& get_elapsed()
+    {
+        static duration elapsed(0);
+        return elapsed;
+    }
+};
+
+// Timers are checked on every poll of the io_context instead of waiting for
+// the real time to pass.
+struct sim_wait_traits
+{
+    static sim_clock::duration to_wait_duration(const sim_clock::duration& /*duration*/)
+    {
+        return sim_clock::duration::zero();
+    }
+
+    static sim_clock::duration to_wait_duration(const sim_clock::time_point& /*time*/)
+    {
+        return sim_clock::duration::zero();
+    }
+};
+
+typedef asio::basic_waitable_timer<sim_clock, sim_wait_traits> sim_timer;
+
+// Conditions of the simulated links, probabilities are per datagram.
+struct sim_link_settings
+{
+    sim_link_settings()
+        : m_loss(0.0)
+        , m_duplication(0.0)
+        , m_reordering(0.0)
+        , m_delay(0)
+        , m_jitter(0)
+        , m_reorder_delay(std::chrono::milliseconds(1))
+        , m_bandwidth(0)
+    {
+        // noop
+    }
+
+    double m_loss;
+    double m_duplication;
+    // reordered datagram is held back by the reorder delay
+    double m_reordering;
+    // one way
+    std::chrono::microseconds m_delay;
+    std::chrono::microseconds m_jitter;
+    std::chrono::microseconds m_reorder_delay;
+    // bytes per second sent by a socket, zero if unlimited
+    std::uint64_t m_bandwidth;
+};
+
+struct sim_network_stats
+{
+    sim_network_stats()
+        : m_sent(0)
+        , m_lost(0)
+        , m_duplicated(0)
+        , m_reordered(0)
+        , m_delivered(0)
+        , m_undeliverable(0)
+        , m_overflowed(0)
+    {
+        // noop
+    }
+
+    std::uint64_t m_sent;
+    std::uint64_t m_lost;
+    std::uint64_t m_duplicated;
+    std::uint64_t m_reordered;
+    std::uint64_t m_delivered;
+    // no socket bound to the destination port
+    std::uint64_t m_undeliverable;
+    // receive queue of the destination full
+    std::uint64_t m_overflowed;
+};
+
+class sim_socket;
+
+// Network of a single host run by the thread polling its io_contexts. Sockets
+// are addressed by their address and port, a socket bound to the unspecified
+// address receives the datagrams sent to any address; ephemeral ports are
+// assigned per address. Losses and delays are drawn from a seeded generator and
+// datagrams due at the same time are delivered in the order they were sent, so
+// a run is reproduced exactly by the same seed.
+class sim_network
+{
+public:
+    static const std::uint16_t FIRST_EPHEMERAL_PORT = 49152;
+    static const std::size_t RECEIVE_QUEUE_LIMIT = 256;
+
+    sim_network(const sim_network&) = delete;
+    sim_network& operator=(const sim_network&) = delete;
+
+    static sim_network& get()
+    {
+        static sim_network network;
+        return network;
+    }
+
+    void configure(const sim_link_settings& settings, std::uint32_t seed)
+    {
+        m_settings = settings;
+        m_random.seed(seed);
+    }
+
+    const sim_network_stats& get_stats() const
+    {
+        return m_stats;
+    }
+
+    bool is_idle() const
+    {
+        return m_in_flight.empty();
+    }
+
+    // Runs the ready handlers and delivers the datagrams due. Once none is
+    // ready, the virtual time is advanced to the next delivery, at most by the
+    // tick so the timers expiring meanwhile are not skipped.
+    void run_step(asio::io_context& io_context, sim_clock::duration tick)
+    {
+        if (io_context.stopped())
+        {
+            io_context.restart();
+        }
+
+        if ((io_context.poll() > 0) || deliver_due())
+        {
+            return;
+        }
+
+        auto next_time = sim_clock::now() + tick;
+        if (!m_in_flight.empty())
+        {
+            next_time = std::min(next_time, m_in_flight.top().m_time);
+        }
+        sim_clock::advance_to(next_time);
+    }
+
+    // Runs the ready handlers and delivers the datagrams due until none is
+    // left, without advancing the virtual time.
+    void run_ready(asio::io_context& io_context)
+    {
+        if (io_context.stopped())
+        {
+            io_context.restart();
+        }
+
+        while ((io_context.poll() > 0) || deliver_due())
+        {
+            // continue
+        }
+    }
+
+private:
+    friend class sim_socket;
+
+    struct datagram
+    {
+        sim_clock::time_point m_time;
+        std::uint64_t m_sequence;
+        asio::ip::udp::endpoint m_source;
+        asio::ip::udp::endpoint m_destination;
+        std::vector<std::uint8_t> m_data;
+
+        // earliest first, in the sending order
+        bool operator<(const datagram& other) const
+        {
+            return (m_time != other.m_time) ? (m_time > other.m_time) : (m_sequence > other.m_sequence);
+        }
+    };
+
+    sim_network()
+        : m_settings()
+        , m_random()
+        , m_stats()
+        , m_next_sequence(0)
+        , m_sockets()
+        , m_next_ports()
+    {
+        // noop
+    }
+
+    asio::error_code bind(sim_socket& socket, const asio::ip::address& address, std::uint16_t& port)
+    {
+        if (port == 0)
+        {
+            auto& next_port
+                = m_next_ports.insert(std::make_pair(address, static_cast<std::uint16_t>(FIRST_EPHEMERAL_PORT)))
+                      .first->second;
+            for (std::size_t i = 0; (i < 0x10000) && is_bound(address, next_port); ++i)
+            {
+                next_port = next_ephemeral_port(next_port);
+            }
+            port = next_port;
+            next_port = next_ephemeral_port(next_port);
+        }
+
+        if (is_bound(address, port))
+        {
+            return asio::error::address_in_use;
+        }
+        m_sockets.emplace(port, &socket);
+        return asio::error_code();
+    }
+
+    void unbind(sim_socket& socket, std::uint16_t port)
+    {
+        auto range = m_sockets.equal_range(port);
+        for (auto iter = range.first; iter != range.second; ++iter)
+        {
+            if (iter->second == &socket)
+            {
+                m_sockets.erase(iter);
+                return;
+            }
+        }
+    }
+
+    // Port is taken by a socket bound to the address, or by any if either is unspecified.
+    bool is_bound(const asio::ip::address& address, std::uint16_t port) const;
+
+    // Socket bound to the destination, or to the unspecified address and its port.
+    sim_socket* find_socket(const asio::ip::udp::endpoint& destination) const;
+
+    void send(sim_clock::time_point& link_free_time, const asio::ip::udp::endpoint& source,
+        const asio::ip::udp::endpoint& destination, std::vector<std::uint8_t> data)
+    {
+        ++m_stats.m_sent;
+
+        // serialized by the link of the sender even if lost on the way
+        auto time = sim_clock::now();
+        if (m_settings.m_bandwidth > 0)
+        {
+            time = std::max(time, link_free_time)
+                + std::chrono::nanoseconds(data.size() * 1000000000 / m_settings.m_bandwidth);
+            link_free_time = time;
+        }
+
+        if (draw(m_settings.m_loss))
+        {
+            ++m_stats.m_lost;
+            return;
+        }
+
+        bool duplicated = draw(m_settings.m_duplication);
+        if (duplicated)
+        {
+            ++m_stats.m_duplicated;
+            schedule(time, source, destination, data);
+        }
+        schedule(time, source, destination, std::move(data));
+    }
+
+    void schedule(sim_clock::time_point time, const asio::ip::udp::endpoint& source,
+        const asio::ip::udp::endpoint& destination, std::vector<std::uint8_t> data)
+    {
+        time += m_settings.m_delay;
+        if (m_settings.m_jitter.count() > 0)
+        {
+            time += std::chrono::microseconds(m_random() % (m_settings.m_jitter.count() + 1));
+        }
+        if (draw(m_settings.m_reordering))
+        {
+            ++m_stats.m_reordered;
+            time += m_settings.m_reorder_delay;
+        }
+
+        datagram packet;
+        packet.m_time = time;
+        packet.m_sequence = m_next_sequence++;
+        packet.m_source = source;
+        packet.m_destination = destination;
+        packet.m_data = std::move(data);
+        m_in_flight.push(std::move(packet));
+    }
+
+    bool deliver_due();
+
+    bool draw(double probability)
+    {
+        // independent of the distributions of the standard library
+        return (probability > 0.0) && (m_random() < probability * 4294967296.0);
+    }
+
+    static std::uint16_t next_ephemeral_port(std::uint16_t port)
+    {
+        return (port == 0xFFFF) ? FIRST_EPHEMERAL_PORT : static_cast<std::uint16_t>(port + 1);
+    }
+
+    sim_link_settings m_settings;
+    std::mt19937 m_random;
+    sim_network_stats m_stats;
+
+    std::priority_queue<datagram> m_in_flight;
+    std::uint64_t m_next_sequence;
+
+    // by port, a few sockets per port at most
+    std::multimap<std::uint16_t, sim_socket*> m_sockets;
+    std::map<asio::ip::address, std::uint16_t> m_next_ports;
+};
+
+// UDP socket of the simulated network, providing the subset of the asio socket
+// used by the transfers. Operations complete through handlers posted to the
+// io_context, as the ones of a real socket. With OCTNET_TFTP_WITH_COROUTINES
+// they take completion tokens, e.g. of the coroutine send windows.
+class sim_socket
+{
+public:
+    typedef asio::ip::udp protocol_type;
+    typedef asio::ip::udp::endpoint endpoint_type;
+    typedef asio::io_context::executor_type executor_type;
+
+    sim_socket(const sim_socket&) = delete;
+    sim_socket& operator=(const sim_socket&) = delete;
+
+    explicit sim_socket(asio::io_context& io_context)
+        : m_io_context(io_context)
+        , m_open(false)
+        , m_bound(false)
+        , m_non_blocking(false)
+        , m_local_endpoint()
+        , m_link_free_time()
+    {
+        // noop
+    }
+
+    ~sim_socket()
+    {
+        asio::error_code ignored;
+        close(ignored);
+    }
+
+    void open(const protocol_type& protocol)
+    {
+        m_open = true;
+        m_local_endpoint = endpoint_type(protocol, 0);
+    }
+
+    void open(const protocol_type& protocol, asio::error_code& ec)
+    {
+        open(protocol);
+        ec = asio::error_code();
+    }
+
+    template <class option_T>
+    void set_option(const option_T& /*option*/)
+    {
+        // noop
+    }
+
+    template <class option_T>
+    void set_option(const option_T& /*option*/, asio::error_code& ec)
+    {
+        ec = asio::error_code();
+    }
+
+    bool is_open() const
+    {
+        return m_open;
+    }
+
+    void bind(const endpoint_type& endpoint)
+    {
+        asio::error_code ec;
+        bind(endpoint, ec);
+        if (ec)
+        {
+            throw asio::system_error(ec);
+        }
+    }
+
+    void bind(const endpoint_type& endpoint, asio::error_code& ec)
+    {
+        if (!m_open || m_bound)
+        {
+            ec = asio::error::invalid_argument;
+            return;
+        }
+
+        auto port = endpoint.port();
+        ec = sim_network::get().bind(*this, endpoint.address(), port);
+        if (!ec)
+        {
+            m_bound = true;
+            m_local_endpoint = endpoint_type(endpoint.address(), port);
+        }
+    }
+
+    void close(asio::error_code& ec)
+    {
+        cancel(ec);
+        if (m_bound)
+        {
+            sim_network::get().unbind(*this, m_local_endpoint.port());
+        }
+        m_open = false;
+        m_bound = false;
+        m_received.clear();
+    }
+
+    void cancel(asio::error_code& ec)
+    {
+        allocation_counter::uncounted scope;
+        complete_waits(asio::error::operation_aborted);
+        ec = asio::error_code();
+    }
+
+    bool non_blocking() const
+    {
+        return m_non_blocking;
+    }
+
+    void non_blocking(bool mode, asio::error_code& ec)
+    {
+        m_non_blocking = mode;
+        ec = asio::error_code();
+    }
+
+    endpoint_type local_endpoint() const
+    {
+        return m_local_endpoint;
+    }
+
+    executor_type get_executor()
+    {
+        return m_io_context.get_executor();
+    }
+
+    template <class buffers_T>
+    std::size_t send_to(
+        const buffers_T& buffers, const endpoint_type& destination, int /*flags*/, asio::error_code& ec)
+    {
+        if (!m_open)
+        {
+            ec = asio::error::bad_descriptor;
+            return 0;
+        }
+        if (!m_bound)
+        {
+            // bound on the first send, as a real socket
+            bind(m_local_endpoint, ec);
+            if (ec)
+            {
+                return 0;
+            }
+        }
+
+        // the network and the reactor stand in for the kernel, their allocations are not counted
+        allocation_counter::uncounted scope;
+        std::vector<std::uint8_t> data(asio::buffer_size(buffers));
+        asio::buffer_copy(asio::buffer(data), buffers);
+
+        // source address of a socket bound to any is the local one the datagram is sent to
+        auto source_address
+            = m_local_endpoint.address().is_unspecified() ? destination.address() : m_local_endpoint.address();
+        sim_network::get().send(
+            m_link_free_time, endpoint_type(source_address, m_local_endpoint.port()), destination, std::move(data));
+
+        ec = asio::error_code();
+        return asio::buffer_size(buffers);
+    }
+
+#if defined(OCTNET_TFTP_WITH_COROUTINES)
+    template <class buffers_T, class token_T>
+    auto async_send_to(const buffers_T& buffers, const endpoint_type& destination, token_T&& token)
+    {
+        return asio::async_initiate<token_T, void(asio::error_code, std::size_t)>(
+            [this](auto handler, const buffers_T& buffers, const endpoint_type& destination) {
+                initiate_send_to(buffers, destination, std::move(handler));
+            },
+            token, buffers, destination);
+    }
+#else
+    template <class buffers_T, class handler_T>
+    void async_send_to(const buffers_T& buffers, const endpoint_type& destination, handler_T&& handler)
+    {
+        initiate_send_to(buffers, destination, std::forward<handler_T>(handler));
+    }
+#endif
+
+    template <class buffers_T>
+    std::size_t receive_from(const buffers_T& buffers, endpoint_type& source, int /*flags*/, asio::error_code& ec)
+    {
+        asio::ip::address destination;
+        return receive_packet(buffers, source, destination, ec);
+    }
+
+    // Receives also the destination address of the datagram, as IP_PKTINFO.
+    template <class buffers_T>
+    std::size_t receive_packet(
+        const buffers_T& buffers, endpoint_type& source, asio::ip::address& destination, asio::error_code& ec)
+    {
+        if (!m_open)
+        {
+            ec = asio::error::bad_descriptor;
+            return 0;
+        }
+        if (m_received.empty())
+        {
+            // blocking receive would never return
+            ec = asio::error::would_block;
+            return 0;
+        }
+
+        auto& packet = m_received.front();
+        source = packet.first;
+        destination = packet.second.first;
+        auto bytes_received = asio::buffer_copy(buffers, asio::buffer(packet.second.second));
+        m_received.pop_front();
+
+        ec = asio::error_code();
+        return bytes_received;
+    }
+
+#if defined(OCTNET_TFTP_WITH_COROUTINES)
+    template <class token_T>
+    auto async_wait(asio::socket_base::wait_type type, token_T&& token)
+    {
+        return asio::async_initiate<token_T, void(asio::error_code)>(
+            [this](auto handler, asio::socket_base::wait_type type) { initiate_wait(type, std::move(handler)); },
+            token, type);
+    }
+#else
+    template <class handler_T>
+    void async_wait(asio::socket_base::wait_type type, handler_T&& handler)
+    {
+        initiate_wait(type, std::forward<handler_T>(handler));
+    }
+#endif
+
+private:
+    friend class sim_network;
+
+    template <class buffers_T, class handler_T>
+    void initiate_send_to(const buffers_T& buffers, const endpoint_type& destination, handler_T&& handler)
+    {
+        asio::error_code ec;
+        auto bytes_sent = send_to(buffers, destination, 0, ec);
+        allocation_counter::uncounted scope;
+        asio::post(m_io_context, std::bind(std::forward<handler_T>(handler), ec, bytes_sent));
+    }
+
+    template <class handler_T>
+    void initiate_wait(asio::socket_base::wait_type type, handler_T&& handler)
+    {
+        allocation_counter::uncounted scope;
+        if (!m_open)
+        {
+            asio::post(m_io_context,
+                std::bind(std::forward<handler_T>(handler), asio::error_code(asio::error::bad_descriptor)));
+            return;
+        }
+
+        // held by a pointer, the handler could be move-only (e.g. resuming a coroutine)
+        auto held_handler = std::make_shared<typename std::decay<handler_T>::type>(std::forward<handler_T>(handler));
+        m_wait_handlers.emplace_back([held_handler](const asio::error_code& ec) { (*held_handler)(ec); });
+        if ((type != asio::socket_base::wait_read) || !m_received.empty())
+        {
+            complete_waits(asio::error_code());
+        }
+    }
+
+    // Datagram queued for the receive, false if the queue is full.
+    bool deliver(
+        const endpoint_type& source, const asio::ip::address& destination, std::vector<std::uint8_t> data)
+    {
+        if (m_received.size() >= sim_network::RECEIVE_QUEUE_LIMIT)
+        {
+            return false;
+        }
+
+        m_received.emplace_back(source, std::make_pair(destination, std::move(data)));
+        complete_waits(asio::error_code());
+        return true;
+    }
+
+    void complete_waits(const asio::error_code& ec)
+    {
+        for (auto& handler : m_wait_handlers)
+        {
+            asio::post(m_io_context, std::bind(std::move(handler), ec));
+        }
+        m_wait_handlers.clear();
+    }
+
+    asio::io_context& m_io_context;
+
+    bool m_open;
+    bool m_bound;
+    bool m_non_blocking;
+    endpoint_type m_local_endpoint;
+    sim_clock::time_point m_link_free_time;
+
+    // source, destination address and data of the received datagrams, a list
+    // keeps no memory while empty as a waiting kernel socket (a deque would)
+    std::list<std::pair<endpoint_type, std::pair<asio::ip::address, std::vector<std::uint8_t>>>> m_received;
+    std::vector<std::function<void(const asio::error_code&)>> m_wait_handlers;
+};
+
+inline bool sim_network::is_bound(const asio::ip::address& address, std::uint16_t port) const
+{
+    auto range = m_sockets.equal_range(port);
+    for (auto iter = range.first; iter != range.second; ++iter)
+    {
+        auto bound_address = iter->second->m_local_endpoint.address();
+        if ((bound_address == address) || bound_address.is_unspecified() || address.is_unspecified())
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+inline sim_socket* sim_network::find_socket(const asio::ip::udp::endpoint& destination) const
+{
+    sim_socket* found = nullptr;
+    auto range = m_sockets.equal_range(destination.port());
+    for (auto iter = range.first; iter != range.second; ++iter)
+    {
+        auto bound_address = iter->second->m_local_endpoint.address();
+        if (bound_address == destination.address())
+        {
+            return iter->second;
+        }
+        if (bound_address.is_unspecified())
+        {
+            found = iter->second;
+        }
+    }
+    return found;
+}
+
+inline bool sim_network::deliver_due()
+{
+    allocation_counter::uncounted scope;
+    bool delivered = false;
+    while (!m_in_flight.empty() && (m_in_flight.top().m_time <= sim_clock::now()))
+    {
+        // moved out before pop, the queue provides only a const top
+        auto& top = const_cast<datagram&>(m_in_flight.top());
+        auto source = top.m_source;
+        auto destination = top.m_destination;
+        auto data = std::move(top.m_data);
+        m_in_flight.pop();
+
+        auto socket = find_socket(destination);
+        if (!socket)
+        {
+            ++m_stats.m_undeliverable;
+        }
+        else if (socket->deliver(source, destination.address(), std::move(data)))
+        {
+            ++m_stats.m_delivered;
+            delivered = true;
+        }
+        else
+        {
+            ++m_stats.m_overflowed;
+        }
+    }
+    return delivered;
+}
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
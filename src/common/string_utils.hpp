@@ -1,7 +1,10 @@
 #pragma once
 
 #include <cctype>
+#include <cstdint>
+#include <limits>
 #include <string>
+#include <vector>
 
 namespace oct
 {
@@ -10,7 +13,7 @@ namespace net
 namespace tftp
 {
 
-bool equal_ignore_case(const std::string& a, const std::string& b)
+inline bool equal_ignore_case(const std::string& a, const std::string& b)
 {
     const std::size_t a_size = a.size();
 
@@ -30,6 +33,95 @@ bool equal_ignore_case(const std::string& a, const std::string& b)
     return true;
 }
 
+inline std::string trim(const std::string& str)
+{
+    const char* whitespace = " \t\r\n";
+
+    auto begin = str.find_first_not_of(whitespace);
+    if (begin == std::string::npos)
+    {
+        return std::string();
+    }
+    auto end = str.find_last_not_of(whitespace);
+    return str.substr(begin, end - begin + 1);
+}
+
+inline bool parse_uint64(const std::string& str, std::uint64_t& value)
+{
+    if (str.empty())
+    {
+        return false;
+    }
+
+    std::uint64_t result = 0;
+    for (auto c : str)
+    {
+        if ((c < '0') || (c > '9'))
+        {
+            return false;
+        }
+
+        std::uint64_t digit = static_cast<std::uint64_t>(c - '0');
+        if (result > (std::numeric_limits<std::uint64_t>::max() - digit) / 10)
+        {
+            return false;
+        }
+        result = result * 10 + digit;
+    }
+
+    value = result;
+    return true;
+}
+
+inline bool glob_match(const std::string& pattern, std::size_t pattern_pos, const std::string& text,
+    std::size_t text_pos, std::vector<std::string>& captures)
+{
+    auto captures_size = captures.size();
+
+    for (; pattern_pos < pattern.size(); ++pattern_pos, ++text_pos)
+    {
+        auto c = pattern[pattern_pos];
+        if (c == '*')
+        {
+            // shortest match first
+            for (auto end_pos = text_pos; end_pos <= text.size(); ++end_pos)
+            {
+                captures.push_back(text.substr(text_pos, end_pos - text_pos));
+                if (glob_match(pattern, pattern_pos + 1, text, end_pos, captures))
+                {
+                    return true;
+                }
+                captures.resize(captures_size);
+            }
+            return false;
+        }
+
+        if ((text_pos >= text.size()) || ((c != '?') && (c != text[text_pos])))
+        {
+            captures.resize(captures_size);
+            return false;
+        }
+        if (c == '?')
+        {
+            captures.emplace_back(1, text[text_pos]);
+        }
+    }
+
+    if (text_pos != text.size())
+    {
+        captures.resize(captures_size);
+        return false;
+    }
+    return true;
+}
+
+// Matches text against a pattern with '*' (any sequence) and '?' (any character)
+// wildcards. Text matched by each wildcard is appended to captures.
+inline bool glob_match(const std::string& pattern, const std::string& text, std::vector<std::string>& captures)
+{
+    return glob_match(pattern, 0, text, 0, captures);
+}
+
 } // namespace tftp
 } // namespace net
 } // namespace oct
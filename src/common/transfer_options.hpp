@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cstdint>
+
+#include "defs.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+struct transfer_options
+{
+    transfer_options()
+        : m_block_size(DEFAULT_DATA_SIZE)
+        , m_window_size(DEFAULT_WINDOW_SIZE)
+        , m_timeout_sec(DEFAULT_RETRY_TIMEOUT_SEC)
+        , m_has_transfer_size(false)
+        , m_transfer_size(0)
+        , m_block_offset(0)
+        , m_has_block_count(false)
+        , m_block_count(0)
+    {
+        // noop
+    }
+
+    std::size_t m_block_size;
+    std::uint16_t m_window_size;
+    int m_timeout_sec;
+    bool m_has_transfer_size;
+    std::uint64_t m_transfer_size;
+    // blocks skipped at the beginning of the file
+    std::uint64_t m_block_offset;
+    // blocks sent at most
+    bool m_has_block_count;
+    std::uint64_t m_block_count;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
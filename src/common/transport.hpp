@@ -0,0 +1,28 @@
+#pragma once
+
+#include <asio.hpp>
+
+#if defined(OCTNET_TFTP_WITH_SIMULATED_NETWORK)
+#include "sim_network.hpp"
+#endif
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Socket and timer of the transfers. The simulated network of the simulation
+// harness replaces them when OCTNET_TFTP_WITH_SIMULATED_NETWORK is defined.
+#if defined(OCTNET_TFTP_WITH_SIMULATED_NETWORK)
+typedef sim_socket udp_socket;
+typedef sim_timer transfer_timer;
+#else
+typedef asio::ip::udp::socket udp_socket;
+typedef asio::system_timer transfer_timer;
+#endif
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,559 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+
+#include <asio.hpp>
+
+#include "defs.hpp"
+#include "log.hpp"
+#include "packet.hpp"
+#include "packet_parser.hpp"
+#include "packet_window.hpp"
+#include "receive_buffer.hpp"
+#include "round_trip_stats.hpp"
+#include "transport.hpp"
+
+#if defined(OCTNET_TFTP_WITH_COROUTINES) && (!defined(ASIO_HAS_CO_AWAIT) || (ASIO_VERSION < 101400))
+#error "OCTNET_TFTP_WITH_COROUTINES requires a C++20 compiler and asio 1.14 or newer"
+#endif
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Result of a packet processed by the host of a send window.
+enum class ack_result
+{
+    // packet does not advance the window
+    IGNORED,
+    // acknowledged packets removed, window filled with the following ones
+    ADVANCED,
+    // last packet acknowledged
+    COMPLETE,
+    // window could not be filled, the host reports the error
+    FAILED
+};
+
+// Sends a window of packets (RFC 7440, a window of one packet for RFC 1350)
+// until its last packet is acknowledged, resending it on timeout. It is the
+// send state machine of the server downloads and the client uploads, the host
+// fills the window and provides:
+//
+//   ack_result acknowledge(std::uint16_t block_no);
+//   ack_result process_other_packet(const asio::const_buffer& packet);
+//   void on_sender_done(window_sender::status status);
+//
+// The host is a handler_owner tracking the handlers of the sender (befriended
+// if its track() is not visible). With OCTNET_TFTP_WITH_COROUTINES the state
+// machine runs as a coroutine instead of callbacks.
+template <class host_T>
+class window_sender
+{
+public:
+    enum class status
+    {
+        COMPLETE,
+        // stopped by the host, e.g. the window could not be filled
+        STOPPED,
+        TIMEOUT,
+        NETWORK_ERROR
+    };
+
+    // The peer endpoint is owned by the host, set before the start and by
+    // confirm_peer().
+    window_sender(host_T& host, asio::io_context& io_context, udp_socket& socket, packet_window& window,
+        asio::ip::udp::endpoint& peer)
+        : m_host(host)
+        , m_socket(socket)
+        , m_window(window)
+        , m_timer(io_context)
+        , m_peer(peer)
+        , m_peer_confirmed(false)
+        , m_source()
+        , m_retry_count(0)
+        , m_timeout(0)
+        , m_retry_counter(0)
+        , m_wait_id(0)
+        , m_timed_out(false)
+        , m_send_index(0)
+        , m_sending(false)
+        , m_ack_deferred(false)
+        , m_deferred_ack_id(0)
+        , m_receive_pending(false)
+        , m_stopped(false)
+        , m_retransmits(0)
+        , m_ignored_acks(0)
+        , m_window_sent_time()
+        , m_window_resent(false)
+        , m_round_trips()
+        , m_error()
+    {
+        // noop
+    }
+
+    // Sends the window, which must not be empty, to the peer. Unless the peer
+    // is confirmed, packets from any source are processed until the host
+    // calls confirm_peer(), e.g. on the response to a request.
+    void start(bool peer_confirmed, int retry_count, std::chrono::seconds timeout)
+    {
+        m_peer_confirmed = peer_confirmed;
+        m_retry_count = retry_count;
+        m_retry_counter = retry_count;
+        m_timeout = timeout;
+
+#if defined(OCTNET_TFTP_WITH_COROUTINES)
+        asio::co_spawn(m_socket.get_executor(), run(),
+            m_host.track([this](std::exception_ptr error, status result) {
+                if (error)
+                {
+                    std::rethrow_exception(error);
+                }
+                m_host.on_sender_done(result);
+            }));
+#else
+        send_window();
+#endif
+    }
+
+    // Pending operations are cancelled by closing the socket.
+    void stop()
+    {
+        m_stopped = true;
+        stop_timer();
+    }
+
+    // Packets from other sources than the one of the packet being processed
+    // are ignored from now on.
+    void confirm_peer()
+    {
+        m_peer = m_source;
+        m_peer_confirmed = true;
+    }
+
+    // Window packets are referenced by a pending send.
+    bool is_sending() const
+    {
+        return m_sending;
+    }
+
+    std::size_t get_retransmits() const
+    {
+        return m_retransmits;
+    }
+
+    // ACKs not advancing the window, e.g. duplicated or answering a resent window.
+    std::size_t get_ignored_acks() const
+    {
+        return m_ignored_acks;
+    }
+
+    // From a window sent to the ACK advancing it.
+    const round_trip_stats& get_round_trips() const
+    {
+        return m_round_trips;
+    }
+
+    // Error of the failed send or receive.
+    const asio::error_code& get_error() const
+    {
+        return m_error;
+    }
+
+private:
+    // Packet is referenced in the receive buffer of the thread.
+    ack_result process_packet(const asio::ip::udp::endpoint& source, std::size_t bytes_received)
+    {
+        if (m_peer_confirmed && (source != m_peer))
+        {
+            log_warning() << "Received packet from unexpected source: " << source << std::endl;
+            return ack_result::IGNORED;
+        }
+
+        if (m_ack_deferred && (source != m_source))
+        {
+            // the deferred ACK is processed with the source it came from
+            log_warning() << "Received packet from another source than the deferred ACK: " << source << std::endl;
+            return ack_result::IGNORED;
+        }
+
+        asio::const_buffer packet(receive_buffer::data(), bytes_received);
+
+        // ACKs are parsed in place
+        std::uint16_t op = 0;
+        std::uint16_t block_no = 0;
+        if (packet_parser::parse_block_header(packet, op, block_no) && (op == OP_ACK))
+        {
+            log_debug() << "ACK received: " << block_no << std::endl;
+
+            if (m_sending)
+            {
+                // packets are referenced by the pending send, handle when it completes
+                m_ack_deferred = true;
+                m_deferred_ack_id = block_no;
+                m_source = source;
+                return ack_result::IGNORED;
+            }
+
+            m_source = source;
+            return acknowledge(block_no);
+        }
+
+        m_source = source;
+        return m_host.process_other_packet(packet);
+    }
+
+    ack_result acknowledge(std::uint16_t block_no)
+    {
+        auto result = m_host.acknowledge(block_no);
+        if (result == ack_result::IGNORED)
+        {
+            ++m_ignored_acks;
+            return result;
+        }
+
+        if ((result != ack_result::FAILED) && !m_window_resent)
+        {
+            m_round_trips.add(std::chrono::duration_cast<std::chrono::microseconds>(
+                transfer_timer::clock_type::now() - m_window_sent_time));
+        }
+        m_window_resent = false;
+        return result;
+    }
+
+    // A wait already completed when the timer is stopped is ignored, as its
+    // id is no longer current.
+    void start_timer()
+    {
+        auto wait_id = ++m_wait_id;
+        m_timed_out = false;
+        m_timer.expires_after(m_timeout);
+        m_timer.async_wait(m_host.track([this, wait_id](const asio::error_code& ec) {
+            if ((ec == asio::error::operation_aborted) || (wait_id != m_wait_id))
+            {
+                // ignore, cancelled
+                return;
+            }
+            if (ec)
+            {
+                log_error() << "Timer error: " << ec << std::endl;
+                return;
+            }
+            on_timeout();
+        }));
+    }
+
+    void stop_timer()
+    {
+        ++m_wait_id;
+        m_timer.cancel();
+    }
+
+#if defined(OCTNET_TFTP_WITH_COROUTINES)
+    asio::awaitable<status> run()
+    {
+        m_socket.non_blocking(true, m_error);
+        if (m_error)
+        {
+            co_return get_failure_status();
+        }
+
+        while (true)
+        {
+            m_sending = true;
+            m_window_sent_time = transfer_timer::clock_type::now();
+            for (std::size_t i = 0; i < m_window.size(); ++i)
+            {
+                // sent directly unless the socket buffer is full, saving a suspension per packet
+                const auto& packet_data = m_window[i];
+                asio::const_buffer packet(packet_data.data(), packet_data.size());
+                m_socket.send_to(packet, m_peer, 0, m_error);
+                if (m_error == asio::error::would_block)
+                {
+                    co_await m_socket.async_send_to(
+                        packet, m_peer, asio::redirect_error(asio::use_awaitable, m_error));
+                }
+                if (m_error)
+                {
+                    co_return get_failure_status();
+                }
+            }
+            m_sending = false;
+
+            auto result = ack_result::IGNORED;
+            start_timer();
+            while ((result == ack_result::IGNORED) && !m_timed_out)
+            {
+                asio::ip::udp::endpoint source;
+                auto bytes_received = receive_buffer::receive(m_socket, source, m_error);
+                if (m_error == asio::error::would_block)
+                {
+                    // no receive buffer is held while waiting
+                    co_await m_socket.async_wait(
+                        asio::socket_base::wait_read, asio::redirect_error(asio::use_awaitable, m_error));
+                    if ((m_error == asio::error::operation_aborted) && m_timed_out && !m_stopped)
+                    {
+                        break;
+                    }
+                    if (!m_error)
+                    {
+                        continue;
+                    }
+                }
+                if (m_error)
+                {
+                    stop_timer();
+                    co_return get_failure_status();
+                }
+
+                result = process_packet(source, bytes_received);
+                if (m_stopped)
+                {
+                    co_return status::STOPPED;
+                }
+            }
+            stop_timer();
+
+            switch (result)
+            {
+            case ack_result::COMPLETE:
+                co_return status::COMPLETE;
+
+            case ack_result::FAILED:
+                co_return status::STOPPED;
+
+            case ack_result::ADVANCED:
+                m_retry_counter = m_retry_count;
+                break;
+
+            case ack_result::IGNORED:
+                // timed out
+                if (--m_retry_counter <= 0)
+                {
+                    co_return status::TIMEOUT;
+                }
+                ++m_retransmits;
+                m_window_resent = true;
+                break;
+            }
+        }
+    }
+
+    // receive of the coroutine is cancelled
+    void on_timeout()
+    {
+        m_timed_out = true;
+        asio::error_code ignored;
+        m_socket.cancel(ignored);
+    }
+
+    status get_failure_status() const
+    {
+        if ((m_error == asio::error::operation_aborted) || m_stopped)
+        {
+            return status::STOPPED;
+        }
+        return status::NETWORK_ERROR;
+    }
+#else
+    void send_window()
+    {
+        m_send_index = 0;
+        m_sending = true;
+        m_window_sent_time = transfer_timer::clock_type::now();
+
+        send_next_window_packet();
+    }
+
+    void send_next_window_packet()
+    {
+        const auto& packet_data = m_window[m_send_index];
+
+        m_socket.async_send_to(asio::const_buffer(packet_data.data(), packet_data.size()), m_peer,
+            m_host.track([this](const asio::error_code& ec, std::size_t bytes_transferred) {
+                on_packet_sent(ec, bytes_transferred);
+            }));
+    }
+
+    void on_packet_sent(const asio::error_code& ec, std::size_t bytes_transferred)
+    {
+        if ((ec == asio::error::operation_aborted) || m_stopped)
+        {
+            // ignore, cancelled or completed before the stop
+            return;
+        }
+
+        if (ec)
+        {
+            finish(status::NETWORK_ERROR, ec);
+            return;
+        }
+
+        log_debug() << "Packet sent: " << bytes_transferred << std::endl;
+
+        if (m_ack_deferred)
+        {
+            m_sending = false;
+            m_ack_deferred = false;
+            if (advance(acknowledge(m_deferred_ack_id)))
+            {
+                return;
+            }
+            m_sending = true;
+        }
+
+        if (++m_send_index < m_window.size())
+        {
+            send_next_window_packet();
+            return;
+        }
+
+        m_sending = false;
+
+        start_timer();
+        receive_packets();
+    }
+
+    // Processes the pending packets and waits for the socket to become
+    // readable, no receive buffer is held while waiting.
+    void receive_packets()
+    {
+        while (!m_receive_pending && !m_stopped)
+        {
+            asio::ip::udp::endpoint source;
+            asio::error_code ec;
+            auto bytes_received = receive_buffer::receive(m_socket, source, ec);
+            if (ec == asio::error::would_block)
+            {
+                wait_readable();
+                return;
+            }
+
+            if (ec)
+            {
+                finish(status::NETWORK_ERROR, ec);
+                return;
+            }
+
+            log_debug() << "Packet received: " << bytes_received << std::endl;
+
+            advance(process_packet(source, bytes_received));
+        }
+    }
+
+    void wait_readable()
+    {
+        m_receive_pending = true;
+        m_socket.async_wait(asio::socket_base::wait_read,
+            m_host.track([this](const asio::error_code& ec) { on_socket_readable(ec); }));
+    }
+
+    void on_socket_readable(const asio::error_code& ec)
+    {
+        m_receive_pending = false;
+
+        if ((ec == asio::error::operation_aborted) || m_stopped)
+        {
+            // ignore, cancelled or completed before the stop
+            return;
+        }
+
+        if (ec)
+        {
+            finish(status::NETWORK_ERROR, ec);
+            return;
+        }
+
+        receive_packets();
+    }
+
+    // False if the window did not change.
+    bool advance(ack_result result)
+    {
+        switch (result)
+        {
+        case ack_result::IGNORED:
+            return false;
+
+        case ack_result::ADVANCED:
+            // remaining packets of a partially acked window are resent together with new ones
+            stop_timer();
+            m_retry_counter = m_retry_count;
+            send_window();
+            return true;
+
+        case ack_result::COMPLETE:
+            finish(status::COMPLETE, asio::error_code());
+            return true;
+
+        case ack_result::FAILED:
+            stop_timer();
+            return true;
+        }
+        return false;
+    }
+
+    void on_timeout()
+    {
+        if (--m_retry_counter > 0)
+        {
+            ++m_retransmits;
+            m_window_resent = true;
+            send_window();
+        }
+        else
+        {
+            finish(status::TIMEOUT, asio::error_code());
+        }
+    }
+
+    void finish(status result, const asio::error_code& ec)
+    {
+        m_error = ec;
+        stop_timer();
+        m_host.on_sender_done(result);
+    }
+#endif
+
+    host_T& m_host;
+    udp_socket& m_socket;
+    packet_window& m_window;
+
+    transfer_timer m_timer;
+
+    asio::ip::udp::endpoint& m_peer;
+    bool m_peer_confirmed;
+    // source of the packet being processed or of the deferred ACK
+    asio::ip::udp::endpoint m_source;
+
+    int m_retry_count;
+    std::chrono::seconds m_timeout;
+    int m_retry_counter;
+    std::size_t m_wait_id;
+    bool m_timed_out;
+
+    std::size_t m_send_index;
+    bool m_sending;
+    bool m_ack_deferred;
+    std::uint16_t m_deferred_ack_id;
+
+    bool m_receive_pending;
+    bool m_stopped;
+
+    std::size_t m_retransmits;
+    std::size_t m_ignored_acks;
+    transfer_timer::time_point m_window_sent_time;
+    // round trip of the window is not measured
+    bool m_window_resent;
+    round_trip_stats m_round_trips;
+    asio::error_code m_error;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
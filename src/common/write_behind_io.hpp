@@ -0,0 +1,254 @@
+#pragma once
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "background_executor.hpp"
+#include "io.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Collects written data into chunks which are written to the peer writer by
+// the background executor, so write() returns once the data are in memory.
+// It is not ready once memory_limit bytes are buffered, the caller waits for
+// it with async_wait_ready() (write() does not block, the limit could be
+// exceeded by the data received meanwhile). The peer is closed by the
+// executor too with async_close(), close() blocks until the data are written.
+// Peer write failure is reported by the next write() or by the close.
+class write_behind_writer : public writer
+{
+public:
+    static const std::size_t MAX_CHUNK_SIZE = 1024 * 1024;
+
+    write_behind_writer(const write_behind_writer&) = delete;
+    write_behind_writer& operator=(const write_behind_writer&) = delete;
+
+    write_behind_writer(std::unique_ptr<writer> peer_writer, background_executor& executor, std::size_t memory_limit)
+        : m_peer_writer(std::move(peer_writer))
+        , m_executor(executor)
+        , m_memory_limit(memory_limit)
+        , m_chunk_size(std::max<std::size_t>(std::min(memory_limit / 2, static_cast<std::size_t>(MAX_CHUNK_SIZE)), 1))
+        , m_buffered_size(0)
+        , m_flushing(false)
+        , m_closing(false)
+        , m_failed(false)
+        , m_aborted(false)
+    {
+        m_chunk.reserve(m_chunk_size);
+    }
+
+    ~write_behind_writer()
+    {
+        // queued job references this writer, its handlers are not called anymore
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_aborted = true;
+        m_flushed.wait(lock, [this]() { return !m_flushing; });
+    }
+
+    bool is_open() const final
+    {
+        return m_peer_writer->is_open();
+    }
+
+    bool write(const void* buffer, const std::size_t bytes_count) final
+    {
+        if (has_failed())
+        {
+            return false;
+        }
+
+        auto data = reinterpret_cast<const std::uint8_t*>(buffer);
+        m_chunk.insert(m_chunk.end(), data, data + bytes_count);
+        if (m_chunk.size() >= m_chunk_size)
+        {
+            return submit_chunk();
+        }
+        return true;
+    }
+
+    bool close() final
+    {
+        if (!m_chunk.empty() && !submit_chunk())
+        {
+            return false;
+        }
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_flushed.wait(lock, [this]() { return !m_flushing; });
+            if (m_failed)
+            {
+                // peer is not closed, incomplete file is discarded with it
+                return false;
+            }
+        }
+
+        return m_peer_writer->close();
+    }
+
+    bool is_ready() const final
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_failed || (m_buffered_size < m_memory_limit);
+    }
+
+    void async_wait_ready(std::function<void(bool)> handler) final
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (m_failed || (m_buffered_size < m_memory_limit))
+        {
+            bool ready = !m_failed;
+            lock.unlock();
+            handler(ready);
+            return;
+        }
+
+        m_ready_handler = std::move(handler);
+    }
+
+    // Remaining data are written, the peer is closed (e.g. synced and renamed)
+    // and the handler called by the executor.
+    void async_close(std::function<void(bool)> handler) final
+    {
+        if (!m_chunk.empty() && !submit_chunk())
+        {
+            handler(false);
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closing = true;
+        m_close_handler = std::move(handler);
+        start_flush();
+    }
+
+private:
+    bool has_failed()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_failed;
+    }
+
+    bool submit_chunk()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_failed)
+        {
+            return false;
+        }
+
+        m_buffered_size += m_chunk.size();
+        m_pending_chunks.push_back(std::move(m_chunk));
+        m_chunk = std::vector<std::uint8_t>();
+        m_chunk.reserve(m_chunk_size);
+
+        start_flush();
+        return true;
+    }
+
+    // called locked
+    void start_flush()
+    {
+        if (!m_flushing)
+        {
+            m_flushing = true;
+            m_executor.post([this]() { flush_pending(); });
+        }
+    }
+
+    // run by the executor, chunks are written in order by a single job
+    void flush_pending()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+
+        while (!m_pending_chunks.empty() && !m_failed && !m_aborted)
+        {
+            auto chunk = std::move(m_pending_chunks.front());
+            m_pending_chunks.pop_front();
+
+            lock.unlock();
+            bool written = m_peer_writer->write(chunk.data(), chunk.size());
+            lock.lock();
+
+            m_buffered_size -= chunk.size();
+            m_failed |= !written;
+            m_flushed.notify_all();
+
+            if (m_ready_handler && (m_failed || (m_buffered_size < m_memory_limit)) && !m_aborted)
+            {
+                call_handler(m_ready_handler, !m_failed);
+            }
+        }
+
+        m_pending_chunks.clear();
+        m_buffered_size = 0;
+
+        if (m_ready_handler && !m_aborted)
+        {
+            call_handler(m_ready_handler, !m_failed);
+        }
+
+        if (m_closing && !m_aborted)
+        {
+            m_closing = false;
+
+            bool closed = false;
+            if (!m_failed)
+            {
+                lock.unlock();
+                closed = m_peer_writer->close();
+                lock.lock();
+            }
+            if (!m_aborted)
+            {
+                call_handler(m_close_handler, closed);
+            }
+        }
+
+        m_flushing = false;
+        m_flushed.notify_all();
+    }
+
+    // called locked, the handler only posts the completion
+    static void call_handler(std::function<void(bool)>& handler, bool result)
+    {
+        auto called_handler = std::move(handler);
+        handler = nullptr;
+        called_handler(result);
+    }
+
+    std::unique_ptr<writer> m_peer_writer;
+    background_executor& m_executor;
+    const std::size_t m_memory_limit;
+    const std::size_t m_chunk_size;
+
+    // filled by write(), not shared with the executor
+    std::vector<std::uint8_t> m_chunk;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_flushed;
+    std::deque<std::vector<std::uint8_t>> m_pending_chunks;
+    std::size_t m_buffered_size;
+    bool m_flushing;
+    bool m_closing;
+    bool m_failed;
+    bool m_aborted;
+
+    std::function<void(bool)> m_ready_handler;
+    std::function<void(bool)> m_close_handler;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
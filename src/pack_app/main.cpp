@@ -0,0 +1,7 @@
+#include "pack_app.hpp"
+
+int main(int argc, char* argv[])
+{
+    oct::net::tftp::pack_app app(argc, argv);
+    return app.run();
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "log.hpp"
+#include "pack_builder.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Builds a pack of a directory tree, served by the server given as its root.
+class pack_app
+{
+public:
+    pack_app(int argc, char* argv[])
+        : m_program_name(argv[0])
+        , m_argc(argc)
+        , m_argv(argv)
+    {
+        // noop
+    }
+
+    int run()
+    {
+        pack_builder builder;
+        std::vector<std::string> arguments;
+        log_level level = log_level::WARNING;
+
+        for (int i = 1; i < m_argc; ++i)
+        {
+            std::string arg = m_argv[i];
+
+            if ((arg == "-h") || (arg == "--help"))
+            {
+                print_usage(std::cout);
+                return EXIT_SUCCESS;
+            }
+            if ((arg == "--netascii") || (arg == "--log-level"))
+            {
+                if (i + 1 >= m_argc)
+                {
+                    log_error() << "missing value for: " << arg << std::endl;
+                    print_usage(std::cerr);
+                    return EXIT_FAILURE;
+                }
+
+                std::string value = m_argv[++i];
+                if (arg == "--netascii")
+                {
+                    builder.add_netascii_pattern(value);
+                }
+                else if (!logger::parse_level(value, level))
+                {
+                    log_error() << "invalid value for " << arg << ": " << value << std::endl;
+                    return EXIT_FAILURE;
+                }
+                continue;
+            }
+            if (arg.compare(0, 1, "-") == 0)
+            {
+                log_error() << "unknown option: " << arg << std::endl;
+                print_usage(std::cerr);
+                return EXIT_FAILURE;
+            }
+
+            arguments.push_back(arg);
+        }
+
+        if (arguments.size() != 2)
+        {
+            print_usage(std::cerr);
+            return EXIT_FAILURE;
+        }
+
+        logger::set_level(level);
+
+        std::uint64_t pack_size = 0;
+        if (!builder.add_directory(arguments[0]) || !builder.write(arguments[1], pack_size))
+        {
+            return EXIT_FAILURE;
+        }
+
+        std::cout << arguments[1] << ": " << builder.get_files_count() << " files, " << pack_size << " bytes"
+                  << std::endl;
+        return EXIT_SUCCESS;
+    }
+
+private:
+    void print_usage(std::ostream& stream) const
+    {
+        stream << "Usage: " << m_program_name << " [options] DIRECTORY PACK\n"
+               << "\n"
+               << "Options:\n"
+               << "  -h, --help                  print this message\n"
+               << "  --netascii PATTERN          store files matching the pattern also converted to netascii,\n"
+               << "                              could be repeated, e.g. 'pxelinux.cfg/*'\n"
+               << "  --log-level LEVEL           error, warning, info or debug (default: warning)\n";
+    }
+
+    const char* m_program_name;
+    int m_argc;
+    char** m_argv;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,342 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "file_io.hpp"
+#include "log.hpp"
+#include "make_unique.hpp"
+#include "netascii_io.hpp"
+#include "pack_archive.hpp"
+#include "string_utils.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Builds a pack (see pack_archive) of the regular files below a directory.
+class pack_builder
+{
+public:
+    static const std::size_t COPY_BUFFER_SIZE = 256 * 1024;
+
+    pack_builder()
+        : m_files()
+        , m_netascii_patterns()
+    {
+        // noop
+    }
+
+    // Files with path matching any of the patterns get a pre-encoded netascii variant.
+    void add_netascii_pattern(const std::string& pattern)
+    {
+        m_netascii_patterns.push_back(pattern);
+    }
+
+    // Symlinked files are stored as regular ones, symlinked directories are skipped.
+    bool add_directory(const std::string& root_path)
+    {
+        return add_directory(root_path, std::string());
+    }
+
+    std::size_t get_files_count() const
+    {
+        return m_files.size();
+    }
+
+    // Writes to a temporary file renamed to the pack path when complete.
+    bool write(const std::string& pack_path, std::uint64_t& pack_size)
+    {
+        for (auto& file : m_files)
+        {
+            if (file.m_netascii && !get_netascii_size(file))
+            {
+                return false;
+            }
+        }
+
+        pack_format::header header;
+        std::vector<std::uint8_t> index = build_index(header);
+
+        auto temp_path = pack_path + ".tmp";
+        file_writer output(::open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+        if (!output.is_open())
+        {
+            log_error() << "Cannot create " << temp_path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        std::uint64_t position = index.size();
+        bool success = output.write(index.data(), index.size());
+        for (std::size_t i = 0; success && (i < m_files.size()); ++i)
+        {
+            auto& entry = m_files[i].m_entry;
+            success = pad(output, position, entry.m_data_offset) && copy_file(output, m_files[i], false, position);
+            if (success && (entry.m_flags & pack_format::ENTRY_FLAG_NETASCII))
+            {
+                success = pad(output, position, entry.m_netascii_offset)
+                    && copy_file(output, m_files[i], true, position);
+            }
+        }
+
+        if (!output.close() || !success)
+        {
+            log_error() << "Cannot write " << temp_path << std::endl;
+            ::unlink(temp_path.c_str());
+            return false;
+        }
+        if (std::rename(temp_path.c_str(), pack_path.c_str()) != 0)
+        {
+            log_error() << "Cannot rename " << temp_path << ": " << std::strerror(errno) << std::endl;
+            ::unlink(temp_path.c_str());
+            return false;
+        }
+
+        pack_size = position;
+        return true;
+    }
+
+private:
+    struct source_file
+    {
+        source_file()
+            : m_path()
+            , m_full_path()
+            , m_netascii(false)
+            , m_entry()
+        {
+            // noop
+        }
+
+        std::string m_path;
+        std::string m_full_path;
+        bool m_netascii;
+        pack_format::entry m_entry;
+    };
+
+    bool add_directory(const std::string& root_path, const std::string& dir)
+    {
+        auto dir_path = dir.empty() ? root_path : root_path + '/' + dir;
+        std::unique_ptr<DIR, int (*)(DIR*)> dir_stream(::opendir(dir_path.c_str()), &::closedir);
+        if (!dir_stream)
+        {
+            log_error() << "Cannot open directory " << dir_path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        while (auto dir_entry = ::readdir(dir_stream.get()))
+        {
+            std::string name = dir_entry->d_name;
+            if ((name == ".") || (name == ".."))
+            {
+                continue;
+            }
+
+            source_file file;
+            file.m_path = dir.empty() ? name : dir + '/' + name;
+            file.m_full_path = root_path + '/' + file.m_path;
+
+            struct stat file_stat;
+            if (::lstat(file.m_full_path.c_str(), &file_stat) != 0)
+            {
+                log_error() << "Cannot stat " << file.m_full_path << ": " << std::strerror(errno) << std::endl;
+                return false;
+            }
+            if (S_ISDIR(file_stat.st_mode))
+            {
+                if (!add_directory(root_path, file.m_path))
+                {
+                    return false;
+                }
+                continue;
+            }
+            if (S_ISLNK(file_stat.st_mode) && (::stat(file.m_full_path.c_str(), &file_stat) != 0))
+            {
+                log_warning() << "Dangling symlink skipped: " << file.m_full_path << std::endl;
+                continue;
+            }
+            if (!S_ISREG(file_stat.st_mode))
+            {
+                continue;
+            }
+
+            file.m_entry.m_hash = pack_format::hash_path(file.m_path.data(), file.m_path.size());
+            file.m_entry.m_data_size = static_cast<std::uint64_t>(file_stat.st_size);
+            file.m_netascii = is_netascii_path(file.m_path);
+            m_files.push_back(file);
+        }
+
+        return true;
+    }
+
+    bool is_netascii_path(const std::string& path) const
+    {
+        std::vector<std::string> captures;
+        for (auto& pattern : m_netascii_patterns)
+        {
+            if (glob_match(pattern, path, captures))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool get_netascii_size(source_file& file)
+    {
+        netascii_encoder<file_reader> reader(file.m_full_path);
+
+        std::vector<std::uint8_t> buffer(COPY_BUFFER_SIZE);
+        std::uint64_t size = 0;
+        std::size_t bytes_read = 0;
+        do
+        {
+            if (!reader.read(buffer.data(), buffer.size(), bytes_read))
+            {
+                log_error() << "Cannot read " << file.m_full_path << std::endl;
+                return false;
+            }
+            size += bytes_read;
+        } while (bytes_read > 0);
+
+        file.m_entry.m_flags |= pack_format::ENTRY_FLAG_NETASCII;
+        file.m_entry.m_netascii_size = size;
+        return true;
+    }
+
+    static std::uint64_t align(std::uint64_t offset)
+    {
+        return (offset + pack_format::ALIGNMENT - 1) / pack_format::ALIGNMENT * pack_format::ALIGNMENT;
+    }
+
+    // Sorts the files by bucket and lays out the pack, returns all before the data.
+    std::vector<std::uint8_t> build_index(pack_format::header& header)
+    {
+        header.m_entries_count = m_files.size();
+        header.m_buckets_count = std::max<std::uint64_t>(m_files.size(), 1);
+
+        auto buckets_count = header.m_buckets_count;
+        std::sort(m_files.begin(), m_files.end(), [buckets_count](const source_file& a, const source_file& b) {
+            return std::make_tuple(a.m_entry.m_hash % buckets_count, a.m_entry.m_hash, std::cref(a.m_path))
+                < std::make_tuple(b.m_entry.m_hash % buckets_count, b.m_entry.m_hash, std::cref(b.m_path));
+        });
+
+        std::string strings;
+        for (auto& file : m_files)
+        {
+            file.m_entry.m_path_offset = strings.size();
+            file.m_entry.m_path_size = static_cast<std::uint32_t>(file.m_path.size());
+            strings += file.m_path;
+        }
+
+        header.m_buckets_offset = pack_format::HEADER_SIZE;
+        header.m_entries_offset = header.m_buckets_offset + (header.m_buckets_count + 1) * pack_format::BUCKET_SIZE;
+        header.m_strings_offset = header.m_entries_offset + header.m_entries_count * pack_format::ENTRY_SIZE;
+        header.m_strings_size = strings.size();
+
+        auto offset = header.m_strings_offset + header.m_strings_size;
+        for (auto& file : m_files)
+        {
+            file.m_entry.m_data_offset = align(offset);
+            offset = file.m_entry.m_data_offset + file.m_entry.m_data_size;
+            if (file.m_entry.m_flags & pack_format::ENTRY_FLAG_NETASCII)
+            {
+                file.m_entry.m_netascii_offset = align(offset);
+                offset = file.m_entry.m_netascii_offset + file.m_entry.m_netascii_size;
+            }
+        }
+
+        std::vector<std::uint8_t> index(static_cast<std::size_t>(header.m_strings_offset));
+        pack_format::encode_header(header, index.data());
+
+        std::uint64_t bucket = 0;
+        for (std::uint64_t i = 0; i < m_files.size(); ++i)
+        {
+            // buckets up to and including the one of the file start at it
+            for (; bucket <= m_files[i].m_entry.m_hash % buckets_count; ++bucket)
+            {
+                pack_format::store_uint(index.data() + header.m_buckets_offset + bucket * pack_format::BUCKET_SIZE, i,
+                    pack_format::BUCKET_SIZE);
+            }
+            pack_format::encode_entry(
+                m_files[i].m_entry, index.data() + header.m_entries_offset + i * pack_format::ENTRY_SIZE);
+        }
+        for (; bucket <= buckets_count; ++bucket)
+        {
+            pack_format::store_uint(index.data() + header.m_buckets_offset + bucket * pack_format::BUCKET_SIZE,
+                m_files.size(), pack_format::BUCKET_SIZE);
+        }
+
+        index.insert(index.end(), strings.begin(), strings.end());
+        return index;
+    }
+
+    static bool pad(writer& output, std::uint64_t& position, std::uint64_t offset)
+    {
+        static const std::uint8_t zeros[pack_format::ALIGNMENT] = {};
+
+        auto length = static_cast<std::size_t>(offset - position);
+        position = offset;
+        return output.write(zeros, length);
+    }
+
+    // Fails if the file size changed since it was added.
+    static bool copy_file(writer& output, const source_file& file, bool netascii, std::uint64_t& position)
+    {
+        std::unique_ptr<reader> input = stdext::make_unique<file_reader>(file.m_full_path);
+        if (!input->is_open())
+        {
+            log_error() << "Cannot open " << file.m_full_path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        if (netascii)
+        {
+            input = stdext::make_unique<netascii_reader>(std::move(input));
+        }
+
+        auto expected_size = netascii ? file.m_entry.m_netascii_size : file.m_entry.m_data_size;
+
+        std::vector<std::uint8_t> buffer(COPY_BUFFER_SIZE);
+        std::uint64_t size = 0;
+        std::size_t bytes_read = 0;
+        do
+        {
+            if (!input->read(buffer.data(), buffer.size(), bytes_read) || !output.write(buffer.data(), bytes_read))
+            {
+                log_error() << "Cannot copy " << file.m_full_path << std::endl;
+                return false;
+            }
+            size += bytes_read;
+        } while ((bytes_read > 0) && (size <= expected_size));
+
+        if (size != expected_size)
+        {
+            log_error() << "File changed while packed: " << file.m_full_path << std::endl;
+            return false;
+        }
+
+        position += size;
+        return true;
+    }
+
+    std::vector<source_file> m_files;
+    std::vector<std::string> m_netascii_patterns;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
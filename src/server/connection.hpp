@@ -1,9 +1,20 @@
 #pragma once
 
+#include <chrono>
+#include <cstddef>
 #include <memory>
 
 #include <asio.hpp>
 
+#include "defs.hpp"
+#include "handler_owner.hpp"
+#include "log.hpp"
+#include "make_unique.hpp"
+#include "packet.hpp"
+#include "request_handler.hpp"
+#include "transfer_stats.hpp"
+#include "transport.hpp"
+
 namespace oct
 {
 namespace net
@@ -11,22 +22,176 @@ namespace net
 namespace tftp
 {
 
-class connection : public std::enable_shared_from_this<connection>
+// Transfer run by a single worker. Its handlers capture it by a raw pointer,
+// the registry of the request handler keeps it until it is terminated and
+// none of them is pending. A transfer making no progress for longer than its
+// idle limit is reaped by the periodic sweep of its worker.
+class connection : public handler_owner
 {
-protected:
 public:
-    virtual ~connection() = default;
+    connection(request_handler& handler, asio::io_context& io_context, const asio::ip::udp::endpoint& client_endpoint)
+        : handler_owner()
+        , m_client_endpoint(client_endpoint)
+        , m_counters()
+        , m_record()
+        , m_handler(handler)
+        , m_io_context(io_context)
+        , m_registry_index(0)
+        , m_sweep_index(0)
+        , m_idle_limit(std::chrono::seconds(MAX_RETRY_TIMEOUT_SEC * (DEFAULT_RETRY_COUNTER + 1)))
+        , m_idle_since(transfer_timer::clock_type::now())
+        , m_idle_blocks(0)
+    {
+        // noop
+    }
 
     virtual void start() = 0;
 
+    // Closes the socket and cancels the timer, pending handlers complete as cancelled.
     virtual void stop() = 0;
 
+    // Stops the connection, released by the request handler once drained.
+    void terminate()
+    {
+        if (is_finished())
+        {
+            return;
+        }
+
+        stop();
+        m_counters.finish();
+        finish();
+    }
+
+    asio::io_context& get_io_context()
+    {
+        return m_io_context;
+    }
+
+    // Record of the transfer log is filled by the connection, called before the start.
+    void keep_record()
+    {
+        m_record = stdext::make_unique<transfer_stats>();
+    }
+
+    // Null unless kept, complete once the connection is released.
+    std::unique_ptr<transfer_stats> take_record()
+    {
+        if (m_record)
+        {
+            m_record->m_counters = m_counters;
+        }
+        return std::move(m_record);
+    }
+
+    // Terminates the transfer if no block was transferred for longer than its
+    // idle limit, e.g. stuck on a send that never completes. Run by its worker,
+    // true if reaped.
+    bool reap_if_idle()
+    {
+        if (is_finished())
+        {
+            return false;
+        }
+
+        auto now = transfer_timer::clock_type::now();
+        if (m_counters.m_blocks != m_idle_blocks)
+        {
+            m_idle_blocks = m_counters.m_blocks;
+            m_idle_since = now;
+            return false;
+        }
+        if (now - m_idle_since < m_idle_limit)
+        {
+            return false;
+        }
+
+        log_warning() << "Idle transfer reaped: " << m_client_endpoint << std::endl;
+        m_counters.set_end_reason(transfer_counters::end_reason::REAPED);
+        // released by the call if none of its handlers is pending, not used afterwards
+        terminate();
+        return true;
+    }
+
+    // Slot of the connection in the registry of the request handler.
+    std::size_t get_registry_index() const
+    {
+        return m_registry_index;
+    }
+
+    void set_registry_index(std::size_t index)
+    {
+        m_registry_index = index;
+    }
+
+    // Position of the connection in the sweep of its worker.
+    std::size_t get_sweep_index() const
+    {
+        return m_sweep_index;
+    }
+
+    void set_sweep_index(std::size_t index)
+    {
+        m_sweep_index = index;
+    }
+
 protected:
-    template <class derived_T>
-    std::shared_ptr<derived_T> shared_from_base()
+    // Binds the socket to the address the request was received on, so the
+    // replies come from the address the client sent the request to.
+    static void open_socket(udp_socket& socket, const asio::ip::address& local_address,
+        const asio::ip::udp::endpoint& remote_endpoint)
     {
-        return std::static_pointer_cast<derived_T>(shared_from_this());
+        asio::ip::udp::endpoint local_endpoint(local_address, 0);
+        if (local_address.is_unspecified() || (local_address.is_v6() != remote_endpoint.address().is_v6()))
+        {
+            local_endpoint = asio::ip::udp::endpoint(remote_endpoint.protocol(), 0);
+        }
+
+        socket.open(local_endpoint.protocol());
+        socket.set_option(asio::socket_base::reuse_address(true));
+        socket.bind(local_endpoint);
     }
+
+    // Set once the options are negotiated, the retransmissions of a live
+    // transfer end before it.
+    void set_idle_limit(std::chrono::seconds timeout, int retry_count)
+    {
+        m_idle_limit = timeout * (retry_count + 1);
+    }
+
+    // Request part of the record, if kept.
+    void start_record(const packet_file_req& request_packet)
+    {
+        if (m_record)
+        {
+            m_record->m_op = request_packet.m_op;
+            m_record->m_client = m_client_endpoint;
+            m_record->m_filename = request_packet.m_filename;
+            m_record->m_mode = request_packet.m_mode;
+        }
+    }
+
+    // peer of the window sender or block receiver, confirmed from the start
+    asio::ip::udp::endpoint m_client_endpoint;
+    transfer_counters m_counters;
+    // only when the transfer is logged
+    std::unique_ptr<transfer_stats> m_record;
+
+private:
+    void release() final
+    {
+        m_handler.connection_released(*this);
+    }
+
+    request_handler& m_handler;
+    asio::io_context& m_io_context;
+    std::size_t m_registry_index;
+    std::size_t m_sweep_index;
+
+    transfer_timer::duration m_idle_limit;
+    transfer_timer::time_point m_idle_since;
+    // blocks transferred when checked last
+    std::uint64_t m_idle_blocks;
 };
 
 } // namespace tftp
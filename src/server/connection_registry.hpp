@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "connection.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Owns the running connections in a slot map: a connection keeps the index of
+// its slot, so it is added and removed in constant time, and freed slots are
+// reused. Not synchronized, the owner locks it.
+class connection_registry
+{
+public:
+    connection_registry()
+        : m_slots()
+        , m_free_index(NO_INDEX)
+        , m_size(0)
+    {
+        // noop
+    }
+
+    void add(std::shared_ptr<connection> new_connection)
+    {
+        std::size_t index = m_free_index;
+        if (index != NO_INDEX)
+        {
+            m_free_index = m_slots[index].m_next_free_index;
+        }
+        else
+        {
+            index = m_slots.size();
+            m_slots.emplace_back();
+        }
+
+        new_connection->set_registry_index(index);
+        m_slots[index].m_connection = std::move(new_connection);
+        ++m_size;
+    }
+
+    // Null if not registered.
+    std::shared_ptr<connection> remove(const connection& registered_connection)
+    {
+        auto index = registered_connection.get_registry_index();
+        if ((index >= m_slots.size()) || (m_slots[index].m_connection.get() != &registered_connection))
+        {
+            return nullptr;
+        }
+
+        auto& slot = m_slots[index];
+        auto removed = std::move(slot.m_connection);
+        slot.m_connection = nullptr;
+        slot.m_next_free_index = m_free_index;
+        m_free_index = index;
+        --m_size;
+        return removed;
+    }
+
+    std::size_t size() const
+    {
+        return m_size;
+    }
+
+    template <class function_T>
+    void for_each(function_T function) const
+    {
+        for (auto& slot : m_slots)
+        {
+            if (slot.m_connection)
+            {
+                function(slot.m_connection);
+            }
+        }
+    }
+
+private:
+    static const std::size_t NO_INDEX = std::numeric_limits<std::size_t>::max();
+
+    struct slot
+    {
+        slot()
+            : m_connection()
+            , m_next_free_index(NO_INDEX)
+        {
+            // noop
+        }
+
+        std::shared_ptr<connection> m_connection;
+        std::size_t m_next_free_index;
+    };
+
+    std::vector<slot> m_slots;
+    // head of the list of free slots
+    std::size_t m_free_index;
+    std::size_t m_size;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <memory>
+
+#include <asio.hpp>
+
+#include "packet.hpp"
+#include "server_settings.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Request a connection is created for, with the settings negotiating it and
+// the local address it was received at. Not needed once the connection starts.
+struct connection_request
+{
+    connection_request(std::shared_ptr<const server_settings> settings, std::shared_ptr<const packet_file_req> packet,
+        const asio::ip::address& local_address)
+        : m_settings(settings)
+        , m_packet(packet)
+        , m_local_address(local_address)
+    {
+        // noop
+    }
+
+    std::shared_ptr<const server_settings> m_settings;
+    std::shared_ptr<const packet_file_req> m_packet;
+    asio::ip::address m_local_address;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+struct content_request
+{
+    // requested name without leading slashes
+    std::string m_filename;
+    // text matched by the pattern wildcards, in order
+    std::vector<std::string> m_captures;
+};
+
+// Generates contents of files matched by a filename pattern, see provider_io_manager.
+// Called from worker threads concurrently.
+class content_provider
+{
+public:
+    virtual ~content_provider() = default;
+
+    // Returns false if the file does not exist, it is then looked up by the next providers.
+    virtual bool generate(const content_request& request, std::vector<std::uint8_t>& content) = 0;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -17,6 +17,13 @@ public:
     virtual ~io_manager() = default;
     virtual std::unique_ptr<reader> create_reader(const std::string& filename, const std::string& mode) = 0;
     virtual std::unique_ptr<writer> create_writer(const std::string& filename, const std::string& mode) = 0;
+
+    // Prepares the file to be served without waiting for the disk, e.g. loads it
+    // into a cache, before the server accepts requests. True if the file exists.
+    virtual bool warm_up(const std::string& /*filename*/)
+    {
+        return false;
+    }
 };
 
 } // namespace tftp
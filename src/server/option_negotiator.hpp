@@ -0,0 +1,135 @@
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <string>
+
+#include "defs.hpp"
+#include "io.hpp"
+#include "packet.hpp"
+#include "server_settings.hpp"
+#include "string_utils.hpp"
+#include "transfer_options.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+class option_negotiator
+{
+public:
+    static transfer_options negotiate_read(const packet_file_req& request, const server_settings& settings,
+        reader& reader, std::map<std::string, std::string>& acked_options)
+    {
+        auto options = negotiate_common(request, settings, acked_options);
+
+        std::string value;
+        if (find_option(request, OPTION_TSIZE, value))
+        {
+            std::uint64_t size = 0;
+            if (reader.get_size(size))
+            {
+                options.m_has_transfer_size = true;
+                options.m_transfer_size = size;
+                acked_options[OPTION_TSIZE] = std::to_string(size);
+            }
+        }
+
+        // resumed transfer, ignored if the reader cannot seek or the offset is past the end
+        std::uint64_t offset = 0;
+        std::uint64_t size = 0;
+        if (find_option(request, OPTION_OFFSET, value) && parse_uint64(value, offset)
+            && (offset <= std::numeric_limits<std::uint64_t>::max() / options.m_block_size)
+            && (!reader.get_size(size) || (offset * options.m_block_size <= size))
+            && reader.seek(offset * options.m_block_size))
+        {
+            options.m_block_offset = offset;
+            acked_options[OPTION_OFFSET] = value;
+        }
+
+        std::uint64_t count = 0;
+        if (find_option(request, OPTION_COUNT, value) && parse_uint64(value, count) && (count >= 1))
+        {
+            options.m_has_block_count = true;
+            options.m_block_count = count;
+            acked_options[OPTION_COUNT] = value;
+        }
+
+        return options;
+    }
+
+    static transfer_options negotiate_write(const packet_file_req& request, const server_settings& settings,
+        std::map<std::string, std::string>& acked_options)
+    {
+        auto options = negotiate_common(request, settings, acked_options);
+
+        std::string value;
+        std::uint64_t size = 0;
+        if (find_option(request, OPTION_TSIZE, value) && parse_uint64(value, size))
+        {
+            options.m_has_transfer_size = true;
+            options.m_transfer_size = size;
+            acked_options[OPTION_TSIZE] = value;
+        }
+
+        return options;
+    }
+
+private:
+    static transfer_options negotiate_common(const packet_file_req& request, const server_settings& settings,
+        std::map<std::string, std::string>& acked_options)
+    {
+        transfer_options options;
+        options.m_timeout_sec = settings.m_retry_timeout_sec;
+
+        std::string value;
+        std::uint64_t number = 0;
+
+        // RFC 2348: values outside the valid range cause the option to be ignored
+        if (find_option(request, OPTION_BLKSIZE, value) && parse_uint64(value, number) && (number >= MIN_DATA_SIZE)
+            && (number <= MAX_DATA_SIZE))
+        {
+            options.m_block_size = std::min(static_cast<std::size_t>(number), settings.m_max_block_size);
+            acked_options[OPTION_BLKSIZE] = std::to_string(options.m_block_size);
+        }
+
+        // RFC 2349: server must not change the value
+        if (find_option(request, OPTION_TIMEOUT, value) && parse_uint64(value, number)
+            && (number >= MIN_RETRY_TIMEOUT_SEC) && (number <= MAX_RETRY_TIMEOUT_SEC))
+        {
+            options.m_timeout_sec = static_cast<int>(number);
+            acked_options[OPTION_TIMEOUT] = value;
+        }
+
+        // RFC 7440
+        if (find_option(request, OPTION_WINDOWSIZE, value) && parse_uint64(value, number) && (number >= 1)
+            && (number <= MAX_WINDOW_SIZE))
+        {
+            options.m_window_size = std::min(static_cast<std::uint16_t>(number), settings.m_max_window_size);
+            acked_options[OPTION_WINDOWSIZE] = std::to_string(options.m_window_size);
+        }
+
+        return options;
+    }
+
+    static bool find_option(const packet_file_req& request, const char* name, std::string& value)
+    {
+        for (auto& option : request.m_options)
+        {
+            if (equal_ignore_case(option.first, name))
+            {
+                value = option.second;
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,207 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "content_provider.hpp"
+#include "io_manager.hpp"
+#include "log.hpp"
+#include "make_unique.hpp"
+#include "memory_io.hpp"
+#include "netascii_io.hpp"
+#include "string_utils.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Serves files matching the rule patterns from content providers, other
+// requests are passed to the peer io_manager. The first rule with matching
+// pattern and provider generating the content wins. Generated contents are
+// cached by rule and filename for the rule TTL.
+class provider_io_manager : public io_manager
+{
+public:
+    static const std::size_t MAX_CACHED_ENTRIES = 4096;
+
+    struct rule
+    {
+        rule(const std::string& pattern, std::shared_ptr<content_provider> provider, std::chrono::seconds ttl)
+            : m_pattern(pattern)
+            , m_provider(provider)
+            , m_ttl(ttl)
+        {
+            // noop
+        }
+
+        std::string m_pattern;
+        std::shared_ptr<content_provider> m_provider;
+        // zero disables caching
+        std::chrono::seconds m_ttl;
+    };
+
+    provider_io_manager(io_manager& peer_io_manager)
+        : io_manager()
+        , m_peer_io_manager(peer_io_manager)
+        , m_rules(std::make_shared<std::vector<rule>>())
+        , m_generation(0)
+    {
+        // noop
+    }
+
+    // Replaces the rules, cached contents are dropped.
+    void set_rules(std::vector<rule> rules)
+    {
+        auto new_rules = std::make_shared<std::vector<rule>>(std::move(rules));
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_rules = new_rules;
+        m_cache.clear();
+        ++m_generation;
+    }
+
+    std::unique_ptr<reader> create_reader(const std::string& filename, const std::string& mode) final
+    {
+        content_request request;
+        request.m_filename = filename.substr(std::min(filename.find_first_not_of('/'), filename.size()));
+
+        std::shared_ptr<const std::vector<rule>> rules;
+        std::uint64_t generation = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            rules = m_rules;
+            generation = m_generation;
+        }
+
+        for (auto& rule : *rules)
+        {
+            request.m_captures.clear();
+            if (!glob_match(rule.m_pattern, request.m_filename, request.m_captures))
+            {
+                continue;
+            }
+
+            auto content = get_content(rule, request, generation);
+            if (content)
+            {
+                return create_memory_reader(content, mode);
+            }
+        }
+
+        return m_peer_io_manager.create_reader(filename, mode);
+    }
+
+    std::unique_ptr<writer> create_writer(const std::string& filename, const std::string& mode) final
+    {
+        return m_peer_io_manager.create_writer(filename, mode);
+    }
+
+    bool warm_up(const std::string& filename) final
+    {
+        // generated contents depend on the client
+        return m_peer_io_manager.warm_up(filename);
+    }
+
+private:
+    struct cached_content
+    {
+        std::shared_ptr<const std::vector<std::uint8_t>> m_content;
+        std::chrono::steady_clock::time_point m_expires;
+    };
+
+    static std::unique_ptr<reader> create_memory_reader(
+        std::shared_ptr<const std::vector<std::uint8_t>> content, const std::string& mode)
+    {
+        if (equal_ignore_case(mode, "octet"))
+        {
+            return stdext::make_unique<memory_reader>(content);
+        }
+        if (equal_ignore_case(mode, "netascii"))
+        {
+            return stdext::make_unique<netascii_encoder<memory_reader>>(content);
+        }
+        return nullptr;
+    }
+
+    std::shared_ptr<const std::vector<std::uint8_t>> get_content(
+        const rule& rule, const content_request& request, std::uint64_t generation)
+    {
+        auto now = std::chrono::steady_clock::now();
+        auto key = rule.m_pattern + '\0' + request.m_filename;
+
+        if (rule.m_ttl.count() > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            auto iter = m_cache.find(key);
+            if ((iter != m_cache.end()) && (iter->second.m_expires > now))
+            {
+                return iter->second.m_content;
+            }
+        }
+
+        auto content = std::make_shared<std::vector<std::uint8_t>>();
+        if (!rule.m_provider->generate(request, *content))
+        {
+            return nullptr;
+        }
+
+        log_debug() << "Generated " << request.m_filename << " by rule " << rule.m_pattern << std::endl;
+
+        if (rule.m_ttl.count() > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            // rules were replaced meanwhile
+            if (generation == m_generation)
+            {
+                if (m_cache.size() >= MAX_CACHED_ENTRIES)
+                {
+                    remove_expired(now);
+                }
+                if (m_cache.size() < MAX_CACHED_ENTRIES)
+                {
+                    cached_content& cached = m_cache[key];
+                    cached.m_content = content;
+                    cached.m_expires = now + rule.m_ttl;
+                }
+            }
+        }
+
+        return content;
+    }
+
+    void remove_expired(std::chrono::steady_clock::time_point now)
+    {
+        for (auto iter = m_cache.begin(); iter != m_cache.end();)
+        {
+            if (iter->second.m_expires <= now)
+            {
+                iter = m_cache.erase(iter);
+            }
+            else
+            {
+                ++iter;
+            }
+        }
+    }
+
+    io_manager& m_peer_io_manager;
+
+    std::mutex m_mutex;
+    std::shared_ptr<const std::vector<rule>> m_rules;
+    std::map<std::string, cached_content> m_cache;
+    std::uint64_t m_generation;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -1,18 +1,25 @@
 #pragma once
 
-#include <functional>
-#include <iostream>
+#include <chrono>
+#include <map>
 #include <memory>
 
 #include <asio.hpp>
 
 #include "connection.hpp"
+#include "connection_request.hpp"
 #include "defs.hpp"
 #include "io_manager.hpp"
+#include "log.hpp"
+#include "option_negotiator.hpp"
 #include "packet.hpp"
 #include "packet_builder.hpp"
 #include "packet_parser.hpp"
+#include "packet_window.hpp"
 #include "request_handler.hpp"
+#include "server_settings.hpp"
+#include "transport.hpp"
+#include "window_sender.hpp"
 
 namespace oct
 {
@@ -25,169 +32,196 @@ class read_connection : public connection
 {
 public:
     read_connection(request_handler& handler, io_manager& io_manager, asio::io_context& io_context,
-        std::shared_ptr<const packet_file_req> request_packet, const asio::ip::udp::endpoint& requesting_endpoint)
-        : m_handler(handler)
+        std::shared_ptr<const server_settings> settings, std::shared_ptr<const packet_file_req> request_packet,
+        const asio::ip::udp::endpoint& requesting_endpoint, const asio::ip::address& local_address)
+        : connection(handler, io_context, requesting_endpoint)
         , m_io_manager(io_manager)
         , m_connection_socket(io_context)
-        , m_send_timeout_timer(io_context)
-        , m_request_packet(request_packet)
-        , m_client_endpoint(requesting_endpoint)
+        , m_request(stdext::make_unique<connection_request>(settings, request_packet, local_address))
         , m_reader()
-        , m_last_packet_sent(false)
-        , m_last_sent_packet_id(0)
-        , m_response_expected(false)
-        , m_retry_counter(0)
+        , m_block_size(DEFAULT_DATA_SIZE)
+        , m_window_size(DEFAULT_WINDOW_SIZE)
+        , m_has_block_count(false)
+        , m_oack_pending(false)
+        , m_last_packet_read(false)
+        , m_last_read_packet_id(0)
+        , m_last_acked_packet_id(0)
+        , m_blocks_left(0)
+        , m_window_packets()
+        , m_sender(*this, io_context, m_connection_socket, m_window_packets, m_client_endpoint)
     {
         // noop
     }
 
     void start() final
     {
-        asio::ip::udp::endpoint connection_endpoint(asio::ip::address_v4::any(), 0);
+        // the request is not kept once negotiated
+        auto request = std::move(m_request);
 
-        m_connection_socket.open(connection_endpoint.protocol());
-        m_connection_socket.set_option(asio::socket_base::reuse_address(true));
-        m_connection_socket.bind(connection_endpoint);
+        start_record(*request->m_packet);
 
-        m_reader = m_io_manager.create_reader(m_request_packet->m_filename, m_request_packet->m_mode);
+        open_socket(m_connection_socket, request->m_local_address, m_client_endpoint);
 
-        send_first_packet();
+        m_reader = m_io_manager.create_reader(request->m_packet->m_filename, request->m_packet->m_mode);
+
+        send_first_packet(*request->m_packet, *request->m_settings);
     }
 
     void stop() final
     {
         asio::error_code ec;
 
+        m_sender.stop();
+
+        // record is final once stopped
+        if (m_record)
+        {
+            m_record->m_retransmits = m_sender.get_retransmits();
+            m_record->m_ignored_packets = m_sender.get_ignored_acks();
+            m_record->m_round_trips = m_sender.get_round_trips();
+        }
+
         if (m_connection_socket.is_open())
         {
             m_connection_socket.close(ec);
             if (ec)
             {
-                std::cerr << "Socket close failed: " << ec << std::endl;
+                log_error() << "Socket close failed: " << ec << std::endl;
             }
         }
-
-        m_send_timeout_timer.cancel();
     }
 
 private:
-    void send_first_packet()
+    friend class window_sender<read_connection>;
+
+    void send_first_packet(const packet_file_req& request_packet, const server_settings& settings)
     {
         if (!m_reader)
         {
-            packet_error packet;
-            packet.m_op = OP_ERROR;
-            packet.m_error_code = ERRCODE_ACCESS_VIOLATION;
-            packet.m_error_message = "invalid path or mode";
+            send_error(ERRCODE_ACCESS_VIOLATION, "invalid path or mode");
+            return;
+        }
 
-            send_packet(packet, false, 0);
+        if (!m_reader->is_open())
+        {
+            send_error(ERRCODE_FILE_NOT_FOUND, "file not found");
+            return;
         }
-        else if (!m_reader->is_open())
+
+        packet_oack oack_packet;
+        oack_packet.m_op = OP_OACK;
+
+        auto options = option_negotiator::negotiate_read(request_packet, settings, *m_reader, oack_packet.m_options);
+        if (m_record)
         {
-            packet_error packet;
-            packet.m_op = OP_ERROR;
-            packet.m_error_code = ERRCODE_FILE_NOT_FOUND;
-            packet.m_error_message = "file not found";
+            m_record->set_options(options);
+        }
+        set_idle_limit(std::chrono::seconds(options.m_timeout_sec), settings.m_retry_count);
+        m_block_size = static_cast<std::uint16_t>(options.m_block_size);
+        m_window_size = options.m_window_size;
+        m_has_block_count = options.m_has_block_count;
+        m_blocks_left = options.m_block_count;
 
-            send_packet(packet, false, 0);
+        if (!oack_packet.m_options.empty())
+        {
+            // OACK is handled like a single packet window
+            m_window_packets.add() = packet_builder::build_packet(oack_packet);
+            m_oack_pending = true;
         }
-        else
+        else if (!fill_window())
         {
-            send_next_data_packet();
+            return;
         }
-    }
 
-    template <class packet_T>
-    void send_packet(const packet_T& packet, bool response_expected, int retry_counter)
-    {
-        m_out_packet_data = packet_builder::build_packet(packet);
-        m_response_expected = response_expected;
-        m_retry_counter = retry_counter;
-
-        send_prepared_packet();
-    }
-
-    void send_prepared_packet()
-    {
-        m_connection_socket.async_send_to(asio::const_buffer(m_out_packet_data.data(), m_out_packet_data.size()),
-            m_client_endpoint,
-            std::bind(&read_connection::on_packet_sent, shared_from_base<read_connection>(), std::placeholders::_1,
-                std::placeholders::_2));
+        m_sender.start(true, settings.m_retry_count, std::chrono::seconds(options.m_timeout_sec));
     }
 
-    void send_next_data_packet()
+    // Reads all missing blocks of the window by a single read_blocks() call,
+    // directly into the packets after their headers.
+    bool fill_window()
     {
-        std::size_t bytes_read = 0;
-
-        packet_data packet;
-        packet.m_op = OP_DATA;
-        packet.m_block_no = ++m_last_sent_packet_id;
-        packet.m_data.resize(DEFAULT_DATA_SIZE);
-
-        if (!m_reader->read(packet.m_data.data(), packet.m_data.size(), bytes_read))
+        if (m_last_packet_read || (m_window_packets.size() >= m_window_size))
         {
-            std::cerr << "Read failed" << std::endl;
-
-            packet_error packet;
-            packet.m_op = OP_ERROR;
-            packet.m_error_code = ERRCODE_FILE_NOT_FOUND;
-            packet.m_error_message = "invalid path";
-
-            send_packet(packet, false, 0);
-
-            return;
+            return true;
         }
 
-        std::cout << "Bytes read: " << bytes_read << std::endl;
-
-        packet.m_data.resize(bytes_read, 0);
+        const std::size_t block_size = m_block_size;
+        std::size_t blocks_count = m_window_size - m_window_packets.size();
 
-        if (bytes_read < DEFAULT_DATA_SIZE)
+        // range ends with an empty block like a file of block size multiple
+        bool range_end = false;
+        if (m_has_block_count && (m_blocks_left < blocks_count))
         {
-            m_last_packet_sent = true;
+            blocks_count = static_cast<std::size_t>(m_blocks_left);
+            range_end = true;
         }
 
-        send_packet(packet, true, DEFAULT_RETRY_COUNTER);
-    }
-
-    void request_next_receive()
-    {
-        m_connection_socket.async_receive_from(asio::buffer(m_in_packet_data), m_in_packet_endpoint,
-            std::bind(&read_connection::on_packet_received, shared_from_base<read_connection>(), std::placeholders::_1,
-                std::placeholders::_2));
-    }
-
-    void on_packet_sent(const asio::error_code& ec, std::size_t bytes_transferred)
-    {
-        if (ec == asio::error::operation_aborted)
+        auto first_index = m_window_packets.size();
+        m_block_buffers.resize(blocks_count);
+        for (std::size_t i = 0; i < blocks_count; ++i)
         {
-            // ignore, cancelled
-            return;
+            auto& packet = m_window_packets.add();
+            packet_builder::build_data_header(++m_last_read_packet_id, packet);
+            packet.resize(DATA_HEADER_SIZE + block_size);
+            m_block_buffers[i] = packet.data() + DATA_HEADER_SIZE;
         }
 
-        if (ec)
+        std::size_t bytes_read = 0;
+        auto read_start = std::chrono::steady_clock::now();
+        bool read_ok = (blocks_count == 0)
+            || m_reader->read_blocks(m_block_buffers.data(), blocks_count, block_size, bytes_read);
+        m_counters.m_disk_time += std::chrono::steady_clock::now() - read_start;
+        if (!read_ok)
         {
-            std::cerr << "Packet send failed: " << ec << std::endl;
-            terminate();
-            return;
+            log_error() << "Read failed" << std::endl;
+            send_error(ERRCODE_FILE_NOT_FOUND, "invalid path");
+            return false;
         }
 
-        std::cout << "Packet sent: " << bytes_transferred << std::endl;
+        log_debug() << "Bytes read: " << bytes_read << std::endl;
 
-        if (m_response_expected)
+        if (m_has_block_count)
         {
-            m_send_timeout_timer.expires_after(std::chrono::seconds(DEFAULT_RETRY_TIMEOUT_SEC));
-            m_send_timeout_timer.async_wait(std::bind(
-                &read_connection::on_send_timeout, shared_from_base<read_connection>(), std::placeholders::_1));
-            request_next_receive();
+            m_blocks_left -= blocks_count;
         }
-        else
+
+        auto full_blocks = bytes_read / block_size;
+        if (full_blocks < blocks_count)
         {
-            terminate();
+            // end of file, the short block is the last one
+            m_window_packets[first_index + full_blocks].resize(DATA_HEADER_SIZE + bytes_read % block_size);
+            m_window_packets.truncate(first_index + full_blocks + 1);
+            auto dropped_count = blocks_count - full_blocks - 1;
+            m_last_read_packet_id = static_cast<std::uint16_t>(m_last_read_packet_id - dropped_count);
+            m_last_packet_read = true;
         }
+        else if (range_end)
+        {
+            packet_builder::build_data_header(++m_last_read_packet_id, m_window_packets.add());
+            m_last_packet_read = true;
+        }
+        return true;
+    }
+
+    void send_error(std::uint16_t error_code, const std::string& error_message)
+    {
+        m_counters.set_end_reason(transfer_counters::end_reason::ERROR_SENT, error_code);
+
+        packet_error packet;
+        packet.m_op = OP_ERROR;
+        packet.m_error_code = error_code;
+        packet.m_error_message = error_message;
+
+        m_error_packet_data = packet_builder::build_packet(packet);
+
+        m_connection_socket.async_send_to(
+            asio::const_buffer(m_error_packet_data.data(), m_error_packet_data.size()), m_client_endpoint,
+            track([this](const asio::error_code& ec, std::size_t bytes_transferred) {
+                on_error_sent(ec, bytes_transferred);
+            }));
     }
 
-    void on_send_timeout(const asio::error_code& ec)
+    void on_error_sent(const asio::error_code& ec, std::size_t /*bytes_transferred*/)
     {
         if (ec == asio::error::operation_aborted)
         {
@@ -197,121 +231,132 @@ private:
 
         if (ec)
         {
-            std::cerr << "Timer error: " << ec << std::endl;
-            return;
+            log_error() << "Packet send failed: " << ec << std::endl;
         }
 
-        if (--m_retry_counter > 0)
-        {
-            send_prepared_packet();
-        }
-        else
-        {
-            std::cerr << "No more retries" << std::endl;
-            terminate();
-        }
+        terminate();
     }
 
-    void process_ack_received(std::shared_ptr<packet_ack> packet)
+    void on_sender_done(window_sender<read_connection>::status status)
     {
-        std::cout << "ACK received: " << packet->m_block_no << std::endl;
+        typedef window_sender<read_connection>::status sender_status;
 
-        if (packet->m_block_no != m_last_sent_packet_id)
+        switch (status)
         {
-            std::cerr << "ACK with bad block no received: " << packet->m_block_no << std::endl;
+        case sender_status::COMPLETE:
+            m_counters.set_end_reason(transfer_counters::end_reason::COMPLETE);
+            break;
+
+        case sender_status::STOPPED:
+            // terminated, or the error is being sent
             return;
-        }
 
-        m_send_timeout_timer.cancel();
+        case sender_status::TIMEOUT:
+            log_warning() << "No more retries" << std::endl;
+            m_counters.set_end_reason(transfer_counters::end_reason::TIMEOUT);
+            break;
 
-        if (m_last_packet_sent)
-        {
-            terminate();
-            return;
+        case sender_status::NETWORK_ERROR:
+            log_error() << "Network error: " << m_sender.get_error() << std::endl;
+            m_counters.set_end_reason(transfer_counters::end_reason::NETWORK_ERROR);
+            break;
         }
 
-        send_next_data_packet();
-    }
-
-    void process_error_received(std::shared_ptr<packet_error> packet)
-    {
-        std::cout << "ERROR received: " << packet->m_error_code << ' ' << packet->m_error_message << std::endl;
         terminate();
     }
 
-    void on_packet_received(const asio::error_code& ec, std::size_t bytes_received)
+    // Removes the acknowledged packets from the window and fills it again.
+    ack_result acknowledge(std::uint16_t block_no)
     {
-        if (ec == asio::error::operation_aborted)
+        // block numbers wrap around, so compare distance from the last acked one
+        std::size_t acked_count = static_cast<std::uint16_t>(block_no - m_last_acked_packet_id);
+        if (m_oack_pending && (block_no == 0))
         {
-            // ignore, cancelled
-            return;
+            // OACK is acknowledged with block 0
+            m_oack_pending = false;
+            acked_count = 1;
         }
-
-        if (ec)
+        else if (m_oack_pending || (acked_count == 0) || (acked_count > m_window_packets.size()))
         {
-            std::cerr << "Error occurred: " << ec << std::endl;
-            terminate();
-            return;
+            log_debug() << "ACK with bad block no received: " << block_no << std::endl;
+            return ack_result::IGNORED;
+        }
+        else
+        {
+            // data blocks acknowledged
+            for (std::size_t i = 0; i < acked_count; ++i)
+            {
+                m_counters.m_bytes += m_window_packets[i].size() - DATA_HEADER_SIZE;
+            }
+            m_counters.m_blocks += acked_count;
         }
 
-        std::cout << "Packet received: " << bytes_received << std::endl;
+        m_window_packets.remove_front(acked_count);
+        m_last_acked_packet_id = block_no;
 
-        if (m_client_endpoint != m_in_packet_endpoint)
+        if (m_window_packets.empty() && m_last_packet_read)
         {
-            std::cerr << "Received packet from unexpected source: " << m_in_packet_endpoint << std::endl;
-            return;
+            return ack_result::COMPLETE;
         }
+        return fill_window() ? ack_result::ADVANCED : ack_result::FAILED;
+    }
 
-        auto packet = packet_parser::parse_packet(asio::const_buffer(m_in_packet_data.data(), bytes_received));
+    ack_result process_other_packet(const asio::const_buffer& buffer)
+    {
+        auto packet = packet_parser::parse_packet(buffer);
         if (!packet)
         {
-            std::cerr << "Invalid packet received of size: " << bytes_received << std::endl;
-            return;
+            log_warning() << "Invalid packet received of size: " << buffer.size() << std::endl;
+            return ack_result::IGNORED;
         }
 
         switch (packet->m_op)
         {
-        case OP_ACK:
-            process_ack_received(std::static_pointer_cast<packet_ack>(packet));
-            return;
-
         case OP_ERROR:
             process_error_received(std::static_pointer_cast<packet_error>(packet));
-            return;
+            break;
 
         default:
-            std::cerr << "Unexpected packet type: " << packet->m_op << std::endl;
-            return;
+            log_warning() << "Unexpected packet type: " << packet->m_op << std::endl;
+            break;
         }
+        return ack_result::IGNORED;
     }
 
-    void terminate()
+    void process_error_received(std::shared_ptr<packet_error> packet)
     {
-        m_handler.connection_terminated(shared_from_base<read_connection>());
+        log_info() << "ERROR received: " << packet->m_error_code << ' ' << packet->m_error_message << std::endl;
+        m_counters.set_end_reason(transfer_counters::end_reason::ERROR_RECEIVED, packet->m_error_code);
+        terminate();
     }
 
-    request_handler& m_handler;
     io_manager& m_io_manager;
 
-    asio::ip::udp::socket m_connection_socket;
-    asio::system_timer m_send_timeout_timer;
-
-    std::shared_ptr<const packet_file_req> m_request_packet;
+    udp_socket m_connection_socket;
 
-    const asio::ip::udp::endpoint m_client_endpoint;
+    // released by start()
+    std::unique_ptr<connection_request> m_request;
 
     std::unique_ptr<reader> m_reader;
-    bool m_last_packet_sent;
+    // negotiated options the blocks are read by
+    std::uint16_t m_block_size;
+    std::uint16_t m_window_size;
+    bool m_has_block_count;
+    bool m_oack_pending;
 
-    std::uint16_t m_last_sent_packet_id;
+    bool m_last_packet_read;
+    std::uint16_t m_last_read_packet_id;
+    std::uint16_t m_last_acked_packet_id;
+    // block numbers wrap, blocks of the count option are counted down
+    std::uint64_t m_blocks_left;
 
-    bool m_response_expected;
-    int m_retry_counter;
+    packet_window m_window_packets;
+    // data parts of the packets being filled
+    std::vector<void*> m_block_buffers;
 
-    std::vector<std::uint8_t> m_out_packet_data;
+    std::vector<std::uint8_t> m_error_packet_data;
 
-    std::array<std::uint8_t, MAX_RECV_PACKET_SIZE> m_in_packet_data;
-    asio::ip::udp::endpoint m_in_packet_endpoint;
+    window_sender<read_connection> m_sender;
 };
 
 } // namespace tftp
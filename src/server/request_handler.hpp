@@ -20,10 +20,13 @@ class request_handler
 public:
     virtual ~request_handler() = default;
 
-    virtual void handle_server_packet(std::shared_ptr<packet> packet, const asio::ip::udp::endpoint& client_endpoint)
+    virtual void handle_server_packet(std::shared_ptr<packet> packet, const asio::ip::udp::endpoint& client_endpoint,
+        const asio::ip::address& local_address)
         = 0;
 
-    virtual void connection_terminated(std::shared_ptr<connection> connection) = 0;
+    // Called by the worker of the terminated connection once none of its
+    // handlers is pending, the connection could be destroyed then.
+    virtual void connection_released(connection& connection) = 0;
 };
 
 } // namespace tftp
@@ -1,16 +1,28 @@
 #pragma once
 
-#include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
-#include <set>
+#include <mutex>
+#include <vector>
+
+#include <unistd.h>
 
 #include <asio.hpp>
 
+#include "connection_registry.hpp"
+#include "handler_allocator.hpp"
+#include "log.hpp"
 #include "make_unique.hpp"
 #include "read_connection.hpp"
 #include "request_handler.hpp"
 #include "server_acceptor.hpp"
 #include "server_settings.hpp"
+#include "transfer_log.hpp"
+#include "transport.hpp"
+#include "worker_pool.hpp"
 #include "write_connection.hpp"
 
 namespace oct
@@ -20,111 +32,538 @@ namespace net
 namespace tftp
 {
 
-class server : private request_handler
+class server
 {
 public:
-    server(asio::io_context& io_context, const server_settings& settings, io_manager& io_manager)
+    server(asio::io_context& io_context, worker_pool& workers, std::shared_ptr<const server_settings> settings,
+        io_manager& io_manager)
         : m_io_context(io_context)
+        , m_workers(workers)
         , m_settings(settings)
         , m_io_manager(io_manager)
-        , m_acceptor(stdext::make_unique<server_acceptor>(m_io_context, get_handler()))
+        , m_transfer_log(nullptr)
+        , m_connections()
+        , m_stopping(false)
+        , m_draining(false)
+        , m_drain_handler()
+        , m_sweeps()
+        , m_drain_timer(io_context)
+        , m_reaped_count(0)
+        , m_request_tokens(0)
+        , m_last_tokens_update(std::chrono::steady_clock::now())
+    {
+        for (std::size_t i = 0; i < m_workers.size(); ++i)
+        {
+            m_sweeps.emplace_back(stdext::make_unique<worker_sweep>(m_workers.get_io_context(i)));
+        }
+    }
+
+    // Listen addresses bound by one of the inherited sockets (e.g. handed over
+    // by the previous process) are served by it, the unused ones are closed.
+    void start(std::vector<listening_socket> inherited_sockets = std::vector<listening_socket>())
     {
-        // noop
+        auto settings = get_settings();
+
+        m_request_tokens = settings->m_max_requests_per_sec;
+
+        bool v4_any_used = false;
+        for (auto& listen : settings->m_listen)
+        {
+            auto address = asio::ip::make_address(listen.m_address);
+            v4_any_used |= (address.is_v4() && address.is_unspecified());
+        }
+
+        for (auto& listen : settings->m_listen)
+        {
+            auto new_listener = stdext::make_unique<listener>(*this, listen.m_workers);
+
+            // acceptor runs on the first of its workers
+            auto& io_context = m_workers.get_io_context(new_listener->get_worker_index(0));
+            new_listener->m_acceptor = std::make_shared<server_acceptor>(io_context, *new_listener);
+
+            auto address = asio::ip::make_address(listen.m_address);
+            asio::ip::udp::endpoint endpoint(address, settings->m_server_port);
+
+            auto inherited = std::find_if(inherited_sockets.begin(), inherited_sockets.end(),
+                [&endpoint](const listening_socket& socket) { return socket.m_endpoint == endpoint; });
+            if ((inherited != inherited_sockets.end()) && new_listener->m_acceptor->start(address, *inherited))
+            {
+                inherited_sockets.erase(inherited);
+                log_info() << "Listening on " << endpoint << " (inherited)" << std::endl;
+            }
+            else
+            {
+                new_listener->m_acceptor->start(address, settings->m_server_port, v4_any_used);
+                log_info() << "Listening on " << endpoint << std::endl;
+            }
+
+            m_listeners.emplace_back(std::move(new_listener));
+        }
+
+        for (auto& socket : inherited_sockets)
+        {
+            log_warning() << "Inherited socket not used, closed: " << socket.m_endpoint << std::endl;
+            ::close(socket.m_native_handle);
+        }
+
+        for (auto& sweep : m_sweeps)
+        {
+            auto worker_sweep = sweep.get();
+            asio::post(worker_sweep->m_io_context, [this, worker_sweep]() { start_sweep_timer(*worker_sweep); });
+        }
     }
 
-    void start()
+    // Sockets stay owned by the server.
+    std::vector<listening_socket> get_listening_sockets()
     {
-        m_acceptor->start(m_settings.m_server_port);
+        std::vector<listening_socket> sockets;
+        for (auto& listener : m_listeners)
+        {
+            listening_socket socket;
+            if (listener->m_acceptor->get_listening_socket(socket))
+            {
+                sockets.push_back(socket);
+            }
+        }
+        return sockets;
     }
 
+    // Terminates the running transfers, the workers run out of work once they are released.
+    // Called by the thread of the io_context of the server, like drain().
     void stop()
     {
-        for (auto& connection : m_connections)
+        stop_acceptors();
+        for (auto& sweep : m_sweeps)
+        {
+            auto worker_sweep = sweep.get();
+            asio::post(worker_sweep->m_io_context, [worker_sweep]() { worker_sweep->stop(); });
+        }
+
+        std::lock_guard<std::mutex> lock(m_connections_mutex);
+        m_stopping = true;
+        m_connections.for_each([](const std::shared_ptr<connection>& connection) {
+            asio::post(connection->get_io_context(), [connection]() { connection->terminate(); });
+        });
+    }
+
+    // Stops accepting requests and lets the running transfers complete, the
+    // ones left after the timeout are terminated. The handler is run by the
+    // io_context of the server once no transfer is left or they are terminated.
+    void drain(std::chrono::seconds timeout, std::function<void()> handler)
+    {
+        stop_acceptors();
+
         {
-            connection->stop();
+            std::lock_guard<std::mutex> lock(m_connections_mutex);
+            m_draining = true;
+            m_drain_handler = std::move(handler);
+
+            log_info() << "Draining transfers: " << m_connections.size() << std::endl;
+            if (m_connections.size() == 0)
+            {
+                asio::post(m_io_context, std::bind(&server::finish_drain, this));
+                return;
+            }
         }
-        m_acceptor->stop();
+
+        m_drain_timer.expires_after(timeout);
+        m_drain_timer.async_wait([this](const asio::error_code& ec) {
+            if (ec)
+            {
+                return;
+            }
+            log_warning() << "Drain timed out, terminating transfers: " << get_connections_count() << std::endl;
+            stop();
+            finish_drain();
+        });
+    }
+
+    std::size_t get_connections_count()
+    {
+        std::lock_guard<std::mutex> lock(m_connections_mutex);
+        return m_connections.size();
+    }
+
+    // Transfers terminated for making no progress.
+    std::size_t get_reaped_count() const
+    {
+        return m_reaped_count;
+    }
+
+    // Stats of the released transfers are added to the log, set before start.
+    void set_transfer_log(transfer_log* log)
+    {
+        m_transfer_log = log;
+    }
+
+    // Transfers already running keep the settings they were started with.
+    void update_settings(std::shared_ptr<const server_settings> settings)
+    {
+        std::lock_guard<std::mutex> lock(m_settings_mutex);
+        m_settings = settings;
     }
 
 private:
-    request_handler& get_handler()
+    // Connections started on a worker, checked for progress by its own sweep
+    // timer. Used only by the thread of the worker, so neither the sweep nor
+    // its handlers take a lock or cross threads.
+    struct worker_sweep
     {
-        return *this;
+        explicit worker_sweep(asio::io_context& io_context)
+            : m_io_context(io_context)
+            , m_timer(io_context)
+            , m_stopped(false)
+            , m_connections()
+        {
+            // noop
+        }
+
+        void add(connection& new_connection)
+        {
+            new_connection.set_sweep_index(m_connections.size());
+            m_connections.push_back(&new_connection);
+        }
+
+        // The last connection takes the place of the removed one.
+        void remove(connection& removed_connection)
+        {
+            auto index = removed_connection.get_sweep_index();
+            if ((index >= m_connections.size()) || (m_connections[index] != &removed_connection))
+            {
+                return;
+            }
+
+            m_connections[index] = m_connections.back();
+            m_connections[index]->set_sweep_index(index);
+            m_connections.pop_back();
+        }
+
+        void stop()
+        {
+            // completion could be queued already
+            m_stopped = true;
+            m_timer.cancel();
+        }
+
+        asio::io_context& m_io_context;
+        transfer_timer m_timer;
+        bool m_stopped;
+        std::vector<connection*> m_connections;
+    };
+
+    // Requests received by the acceptor are served by the listener workers.
+    class listener : public request_handler
+    {
+    public:
+        listener(server& owner, const std::vector<std::size_t>& workers)
+            : m_owner(owner)
+            , m_workers(workers)
+            , m_next_worker(0)
+        {
+            if (m_workers.empty())
+            {
+                for (std::size_t i = 0; i < m_owner.m_workers.size(); ++i)
+                {
+                    m_workers.push_back(i);
+                }
+            }
+        }
+
+        std::size_t get_worker_index(std::size_t index) const
+        {
+            return m_workers[index % m_workers.size()];
+        }
+
+        asio::io_context& get_next_io_context()
+        {
+            return m_owner.m_workers.get_io_context(get_worker_index(m_next_worker++));
+        }
+
+        void handle_server_packet(std::shared_ptr<packet> packet, const asio::ip::udp::endpoint& client_endpoint,
+            const asio::ip::address& local_address) final
+        {
+            m_owner.handle_listener_packet(*this, packet, client_endpoint, local_address);
+        }
+
+        void connection_released(connection& connection) final
+        {
+            m_owner.connection_released(connection);
+        }
+
+        std::shared_ptr<server_acceptor> m_acceptor;
+
+    private:
+        server& m_owner;
+        std::vector<std::size_t> m_workers;
+        // used only from the acceptor handlers
+        std::size_t m_next_worker;
+    };
+
+    std::shared_ptr<const server_settings> get_settings()
+    {
+        std::lock_guard<std::mutex> lock(m_settings_mutex);
+        return m_settings;
+    }
+
+    bool accept_request(const server_settings& settings)
+    {
+        auto max_requests_per_sec = settings.m_max_requests_per_sec;
+        if (max_requests_per_sec > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_request_tokens_mutex);
+
+            // token bucket allowing bursts of up to one second worth of requests
+            auto now = std::chrono::steady_clock::now();
+            std::chrono::duration<double> elapsed = now - m_last_tokens_update;
+            m_last_tokens_update = now;
+
+            m_request_tokens = std::min<double>(
+                m_request_tokens + elapsed.count() * max_requests_per_sec, max_requests_per_sec);
+            if (m_request_tokens < 1.0)
+            {
+                log_warning() << "Request rate limit exceeded" << std::endl;
+                return false;
+            }
+            m_request_tokens -= 1.0;
+        }
+
+        auto max_connections = settings.m_max_connections;
+        if (max_connections > 0)
+        {
+            std::lock_guard<std::mutex> lock(m_connections_mutex);
+            if (m_connections.size() >= max_connections)
+            {
+                log_warning() << "Connection limit reached" << std::endl;
+                return false;
+            }
+        }
+
+        return true;
     }
 
-    void handle_rrq_packet(std::shared_ptr<packet_file_req> packet, const asio::ip::udp::endpoint& client_endpoint)
+    void handle_rrq_packet(listener& source, std::shared_ptr<const server_settings> settings,
+        std::shared_ptr<packet_file_req> packet, const asio::ip::udp::endpoint& client_endpoint,
+        const asio::ip::address& local_address)
     {
-        auto new_connection
-            = std::make_shared<read_connection>(get_handler(), m_io_manager, m_io_context, packet, client_endpoint);
+        auto new_connection = std::make_shared<read_connection>(source, m_io_manager, source.get_next_io_context(),
+            settings, packet, client_endpoint, local_address);
 
         connection_created(new_connection);
     }
 
-    void handle_wrq_packet(std::shared_ptr<packet_file_req> packet, const asio::ip::udp::endpoint& client_endpoint)
+    void handle_wrq_packet(listener& source, std::shared_ptr<const server_settings> settings,
+        std::shared_ptr<packet_file_req> packet, const asio::ip::udp::endpoint& client_endpoint,
+        const asio::ip::address& local_address)
     {
-        auto new_connection
-            = std::make_shared<write_connection>(get_handler(), m_io_manager, m_io_context, packet, client_endpoint);
+        auto new_connection = std::make_shared<write_connection>(source, m_io_manager, source.get_next_io_context(),
+            settings, packet, client_endpoint, local_address);
 
         connection_created(new_connection);
     }
 
-    void handle_server_packet(std::shared_ptr<packet> packet, const asio::ip::udp::endpoint& client_endpoint) final
+    void handle_listener_packet(listener& source, std::shared_ptr<packet> packet,
+        const asio::ip::udp::endpoint& client_endpoint, const asio::ip::address& local_address)
     {
         try
         {
+            auto settings = get_settings();
+
             switch (packet->m_op)
             {
             case OP_RRQ:
-                handle_rrq_packet(std::static_pointer_cast<packet_file_req>(packet), client_endpoint);
+                if (accept_request(*settings))
+                {
+                    handle_rrq_packet(source, settings, std::static_pointer_cast<packet_file_req>(packet),
+                        client_endpoint, local_address);
+                }
                 break;
 
             case OP_WRQ:
-                handle_wrq_packet(std::static_pointer_cast<packet_file_req>(packet), client_endpoint);
+                if (accept_request(*settings))
+                {
+                    handle_wrq_packet(source, settings, std::static_pointer_cast<packet_file_req>(packet),
+                        client_endpoint, local_address);
+                }
                 break;
 
             default:
-                std::cerr << "Unsupported packet type: " << packet->m_op << std::endl;
+                log_warning() << "Unsupported packet type: " << packet->m_op << std::endl;
                 break;
             }
         }
         catch (const std::exception& e)
         {
-            std::cerr << "Packet processing failed: " << e.what() << std::endl;
+            log_error() << "Packet processing failed: " << e.what() << std::endl;
         }
     }
 
     void connection_created(std::shared_ptr<connection> connection)
     {
-        std::cout << "Connection created: " << connection.get() << std::endl;
+        log_debug() << "Connection created: " << connection.get() << std::endl;
+
+        if (m_transfer_log)
+        {
+            connection->keep_record();
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_connections_mutex);
+            if (m_stopping)
+            {
+                return;
+            }
+            m_connections.add(connection);
+        }
+
+        // connection handlers are run by its worker only
+        asio::post(connection->get_io_context(), std::bind(&server::start_connection, this, connection));
+    }
+
+    void start_connection(std::shared_ptr<connection> connection)
+    {
+        get_sweep(*connection).add(*connection);
+
+        try
+        {
+            connection->start();
+        }
+        catch (const std::exception& e)
+        {
+            log_error() << "Connection start failed: " << e.what() << std::endl;
+            connection->terminate();
+        }
+    }
+
+    // Connection is destroyed here unless the start is still running.
+    void connection_released(connection& connection)
+    {
+        log_debug() << "Connection terminated: " << &connection << std::endl;
+
+        get_sweep(connection).remove(connection);
 
-        m_connections.insert(connection);
+        std::shared_ptr<tftp::connection> released;
+        bool drained = false;
+        {
+            std::lock_guard<std::mutex> lock(m_connections_mutex);
 
-        connection->start();
+            released = m_connections.remove(connection);
+            if (!released)
+            {
+                log_error() << "Connection released but not registered" << std::endl;
+                return;
+            }
+            drained = m_draining && (m_connections.size() == 0);
+        }
+
+        auto record = connection.take_record();
+        if (record)
+        {
+            m_transfer_log->add(std::move(*record));
+        }
+
+        if (drained)
+        {
+            asio::post(m_io_context, std::bind(&server::finish_drain, this));
+        }
     }
 
-    void connection_terminated(std::shared_ptr<connection> connection) final
+    void stop_acceptors()
     {
-        std::cout << "Connection terminated: " << connection.get() << std::endl;
+        for (auto& listener : m_listeners)
+        {
+            auto& acceptor = listener->m_acceptor;
+            asio::post(acceptor->get_io_context(), std::bind(&server_acceptor::stop, acceptor));
+        }
+    }
 
-        connection->stop();
+    // Handler is run once, by the first of the drain completion and the timeout.
+    void finish_drain()
+    {
+        std::function<void()> handler;
+        {
+            std::lock_guard<std::mutex> lock(m_connections_mutex);
+            handler.swap(m_drain_handler);
+        }
+        if (handler)
+        {
+            m_drain_timer.cancel();
+            handler();
+        }
+    }
 
-        auto iter = m_connections.find(connection);
-        if (iter != m_connections.end())
+    // Run by the worker of the connection, among a few workers.
+    worker_sweep& get_sweep(connection& connection)
+    {
+        for (auto& sweep : m_sweeps)
         {
-            m_connections.erase(iter);
+            if (&sweep->m_io_context == &connection.get_io_context())
+            {
+                return *sweep;
+            }
         }
-        else
+        // connections are started only on the workers
+        return *m_sweeps.front();
+    }
+
+    // Handler is allocated in the handler memory of the worker, which frees it too.
+    void start_sweep_timer(worker_sweep& sweep)
+    {
+        if (sweep.m_stopped)
         {
-            std::cerr << "Connection terminate request but connection not registered" << std::endl;
+            return;
+        }
+
+        sweep.m_timer.expires_after(std::chrono::seconds(CONNECTION_SWEEP_INTERVAL_SEC));
+        sweep.m_timer.async_wait(make_allocating_handler([this, &sweep](const asio::error_code& ec) {
+            if (ec)
+            {
+                return;
+            }
+
+            sweep_connections(sweep);
+            start_sweep_timer(sweep);
+        }));
+    }
+
+    // Backwards, a reaped connection is released and replaced by the last one, already checked.
+    void sweep_connections(worker_sweep& sweep)
+    {
+        for (auto i = sweep.m_connections.size(); i > 0; --i)
+        {
+            if ((i <= sweep.m_connections.size()) && sweep.m_connections[i - 1]->reap_if_idle())
+            {
+                ++m_reaped_count;
+            }
         }
     }
 
     asio::io_context& m_io_context;
-    const server_settings& m_settings;
+    worker_pool& m_workers;
+
+    std::mutex m_settings_mutex;
+    std::shared_ptr<const server_settings> m_settings;
+
     io_manager& m_io_manager;
+    transfer_log* m_transfer_log;
+
+    std::vector<std::unique_ptr<listener>> m_listeners;
+
+    std::mutex m_connections_mutex;
+    // owns the connections, their handlers reference them by a raw pointer
+    connection_registry m_connections;
+    bool m_stopping;
+    bool m_draining;
+    std::function<void()> m_drain_handler;
+
+    // a sweep per worker, in the order of the workers
+    std::vector<std::unique_ptr<worker_sweep>> m_sweeps;
+    // run by the io_context of the server
+    transfer_timer m_drain_timer;
+    std::atomic<std::size_t> m_reaped_count;
 
-    std::unique_ptr<server_acceptor> m_acceptor;
-    std::set<std::shared_ptr<connection>> m_connections;
+    std::mutex m_request_tokens_mutex;
+    double m_request_tokens;
+    std::chrono::steady_clock::time_point m_last_tokens_update;
 };
 
 } // namespace tftp
@@ -1,14 +1,21 @@
 #pragma once
 
+#include <array>
+#include <cerrno>
+#include <cstring>
 #include <functional>
-#include <iostream>
 #include <string>
 
+#include <netinet/in.h>
+#include <sys/socket.h>
+
 #include <asio.hpp>
 
 #include "defs.hpp"
+#include "log.hpp"
 #include "packet_parser.hpp"
 #include "request_handler.hpp"
+#include "transport.hpp"
 
 namespace oct
 {
@@ -17,9 +24,25 @@ namespace net
 namespace tftp
 {
 
+// Bound server socket, handed over between the server processes on restart.
+struct listening_socket
+{
+    listening_socket()
+        : m_endpoint()
+        , m_native_handle(-1)
+    {
+        // noop
+    }
+
+    asio::ip::udp::endpoint m_endpoint;
+    int m_native_handle;
+};
+
 class server_acceptor : public std::enable_shared_from_this<server_acceptor>
 {
 public:
+    static const std::size_t MAX_REQUESTS_PER_WAKEUP = 64;
+
     server_acceptor(asio::io_context& io_context, request_handler& handler)
         : m_io_context(io_context)
         , m_handler(handler)
@@ -28,17 +51,70 @@ public:
         // noop
     }
 
-    void start(std::uint16_t server_port)
+    asio::io_context& get_io_context()
+    {
+        return m_io_context;
+    }
+
+    // IPv6 socket bound to unspecified address accepts IPv4 packets too,
+    // unless v6_only is set (needed when IPv4 socket is bound to the same port).
+    void start(const asio::ip::address& server_address, std::uint16_t server_port, bool v6_only)
     {
-        asio::ip::udp::endpoint server_endpoint(asio::ip::address_v4::any(), server_port);
+        asio::ip::udp::endpoint server_endpoint(server_address, server_port);
 
         m_server_socket.open(server_endpoint.protocol());
         m_server_socket.set_option(asio::socket_base::reuse_address(true));
+        if (server_address.is_v6())
+        {
+            m_server_socket.set_option(asio::ip::v6_only(v6_only));
+        }
+        enable_packet_info(!server_address.is_v6() || !v6_only, server_address.is_v6());
         m_server_socket.bind(server_endpoint);
 
         request_receive();
     }
 
+#if defined(OCTNET_TFTP_WITH_SIMULATED_NETWORK)
+    // Simulated network has no native sockets.
+    bool start(const asio::ip::address& /*server_address*/, const listening_socket& /*socket*/)
+    {
+        return false;
+    }
+
+    bool get_listening_socket(listening_socket& /*socket*/)
+    {
+        return false;
+    }
+#else
+    // Serves the socket bound by another process, taking its ownership.
+    bool start(const asio::ip::address& server_address, const listening_socket& socket)
+    {
+        auto protocol = server_address.is_v6() ? asio::ip::udp::v6() : asio::ip::udp::v4();
+
+        asio::error_code ec;
+        m_server_socket.assign(protocol, socket.m_native_handle, ec);
+        if (ec)
+        {
+            log_error() << "Cannot use inherited socket: " << ec << std::endl;
+            return false;
+        }
+        // options are shared with the other process, set again in case it did not
+        enable_packet_info(!server_address.is_v6() || !is_v6_only(), server_address.is_v6());
+
+        request_receive();
+        return true;
+    }
+
+    // False if not listening.
+    bool get_listening_socket(listening_socket& socket)
+    {
+        asio::error_code ec;
+        socket.m_endpoint = m_server_socket.local_endpoint(ec);
+        socket.m_native_handle = m_server_socket.native_handle();
+        return !ec && m_server_socket.is_open();
+    }
+#endif
+
     void stop()
     {
         asio::error_code ec;
@@ -48,58 +124,216 @@ public:
             m_server_socket.close(ec);
             if (ec)
             {
-                std::cerr << "Socket close failed: " << ec << std::endl;
+                log_error() << "Socket close failed: " << ec << std::endl;
             }
         }
     }
 
 private:
+#if defined(OCTNET_TFTP_WITH_SIMULATED_NETWORK)
+    // Destination address is reported by the simulated socket.
+    void enable_packet_info(bool /*v4_required*/, bool /*v6_required*/)
+    {
+        // noop
+    }
+#else
+    bool is_v6_only()
+    {
+        asio::ip::v6_only v6_only;
+        asio::error_code ec;
+        m_server_socket.get_option(v6_only, ec);
+        return !ec && v6_only.value();
+    }
+
+    // Destination address of the request is needed so the transfer is answered
+    // from the same address, and so leaves through the interface it came from.
+    void enable_packet_info(bool v4_required, bool v6_required)
+    {
+        int enabled = 1;
+
+        if (v4_required
+            && (::setsockopt(m_server_socket.native_handle(), IPPROTO_IP, IP_PKTINFO, &enabled, sizeof(enabled)) != 0))
+        {
+            log_warning() << "Cannot enable IP_PKTINFO" << std::endl;
+        }
+        if (v6_required
+            && (::setsockopt(
+                    m_server_socket.native_handle(), IPPROTO_IPV6, IPV6_RECVPKTINFO, &enabled, sizeof(enabled))
+                != 0))
+        {
+            log_warning() << "Cannot enable IPV6_RECVPKTINFO" << std::endl;
+        }
+    }
+#endif
+
     void request_receive()
     {
-        m_server_socket.async_receive_from(asio::buffer(m_packet_buffer), m_packet_sender_endpoint,
-            std::bind(&server_acceptor::on_packet_received, shared_from_this(), std::placeholders::_1,
-                std::placeholders::_2));
+        m_server_socket.async_wait(asio::socket_base::wait_read,
+            std::bind(&server_acceptor::on_socket_readable, shared_from_this(), std::placeholders::_1));
     }
 
-    void on_packet_received(const asio::error_code& ec, std::size_t bytes_received)
+    void on_socket_readable(const asio::error_code& ec)
     {
-        if (!ec && (bytes_received > 0))
+        if (ec == asio::error::operation_aborted)
         {
-            asio::const_buffer buffer(m_packet_buffer.data(), bytes_received);
+            // ignore, cancelled
+            return;
+        }
 
-            process_initial_packet(buffer, m_packet_sender_endpoint);
+        if (ec)
+        {
+            log_error() << "Error occurred: " << ec << std::endl;
         }
         else
         {
-            std::cerr << "Error occurred: " << ec << std::endl;
+            // process queued requests before going back to the reactor, limited so other handlers are not starved
+            for (std::size_t i = 0; (i < MAX_REQUESTS_PER_WAKEUP) && receive_packet(); ++i)
+            {
+                // continue
+            }
+        }
+
+        if (m_server_socket.is_open())
+        {
+            request_receive();
         }
+    }
 
-        request_receive();
+#if defined(OCTNET_TFTP_WITH_SIMULATED_NETWORK)
+    bool receive_packet()
+    {
+        asio::ip::udp::endpoint sender_endpoint;
+        asio::ip::address local_address;
+
+        asio::error_code ec;
+        auto bytes_received
+            = m_server_socket.receive_packet(asio::buffer(m_packet_buffer), sender_endpoint, local_address, ec);
+        if (ec)
+        {
+            return false;
+        }
+
+        if (bytes_received > 0)
+        {
+            process_initial_packet(
+                asio::const_buffer(m_packet_buffer.data(), bytes_received), sender_endpoint, local_address);
+        }
+
+        return true;
+    }
+#else
+    bool receive_packet()
+    {
+        asio::ip::udp::endpoint sender_endpoint;
+        asio::ip::address local_address;
+
+        iovec packet_iov;
+        packet_iov.iov_base = m_packet_buffer.data();
+        packet_iov.iov_len = m_packet_buffer.size();
+
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_name = sender_endpoint.data();
+        message.msg_namelen = static_cast<socklen_t>(sender_endpoint.capacity());
+        message.msg_iov = &packet_iov;
+        message.msg_iovlen = 1;
+        message.msg_control = m_control_buffer.data();
+        message.msg_controllen = m_control_buffer.size();
+
+        auto bytes_received = ::recvmsg(m_server_socket.native_handle(), &message, MSG_DONTWAIT);
+        if (bytes_received < 0)
+        {
+            if ((errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+            {
+                log_error() << "Receive failed: " << asio::error_code(errno, asio::error::get_system_category())
+                            << std::endl;
+            }
+            return errno == EINTR;
+        }
+
+        sender_endpoint.resize(message.msg_namelen);
+
+        for (auto cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            if ((cmsg->cmsg_level == IPPROTO_IP) && (cmsg->cmsg_type == IP_PKTINFO))
+            {
+                in_pktinfo info;
+                std::memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+
+                // local address, valid also for broadcast requests
+                asio::ip::address_v4::bytes_type bytes;
+                std::memcpy(bytes.data(), &info.ipi_spec_dst, bytes.size());
+                local_address = asio::ip::address_v4(bytes);
+            }
+            else if ((cmsg->cmsg_level == IPPROTO_IPV6) && (cmsg->cmsg_type == IPV6_PKTINFO))
+            {
+                in6_pktinfo info;
+                std::memcpy(&info, CMSG_DATA(cmsg), sizeof(info));
+
+                asio::ip::address_v6::bytes_type bytes;
+                std::memcpy(bytes.data(), &info.ipi6_addr, bytes.size());
+                asio::ip::address_v6 address(bytes, address_is_link_local(bytes) ? info.ipi6_ifindex : 0);
+                if (!address.is_multicast())
+                {
+                    local_address = address;
+                }
+            }
+        }
+
+        if (bytes_received > 0)
+        {
+            process_initial_packet(asio::const_buffer(m_packet_buffer.data(), bytes_received),
+                unmap_endpoint(sender_endpoint), unmap_address(local_address));
+        }
+
+        return true;
+    }
+#endif
+
+    static bool address_is_link_local(const asio::ip::address_v6::bytes_type& bytes)
+    {
+        return asio::ip::address_v6(bytes).is_link_local();
+    }
+
+    static asio::ip::address unmap_address(const asio::ip::address& address)
+    {
+        if (address.is_v6() && address.to_v6().is_v4_mapped())
+        {
+            return asio::ip::make_address_v4(asio::ip::v4_mapped, address.to_v6());
+        }
+        return address;
+    }
+
+    static asio::ip::udp::endpoint unmap_endpoint(const asio::ip::udp::endpoint& endpoint)
+    {
+        return asio::ip::udp::endpoint(unmap_address(endpoint.address()), endpoint.port());
     }
 
-    void process_initial_packet(const asio::const_buffer& buffer, const asio::ip::udp::endpoint& sender_endpoint)
+    void process_initial_packet(const asio::const_buffer& buffer, const asio::ip::udp::endpoint& sender_endpoint,
+        const asio::ip::address& local_address)
     {
-        std::cout << "Packet received with " << buffer.size() << " bytes" << std::endl;
-        std::cout << "Sender: " << m_packet_sender_endpoint << std::endl;
+        log_debug() << "Packet received with " << buffer.size() << " bytes from " << sender_endpoint << " to "
+                    << local_address << std::endl;
 
         auto packet = packet_parser::parse_packet(buffer);
         if (packet)
         {
-            m_handler.handle_server_packet(packet, sender_endpoint);
+            m_handler.handle_server_packet(packet, sender_endpoint, local_address);
         }
         else
         {
-            std::cerr << "Cannot parse packet" << std::endl;
+            log_warning() << "Cannot parse packet" << std::endl;
         }
     }
 
     asio::io_context& m_io_context;
     request_handler& m_handler;
 
-    asio::ip::udp::socket m_server_socket;
+    udp_socket m_server_socket;
 
     std::array<std::uint8_t, MAX_PACKET_SIZE> m_packet_buffer;
-    asio::ip::udp::endpoint m_packet_sender_endpoint;
+    alignas(cmsghdr) std::array<std::uint8_t, CMSG_SPACE(sizeof(in_pktinfo)) + CMSG_SPACE(sizeof(in6_pktinfo))>
+        m_control_buffer;
 };
 
 } // namespace tftp
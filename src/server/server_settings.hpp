@@ -2,8 +2,11 @@
 
 #include <cstdint>
 #include <string>
+#include <vector>
 
+#include "atomic_file_io.hpp"
 #include "defs.hpp"
+#include "log.hpp"
 
 namespace oct
 {
@@ -12,17 +15,118 @@ namespace net
 namespace tftp
 {
 
+struct listen_settings
+{
+    listen_settings()
+        : m_address()
+        , m_workers()
+    {
+        // noop
+    }
+
+    bool operator==(const listen_settings& other) const
+    {
+        return (m_address == other.m_address) && (m_workers == other.m_workers);
+    }
+
+    bool operator!=(const listen_settings& other) const
+    {
+        return !(*this == other);
+    }
+
+    std::string m_address;
+    // indices of workers serving the transfers, all workers if empty
+    std::vector<std::size_t> m_workers;
+};
+
+// file matching the pattern is generated from the template, see template_provider
+struct provider_settings
+{
+    provider_settings()
+        : m_pattern()
+        , m_template_path()
+        , m_template()
+        , m_ttl_sec(DEFAULT_PROVIDER_TTL_SEC)
+    {
+        // noop
+    }
+
+    std::string m_pattern;
+    std::string m_template_path;
+    // template contents, read when the settings are loaded
+    std::string m_template;
+    std::uint32_t m_ttl_sec;
+};
+
 struct server_settings
 {
     server_settings()
-        : m_server_port(DEFAULT_TFTP_PORT)
+        : m_listen()
+        , m_server_port(DEFAULT_TFTP_PORT)
         , m_root_path()
+        , m_preload(false)
+        , m_worker_threads(1)
+        , m_background_threads(1)
+        , m_max_block_size(MAX_DATA_SIZE)
+        , m_max_window_size(DEFAULT_MAX_WINDOW_SIZE)
+        , m_file_cache_size(DEFAULT_FILE_CACHE_SIZE)
+        , m_retry_timeout_sec(DEFAULT_RETRY_TIMEOUT_SEC)
+        , m_retry_count(DEFAULT_RETRY_COUNTER)
+        , m_max_requests_per_sec(0)
+        , m_max_connections(0)
+        , m_drain_timeout_sec(DEFAULT_DRAIN_TIMEOUT_SEC)
+        , m_log_level(log_level::INFO)
+        , m_providers()
+        , m_fsync_policy(fsync_policy::CLOSE)
+        , m_fsync_interval(DEFAULT_FSYNC_INTERVAL)
+        , m_write_behind_size(DEFAULT_WRITE_BEHIND_SIZE)
+        , m_direct_io(false)
+        , m_warm_up_path()
+        , m_hot_list_path()
+        , m_hot_list_interval_sec(DEFAULT_HOT_LIST_INTERVAL_SEC)
+        , m_transfer_log_path()
+        , m_handoff_path()
     {
         // noop
     }
 
+    // startup only, changes are ignored on reload
+    std::vector<listen_settings> m_listen;
     std::uint16_t m_server_port;
     std::string m_root_path;
+    // root directory or tar archive served from memory
+    bool m_preload;
+    std::size_t m_worker_threads;
+    // disk writes of uploads
+    std::size_t m_background_threads;
+
+    // tunables, applied to transfers started after reload
+    std::size_t m_max_block_size;
+    std::uint16_t m_max_window_size;
+    std::uint64_t m_file_cache_size;
+    int m_retry_timeout_sec;
+    int m_retry_count;
+    std::uint32_t m_max_requests_per_sec;
+    std::size_t m_max_connections;
+    // running transfers are waited for on shutdown
+    std::uint32_t m_drain_timeout_sec;
+    log_level m_log_level;
+    std::vector<provider_settings> m_providers;
+    fsync_policy m_fsync_policy;
+    std::uint64_t m_fsync_interval;
+    // per upload buffer, zero writes synchronously
+    std::size_t m_write_behind_size;
+    bool m_direct_io;
+
+    // startup only, files listed are warmed up before requests are accepted
+    std::string m_warm_up_path;
+    // most read files saved periodically and warmed up on the next start
+    std::string m_hot_list_path;
+    std::uint32_t m_hot_list_interval_sec;
+    // stats of every transfer appended there, reopened on reload
+    std::string m_transfer_log_path;
+    // listening sockets are taken over from the running process and handed over to the next one
+    std::string m_handoff_path;
 };
 
 } // namespace tftp
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "content_provider.hpp"
+#include "string_utils.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Expands a text template, "${name}" is replaced by the variable value:
+//   ${filename} - requested filename
+//   ${1}..${N}  - text matched by the pattern wildcards
+//   any variable given on construction
+// "$$" gives a single '$', unknown variables expand to nothing.
+class template_provider : public content_provider
+{
+public:
+    template_provider(const std::string& text, const std::map<std::string, std::string>& variables = {})
+        : m_text(text)
+        , m_variables(variables)
+    {
+        // noop
+    }
+
+    bool generate(const content_request& request, std::vector<std::uint8_t>& content) final
+    {
+        content.clear();
+        content.reserve(m_text.size());
+
+        std::size_t pos = 0;
+        while (pos < m_text.size())
+        {
+            auto var_pos = m_text.find('$', pos);
+            if ((var_pos == std::string::npos) || (var_pos + 1 >= m_text.size()))
+            {
+                append(content, m_text.substr(pos));
+                break;
+            }
+
+            append(content, m_text.substr(pos, var_pos - pos));
+
+            if (m_text[var_pos + 1] == '$')
+            {
+                content.push_back('$');
+                pos = var_pos + 2;
+                continue;
+            }
+
+            auto end_pos = m_text.find('}', var_pos);
+            if ((m_text[var_pos + 1] != '{') || (end_pos == std::string::npos))
+            {
+                content.push_back('$');
+                pos = var_pos + 1;
+                continue;
+            }
+
+            append(content, get_variable(request, m_text.substr(var_pos + 2, end_pos - var_pos - 2)));
+            pos = end_pos + 1;
+        }
+
+        return true;
+    }
+
+private:
+    static void append(std::vector<std::uint8_t>& content, const std::string& text)
+    {
+        content.insert(content.end(), text.begin(), text.end());
+    }
+
+    std::string get_variable(const content_request& request, const std::string& name) const
+    {
+        if (name == "filename")
+        {
+            return request.m_filename;
+        }
+
+        std::uint64_t index = 0;
+        if (parse_uint64(name, index))
+        {
+            return ((index > 0) && (index <= request.m_captures.size())) ? request.m_captures[index - 1]
+                                                                          : std::string();
+        }
+
+        auto iter = m_variables.find(name);
+        return (iter != m_variables.end()) ? iter->second : std::string();
+    }
+
+    const std::string m_text;
+    const std::map<std::string, std::string> m_variables;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "background_executor.hpp"
+#include "log.hpp"
+#include "transfer_stats.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Appends the stats of the finished transfers to a file, a line each. The
+// workers only queue them, the lines are formatted and written in batches by
+// a background job, so a slow disk never delays a transfer. Records arriving
+// while the queue is full are dropped.
+class transfer_log
+{
+public:
+    static const std::size_t MAX_PENDING_RECORDS = 65536;
+
+    transfer_log(background_executor& executor)
+        : m_executor(executor)
+        , m_path()
+        , m_pending()
+        , m_flush_pending(false)
+        , m_reopen_requested(false)
+        , m_dropped_count(0)
+        , m_stream()
+    {
+        // noop
+    }
+
+    // Must be called before any record is added.
+    bool open(const std::string& path)
+    {
+        m_path = path;
+        m_stream.open(m_path, std::ios::app);
+        if (!m_stream)
+        {
+            log_error() << "Cannot open transfer log: " << m_path << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    void add(transfer_stats stats)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pending.size() >= MAX_PENDING_RECORDS)
+        {
+            ++m_dropped_count;
+            return;
+        }
+        m_pending.push_back(std::move(stats));
+        schedule_flush();
+    }
+
+    // File is reopened by the next flush, e.g. once rotated.
+    void reopen()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_reopen_requested = true;
+        schedule_flush();
+    }
+
+private:
+    // A single flush job runs at a time, it is the only user of the stream.
+    void schedule_flush()
+    {
+        if (!m_flush_pending)
+        {
+            m_flush_pending = true;
+            m_executor.post([this]() { flush(); });
+        }
+    }
+
+    void flush()
+    {
+        std::vector<transfer_stats> records;
+        while (true)
+        {
+            bool reopen_requested = false;
+            std::size_t dropped_count = 0;
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                if (m_pending.empty() && !m_reopen_requested)
+                {
+                    m_flush_pending = false;
+                    return;
+                }
+                records.clear();
+                records.swap(m_pending);
+                std::swap(reopen_requested, m_reopen_requested);
+                std::swap(dropped_count, m_dropped_count);
+            }
+
+            if (reopen_requested)
+            {
+                m_stream.close();
+                m_stream.open(m_path, std::ios::app);
+                if (!m_stream)
+                {
+                    log_error() << "Cannot reopen transfer log: " << m_path << std::endl;
+                }
+            }
+            if (dropped_count > 0)
+            {
+                log_warning() << "Transfer log records dropped: " << dropped_count << std::endl;
+            }
+
+            for (auto& record : records)
+            {
+                record.write(m_stream);
+                m_stream << '\n';
+            }
+            m_stream.flush();
+        }
+    }
+
+    background_executor& m_executor;
+    std::string m_path;
+
+    std::mutex m_mutex;
+    std::vector<transfer_stats> m_pending;
+    bool m_flush_pending;
+    bool m_reopen_requested;
+    std::size_t m_dropped_count;
+
+    std::ofstream m_stream;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
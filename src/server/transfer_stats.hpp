@@ -0,0 +1,225 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <iomanip>
+#include <ostream>
+#include <string>
+
+#include <asio.hpp>
+
+#include "defs.hpp"
+#include "round_trip_stats.hpp"
+#include "transfer_options.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Counters of a running transfer, kept by its connection.
+struct transfer_counters
+{
+    enum class end_reason
+    {
+        COMPLETE,
+        TIMEOUT,
+        NETWORK_ERROR,
+        // the transfer failed, e.g. file not found
+        ERROR_SENT,
+        ERROR_RECEIVED,
+        // no progress for longer than the idle limit
+        REAPED,
+        // stopped by the server
+        TERMINATED
+    };
+
+    transfer_counters()
+        : m_start(std::chrono::steady_clock::now())
+        , m_duration(0)
+        , m_bytes(0)
+        , m_blocks(0)
+        , m_disk_time(0)
+        , m_end_reason(end_reason::TERMINATED)
+        , m_error_code(0)
+    {
+        // noop
+    }
+
+    // Reason is kept if already set, e.g. the error sent is followed by the termination.
+    void set_end_reason(end_reason reason, std::uint16_t error_code = 0)
+    {
+        if (m_end_reason == end_reason::TERMINATED)
+        {
+            m_end_reason = reason;
+            m_error_code = error_code;
+        }
+    }
+
+    // Duration is kept if already set, e.g. the transfer completed before its end.
+    void finish()
+    {
+        if (m_duration == std::chrono::steady_clock::duration::zero())
+        {
+            m_duration = std::chrono::steady_clock::now() - m_start;
+        }
+    }
+
+    std::chrono::steady_clock::time_point m_start;
+    std::chrono::steady_clock::duration m_duration;
+
+    // data transferred, acknowledged ones for downloads
+    std::uint64_t m_bytes;
+    std::uint64_t m_blocks;
+    // spent reading or writing the file
+    std::chrono::steady_clock::duration m_disk_time;
+
+    end_reason m_end_reason;
+    // of the ERROR sent or received
+    std::uint16_t m_error_code;
+};
+
+// Summary of a transfer written as a single line of "name=value" fields by the
+// transfer log. Kept by the connection only when the transfer is logged: the
+// request part is filled at the start, the counters once it is released.
+struct transfer_stats
+{
+    typedef transfer_counters::end_reason end_reason;
+
+    transfer_stats()
+        : m_start_time(std::chrono::system_clock::now())
+        , m_op(0)
+        , m_client()
+        , m_filename()
+        , m_mode()
+        , m_block_size(0)
+        , m_window_size(0)
+        , m_timeout_sec(0)
+        , m_retransmits(0)
+        , m_ignored_packets(0)
+        , m_round_trips()
+        , m_counters()
+    {
+        // noop
+    }
+
+    void set_options(const transfer_options& options)
+    {
+        m_block_size = options.m_block_size;
+        m_window_size = options.m_window_size;
+        m_timeout_sec = options.m_timeout_sec;
+    }
+
+    void write(std::ostream& stream) const
+    {
+        using std::chrono::duration_cast;
+        using std::chrono::milliseconds;
+
+        auto& counters = m_counters;
+
+        auto start_time = std::chrono::system_clock::to_time_t(m_start_time);
+        auto start_ms = duration_cast<milliseconds>(m_start_time.time_since_epoch()).count() % 1000;
+        std::tm start_tm;
+        gmtime_r(&start_time, &start_tm);
+
+        // time not spent in the disk I/O is spent waiting for the peer
+        auto network_time = (counters.m_duration > counters.m_disk_time) ? counters.m_duration - counters.m_disk_time
+                                                                         : counters.m_duration.zero();
+
+        stream << "start=" << std::put_time(&start_tm, "%Y-%m-%dT%H:%M:%S") << '.' << std::setfill('0')
+               << std::setw(3) << start_ms << std::setfill(' ') << "Z"
+               << " duration_ms=" << duration_cast<milliseconds>(counters.m_duration).count() << " client=" << m_client
+               << " op=" << ((m_op == OP_WRQ) ? "write" : "read") << " file=";
+        write_quoted(stream, m_filename);
+        stream << " mode=";
+        write_quoted(stream, m_mode);
+        stream << " blksize=" << m_block_size << " windowsize=" << m_window_size << " timeout=" << m_timeout_sec
+               << " bytes=" << counters.m_bytes << " blocks=" << counters.m_blocks << " retransmits=" << m_retransmits
+               << ((m_op == OP_WRQ) ? " ignored_blocks=" : " ignored_acks=") << m_ignored_packets
+               << " rtt_count=" << m_round_trips.get_count() << " rtt_min_us=" << m_round_trips.get_min().count()
+               << " rtt_avg_us=" << m_round_trips.get_average().count()
+               << " rtt_max_us=" << m_round_trips.get_max().count()
+               << " disk_ms=" << duration_cast<milliseconds>(counters.m_disk_time).count()
+               << " network_ms=" << duration_cast<milliseconds>(network_time).count()
+               << " result=" << get_end_reason_name(counters.m_end_reason);
+        if ((counters.m_end_reason == end_reason::ERROR_SENT) || (counters.m_end_reason == end_reason::ERROR_RECEIVED))
+        {
+            stream << " error=" << counters.m_error_code;
+        }
+    }
+
+    std::chrono::system_clock::time_point m_start_time;
+
+    // OP_RRQ or OP_WRQ
+    std::uint16_t m_op;
+    asio::ip::udp::endpoint m_client;
+    std::string m_filename;
+    std::string m_mode;
+
+    // negotiated
+    std::size_t m_block_size;
+    std::uint16_t m_window_size;
+    int m_timeout_sec;
+
+    std::size_t m_retransmits;
+    // ACKs of downloads or DATA of uploads the transfer could not use
+    std::size_t m_ignored_packets;
+    round_trip_stats m_round_trips;
+
+    transfer_counters m_counters;
+
+private:
+    static const char* get_end_reason_name(end_reason reason)
+    {
+        switch (reason)
+        {
+        case end_reason::COMPLETE:
+            return "complete";
+        case end_reason::TIMEOUT:
+            return "timeout";
+        case end_reason::NETWORK_ERROR:
+            return "network_error";
+        case end_reason::ERROR_SENT:
+            return "error_sent";
+        case end_reason::ERROR_RECEIVED:
+            return "error_received";
+        case end_reason::REAPED:
+            return "reaped";
+        case end_reason::TERMINATED:
+            return "terminated";
+        }
+        return "unknown";
+    }
+
+    // Names come from the request, so quotes, backslashes and control characters are escaped.
+    static void write_quoted(std::ostream& stream, const std::string& value)
+    {
+        static const char HEX_DIGITS[] = "0123456789abcdef";
+
+        stream << '"';
+        for (auto c : value)
+        {
+            auto byte = static_cast<unsigned char>(c);
+            if ((c == '"') || (c == '\\'))
+            {
+                stream << '\\' << c;
+            }
+            else if ((byte < 0x20) || (byte >= 0x7f))
+            {
+                stream << "\\x" << HEX_DIGITS[byte >> 4] << HEX_DIGITS[byte & 0x0f];
+            }
+            else
+            {
+                stream << c;
+            }
+        }
+        stream << '"';
+    }
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "log.hpp"
+#include "make_unique.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Set of io_contexts each run by a single thread. A transfer is bound to one
+// worker, so its handlers never run concurrently and need no locking.
+class worker_pool
+{
+public:
+    worker_pool(const worker_pool&) = delete;
+    worker_pool& operator=(const worker_pool&) = delete;
+
+    worker_pool(std::size_t size)
+        : m_next_worker(0)
+    {
+        if (size == 0)
+        {
+            size = 1;
+        }
+
+        for (std::size_t i = 0; i < size; ++i)
+        {
+            auto worker = stdext::make_unique<worker_data>();
+            m_workers.emplace_back(std::move(worker));
+        }
+    }
+
+    ~worker_pool()
+    {
+        stop();
+        join();
+    }
+
+    std::size_t size() const
+    {
+        return m_workers.size();
+    }
+
+    asio::io_context& get_io_context(std::size_t index)
+    {
+        return m_workers[index % m_workers.size()]->m_io_context;
+    }
+
+    asio::io_context& get_next_io_context()
+    {
+        return get_io_context(m_next_worker.fetch_add(1, std::memory_order_relaxed));
+    }
+
+    void run()
+    {
+        for (auto& worker : m_workers)
+        {
+            auto worker_ptr = worker.get();
+            worker->m_thread = std::thread([worker_ptr]() { run_worker(*worker_ptr); });
+        }
+    }
+
+    // Workers return once their io_contexts run out of work, e.g. when the transfers are drained.
+    void finish()
+    {
+        for (auto& worker : m_workers)
+        {
+            worker->m_work_guard.reset();
+        }
+    }
+
+    void stop()
+    {
+        for (auto& worker : m_workers)
+        {
+            worker->m_work_guard.reset();
+            worker->m_io_context.stop();
+        }
+    }
+
+    void join()
+    {
+        for (auto& worker : m_workers)
+        {
+            if (worker->m_thread.joinable())
+            {
+                worker->m_thread.join();
+            }
+        }
+    }
+
+private:
+    struct worker_data
+    {
+        worker_data()
+            : m_io_context(1)
+            , m_work_guard(asio::make_work_guard(m_io_context))
+        {
+            // noop
+        }
+
+        asio::io_context m_io_context;
+        asio::executor_work_guard<asio::io_context::executor_type> m_work_guard;
+        std::thread m_thread;
+    };
+
+    static void run_worker(worker_data& worker)
+    {
+        try
+        {
+            worker.m_io_context.run();
+        }
+        catch (const std::exception& e)
+        {
+            log_error() << "Worker failed: " << e.what() << std::endl;
+        }
+    }
+
+    std::vector<std::unique_ptr<worker_data>> m_workers;
+    std::atomic<std::size_t> m_next_worker;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
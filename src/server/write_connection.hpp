@@ -1,18 +1,24 @@
 #pragma once
 
-#include <functional>
-#include <iostream>
+#include <chrono>
+#include <map>
 #include <memory>
 
 #include <asio.hpp>
 
+#include "block_receiver.hpp"
 #include "connection.hpp"
+#include "connection_request.hpp"
 #include "defs.hpp"
 #include "io_manager.hpp"
+#include "log.hpp"
+#include "option_negotiator.hpp"
 #include "packet.hpp"
 #include "packet_builder.hpp"
 #include "packet_parser.hpp"
 #include "request_handler.hpp"
+#include "server_settings.hpp"
+#include "transport.hpp"
 
 namespace oct
 {
@@ -25,116 +31,118 @@ class write_connection : public connection
 {
 public:
     write_connection(request_handler& handler, io_manager& io_manager, asio::io_context& io_context,
-        std::shared_ptr<const packet_file_req> request_packet, const asio::ip::udp::endpoint& requesting_endpoint)
-        : m_handler(handler)
+        std::shared_ptr<const server_settings> settings, std::shared_ptr<const packet_file_req> request_packet,
+        const asio::ip::udp::endpoint& requesting_endpoint, const asio::ip::address& local_address)
+        : connection(handler, io_context, requesting_endpoint)
         , m_io_manager(io_manager)
         , m_connection_socket(io_context)
-        , m_send_timeout_timer(io_context)
-        , m_request_packet(request_packet)
-        , m_client_endpoint(requesting_endpoint)
+        , m_request(stdext::make_unique<connection_request>(settings, request_packet, local_address))
         , m_writer()
-        , m_next_expected_packet_id(0)
-        , m_response_expected(false)
-        , m_retry_counter(0)
+        , m_writer_waiting(false)
+        , m_writer_closing(false)
+        , m_disk_wait_start()
+        , m_receiver(*this, io_context, m_connection_socket, m_client_endpoint)
     {
         // noop
     }
 
     void start() final
     {
-        asio::ip::udp::endpoint connection_endpoint(asio::ip::address_v4::any(), 0);
+        // the request is not kept once negotiated
+        auto request = std::move(m_request);
 
-        m_connection_socket.open(connection_endpoint.protocol());
-        m_connection_socket.set_option(asio::socket_base::reuse_address(true));
-        m_connection_socket.bind(connection_endpoint);
+        start_record(*request->m_packet);
 
-        m_writer = m_io_manager.create_writer(m_request_packet->m_filename, m_request_packet->m_mode);
+        open_socket(m_connection_socket, request->m_local_address, m_client_endpoint);
 
-        send_first_packet();
+        m_writer = m_io_manager.create_writer(request->m_packet->m_filename, request->m_packet->m_mode);
+
+        send_first_packet(*request->m_packet, *request->m_settings);
     }
 
     void stop() final
     {
         asio::error_code ec;
 
+        m_receiver.stop();
+
+        // record is final once stopped
+        if (m_record)
+        {
+            m_record->m_retransmits = m_receiver.get_retransmits();
+            m_record->m_ignored_packets = m_receiver.get_ignored_blocks();
+            m_record->m_round_trips = m_receiver.get_round_trips();
+        }
+
         if (m_connection_socket.is_open())
         {
             m_connection_socket.close(ec);
             if (ec)
             {
-                std::cerr << "Socket close failed: " << ec << std::endl;
+                log_error() << "Socket close failed: " << ec << std::endl;
             }
         }
-
-        m_send_timeout_timer.cancel();
     }
 
 private:
-    void send_first_packet()
+    friend class block_receiver<write_connection>;
+
+    void send_first_packet(const packet_file_req& request_packet, const server_settings& settings)
     {
         if (!m_writer)
         {
-            packet_error packet;
-            packet.m_op = OP_ERROR;
-            packet.m_error_code = ERRCODE_ACCESS_VIOLATION;
-            packet.m_error_message = "invalid path";
-
-            send_packet(packet, false, 0);
+            send_error(ERRCODE_ACCESS_VIOLATION, "invalid path");
+            return;
         }
-        else if (!m_writer->is_open())
-        {
-            packet_error packet;
-            packet.m_op = OP_ERROR;
-            packet.m_error_code = ERRCODE_FILE_NOT_FOUND;
-            packet.m_error_message = "invalid path";
 
-            send_packet(packet, false, 0);
-        }
-        else
+        if (!m_writer->is_open())
         {
-            send_ack(0, false);
+            send_error(ERRCODE_FILE_NOT_FOUND, "invalid path");
+            return;
         }
-    }
-
-    void send_ack(std::uint32_t block_no, bool is_last)
-    {
-        std::cout << "Sending ACK: " << block_no << ' ' << is_last << std::endl;
 
-        packet_ack packet;
-        packet.m_op = OP_ACK;
-        packet.m_block_no = block_no;
+        packet_oack oack_packet;
+        oack_packet.m_op = OP_OACK;
 
-        m_next_expected_packet_id = block_no + 1;
-
-        send_packet(packet, !is_last, DEFAULT_RETRY_COUNTER);
+        auto options = option_negotiator::negotiate_write(request_packet, settings, oack_packet.m_options);
+        if (m_record)
+        {
+            m_record->set_options(options);
+        }
+        set_idle_limit(std::chrono::seconds(options.m_timeout_sec), settings.m_retry_count);
+        m_receiver.set_block_size(options.m_block_size);
+        m_receiver.set_window_size(options.m_window_size);
+
+        // OACK replaces ACK 0, client answers with DATA 1
+        packet_ack ack_packet;
+        ack_packet.m_op = OP_ACK;
+        ack_packet.m_block_no = 0;
+
+        m_receiver.start(true,
+            oack_packet.m_options.empty() ? packet_builder::build_packet(ack_packet)
+                                          : packet_builder::build_packet(oack_packet),
+            settings.m_retry_count, std::chrono::seconds(options.m_timeout_sec));
     }
 
-    template <class packet_T>
-    void send_packet(const packet_T& packet, bool response_expected, int retry_counter)
+    void send_error(std::uint16_t error_code, const std::string& error_message)
     {
-        m_out_packet_data = packet_builder::build_packet(packet);
-        m_response_expected = response_expected;
-        m_retry_counter = retry_counter;
+        m_counters.set_end_reason(transfer_counters::end_reason::ERROR_SENT, error_code);
 
-        send_prepared_packet();
-    }
+        packet_error packet;
+        packet.m_op = OP_ERROR;
+        packet.m_error_code = error_code;
+        packet.m_error_message = error_message;
 
-    void send_prepared_packet()
-    {
-        m_connection_socket.async_send_to(asio::const_buffer(m_out_packet_data.data(), m_out_packet_data.size()),
-            m_client_endpoint,
-            std::bind(&write_connection::on_packet_sent, shared_from_base<write_connection>(), std::placeholders::_1,
-                std::placeholders::_2));
-    }
+        m_error_packet_data = packet_builder::build_packet(packet);
 
-    void request_next_receive()
-    {
-        m_connection_socket.async_receive_from(asio::buffer(m_in_packet_data), m_in_packet_endpoint,
-            std::bind(&write_connection::on_packet_received, shared_from_base<write_connection>(),
-                std::placeholders::_1, std::placeholders::_2));
+        m_connection_socket.async_send_to(
+            asio::const_buffer(m_error_packet_data.data(), m_error_packet_data.size()), m_client_endpoint,
+            track([this](const asio::error_code& ec, std::size_t bytes_transferred) {
+                on_error_sent(ec, bytes_transferred);
+            }));
     }
 
-    void on_packet_sent(const asio::error_code& ec, std::size_t bytes_transferred)
+    void on_error_sent(const asio::error_code& ec, std::size_t /*bytes_transferred*/)
     {
         if (ec == asio::error::operation_aborted)
         {
@@ -144,176 +152,182 @@ private:
 
         if (ec)
         {
-            std::cerr << "Packet send failed: " << ec << std::endl;
-            terminate();
-            return;
+            log_error() << "Packet send failed: " << ec << std::endl;
         }
 
-        std::cout << "Packet sent: " << bytes_transferred << std::endl;
-
-        if (m_response_expected)
-        {
-            m_send_timeout_timer.expires_after(std::chrono::seconds(DEFAULT_RETRY_TIMEOUT_SEC));
-            m_send_timeout_timer.async_wait(std::bind(
-                &write_connection::on_send_timeout, shared_from_base<write_connection>(), std::placeholders::_1));
-            request_next_receive();
-        }
-        else
-        {
-            terminate();
-        }
+        terminate();
     }
 
-    void on_send_timeout(const asio::error_code& ec)
+    void on_receiver_done(block_receiver<write_connection>::status status)
     {
-        if (ec == asio::error::operation_aborted)
-        {
-            // ignore, cancelled
-            return;
-        }
+        typedef block_receiver<write_connection>::status receiver_status;
 
-        if (ec)
+        switch (status)
         {
-            std::cerr << "Timer error: " << ec << std::endl;
+        case receiver_status::COMPLETE:
+            // socket is kept while dallying, not counted in the duration
+            m_counters.set_end_reason(transfer_counters::end_reason::COMPLETE);
+            m_counters.finish();
             return;
-        }
 
-        if (--m_retry_counter > 0)
-        {
-            send_prepared_packet();
-        }
-        else
-        {
-            std::cerr << "No more retries" << std::endl;
-            terminate();
+        case receiver_status::DALLIED:
+            break;
+
+        case receiver_status::TIMEOUT:
+            log_warning() << "No more retries" << std::endl;
+            m_counters.set_end_reason(transfer_counters::end_reason::TIMEOUT);
+            break;
+
+        case receiver_status::NETWORK_ERROR:
+            log_error() << "Network error: " << m_receiver.get_error() << std::endl;
+            m_counters.set_end_reason(transfer_counters::end_reason::NETWORK_ERROR);
+            break;
         }
+
+        terminate();
     }
 
-    void process_data_received(std::shared_ptr<packet_data> packet)
+    // Data are referenced in the receive buffer.
+    bool write_block(const std::uint8_t* data, std::size_t size, bool last_block)
     {
-        std::cout << "Data received: " << packet->m_block_no << std::endl;
-
-        if (packet->m_block_no != m_next_expected_packet_id)
+        if (size > m_receiver.get_block_size())
         {
-            std::cerr << "Data with bad block no received: " << packet->m_block_no
-                      << "; expected: " << m_next_expected_packet_id << std::endl;
-            return;
+            send_error(ERRCODE_ILLEGAL_OP, "block too large");
+            return false;
         }
 
-        m_send_timeout_timer.cancel();
+        auto write_start = std::chrono::steady_clock::now();
+        bool write_ok = (size == 0) || m_writer->write(data, size);
+        m_counters.m_disk_time += std::chrono::steady_clock::now() - write_start;
 
-        if (packet->m_data.size() > 0)
+        if (!write_ok)
         {
-            if (!m_writer->write(packet->m_data.data(), packet->m_data.size()))
-            {
-                std::cerr << "Write failed" << std::endl;
-
-                packet_error packet;
-                packet.m_op = OP_ERROR;
-                packet.m_error_code = ERRCODE_DISK_FULL;
-                packet.m_error_message = "write failed";
+            log_error() << "Write failed" << std::endl;
+            send_error(ERRCODE_DISK_FULL, "write failed");
+            return false;
+        }
 
-                send_packet(packet, false, 0);
+        m_counters.m_bytes += size;
+        ++m_counters.m_blocks;
 
-                return;
-            }
+        if (last_block)
+        {
+            // final ACK is sent once the file is stored, buffering writers close it in the background
+            hold_ack();
+            m_writer_closing = true;
+            m_writer->async_close(
+                track_posted(get_io_context(), [this](bool closed) { on_writer_closed(closed); }));
         }
-
-        if (packet->m_data.size() == DEFAULT_DATA_SIZE)
+        else if (!m_writer_waiting && !m_writer->is_ready())
         {
-            send_ack(packet->m_block_no, false);
+            // client sends the next window once the buffered data are written
+            hold_ack();
+            m_writer_waiting = true;
+            m_writer->async_wait_ready(
+                track_posted(get_io_context(), [this](bool ready) { on_writer_ready(ready); }));
         }
-        else
+        return true;
+    }
+
+    // Time waiting for the writer is counted as the disk time.
+    void hold_ack()
+    {
+        if (!m_writer_waiting && !m_writer_closing)
         {
-            send_ack(packet->m_block_no, true);
-            // TODO: dallying:
-            //   The host acknowledging the final DATA packet may terminate its side
-            //   of the connection on sending the final ACK.  On the other hand,
-            //   dallying is encouraged.  This means that the host sending the final
-            //   ACK will wait for a while before terminating in order to retransmit
-            //   the final ACK if it has been lost.
+            m_disk_wait_start = std::chrono::steady_clock::now();
         }
+        m_receiver.hold_ack();
     }
 
-    void process_error_received(std::shared_ptr<packet_error> packet)
+    void release_ack()
     {
-        std::cout << "ERROR received: " << packet->m_error_code << ' ' << packet->m_error_message << std::endl;
-        terminate();
+        m_counters.m_disk_time += std::chrono::steady_clock::now() - m_disk_wait_start;
+        m_receiver.release_ack();
     }
 
-    void on_packet_received(const asio::error_code& ec, std::size_t bytes_received)
+    void on_writer_ready(bool ready)
     {
-        if (ec == asio::error::operation_aborted)
+        m_writer_waiting = false;
+
+        if (is_finished() || m_writer_closing)
         {
-            // ignore, cancelled
+            // ACK is held until closed
             return;
         }
 
-        if (ec)
+        if (!ready)
         {
-            std::cerr << "Error occurred: " << ec << std::endl;
-            terminate();
+            log_error() << "Write failed" << std::endl;
+            send_error(ERRCODE_DISK_FULL, "write failed");
             return;
         }
 
-        std::cout << "Packet received: " << bytes_received << std::endl;
+        release_ack();
+    }
 
-        if (m_client_endpoint != m_in_packet_endpoint)
+    void on_writer_closed(bool closed)
+    {
+        if (is_finished())
         {
-            std::cerr << "Received packet from unexpected source: " << m_in_packet_endpoint << std::endl;
             return;
         }
 
-        auto packet = packet_parser::parse_packet(asio::const_buffer(m_in_packet_data.data(), bytes_received));
-        if (!packet)
+        if (!closed)
         {
-            std::cerr << "Invalid packet received of size: " << bytes_received << std::endl;
+            log_error() << "Close failed" << std::endl;
+            send_error(ERRCODE_DISK_FULL, "write failed");
             return;
         }
 
-        switch (packet->m_op)
+        release_ack();
+    }
+
+    bool process_other_packet(const asio::const_buffer& buffer)
+    {
+        auto packet = packet_parser::parse_packet(buffer);
+        if (!packet)
         {
-        case OP_DATA:
-            process_data_received(std::static_pointer_cast<packet_data>(packet));
-            return;
+            log_warning() << "Invalid packet received of size: " << buffer.size() << std::endl;
+            return false;
+        }
 
+        switch (packet->m_op)
+        {
         case OP_ERROR:
             process_error_received(std::static_pointer_cast<packet_error>(packet));
-            return;
+            break;
 
         default:
-            std::cerr << "Unexpected packet type: " << packet->m_op << std::endl;
-            return;
+            log_warning() << "Unexpected packet type: " << packet->m_op << std::endl;
+            break;
         }
+        return false;
     }
 
-    void terminate()
+    void process_error_received(std::shared_ptr<packet_error> packet)
     {
-        m_handler.connection_terminated(shared_from_base<write_connection>());
+        log_info() << "ERROR received: " << packet->m_error_code << ' ' << packet->m_error_message << std::endl;
+        m_counters.set_end_reason(transfer_counters::end_reason::ERROR_RECEIVED, packet->m_error_code);
+        terminate();
     }
 
-    request_handler& m_handler;
     io_manager& m_io_manager;
 
-    asio::ip::udp::socket m_connection_socket;
-    asio::system_timer m_send_timeout_timer;
+    udp_socket m_connection_socket;
 
-    std::shared_ptr<const server_settings> m_settings;
-    std::shared_ptr<const packet_file_req> m_request_packet;
-
-    const asio::ip::udp::endpoint m_client_endpoint;
+    // released by start()
+    std::unique_ptr<connection_request> m_request;
 
     std::unique_ptr<writer> m_writer;
 
-    std::uint16_t m_next_expected_packet_id;
-
-    bool m_response_expected;
-    int m_retry_counter;
+    // ACK is held meanwhile
+    bool m_writer_waiting;
+    bool m_writer_closing;
+    std::chrono::steady_clock::time_point m_disk_wait_start;
 
-    std::vector<std::uint8_t> m_out_packet_data;
+    std::vector<std::uint8_t> m_error_packet_data;
 
-    std::array<std::uint8_t, MAX_RECV_PACKET_SIZE> m_in_packet_data;
-    asio::ip::udp::endpoint m_in_packet_endpoint;
+    block_receiver<write_connection> m_receiver;
 };
 
 } // namespace tftp
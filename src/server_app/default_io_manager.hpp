@@ -1,12 +1,30 @@
 #pragma once
 
-#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <mutex>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <asio.hpp>
+
+#include "atomic_file_io.hpp"
+#include "background_executor.hpp"
+#include "decompressing_io.hpp"
+#include "file_cache.hpp"
 #include "file_io.hpp"
 #include "io_manager.hpp"
+#include "log.hpp"
 #include "make_unique.hpp"
+#include "memory_io.hpp"
 #include "netascii_io.hpp"
+#include "root_directory.hpp"
+#include "server_settings.hpp"
 #include "string_utils.hpp"
+#include "write_behind_io.hpp"
 
 namespace oct
 {
@@ -15,93 +33,353 @@ namespace net
 namespace tftp
 {
 
+// Serves files from the root directory. Missing file is looked up also
+// compressed (see get_compressed_suffixes) and decompressed when read.
 class default_io_manager : public io_manager
 {
 public:
-    default_io_manager(const std::string& root_path)
+    static constexpr const char* SIZE_FILE_SUFFIX = ".size";
+
+    // Root path is taken from the settings, further changes of it are ignored.
+    default_io_manager(asio::io_context& io_context, background_executor& executor,
+        std::shared_ptr<const server_settings> settings)
         : io_manager()
-        , m_root_path(root_path)
+        , m_root(settings->m_root_path)
+        , m_cache(io_context, settings->m_root_path, settings->m_file_cache_size)
+        , m_compressed_suffixes(get_compressed_suffixes())
+        , m_executor(executor)
+        , m_settings(settings)
+    {
+        for (auto& suffix : m_compressed_suffixes)
+        {
+            m_cache.add_variant_suffix(suffix);
+        }
+        m_cache.add_variant_suffix(SIZE_FILE_SUFFIX);
+    }
+
+    void update_settings(std::shared_ptr<const server_settings> settings)
     {
-        // noop
+        m_cache.set_size_limit(settings->m_file_cache_size);
+
+        std::lock_guard<std::mutex> lock(m_settings_mutex);
+        m_settings = settings;
     }
 
     std::unique_ptr<reader> create_reader(const std::string& filename, const std::string& mode) final
     {
-        if (filename.find("..") != std::string::npos)
+        std::string path;
+        if (!resolve_path(filename, path))
         {
-            std::cerr << "Invalid filename: " << filename << std::endl;
+            log_warning() << "Invalid filename: " << filename << std::endl;
             return nullptr;
         }
-
-        auto path = m_root_path;
-        path += '/';
-        path += filename;
-
-        auto reader = open_reader(path, mode);
-        if (!reader)
+        if (!is_mode_supported(mode))
         {
-            std::cerr << "Open failed: " << path << std::endl;
+            return nullptr;
         }
-        else if (!reader->is_open())
+
+        auto reader = equal_ignore_case(mode, "netascii") ? open_reader<netascii_encoder>(path)
+                                                          : open_reader<octet_layer>(path);
+        if (!reader->is_open())
         {
-            std::cerr << "File not found: " << path << std::endl;
+            log_info() << "File not found: " << path << std::endl;
         }
         return reader;
     }
 
     std::unique_ptr<writer> create_writer(const std::string& filename, const std::string& mode) final
     {
-        if (filename.find("..") != std::string::npos)
+        std::string path;
+        if (!resolve_path(filename, path))
+        {
+            log_warning() << "Invalid filename: " << filename << std::endl;
+            return nullptr;
+        }
+        if (!is_mode_supported(mode))
         {
-            std::cerr << "Invalid filename: " << filename << std::endl;
             return nullptr;
         }
 
-        auto path = m_root_path;
-        path += '/';
-        path += filename;
+        // file is written next to the destination and renamed on close
+        auto separator_pos = path.rfind('/');
+        auto dir = (separator_pos != std::string::npos) ? path.substr(0, separator_pos) : std::string(".");
+        auto name = (separator_pos != std::string::npos) ? path.substr(separator_pos + 1) : path;
+
+        auto dir_fd = m_root.open_file(dir, O_RDONLY | O_DIRECTORY);
+        if (dir_fd < 0)
+        {
+            log_info() << "Open failed: " << dir << ": " << std::strerror(errno) << std::endl;
+        }
+
+        auto settings = get_settings();
+        bool netascii = equal_ignore_case(mode, "netascii");
 
-        auto writer = open_writer(path, mode);
-        if (!writer)
+        if (settings->m_write_behind_size == 0)
         {
-            std::cerr << "Open failed: " << path << std::endl;
+            if (netascii)
+            {
+                return create_file_writer<netascii_decoder<atomic_file_writer>>(dir_fd, dir, name, *settings);
+            }
+            return create_file_writer<atomic_file_writer>(dir_fd, dir, name, *settings);
         }
-        else if (!writer->is_open())
+
+        // data are acknowledged once buffered, disk writes do not delay the transfer
+        auto file = create_file_writer<atomic_file_writer>(dir_fd, dir, name, *settings);
+        if (netascii)
         {
-            std::cerr << "File not found: " << path << std::endl;
+            return stdext::make_unique<netascii_decoder<write_behind_writer>>(
+                std::move(file), m_executor, settings->m_write_behind_size);
         }
+        return stdext::make_unique<write_behind_writer>(std::move(file), m_executor, settings->m_write_behind_size);
+    }
 
-        return writer;
+    // Looks the file up, caching its content if it fits, and its parent
+    // directories are watched, so the first request needs no disk access.
+    bool warm_up(const std::string& filename) final
+    {
+        std::string path;
+        if (!resolve_path(filename, path))
+        {
+            return false;
+        }
+
+        return open_reader<octet_layer>(path)->is_open();
+    }
+
+    std::uint64_t get_cached_size()
+    {
+        return m_cache.get_content_size();
     }
 
 private:
-    std::unique_ptr<reader> open_reader(const std::string& path, const std::string& mode)
+    std::shared_ptr<const server_settings> get_settings()
+    {
+        std::lock_guard<std::mutex> lock(m_settings_mutex);
+        return m_settings;
+    }
+
+    // Normalized path, temporary files of running uploads are not accessible.
+    static bool resolve_path(const std::string& filename, std::string& path)
+    {
+        if (!root_directory::normalize_path(filename, path))
+        {
+            return false;
+        }
+
+        auto separator_pos = path.rfind('/');
+        return !atomic_file_writer::is_temp_name(
+            (separator_pos != std::string::npos) ? path.substr(separator_pos + 1) : path);
+    }
+
+    static bool is_mode_supported(const std::string& mode)
+    {
+        return equal_ignore_case(mode, "octet") || equal_ignore_case(mode, "netascii");
+    }
+
+    // Content is read unchanged.
+    template <class source_T>
+    using octet_layer = source_T;
+
+    // Reader of the file content converted by the layer (e.g. netascii_encoder),
+    // composed with the source type at compile time, so each combination is
+    // read without virtual calls between them.
+    template <template <class> class layer_T>
+    std::unique_ptr<reader> open_reader(const std::string& path)
     {
-        if (equal_ignore_case(mode, "octet"))
+        file_cache::entry entry;
+        if (m_cache.find(path, entry))
+        {
+            if (!entry.m_found)
+            {
+                return stdext::make_unique<layer_T<file_reader>>(-1);
+            }
+            if (entry.m_content)
+            {
+                return stdext::make_unique<layer_T<memory_reader>>(entry.m_content);
+            }
+            auto descriptor = entry.m_descriptor.lock();
+            return open_variant_reader<layer_T>(
+                path, entry.m_suffix, descriptor ? descriptor : open_shared_descriptor(path, entry.m_suffix));
+        }
+
+        std::uint64_t generation = 0;
+        bool cacheable = m_cache.prepare_insert(path, generation);
+
+        auto fd = m_root.open_file(path, O_RDONLY);
+        for (std::size_t i = 0; (fd < 0) && (errno == ENOENT) && (i < m_compressed_suffixes.size()); ++i)
         {
-            return stdext::make_unique<file_reader>(path);
+            fd = m_root.open_file(path + m_compressed_suffixes[i], O_RDONLY);
+            if (fd >= 0)
+            {
+                entry.m_suffix = m_compressed_suffixes[i];
+            }
         }
-        if (equal_ignore_case(mode, "netascii"))
+
+        if (fd < 0)
         {
-            return stdext::make_unique<netascii_reader>(stdext::make_unique<file_reader>(path));
+            if ((errno == ENOENT) || (errno == ENOTDIR))
+            {
+                if (cacheable)
+                {
+                    m_cache.insert(path, entry, generation);
+                }
+            }
+            else
+            {
+                log_warning() << "Open failed: " << path << ": " << std::strerror(errno) << std::endl;
+            }
+            return stdext::make_unique<layer_T<file_reader>>(-1);
         }
-        return nullptr;
+
+        // readers opened while this one is open share the descriptor
+        auto descriptor = std::make_shared<const shared_descriptor>(fd);
+
+        struct stat file_stat;
+        if (::fstat(fd, &file_stat) != 0)
+        {
+            return open_variant_reader<layer_T>(path, entry.m_suffix, descriptor);
+        }
+        if (S_ISDIR(file_stat.st_mode))
+        {
+            if (cacheable)
+            {
+                entry.m_suffix.clear();
+                m_cache.insert(path, entry, generation);
+            }
+            return stdext::make_unique<layer_T<file_reader>>(-1);
+        }
+
+        entry.m_found = true;
+
+        if (S_ISREG(file_stat.st_mode) && cacheable)
+        {
+            // size of a compressed variant is the decompressed one
+            auto size = static_cast<std::uint64_t>(file_stat.st_size);
+            bool has_size = entry.m_suffix.empty()
+                || read_size_file(path + entry.m_suffix + SIZE_FILE_SUFFIX, size);
+            if (has_size && (size <= m_cache.get_max_content_size()))
+            {
+                auto content = std::make_shared<std::vector<std::uint8_t>>(size);
+                if (read_content(*open_variant_reader<octet_layer>(path, entry.m_suffix, descriptor), *content))
+                {
+                    entry.m_content = content;
+                    m_cache.insert(path, entry, generation);
+                    return stdext::make_unique<layer_T<memory_reader>>(entry.m_content);
+                }
+
+                log_warning() << "Size mismatch, not cached: " << path << entry.m_suffix << std::endl;
+            }
+        }
+
+        if (cacheable)
+        {
+            entry.m_descriptor = descriptor;
+            m_cache.insert(path, entry, generation);
+        }
+        return open_variant_reader<layer_T>(path, entry.m_suffix, descriptor);
     }
 
-    std::unique_ptr<writer> open_writer(const std::string& path, const std::string& mode)
+    // Opens the cached file again once none of its readers is open.
+    std::shared_ptr<const shared_descriptor> open_shared_descriptor(const std::string& path, const std::string& suffix)
     {
-        if (equal_ignore_case(mode, "octet"))
+        std::uint64_t generation = 0;
+        bool cacheable = m_cache.prepare_insert(path, generation);
+
+        auto fd = m_root.open_file(path + suffix, O_RDONLY);
+        if (fd < 0)
+        {
+            return nullptr;
+        }
+
+        auto descriptor = std::make_shared<const shared_descriptor>(fd);
+        if (cacheable)
         {
-            return stdext::make_unique<file_writer>(path);
+            m_cache.share_descriptor(path, descriptor, generation);
         }
-        if (equal_ignore_case(mode, "netascii"))
+        return descriptor;
+    }
+
+    // Reader of the file found as path + suffix, decompressing for compressed
+    // variants. Each reader reads at its own position, the descriptor is shared.
+    template <template <class> class layer_T>
+    std::unique_ptr<reader> open_variant_reader(
+        const std::string& path, const std::string& suffix, std::shared_ptr<const shared_descriptor> descriptor)
+    {
+        if (suffix.empty() || !descriptor)
         {
-            return stdext::make_unique<netascii_writer>(stdext::make_unique<file_writer>(path));
+            return stdext::make_unique<layer_T<file_reader>>(std::move(descriptor));
         }
-        return nullptr;
+
+        // decompressed size is read from the sidecar file, e.g. "vmlinuz.zst.size"
+        std::uint64_t size = 0;
+        bool has_size = read_size_file(path + suffix + SIZE_FILE_SUFFIX, size);
+
+        return stdext::make_unique<layer_T<decompressing_reader>>(
+            stdext::make_unique<file_reader>(std::move(descriptor)), create_decompressor(suffix), has_size, size);
     }
 
-    const std::string& m_root_path;
+    // Atomic file writer, possibly layered (e.g. netascii_decoder<atomic_file_writer>).
+    template <class writer_T>
+    std::unique_ptr<writer_T> create_file_writer(
+        int dir_fd, const std::string& dir, const std::string& name, const server_settings& settings)
+    {
+        auto writer = stdext::make_unique<writer_T>(
+            dir_fd, name, settings.m_fsync_policy, settings.m_fsync_interval, settings.m_direct_io);
+        if ((dir_fd >= 0) && !writer->is_open())
+        {
+            log_info() << "Cannot create file in: " << dir << ": " << std::strerror(errno) << std::endl;
+        }
+        return writer;
+    }
+
+    bool read_size_file(const std::string& path, std::uint64_t& size)
+    {
+        auto fd = m_root.open_file(path, O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        char buffer[32];
+        auto bytes_read = ::read(fd, buffer, sizeof(buffer));
+        ::close(fd);
+        if (bytes_read <= 0)
+        {
+            return false;
+        }
+
+        std::string text(buffer, static_cast<std::size_t>(bytes_read));
+        text.erase(text.find_last_not_of(" \t\r\n") + 1);
+        return parse_uint64(text, size);
+    }
+
+    // Reads exactly the expected content size, fails if the file size differs.
+    static bool read_content(reader& reader, std::vector<std::uint8_t>& content)
+    {
+        std::size_t offset = 0;
+        while (offset < content.size())
+        {
+            std::size_t bytes_read = 0;
+            if (!reader.read(content.data() + offset, content.size() - offset, bytes_read) || (bytes_read == 0))
+            {
+                return false;
+            }
+            offset += bytes_read;
+        }
+
+        std::uint8_t extra_byte;
+        std::size_t bytes_read = 0;
+        return reader.read(&extra_byte, 1, bytes_read) && (bytes_read == 0);
+    }
+
+    root_directory m_root;
+    file_cache m_cache;
+    const std::vector<std::string> m_compressed_suffixes;
+
+    background_executor& m_executor;
+
+    std::mutex m_settings_mutex;
+    std::shared_ptr<const server_settings> m_settings;
 };
 
 } // namespace tftp
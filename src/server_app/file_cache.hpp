@@ -0,0 +1,433 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include <asio.hpp>
+
+#include "file_io.hpp"
+#include "log.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Results of path lookups under the root, both files found (with their content
+// when it fits the budget) and files not found, so repeated requests need no
+// syscalls. Directories of cached paths are watched with inotify and entries
+// are dropped when anything changes, events are handled on the given io_context.
+class file_cache
+{
+public:
+    static const std::size_t MAX_ENTRIES = 65536;
+    // a single file may take this part of the budget at most
+    static const std::uint64_t MAX_CONTENT_SHARE = 4;
+
+    struct entry
+    {
+        entry()
+            : m_found(false)
+            , m_suffix()
+            , m_content()
+            , m_descriptor()
+        {
+            // noop
+        }
+
+        bool m_found;
+        // file found as path + suffix, e.g. compressed variant
+        std::string m_suffix;
+        // null when not cached, e.g. too large
+        std::shared_ptr<const std::vector<std::uint8_t>> m_content;
+        // of a file read from the disk while any of its readers is open
+        std::weak_ptr<const shared_descriptor> m_descriptor;
+    };
+
+    file_cache(asio::io_context& io_context, const std::string& root_path, std::uint64_t size_limit)
+        : m_root_path(root_path)
+        , m_inotify(io_context)
+        , m_size_limit(size_limit)
+        , m_content_size(0)
+        , m_generation(0)
+    {
+        int fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (fd < 0)
+        {
+            log_warning() << "inotify not available, file cache disabled: " << std::strerror(errno) << std::endl;
+            return;
+        }
+
+        m_inotify.assign(fd);
+        request_events();
+    }
+
+    void set_size_limit(std::uint64_t size_limit)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_size_limit = size_limit;
+        evict();
+    }
+
+    std::uint64_t get_content_size()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        return m_content_size;
+    }
+
+    std::uint64_t get_max_content_size()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        return m_size_limit / MAX_CONTENT_SHARE;
+    }
+
+    bool find(const std::string& path, entry& result)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto iter = m_entries.find(path);
+        if (iter == m_entries.end())
+        {
+            return false;
+        }
+
+        result = iter->second.m_entry;
+        if (result.m_content)
+        {
+            m_lru.splice(m_lru.begin(), m_lru, iter->second.m_lru_position);
+        }
+        return true;
+    }
+
+    // Must be called before the path is probed. Returns false if the result
+    // cannot be cached, otherwise the generation to be passed to insert().
+    bool prepare_insert(const std::string& path, std::uint64_t& generation)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if (!m_inotify.is_open() || !watch_parent(path))
+        {
+            return false;
+        }
+
+        generation = m_generation;
+        return true;
+    }
+
+    // Ignored if anything was invalidated since prepare_insert(), the result could be stale.
+    void insert(const std::string& path, const entry& new_entry, std::uint64_t generation)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        if ((generation != m_generation) || (m_entries.find(path) != m_entries.end()))
+        {
+            return;
+        }
+
+        if (m_entries.size() >= MAX_ENTRIES)
+        {
+            log_debug() << "File cache entries limit reached" << std::endl;
+            clear();
+        }
+
+        cached_entry& cached = m_entries[path];
+        cached.m_entry = new_entry;
+
+        if (new_entry.m_content)
+        {
+            m_lru.push_front(path);
+            cached.m_lru_position = m_lru.begin();
+            m_content_size += new_entry.m_content->size();
+            evict();
+        }
+    }
+
+    // Descriptor of a found file is shared with its later readers. Ignored if
+    // anything was invalidated since prepare_insert(), it could be of a stale file.
+    void share_descriptor(
+        const std::string& path, const std::shared_ptr<const shared_descriptor>& descriptor, std::uint64_t generation)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto iter = m_entries.find(path);
+        if ((generation == m_generation) && (iter != m_entries.end()) && iter->second.m_entry.m_found)
+        {
+            iter->second.m_entry.m_descriptor = descriptor;
+        }
+    }
+
+    // Changes of path + suffix also invalidate path, to be called before first use.
+    void add_variant_suffix(const std::string& suffix)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_variant_suffixes.push_back(suffix);
+    }
+
+    void invalidate(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        invalidate_tree(path);
+    }
+
+private:
+    struct cached_entry
+    {
+        entry m_entry;
+        std::list<std::string>::iterator m_lru_position;
+    };
+
+    typedef std::map<std::string, cached_entry> entry_map;
+
+    static std::string get_parent(const std::string& path)
+    {
+        auto separator_pos = path.rfind('/');
+        return (separator_pos != std::string::npos) ? path.substr(0, separator_pos) : std::string();
+    }
+
+    static std::string join_path(const std::string& dir, const std::string& name)
+    {
+        return dir.empty() ? name : dir + '/' + name;
+    }
+
+    // Watches the closest existing ancestor directory, creating a missing
+    // directory in it is reported as well.
+    bool watch_parent(const std::string& path)
+    {
+        const std::uint32_t mask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_FROM
+            | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR;
+
+        auto dir = path;
+        do
+        {
+            dir = get_parent(dir);
+
+            if (m_watches.find(dir) != m_watches.end())
+            {
+                return true;
+            }
+
+            auto watch_path = dir.empty() ? m_root_path : m_root_path + '/' + dir;
+            int wd = ::inotify_add_watch(m_inotify.native_handle(), watch_path.c_str(), mask);
+            if (wd >= 0)
+            {
+                // symlinked directories share the watch
+                m_watches[dir] = wd;
+                m_watched_dirs[wd].insert(dir);
+                return true;
+            }
+            if ((errno != ENOENT) && (errno != ENOTDIR))
+            {
+                log_warning() << "Cannot watch directory " << watch_path << ": " << std::strerror(errno) << std::endl;
+                return false;
+            }
+        } while (!dir.empty());
+
+        return false;
+    }
+
+    void remove_watch(int wd)
+    {
+        auto iter = m_watched_dirs.find(wd);
+        if (iter == m_watched_dirs.end())
+        {
+            return;
+        }
+
+        for (auto& dir : iter->second)
+        {
+            m_watches.erase(dir);
+            invalidate_tree(dir);
+        }
+        m_watched_dirs.erase(iter);
+    }
+
+    // Drops the path and everything below it, empty path is the root.
+    void invalidate_tree(const std::string& path)
+    {
+        ++m_generation;
+
+        if (path.empty())
+        {
+            clear();
+            return;
+        }
+
+        auto iter = m_entries.find(path);
+        if (iter != m_entries.end())
+        {
+            erase(iter);
+        }
+
+        auto prefix = path + '/';
+        iter = m_entries.lower_bound(prefix);
+        while ((iter != m_entries.end()) && (iter->first.compare(0, prefix.size(), prefix) == 0))
+        {
+            iter = erase(iter);
+        }
+    }
+
+    entry_map::iterator erase(entry_map::iterator iter)
+    {
+        if (iter->second.m_entry.m_content)
+        {
+            m_content_size -= iter->second.m_entry.m_content->size();
+            m_lru.erase(iter->second.m_lru_position);
+        }
+        return m_entries.erase(iter);
+    }
+
+    void clear()
+    {
+        m_entries.clear();
+        m_lru.clear();
+        m_content_size = 0;
+    }
+
+    void evict()
+    {
+        while ((m_content_size > m_size_limit) && !m_lru.empty())
+        {
+            erase(m_entries.find(m_lru.back()));
+        }
+    }
+
+    void request_events()
+    {
+        m_inotify.async_read_some(asio::buffer(m_event_buffer, sizeof(m_event_buffer)),
+            std::bind(&file_cache::on_events, this, std::placeholders::_1, std::placeholders::_2));
+    }
+
+    void on_events(const asio::error_code& ec, std::size_t bytes_read)
+    {
+        if (ec == asio::error::operation_aborted)
+        {
+            // ignore, cancelled
+            return;
+        }
+
+        if (ec)
+        {
+            log_error() << "inotify read failed, file cache disabled: " << ec << std::endl;
+
+            std::lock_guard<std::mutex> lock(m_mutex);
+            asio::error_code close_ec;
+            m_inotify.close(close_ec);
+            clear();
+            ++m_generation;
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            std::size_t offset = 0;
+            while (offset + sizeof(inotify_event) <= bytes_read)
+            {
+                inotify_event event;
+                std::memcpy(&event, m_event_buffer + offset, sizeof(event));
+                const char* name = m_event_buffer + offset + sizeof(event);
+                offset += sizeof(event) + event.len;
+
+                process_event(event, (event.len > 0) ? std::string(name) : std::string());
+            }
+        }
+
+        request_events();
+    }
+
+    void process_event(const inotify_event& event, const std::string& name)
+    {
+        if (event.mask & IN_Q_OVERFLOW)
+        {
+            log_debug() << "inotify queue overflow, file cache cleared" << std::endl;
+            invalidate_tree(std::string());
+            return;
+        }
+
+        if (event.mask & IN_IGNORED)
+        {
+            remove_watch(event.wd);
+            return;
+        }
+
+        if (event.mask & IN_MOVE_SELF)
+        {
+            // watch follows the moved directory, it no longer matches the path
+            ::inotify_rm_watch(m_inotify.native_handle(), event.wd);
+            remove_watch(event.wd);
+            return;
+        }
+
+        auto iter = m_watched_dirs.find(event.wd);
+        if (iter == m_watched_dirs.end())
+        {
+            return;
+        }
+
+        for (auto& dir : iter->second)
+        {
+            if (event.mask & IN_DELETE_SELF)
+            {
+                invalidate_tree(dir);
+                continue;
+            }
+
+            auto path = join_path(dir, name);
+            invalidate_tree(path);
+            invalidate_variant_base(path);
+        }
+    }
+
+    void invalidate_variant_base(const std::string& path)
+    {
+        for (auto& suffix : m_variant_suffixes)
+        {
+            if ((path.size() > suffix.size())
+                && (path.compare(path.size() - suffix.size(), suffix.size(), suffix) == 0))
+            {
+                auto base_path = path.substr(0, path.size() - suffix.size());
+                invalidate_tree(base_path);
+                // variant of variant, e.g. sidecar file
+                invalidate_variant_base(base_path);
+            }
+        }
+    }
+
+    const std::string m_root_path;
+    asio::posix::stream_descriptor m_inotify;
+    alignas(inotify_event) char m_event_buffer[16 * 1024];
+
+    std::mutex m_mutex;
+    entry_map m_entries;
+    // most recently used first, entries with content only
+    std::list<std::string> m_lru;
+    std::uint64_t m_size_limit;
+    std::uint64_t m_content_size;
+    std::uint64_t m_generation;
+
+    std::vector<std::string> m_variant_suffixes;
+
+    std::map<std::string, int> m_watches;
+    std::map<int, std::set<std::string>> m_watched_dirs;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
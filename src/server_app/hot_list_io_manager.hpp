@@ -0,0 +1,180 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "io_manager.hpp"
+#include "log.hpp"
+#include "string_utils.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Counts files read through the peer io_manager, the most read ones are saved
+// as the hot list warmed up on the next start.
+class hot_list_io_manager : public io_manager
+{
+public:
+    static const std::size_t MAX_TRACKED_FILES = 65536;
+    static const std::size_t HOT_LIST_SIZE = 4096;
+
+    hot_list_io_manager(io_manager& peer_io_manager)
+        : io_manager()
+        , m_peer_io_manager(peer_io_manager)
+    {
+        // noop
+    }
+
+    std::unique_ptr<reader> create_reader(const std::string& filename, const std::string& mode) final
+    {
+        auto reader = m_peer_io_manager.create_reader(filename, mode);
+        if (reader && reader->is_open())
+        {
+            record(filename);
+        }
+        return reader;
+    }
+
+    std::unique_ptr<writer> create_writer(const std::string& filename, const std::string& mode) final
+    {
+        return m_peer_io_manager.create_writer(filename, mode);
+    }
+
+    bool warm_up(const std::string& filename) final
+    {
+        return m_peer_io_manager.warm_up(filename);
+    }
+
+    // Files of the previous hot list stay on the list until others are read more.
+    void add(const std::vector<std::string>& files)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        for (auto& file : files)
+        {
+            if (m_read_counts.size() < MAX_TRACKED_FILES)
+            {
+                m_read_counts.emplace(file, 0);
+            }
+        }
+    }
+
+    // Writes the most read files, most read first, and halves the counts so
+    // the list follows changes of the load. Replaced by rename.
+    bool save(const std::string& path)
+    {
+        std::vector<std::pair<std::uint64_t, std::string>> files;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+
+            for (auto& read_count : m_read_counts)
+            {
+                files.emplace_back(read_count.second, read_count.first);
+                read_count.second /= 2;
+            }
+        }
+
+        auto count = std::min(files.size(), static_cast<std::size_t>(HOT_LIST_SIZE));
+        std::partial_sort(files.begin(), files.begin() + count, files.end(),
+            [](const std::pair<std::uint64_t, std::string>& a, const std::pair<std::uint64_t, std::string>& b) {
+                return a.first > b.first;
+            });
+
+        auto temp_path = path + ".tmp";
+        {
+            std::ofstream stream(temp_path, std::ios::trunc);
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                stream << files[i].second << '\n';
+            }
+            if (!stream.flush())
+            {
+                log_warning() << "Cannot write hot list: " << temp_path << std::endl;
+                std::remove(temp_path.c_str());
+                return false;
+            }
+        }
+        if (std::rename(temp_path.c_str(), path.c_str()) != 0)
+        {
+            log_warning() << "Cannot rename hot list " << temp_path << ": " << std::strerror(errno) << std::endl;
+            std::remove(temp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Reads a list of files, one per line, '#' starts a comment (e.g. warm-up manifest).
+    static bool load(const std::string& path, std::vector<std::string>& files)
+    {
+        std::ifstream stream(path);
+        if (!stream)
+        {
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(stream, line))
+        {
+            auto comment_pos = line.find('#');
+            if (comment_pos != std::string::npos)
+            {
+                line.resize(comment_pos);
+            }
+
+            line = trim(line);
+            if (!line.empty())
+            {
+                files.push_back(line);
+            }
+        }
+        return true;
+    }
+
+private:
+    void record(const std::string& filename)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto iter = m_read_counts.find(filename);
+        if (iter != m_read_counts.end())
+        {
+            ++iter->second;
+            return;
+        }
+
+        if (m_read_counts.size() >= MAX_TRACKED_FILES)
+        {
+            // files not read since their counts decayed make room
+            for (iter = m_read_counts.begin(); iter != m_read_counts.end();)
+            {
+                iter = (iter->second == 0) ? m_read_counts.erase(iter) : std::next(iter);
+            }
+        }
+        if (m_read_counts.size() < MAX_TRACKED_FILES)
+        {
+            m_read_counts.emplace(filename, 1);
+        }
+    }
+
+    io_manager& m_peer_io_manager;
+
+    std::mutex m_mutex;
+    std::map<std::string, std::uint64_t> m_read_counts;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
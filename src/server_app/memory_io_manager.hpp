@@ -0,0 +1,383 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "file_io.hpp"
+#include "io_manager.hpp"
+#include "log.hpp"
+#include "make_unique.hpp"
+#include "memory_io.hpp"
+#include "netascii_io.hpp"
+#include "root_directory.hpp"
+#include "string_utils.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Serves files held in memory, loaded from a directory tree or a tar archive
+// at startup, so transfers need no file I/O. Uploads are accepted only if
+// max_upload_size is not zero, the uploaded file replaces the stored one
+// when its transfer completes.
+class memory_io_manager : public io_manager
+{
+public:
+    typedef std::shared_ptr<const std::vector<std::uint8_t>> content_ptr;
+
+    static const std::size_t TAR_BLOCK_SIZE = 512;
+
+    memory_io_manager(std::size_t max_upload_size = 0)
+        : io_manager()
+        , m_max_upload_size(max_upload_size)
+        , m_content_size(0)
+    {
+        // noop
+    }
+
+    // Path is normalized as the requested filenames, false if invalid.
+    bool add_file(const std::string& filename, content_ptr content)
+    {
+        std::string path;
+        if (!root_directory::normalize_path(filename, path) || !content)
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        auto& stored = m_files[path];
+        if (stored)
+        {
+            m_content_size -= stored->size();
+        }
+        stored = content;
+        m_content_size += content->size();
+        return true;
+    }
+
+    // Loads regular files below the directory, symlinked directories are not followed.
+    bool load_directory(const std::string& root_path)
+    {
+        return load_directory(root_path, std::string());
+    }
+
+    // Loads regular files of an uncompressed ustar/GNU tar archive.
+    bool load_archive(const std::string& archive_path)
+    {
+        file_reader archive(::open(archive_path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (!archive.is_open())
+        {
+            log_error() << "Cannot open archive " << archive_path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        std::string long_name;
+        std::uint8_t header[TAR_BLOCK_SIZE];
+        while (true)
+        {
+            if (!read_exactly(archive, header, sizeof(header)))
+            {
+                log_error() << "Truncated archive: " << archive_path << std::endl;
+                return false;
+            }
+            if (header[0] == 0)
+            {
+                // end of archive
+                return true;
+            }
+
+            std::uint64_t size = 0;
+            if (!parse_tar_number(header + 124, 12, size) || (size > std::numeric_limits<std::size_t>::max()))
+            {
+                log_error() << "Invalid archive header: " << archive_path << std::endl;
+                return false;
+            }
+
+            auto content = std::make_shared<std::vector<std::uint8_t>>(static_cast<std::size_t>(size));
+            auto padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+            std::uint8_t padding_data[TAR_BLOCK_SIZE];
+            if (!read_exactly(archive, content->data(), content->size())
+                || !read_exactly(archive, padding_data, padding))
+            {
+                log_error() << "Truncated archive: " << archive_path << std::endl;
+                return false;
+            }
+
+            auto type = static_cast<char>(header[156]);
+            if (type == 'L')
+            {
+                // GNU long name of the following entry
+                long_name.assign(content->begin(), content->end());
+                long_name.resize(std::strlen(long_name.c_str()));
+                continue;
+            }
+
+            auto name = long_name.empty() ? get_tar_name(header) : long_name;
+            long_name.clear();
+
+            if ((type == '0') || (type == '\0') || (type == '7'))
+            {
+                if (!add_file(name, content))
+                {
+                    log_warning() << "Invalid path in archive, ignored: " << name << std::endl;
+                }
+            }
+            else if (type != '5')
+            {
+                log_debug() << "Archive entry of type '" << type << "' ignored: " << name << std::endl;
+            }
+        }
+    }
+
+    std::size_t get_files_count()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_files.size();
+    }
+
+    std::uint64_t get_content_size()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_content_size;
+    }
+
+    std::unique_ptr<reader> create_reader(const std::string& filename, const std::string& mode) final
+    {
+        std::string path;
+        if (!root_directory::normalize_path(filename, path))
+        {
+            log_warning() << "Invalid filename: " << filename << std::endl;
+            return nullptr;
+        }
+        if (!is_mode_supported(mode))
+        {
+            return nullptr;
+        }
+
+        content_ptr content;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto iter = m_files.find(path);
+            if (iter != m_files.end())
+            {
+                content = iter->second;
+            }
+        }
+        if (!content)
+        {
+            log_info() << "File not found: " << path << std::endl;
+        }
+
+        if (equal_ignore_case(mode, "netascii"))
+        {
+            return stdext::make_unique<netascii_encoder<memory_reader>>(content);
+        }
+        return stdext::make_unique<memory_reader>(content);
+    }
+
+    std::unique_ptr<writer> create_writer(const std::string& filename, const std::string& mode) final
+    {
+        std::string path;
+        if ((m_max_upload_size == 0) || !root_directory::normalize_path(filename, path) || !is_mode_supported(mode))
+        {
+            log_warning() << "Upload rejected: " << filename << std::endl;
+            return nullptr;
+        }
+
+        memory_writer::commit_handler commit = [this, path](const chunked_buffer& content) {
+            return add_file(path, std::make_shared<const std::vector<std::uint8_t>>(content.to_vector()));
+        };
+
+        if (equal_ignore_case(mode, "netascii"))
+        {
+            return stdext::make_unique<netascii_decoder<memory_writer>>(std::move(commit), m_max_upload_size);
+        }
+        return stdext::make_unique<memory_writer>(std::move(commit), m_max_upload_size);
+    }
+
+    bool warm_up(const std::string& filename) final
+    {
+        std::string path;
+        if (!root_directory::normalize_path(filename, path))
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_files.find(path) != m_files.end();
+    }
+
+private:
+    static bool is_mode_supported(const std::string& mode)
+    {
+        return equal_ignore_case(mode, "octet") || equal_ignore_case(mode, "netascii");
+    }
+
+    bool load_directory(const std::string& root_path, const std::string& dir)
+    {
+        auto dir_path = dir.empty() ? root_path : root_path + '/' + dir;
+        std::unique_ptr<DIR, int (*)(DIR*)> dir_stream(::opendir(dir_path.c_str()), &::closedir);
+        if (!dir_stream)
+        {
+            log_error() << "Cannot open directory " << dir_path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        while (auto entry = ::readdir(dir_stream.get()))
+        {
+            std::string name = entry->d_name;
+            if ((name == ".") || (name == ".."))
+            {
+                continue;
+            }
+
+            auto path = dir.empty() ? name : dir + '/' + name;
+            auto full_path = root_path + '/' + path;
+
+            struct stat file_stat;
+            if (::lstat(full_path.c_str(), &file_stat) != 0)
+            {
+                log_warning() << "Cannot stat " << full_path << ": " << std::strerror(errno) << std::endl;
+                continue;
+            }
+            if (S_ISDIR(file_stat.st_mode))
+            {
+                if (!load_directory(root_path, path))
+                {
+                    return false;
+                }
+                continue;
+            }
+            if (S_ISLNK(file_stat.st_mode) && (::stat(full_path.c_str(), &file_stat) != 0))
+            {
+                // dangling symlink
+                continue;
+            }
+            if (!S_ISREG(file_stat.st_mode))
+            {
+                continue;
+            }
+
+            if (!load_file(full_path, path, static_cast<std::uint64_t>(file_stat.st_size)))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    bool load_file(const std::string& full_path, const std::string& path, std::uint64_t size)
+    {
+        file_reader file(::open(full_path.c_str(), O_RDONLY | O_CLOEXEC));
+        if (!file.is_open() || (size > std::numeric_limits<std::size_t>::max()))
+        {
+            log_error() << "Cannot open " << full_path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+
+        auto content = std::make_shared<std::vector<std::uint8_t>>(static_cast<std::size_t>(size));
+        std::uint8_t extra_byte;
+        std::size_t bytes_read = 0;
+        if (!read_exactly(file, content->data(), content->size()) || !file.read(&extra_byte, 1, bytes_read)
+            || (bytes_read != 0))
+        {
+            log_error() << "File changed while loading: " << full_path << std::endl;
+            return false;
+        }
+
+        return add_file(path, content);
+    }
+
+    static bool read_exactly(reader& reader, void* buffer, std::size_t size)
+    {
+        auto output = reinterpret_cast<std::uint8_t*>(buffer);
+        std::size_t offset = 0;
+        while (offset < size)
+        {
+            std::size_t bytes_read = 0;
+            if (!reader.read(output + offset, size - offset, bytes_read) || (bytes_read == 0))
+            {
+                return false;
+            }
+            offset += bytes_read;
+        }
+        return true;
+    }
+
+    // Octal number, NUL or space terminated, or base-256 (GNU) if the high bit is set.
+    static bool parse_tar_number(const std::uint8_t* field, std::size_t length, std::uint64_t& value)
+    {
+        value = 0;
+        if (field[0] & 0x80)
+        {
+            for (std::size_t i = 1; i < length; ++i)
+            {
+                if (value >> 56)
+                {
+                    return false;
+                }
+                value = (value << 8) | field[i];
+            }
+            return (field[0] & 0x7f) == 0;
+        }
+
+        std::size_t i = 0;
+        while ((i < length) && (field[i] == ' '))
+        {
+            ++i;
+        }
+        for (; (i < length) && (field[i] >= '0') && (field[i] <= '7'); ++i)
+        {
+            value = (value << 3) | static_cast<std::uint64_t>(field[i] - '0');
+        }
+        return (i == length) || (field[i] == '\0') || (field[i] == ' ');
+    }
+
+    // ustar prefix + '/' + name
+    static std::string get_tar_name(const std::uint8_t* header)
+    {
+        auto field = [header](std::size_t offset, std::size_t length) {
+            auto begin = reinterpret_cast<const char*>(header + offset);
+            return std::string(begin, std::find(begin, begin + length, '\0'));
+        };
+
+        auto name = field(0, 100);
+        // GNU format ("ustar  ") keeps other fields there
+        if (std::memcmp(header + 257, "ustar\0", 6) == 0)
+        {
+            auto prefix = field(345, 155);
+            if (!prefix.empty())
+            {
+                name = prefix + '/' + name;
+            }
+        }
+        return name;
+    }
+
+    const std::size_t m_max_upload_size;
+
+    std::mutex m_mutex;
+    std::map<std::string, content_ptr> m_files;
+    std::uint64_t m_content_size;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
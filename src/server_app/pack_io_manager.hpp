@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "io_manager.hpp"
+#include "log.hpp"
+#include "make_unique.hpp"
+#include "memory_io.hpp"
+#include "netascii_io.hpp"
+#include "pack_archive.hpp"
+#include "root_directory.hpp"
+#include "string_utils.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Serves files from a mapped pack (see pack_archive) read-only, a request
+// needs no file I/O besides page faults on the data sent. Netascii transfers
+// of files stored with the pre-encoded variant need no conversion either.
+class pack_io_manager : public io_manager
+{
+public:
+    pack_io_manager()
+        : io_manager()
+        , m_pack()
+    {
+        // noop
+    }
+
+    bool open(const std::string& pack_path)
+    {
+        if (!m_pack.open(pack_path))
+        {
+            log_error() << "Cannot open pack " << pack_path << ": " << std::strerror(errno) << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    const pack_archive& get_pack() const
+    {
+        return m_pack;
+    }
+
+    std::unique_ptr<reader> create_reader(const std::string& filename, const std::string& mode) final
+    {
+        std::string path;
+        if (!root_directory::normalize_path(filename, path))
+        {
+            log_warning() << "Invalid filename: " << filename << std::endl;
+            return nullptr;
+        }
+
+        bool netascii = equal_ignore_case(mode, "netascii");
+        if (!netascii && !equal_ignore_case(mode, "octet"))
+        {
+            return nullptr;
+        }
+
+        const std::uint8_t* data = nullptr;
+        std::size_t size = 0;
+        if (netascii && m_pack.find(path, true, data, size))
+        {
+            return stdext::make_unique<memory_reader>(m_pack.get_owner(), data, size);
+        }
+
+        if (!m_pack.find(path, false, data, size))
+        {
+            log_info() << "File not found: " << path << std::endl;
+            return stdext::make_unique<memory_reader>(nullptr);
+        }
+
+        if (netascii)
+        {
+            return stdext::make_unique<netascii_encoder<memory_reader>>(m_pack.get_owner(), data, size);
+        }
+        return stdext::make_unique<memory_reader>(m_pack.get_owner(), data, size);
+    }
+
+    std::unique_ptr<writer> create_writer(const std::string& filename, const std::string& /*mode*/) final
+    {
+        log_warning() << "Upload rejected, pack is read-only: " << filename << std::endl;
+        return nullptr;
+    }
+
+    // Starts reading the file data into the page cache.
+    bool warm_up(const std::string& filename) final
+    {
+        std::string path;
+        const std::uint8_t* data = nullptr;
+        std::size_t size = 0;
+        if (!root_directory::normalize_path(filename, path) || !m_pack.find(path, false, data, size))
+        {
+            return false;
+        }
+
+        m_pack.advise_will_need(data, size);
+        return true;
+    }
+
+private:
+    pack_archive m_pack;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
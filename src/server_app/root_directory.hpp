@@ -0,0 +1,126 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#if defined(__linux__) && defined(SYS_openat2)
+#include <linux/openat2.h>
+#define OCTNET_TFTP_HAS_OPENAT2 1
+#endif
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Served directory held open, files are opened relative to it so paths
+// cannot escape the root and are not resolved from the filesystem root.
+class root_directory
+{
+public:
+    root_directory(const root_directory&) = delete;
+    root_directory& operator=(const root_directory&) = delete;
+
+    root_directory(const std::string& path)
+        : m_path(path)
+        , m_fd(::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC))
+        , m_openat2_supported(true)
+    {
+        if (m_fd < 0)
+        {
+            throw std::system_error(errno, std::generic_category(), "cannot open root directory " + path);
+        }
+    }
+
+    ~root_directory()
+    {
+        ::close(m_fd);
+    }
+
+    const std::string& get_path() const
+    {
+        return m_path;
+    }
+
+    // Path must be normalized (see normalize_path), returns descriptor or -1 with errno set.
+    int open_file(const std::string& relative_path, int flags, mode_t mode = 0) const
+    {
+        flags |= O_CLOEXEC;
+
+#ifdef OCTNET_TFTP_HAS_OPENAT2
+        if (m_openat2_supported)
+        {
+            open_how how;
+            std::memset(&how, 0, sizeof(how));
+            how.flags = static_cast<std::uint64_t>(flags);
+            how.mode = (flags & O_CREAT) ? mode : 0;
+            how.resolve = RESOLVE_BENEATH | RESOLVE_NO_MAGICLINKS;
+
+            auto fd = static_cast<int>(::syscall(SYS_openat2, m_fd, relative_path.c_str(), &how, sizeof(how)));
+            if ((fd >= 0) || (errno != ENOSYS))
+            {
+                return fd;
+            }
+
+            // kernel older than 5.6
+            m_openat2_supported = false;
+        }
+#endif
+
+        // ".." is rejected by normalize_path, symlinks are followed as with plain open()
+        return ::openat(m_fd, relative_path.c_str(), flags, mode);
+    }
+
+    // Splits the requested filename into components, dropping empty and "." ones.
+    // Parent references are rejected, leading slash is ignored as many clients send it.
+    static bool normalize_path(const std::string& filename, std::string& path)
+    {
+        path.clear();
+
+        std::size_t pos = 0;
+        while (pos <= filename.size())
+        {
+            auto end_pos = filename.find('/', pos);
+            if (end_pos == std::string::npos)
+            {
+                end_pos = filename.size();
+            }
+
+            auto length = end_pos - pos;
+            if ((length == 2) && (filename.compare(pos, length, "..") == 0))
+            {
+                return false;
+            }
+            if ((length > 0) && !((length == 1) && (filename[pos] == '.')))
+            {
+                if (!path.empty())
+                {
+                    path += '/';
+                }
+                path.append(filename, pos, length);
+            }
+
+            pos = end_pos + 1;
+        }
+
+        return !path.empty();
+    }
+
+private:
+    const std::string m_path;
+    const int m_fd;
+    mutable std::atomic<bool> m_openat2_supported;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
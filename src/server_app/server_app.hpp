@@ -1,13 +1,31 @@
 #pragma once
 
+#include <atomic>
+#include <chrono>
 #include <functional>
-#include <iostream>
 #include <memory>
+#include <set>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include <sys/stat.h>
 
 #include <asio.hpp>
 
+#include "background_executor.hpp"
 #include "default_io_manager.hpp"
+#include "hot_list_io_manager.hpp"
+#include "log.hpp"
+#include "memory_io_manager.hpp"
+#include "pack_io_manager.hpp"
+#include "provider_io_manager.hpp"
 #include "server.hpp"
+#include "settings_loader.hpp"
+#include "socket_handoff.hpp"
+#include "template_provider.hpp"
+#include "transfer_log.hpp"
+#include "worker_pool.hpp"
 
 namespace oct
 {
@@ -19,72 +37,382 @@ namespace tftp
 class server_app
 {
 public:
-    server_app(int /*argc*/, char* /*argv*/[])
-        : m_io_context()
-        , m_signals(m_io_context, SIGTERM)
+    static const std::size_t WARM_UP_THREADS = 8;
+
+    server_app(int argc, char* argv[])
+        : m_program_name(argv[0])
+        , m_argc(argc)
+        , m_argv(argv)
+        , m_io_context()
+        , m_signals(m_io_context, SIGTERM, SIGINT, SIGHUP)
+        , m_hot_list_timer(m_io_context)
+        , m_draining(false)
     {
-        m_settings = create_settings();
-        m_io_manager = create_io_manager(*m_settings);
-        m_server = stdext::make_unique<server>(m_io_context, *m_settings, *m_io_manager);
+        // noop
     }
 
     int run()
     {
         try
         {
-            m_signals.async_wait(std::bind(&server_app::on_signal, this, std::placeholders::_1, std::placeholders::_2));
+            m_settings_loader = stdext::make_unique<settings_loader>(m_argc, m_argv);
+            if (m_settings_loader->is_help_requested())
+            {
+                settings_loader::print_usage(std::cout, m_program_name);
+                return EXIT_SUCCESS;
+            }
+
+            m_settings = m_settings_loader->load();
+        }
+        catch (const settings_error& e)
+        {
+            log_error() << e.what() << std::endl;
+            settings_loader::print_usage(std::cerr, m_program_name);
+            return EXIT_FAILURE;
+        }
+
+        try
+        {
+            logger::set_level(m_settings->m_log_level);
+
+            m_background_executor = stdext::make_unique<background_executor>(m_settings->m_background_threads);
+            if (!m_settings->m_transfer_log_path.empty())
+            {
+                m_transfer_log = stdext::make_unique<transfer_log>(*m_background_executor);
+                if (!m_transfer_log->open(m_settings->m_transfer_log_path))
+                {
+                    return EXIT_FAILURE;
+                }
+            }
+            m_hot_list_io_manager = stdext::make_unique<hot_list_io_manager>(create_root_io_manager());
+            m_provider_io_manager = stdext::make_unique<provider_io_manager>(*m_hot_list_io_manager);
+            m_provider_io_manager->set_rules(create_provider_rules(*m_settings));
+            m_workers = stdext::make_unique<worker_pool>(m_settings->m_worker_threads);
+            m_server
+                = stdext::make_unique<server>(m_io_context, *m_workers, m_settings, *m_provider_io_manager);
+            m_server->set_transfer_log(m_transfer_log.get());
+
+            warm_up();
+
+            // the running process keeps serving until the sockets are taken over
+            std::vector<listening_socket> inherited_sockets;
+            if (!m_settings->m_handoff_path.empty())
+            {
+                m_handoff = stdext::make_unique<socket_handoff>(m_io_context, m_settings->m_handoff_path);
+                if (m_handoff->take_over(inherited_sockets))
+                {
+                    log_info() << "Took over " << inherited_sockets.size() << " sockets from the running process"
+                               << std::endl;
+                }
+            }
+
+            wait_for_signal();
+            start_hot_list_timer();
 
-            m_server->start();
+            m_server->start(inherited_sockets);
+            m_workers->run();
+
+            if (m_handoff)
+            {
+                m_handoff->confirm();
+                m_handoff->listen([this]() { return m_server->get_listening_sockets(); },
+                    [this]() { on_handed_over(); });
+            }
 
             m_io_context.run();
 
+            m_workers->join();
+
             return EXIT_SUCCESS;
         }
         catch (const std::exception& e)
         {
-            std::cerr << e.what() << std::endl;
+            log_error() << e.what() << std::endl;
             return EXIT_FAILURE;
         }
     }
 
 private:
+    void wait_for_signal()
+    {
+        m_signals.async_wait(std::bind(&server_app::on_signal, this, std::placeholders::_1, std::placeholders::_2));
+    }
+
     void on_signal(const asio::error_code& ec, int signal_number)
     {
         if (ec)
         {
-            std::cerr << "Signal error: " << ec << std::endl;
+            log_error() << "Signal error: " << ec << std::endl;
             return;
         }
 
-        if (signal_number == SIGTERM)
+        if ((signal_number == SIGTERM) || (signal_number == SIGINT))
         {
-            std::cout << "Terminate requested" << std::endl;
-            m_io_context.stop();
+            if (m_draining)
+            {
+                log_info() << "Terminate requested again, terminating transfers" << std::endl;
+                m_server->stop();
+                return;
+            }
+
+            log_info() << "Terminate requested" << std::endl;
+            start_drain();
+        }
+        else if (signal_number == SIGHUP)
+        {
+            reload_settings();
         }
         else
         {
-            std::cerr << "Unexpected signal: " << signal_number << std::endl;
+            log_warning() << "Unexpected signal: " << signal_number << std::endl;
+        }
+
+        wait_for_signal();
+    }
+
+    void on_handed_over()
+    {
+        log_info() << "Sockets taken over by the next process" << std::endl;
+        if (!m_draining)
+        {
+            start_drain();
+        }
+    }
+
+    // New requests are no longer accepted, the process exits once the transfers complete.
+    void start_drain()
+    {
+        save_hot_list();
+        m_hot_list_timer.cancel();
+        if (m_handoff)
+        {
+            m_handoff->close();
+        }
+
+        m_draining = true;
+        m_server->drain(std::chrono::seconds(m_settings->m_drain_timeout_sec), [this]() { on_drained(); });
+    }
+
+    void on_drained()
+    {
+        auto reaped_count = m_server->get_reaped_count();
+        if (reaped_count > 0)
+        {
+            log_info() << "Idle transfers reaped: " << reaped_count << std::endl;
+        }
+
+        m_server->stop();
+        m_workers->finish();
+        m_io_context.stop();
+    }
+
+    void reload_settings()
+    {
+        log_info() << "Reload requested" << std::endl;
+
+        std::shared_ptr<server_settings> new_settings;
+        try
+        {
+            new_settings = m_settings_loader->load();
+        }
+        catch (const settings_error& e)
+        {
+            log_error() << "Reload failed, keeping current settings: " << e.what() << std::endl;
+            return;
+        }
+
+        if ((new_settings->m_listen != m_settings->m_listen)
+            || (new_settings->m_server_port != m_settings->m_server_port)
+            || (new_settings->m_root_path != m_settings->m_root_path)
+            || (new_settings->m_preload != m_settings->m_preload)
+            || (new_settings->m_worker_threads != m_settings->m_worker_threads)
+            || (new_settings->m_background_threads != m_settings->m_background_threads)
+            || (new_settings->m_transfer_log_path != m_settings->m_transfer_log_path)
+            || (new_settings->m_handoff_path != m_settings->m_handoff_path))
+        {
+            log_warning() << "Listen addresses, port, root, threads, transfer log and handoff changes require restart"
+                          << std::endl;
+
+            new_settings->m_listen = m_settings->m_listen;
+            new_settings->m_server_port = m_settings->m_server_port;
+            new_settings->m_root_path = m_settings->m_root_path;
+            new_settings->m_preload = m_settings->m_preload;
+            new_settings->m_worker_threads = m_settings->m_worker_threads;
+            new_settings->m_background_threads = m_settings->m_background_threads;
+            new_settings->m_transfer_log_path = m_settings->m_transfer_log_path;
+            new_settings->m_handoff_path = m_settings->m_handoff_path;
+        }
+
+        logger::set_level(new_settings->m_log_level);
+        if (m_io_manager)
+        {
+            m_io_manager->update_settings(new_settings);
         }
+        m_provider_io_manager->set_rules(create_provider_rules(*new_settings));
+        if (m_transfer_log)
+        {
+            // e.g. rotated
+            m_transfer_log->reopen();
+        }
+
+        m_settings = new_settings;
+        m_server->update_settings(m_settings);
     }
 
-    static std::unique_ptr<server_settings> create_settings()
+    // Warms up the files of the manifest and of the last hot list in parallel.
+    void warm_up()
     {
-        auto settings = stdext::make_unique<server_settings>();
-        settings->m_server_port = 6969;
-        settings->m_root_path = "testdata";
-        return settings;
+        std::vector<std::string> files;
+        if (!m_settings->m_warm_up_path.empty() && !hot_list_io_manager::load(m_settings->m_warm_up_path, files))
+        {
+            log_warning() << "Cannot read warm-up manifest: " << m_settings->m_warm_up_path << std::endl;
+        }
+        if (!m_settings->m_hot_list_path.empty())
+        {
+            // missing on the first start
+            std::vector<std::string> hot_files;
+            hot_list_io_manager::load(m_settings->m_hot_list_path, hot_files);
+            m_hot_list_io_manager->add(hot_files);
+            files.insert(files.end(), hot_files.begin(), hot_files.end());
+        }
+        if (files.empty())
+        {
+            return;
+        }
+
+        std::set<std::string> unique_files;
+        files.erase(std::remove_if(files.begin(), files.end(),
+                        [&unique_files](const std::string& file) { return !unique_files.insert(file).second; }),
+            files.end());
+
+        auto start_time = std::chrono::steady_clock::now();
+
+        std::atomic<std::size_t> next_index(0);
+        std::atomic<std::size_t> found_count(0);
+        std::vector<std::thread> threads;
+        for (std::size_t i = 0; (i < WARM_UP_THREADS) && (i < files.size()); ++i)
+        {
+            threads.emplace_back([this, &files, &next_index, &found_count]() {
+                for (auto index = next_index++; index < files.size(); index = next_index++)
+                {
+                    if (m_hot_list_io_manager->warm_up(files[index]))
+                    {
+                        ++found_count;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads)
+        {
+            thread.join();
+        }
+
+        auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start_time);
+        auto& log = log_info() << "Warm-up of " << files.size() << " files, " << found_count << " found, took "
+                               << duration.count() << " ms";
+        if (m_io_manager)
+        {
+            log << ", file cache holds " << m_io_manager->get_cached_size() << " bytes";
+        }
+        log << std::endl;
     }
 
-    static std::unique_ptr<io_manager> create_io_manager(server_settings& settings)
+    void start_hot_list_timer()
     {
-        return stdext::make_unique<default_io_manager>(settings.m_root_path);
+        if (m_settings->m_hot_list_path.empty())
+        {
+            return;
+        }
+
+        m_hot_list_timer.expires_after(std::chrono::seconds(m_settings->m_hot_list_interval_sec));
+        m_hot_list_timer.async_wait([this](const asio::error_code& ec) {
+            if (!ec)
+            {
+                save_hot_list();
+                start_hot_list_timer();
+            }
+        });
+    }
+
+    void save_hot_list()
+    {
+        if (!m_settings->m_hot_list_path.empty())
+        {
+            m_hot_list_io_manager->save(m_settings->m_hot_list_path);
+        }
+    }
+
+    io_manager& create_root_io_manager()
+    {
+        if (pack_archive::is_pack(m_settings->m_root_path))
+        {
+            m_pack_io_manager = stdext::make_unique<pack_io_manager>();
+            if (!m_pack_io_manager->open(m_settings->m_root_path))
+            {
+                throw std::runtime_error("cannot open pack: " + m_settings->m_root_path);
+            }
+
+            log_info() << "Serving pack of " << m_pack_io_manager->get_pack().get_files_count() << " files"
+                       << std::endl;
+            return *m_pack_io_manager;
+        }
+
+        if (!m_settings->m_preload)
+        {
+            m_io_manager = stdext::make_unique<default_io_manager>(m_io_context, *m_background_executor, m_settings);
+            return *m_io_manager;
+        }
+
+        m_memory_io_manager = stdext::make_unique<memory_io_manager>();
+
+        struct stat root_stat;
+        bool is_archive = (::stat(m_settings->m_root_path.c_str(), &root_stat) == 0) && S_ISREG(root_stat.st_mode);
+        bool loaded = is_archive ? m_memory_io_manager->load_archive(m_settings->m_root_path)
+                                 : m_memory_io_manager->load_directory(m_settings->m_root_path);
+        if (!loaded)
+        {
+            throw std::runtime_error("cannot preload root: " + m_settings->m_root_path);
+        }
+
+        log_info() << "Preloaded " << m_memory_io_manager->get_files_count() << " files, "
+                   << m_memory_io_manager->get_content_size() << " bytes" << std::endl;
+        return *m_memory_io_manager;
     }
 
+    static std::vector<provider_io_manager::rule> create_provider_rules(const server_settings& settings)
+    {
+        std::vector<provider_io_manager::rule> rules;
+        for (auto& provider : settings.m_providers)
+        {
+            rules.emplace_back(provider.m_pattern, std::make_shared<template_provider>(provider.m_template),
+                std::chrono::seconds(provider.m_ttl_sec));
+        }
+        return rules;
+    }
+
+    const char* m_program_name;
+    int m_argc;
+    char** m_argv;
+
     asio::io_context m_io_context;
     asio::signal_set m_signals;
+    std::unique_ptr<socket_handoff> m_handoff;
 
-    std::unique_ptr<server_settings> m_settings;
-    std::unique_ptr<io_manager> m_io_manager;
+    std::unique_ptr<settings_loader> m_settings_loader;
+    std::shared_ptr<const server_settings> m_settings;
+    // written by the background executor, so it outlives it
+    std::unique_ptr<transfer_log> m_transfer_log;
+    std::unique_ptr<background_executor> m_background_executor;
+    // one of these serves the root
+    std::unique_ptr<default_io_manager> m_io_manager;
+    std::unique_ptr<memory_io_manager> m_memory_io_manager;
+    std::unique_ptr<pack_io_manager> m_pack_io_manager;
+    std::unique_ptr<hot_list_io_manager> m_hot_list_io_manager;
+    asio::steady_timer m_hot_list_timer;
+    bool m_draining;
+    std::unique_ptr<provider_io_manager> m_provider_io_manager;
+    std::unique_ptr<worker_pool> m_workers;
     std::unique_ptr<server> m_server;
 };
 
@@ -0,0 +1,495 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "defs.hpp"
+#include "log.hpp"
+#include "make_unique.hpp"
+#include "server_settings.hpp"
+#include "string_utils.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+class settings_error : public std::runtime_error
+{
+public:
+    settings_error(const std::string& message)
+        : std::runtime_error(message)
+    {
+        // noop
+    }
+};
+
+// Builds server settings from defaults, the configuration file and the
+// command line, in that order of precedence. The command line is kept, so
+// the settings could be rebuilt when the configuration file changes.
+//
+// Configuration file contains "name = value" lines, '#' starts a comment.
+// Command line options use the same names: "--name value" or "--name=value".
+class settings_loader
+{
+public:
+    settings_loader(int argc, char* argv[])
+        : m_help_requested(false)
+    {
+        parse_command_line(argc, argv);
+    }
+
+    bool is_help_requested() const
+    {
+        return m_help_requested;
+    }
+
+    std::unique_ptr<server_settings> load() const
+    {
+        auto settings = stdext::make_unique<server_settings>();
+
+        if (!m_config_path.empty())
+        {
+            for (auto& option : read_config_file(m_config_path))
+            {
+                apply_option(*settings, option.first, option.second);
+            }
+        }
+        for (auto& option : m_command_line_options)
+        {
+            // lists from command line replace the ones from configuration file
+            if (option.first == "listen")
+            {
+                settings->m_listen.clear();
+            }
+            else if (option.first == "provide")
+            {
+                settings->m_providers.clear();
+            }
+        }
+        for (auto& option : m_command_line_options)
+        {
+            apply_option(*settings, option.first, option.second);
+        }
+
+        if (settings->m_root_path.empty())
+        {
+            throw settings_error("root directory not specified");
+        }
+
+        if (settings->m_listen.empty())
+        {
+            listen_settings default_listen;
+            default_listen.m_address = "0.0.0.0";
+            settings->m_listen.push_back(default_listen);
+        }
+        for (auto& listen : settings->m_listen)
+        {
+            for (auto worker : listen.m_workers)
+            {
+                if (worker >= settings->m_worker_threads)
+                {
+                    throw settings_error("invalid worker for " + listen.m_address + ": " + std::to_string(worker));
+                }
+            }
+        }
+
+        return settings;
+    }
+
+    static void print_usage(std::ostream& stream, const char* program_name)
+    {
+        stream << "Usage: " << program_name << " [options]\n"
+               << "\n"
+               << "Options:\n"
+               << "  -h, --help                  print this message\n"
+               << "  -c, --config PATH           configuration file, reloaded on SIGHUP\n"
+               << "  --listen ADDRESS[@WORKERS]  address to listen on, could be repeated (default: 0.0.0.0);\n"
+               << "                              transfers are served by listed workers, e.g. ::@0-1,3\n"
+               << "  -p, --port PORT             port to listen on (default: 69)\n"
+               << "  -r, --root PATH             root directory of served files, or a pack built by\n"
+               << "                              octnet-tftp-pack\n"
+               << "  --preload yes|no            load the root, a directory or tar archive, into memory at\n"
+               << "                              startup and serve it read-only from there (default: no)\n"
+               << "  --threads COUNT             number of worker threads (default: 1)\n"
+               << "  --background-threads COUNT  number of threads writing uploads (default: 1)\n"
+               << "  --max-blksize BYTES         maximum negotiated block size (default: 65464)\n"
+               << "  --max-windowsize BLOCKS     maximum negotiated window size (default: 16)\n"
+               << "  --cache-size BYTES          file cache budget (default: 67108864)\n"
+               << "  --timeout SECONDS           retransmission timeout (default: 1)\n"
+               << "  --retries COUNT             retransmission count (default: 5)\n"
+               << "  --max-requests-per-sec N    new requests rate limit, 0 for none (default: 0)\n"
+               << "  --max-connections N         concurrent transfers limit, 0 for none (default: 0)\n"
+               << "  --drain-timeout SECONDS     running transfers are waited for on SIGTERM, then\n"
+               << "                              terminated (default: 30)\n"
+               << "  --log-level LEVEL           error, warning, info or debug (default: info)\n"
+               << "  --fsync POLICY              uploads sync: none, close or periodic (default: close)\n"
+               << "  --fsync-interval BYTES      periodic sync interval (default: 8388608)\n"
+               << "  --write-behind-size BYTES   upload data buffered before written, 0 to write\n"
+               << "                              synchronously (default: 4194304)\n"
+               << "  --direct-io yes|no          write uploads bypassing the page cache (default: no)\n"
+               << "  --warm-up PATH              files listed, one per line, are loaded into the cache\n"
+               << "                              before requests are accepted\n"
+               << "  --hot-list PATH             most read files are saved there periodically and warmed\n"
+               << "                              up on the next start\n"
+               << "  --hot-list-interval SECONDS hot list save interval (default: 300)\n"
+               << "  --transfer-log PATH         stats of every transfer are appended there, a line each;\n"
+               << "                              reopened on SIGHUP\n"
+               << "  --handoff PATH              Unix socket to take the listening sockets over from the\n"
+               << "                              running server, which then drains and exits, and to hand\n"
+               << "                              them over to the next one\n"
+               << "  --provide 'PATTERN TEMPLATE [TTL]'\n"
+               << "                              generate files matching the pattern from the template file,\n"
+               << "                              cached for TTL seconds (default: 60), could be repeated\n"
+               << "\n"
+               << "Options other than --config could also be given in the configuration file,\n"
+               << "without the leading dashes. Command line takes precedence.\n";
+    }
+
+private:
+    typedef std::vector<std::pair<std::string, std::string>> option_list;
+
+    void parse_command_line(int argc, char* argv[])
+    {
+        for (int i = 1; i < argc; ++i)
+        {
+            std::string arg = argv[i];
+
+            if ((arg == "-h") || (arg == "--help"))
+            {
+                m_help_requested = true;
+                continue;
+            }
+
+            std::string name;
+            std::string value;
+
+            if ((arg == "-c") || (arg == "-p") || (arg == "-r"))
+            {
+                name = (arg == "-c") ? "config" : (arg == "-p") ? "port" : "root";
+            }
+            else if (arg.compare(0, 2, "--") == 0)
+            {
+                name = arg.substr(2);
+
+                auto separator_pos = name.find('=');
+                if (separator_pos != std::string::npos)
+                {
+                    value = name.substr(separator_pos + 1);
+                    name.resize(separator_pos);
+                    add_command_line_option(name, value);
+                    continue;
+                }
+            }
+            else
+            {
+                throw settings_error("unexpected argument: " + arg);
+            }
+
+            if (i + 1 >= argc)
+            {
+                throw settings_error("missing value for: " + arg);
+            }
+            add_command_line_option(name, argv[++i]);
+        }
+    }
+
+    void add_command_line_option(const std::string& name, const std::string& value)
+    {
+        if (name == "config")
+        {
+            m_config_path = value;
+        }
+        else
+        {
+            m_command_line_options.emplace_back(name, value);
+        }
+    }
+
+    static option_list read_config_file(const std::string& path)
+    {
+        std::ifstream stream(path);
+        if (!stream)
+        {
+            throw settings_error("cannot open configuration file: " + path);
+        }
+
+        option_list options;
+
+        std::string line;
+        std::size_t line_no = 0;
+        while (std::getline(stream, line))
+        {
+            ++line_no;
+
+            auto comment_pos = line.find('#');
+            if (comment_pos != std::string::npos)
+            {
+                line.resize(comment_pos);
+            }
+
+            line = trim(line);
+            if (line.empty())
+            {
+                continue;
+            }
+
+            auto separator_pos = line.find('=');
+            if (separator_pos == std::string::npos)
+            {
+                throw settings_error(path + ':' + std::to_string(line_no) + ": expected 'name = value'");
+            }
+
+            options.emplace_back(trim(line.substr(0, separator_pos)), trim(line.substr(separator_pos + 1)));
+        }
+
+        return options;
+    }
+
+    static void apply_option(server_settings& settings, const std::string& name, const std::string& value)
+    {
+        if (name == "listen")
+        {
+            settings.m_listen.push_back(parse_listen(value));
+        }
+        else if (name == "port")
+        {
+            settings.m_server_port = parse_number<std::uint16_t>(name, value, 1);
+        }
+        else if (name == "root")
+        {
+            settings.m_root_path = value;
+        }
+        else if (name == "preload")
+        {
+            settings.m_preload = parse_bool(name, value);
+        }
+        else if (name == "threads")
+        {
+            settings.m_worker_threads = parse_number<std::size_t>(name, value, 1);
+        }
+        else if (name == "background-threads")
+        {
+            settings.m_background_threads = parse_number<std::size_t>(name, value, 1);
+        }
+        else if (name == "max-blksize")
+        {
+            settings.m_max_block_size = parse_number<std::size_t>(name, value, MIN_DATA_SIZE, MAX_DATA_SIZE);
+        }
+        else if (name == "max-windowsize")
+        {
+            settings.m_max_window_size = parse_number<std::uint16_t>(name, value, 1);
+        }
+        else if (name == "cache-size")
+        {
+            settings.m_file_cache_size = parse_number<std::uint64_t>(name, value);
+        }
+        else if (name == "timeout")
+        {
+            settings.m_retry_timeout_sec
+                = parse_number<int>(name, value, MIN_RETRY_TIMEOUT_SEC, MAX_RETRY_TIMEOUT_SEC);
+        }
+        else if (name == "retries")
+        {
+            settings.m_retry_count = parse_number<int>(name, value, 1);
+        }
+        else if (name == "max-requests-per-sec")
+        {
+            settings.m_max_requests_per_sec = parse_number<std::uint32_t>(name, value);
+        }
+        else if (name == "max-connections")
+        {
+            settings.m_max_connections = parse_number<std::size_t>(name, value);
+        }
+        else if (name == "drain-timeout")
+        {
+            settings.m_drain_timeout_sec = parse_number<std::uint32_t>(name, value);
+        }
+        else if (name == "log-level")
+        {
+            if (!logger::parse_level(value, settings.m_log_level))
+            {
+                throw settings_error("invalid value for " + name + ": " + value);
+            }
+        }
+        else if (name == "fsync")
+        {
+            if (!parse_fsync_policy(value, settings.m_fsync_policy))
+            {
+                throw settings_error("invalid value for " + name + ": " + value);
+            }
+        }
+        else if (name == "fsync-interval")
+        {
+            settings.m_fsync_interval = parse_number<std::uint64_t>(name, value, 1);
+        }
+        else if (name == "write-behind-size")
+        {
+            settings.m_write_behind_size = parse_number<std::size_t>(name, value);
+        }
+        else if (name == "direct-io")
+        {
+            settings.m_direct_io = parse_bool(name, value);
+        }
+        else if (name == "warm-up")
+        {
+            settings.m_warm_up_path = value;
+        }
+        else if (name == "hot-list")
+        {
+            settings.m_hot_list_path = value;
+        }
+        else if (name == "hot-list-interval")
+        {
+            settings.m_hot_list_interval_sec = parse_number<std::uint32_t>(name, value, 1);
+        }
+        else if (name == "transfer-log")
+        {
+            settings.m_transfer_log_path = value;
+        }
+        else if (name == "handoff")
+        {
+            settings.m_handoff_path = value;
+        }
+        else if (name == "provide")
+        {
+            settings.m_providers.push_back(parse_provide(value));
+        }
+        else
+        {
+            throw settings_error("unknown option: " + name);
+        }
+    }
+
+    // ADDRESS[@WORKERS], WORKERS is a list of worker indices or ranges, e.g. "::@0-1,4"
+    static listen_settings parse_listen(const std::string& value)
+    {
+        listen_settings listen;
+
+        auto separator_pos = value.find('@');
+        listen.m_address = value.substr(0, separator_pos);
+        if ((listen.m_address.size() > 2) && (listen.m_address.front() == '[') && (listen.m_address.back() == ']'))
+        {
+            listen.m_address = listen.m_address.substr(1, listen.m_address.size() - 2);
+        }
+
+        asio::error_code ec;
+        asio::ip::make_address(listen.m_address, ec);
+        if (ec)
+        {
+            throw settings_error("invalid listen address: " + value);
+        }
+
+        if (separator_pos == std::string::npos)
+        {
+            return listen;
+        }
+
+        std::string workers = value.substr(separator_pos + 1);
+        std::size_t pos = 0;
+        while (pos <= workers.size())
+        {
+            auto end_pos = workers.find(',', pos);
+            if (end_pos == std::string::npos)
+            {
+                end_pos = workers.size();
+            }
+
+            auto range = workers.substr(pos, end_pos - pos);
+            auto dash_pos = range.find('-');
+            auto first = parse_number<std::size_t>("listen", range.substr(0, dash_pos));
+            auto last = first;
+            if (dash_pos != std::string::npos)
+            {
+                last = parse_number<std::size_t>("listen", range.substr(dash_pos + 1));
+            }
+            if (last < first)
+            {
+                throw settings_error("invalid worker range: " + range);
+            }
+            for (auto worker = first; worker <= last; ++worker)
+            {
+                listen.m_workers.push_back(worker);
+            }
+
+            pos = end_pos + 1;
+        }
+
+        return listen;
+    }
+
+    // "PATTERN TEMPLATE_PATH [TTL]", the template file is read immediately
+    static provider_settings parse_provide(const std::string& value)
+    {
+        std::istringstream fields(value);
+        std::vector<std::string> field_list(
+            (std::istream_iterator<std::string>(fields)), std::istream_iterator<std::string>());
+        if ((field_list.size() < 2) || (field_list.size() > 3))
+        {
+            throw settings_error("invalid value for provide: " + value);
+        }
+
+        provider_settings provider;
+        provider.m_pattern = field_list[0];
+        provider.m_template_path = field_list[1];
+        if (field_list.size() > 2)
+        {
+            provider.m_ttl_sec = parse_number<std::uint32_t>("provide", field_list[2]);
+        }
+
+        std::ifstream stream(provider.m_template_path, std::ios::binary);
+        if (!stream)
+        {
+            throw settings_error("cannot open template file: " + provider.m_template_path);
+        }
+        provider.m_template.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+
+        return provider;
+    }
+
+    template <class value_T>
+    static value_T parse_number(const std::string& name, const std::string& value, std::uint64_t min_value = 0,
+        std::uint64_t max_value = std::numeric_limits<value_T>::max())
+    {
+        std::uint64_t number = 0;
+        if (!parse_uint64(value, number) || (number < min_value) || (number > max_value))
+        {
+            throw settings_error("invalid value for " + name + ": " + value);
+        }
+        return static_cast<value_T>(number);
+    }
+
+    static bool parse_bool(const std::string& name, const std::string& value)
+    {
+        if ((value == "yes") || (value == "true") || (value == "on") || (value == "1"))
+        {
+            return true;
+        }
+        if ((value == "no") || (value == "false") || (value == "off") || (value == "0"))
+        {
+            return false;
+        }
+        throw settings_error("invalid value for " + name + ": " + value);
+    }
+
+    bool m_help_requested;
+    std::string m_config_path;
+    option_list m_command_line_options;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
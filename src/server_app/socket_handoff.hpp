@@ -0,0 +1,332 @@
+#pragma once
+
+#include <array>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <asio.hpp>
+
+#include "log.hpp"
+#include "server_acceptor.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Hands the listening sockets over from the running server process to the
+// next one, over a Unix socket at the given path, so a restart drops no
+// request:
+//
+//   1. the next process connects to the path and receives the sockets
+//      (SCM_RIGHTS), then serves them and confirms by a single byte;
+//   2. the running process stops serving them, drains its transfers and
+//      exits, while the next one listens on the path for its successor.
+//
+// Requests received meanwhile are queued in the shared sockets.
+class socket_handoff
+{
+public:
+    static const std::size_t MAX_SOCKETS = 64;
+    static const std::uint32_t MESSAGE_MAGIC = 0x4f544648;
+    static const char CONFIRMATION = 'A';
+    static const int TAKE_OVER_TIMEOUT_SEC = 5;
+
+    socket_handoff(asio::io_context& io_context, const std::string& path)
+        : m_path(path)
+        , m_acceptor(io_context)
+        , m_peer(io_context)
+        , m_sockets_provider()
+        , m_handed_over_handler()
+        , m_confirmation()
+    {
+        // noop
+    }
+
+    // Receives the sockets of the process listening on the path, false if
+    // there is none. Blocking, the caller owns the received sockets.
+    bool take_over(std::vector<listening_socket>& sockets)
+    {
+        asio::error_code ec;
+        m_peer.connect(asio::local::stream_protocol::endpoint(m_path), ec);
+        if (ec)
+        {
+            // no running process
+            log_debug() << "No process to take over from: " << ec << std::endl;
+            m_peer.close(ec);
+            return false;
+        }
+
+        timeval timeout;
+        timeout.tv_sec = TAKE_OVER_TIMEOUT_SEC;
+        timeout.tv_usec = 0;
+        ::setsockopt(m_peer.native_handle(), SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+        if (!receive_sockets(m_peer.native_handle(), sockets))
+        {
+            m_peer.close(ec);
+            return false;
+        }
+        return true;
+    }
+
+    // Running process stops serving the taken over sockets.
+    void confirm()
+    {
+        if (!m_peer.is_open())
+        {
+            return;
+        }
+
+        const char confirmation = CONFIRMATION;
+        asio::error_code ec;
+        asio::write(m_peer, asio::buffer(&confirmation, 1), ec);
+        if (ec)
+        {
+            log_warning() << "Take over confirmation failed: " << ec << std::endl;
+        }
+        m_peer.close(ec);
+    }
+
+    // Waits for the next process, the provided sockets are handed over to it
+    // and the handler is called once it serves them.
+    bool listen(std::function<std::vector<listening_socket>()> sockets_provider,
+        std::function<void()> handed_over_handler)
+    {
+        m_sockets_provider = std::move(sockets_provider);
+        m_handed_over_handler = std::move(handed_over_handler);
+
+        // left by the previous process
+        ::unlink(m_path.c_str());
+
+        asio::error_code ec;
+        asio::local::stream_protocol::endpoint endpoint(m_path);
+        m_acceptor.open(endpoint.protocol(), ec);
+        if (!ec)
+        {
+            m_acceptor.bind(endpoint, ec);
+        }
+        if (!ec)
+        {
+            m_acceptor.listen(asio::socket_base::max_listen_connections, ec);
+        }
+        if (ec)
+        {
+            log_error() << "Cannot listen for handoff on " << m_path << ": " << ec << std::endl;
+            m_acceptor.close(ec);
+            return false;
+        }
+
+        accept_next();
+        return true;
+    }
+
+    // Path is removed, unless it was handed over to the next process.
+    void close()
+    {
+        if (m_acceptor.is_open())
+        {
+            asio::error_code ec;
+            m_acceptor.close(ec);
+            ::unlink(m_path.c_str());
+        }
+    }
+
+private:
+    void accept_next()
+    {
+        m_acceptor.async_accept(m_peer, [this](const asio::error_code& ec) { on_accepted(ec); });
+    }
+
+    void on_accepted(const asio::error_code& ec)
+    {
+        if (ec == asio::error::operation_aborted)
+        {
+            // ignore, cancelled
+            return;
+        }
+
+        if (ec)
+        {
+            log_error() << "Handoff accept failed: " << ec << std::endl;
+            accept_next();
+            return;
+        }
+
+        log_info() << "Handing the sockets over to the next process" << std::endl;
+
+        if (!send_sockets(m_peer.native_handle(), m_sockets_provider()))
+        {
+            asio::error_code ignored;
+            m_peer.close(ignored);
+            accept_next();
+            return;
+        }
+
+        asio::async_read(m_peer, asio::buffer(m_confirmation),
+            [this](const asio::error_code& ec, std::size_t /*bytes_transferred*/) { on_confirmed(ec); });
+    }
+
+    void on_confirmed(const asio::error_code& ec)
+    {
+        if (ec == asio::error::operation_aborted)
+        {
+            // ignore, cancelled
+            return;
+        }
+
+        asio::error_code ignored;
+        m_peer.close(ignored);
+
+        if (ec || (m_confirmation[0] != CONFIRMATION))
+        {
+            log_warning() << "Next process did not take the sockets over, still serving them" << std::endl;
+            accept_next();
+            return;
+        }
+
+        // path is used by the next process now
+        m_acceptor.close(ignored);
+        m_handed_over_handler();
+    }
+
+    struct message_header
+    {
+        std::uint32_t m_magic;
+        std::uint32_t m_count;
+    };
+
+    static bool send_sockets(int unix_socket, const std::vector<listening_socket>& sockets)
+    {
+        if (sockets.size() > MAX_SOCKETS)
+        {
+            log_error() << "Too many sockets to hand over: " << sockets.size() << std::endl;
+            return false;
+        }
+
+        message_header header;
+        header.m_magic = MESSAGE_MAGIC;
+        header.m_count = static_cast<std::uint32_t>(sockets.size());
+
+        iovec header_iov;
+        header_iov.iov_base = &header;
+        header_iov.iov_len = sizeof(header);
+
+        alignas(cmsghdr) std::array<std::uint8_t, CMSG_SPACE(MAX_SOCKETS * sizeof(int))> control_buffer;
+
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &header_iov;
+        message.msg_iovlen = 1;
+        if (!sockets.empty())
+        {
+            message.msg_control = control_buffer.data();
+            message.msg_controllen = CMSG_SPACE(sockets.size() * sizeof(int));
+
+            auto cmsg = CMSG_FIRSTHDR(&message);
+            cmsg->cmsg_level = SOL_SOCKET;
+            cmsg->cmsg_type = SCM_RIGHTS;
+            cmsg->cmsg_len = CMSG_LEN(sockets.size() * sizeof(int));
+            for (std::size_t i = 0; i < sockets.size(); ++i)
+            {
+                std::memcpy(CMSG_DATA(cmsg) + i * sizeof(int), &sockets[i].m_native_handle, sizeof(int));
+            }
+        }
+
+        if (::sendmsg(unix_socket, &message, MSG_NOSIGNAL) != static_cast<ssize_t>(sizeof(header)))
+        {
+            log_error() << "Sockets handoff failed: " << asio::error_code(errno, asio::error::get_system_category())
+                        << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    static bool receive_sockets(int unix_socket, std::vector<listening_socket>& sockets)
+    {
+        message_header header;
+        iovec header_iov;
+        header_iov.iov_base = &header;
+        header_iov.iov_len = sizeof(header);
+
+        alignas(cmsghdr) std::array<std::uint8_t, CMSG_SPACE(MAX_SOCKETS * sizeof(int))> control_buffer;
+
+        msghdr message;
+        std::memset(&message, 0, sizeof(message));
+        message.msg_iov = &header_iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control_buffer.data();
+        message.msg_controllen = control_buffer.size();
+
+        auto bytes_received = ::recvmsg(unix_socket, &message, MSG_CMSG_CLOEXEC);
+        if (bytes_received < 0)
+        {
+            log_error() << "Sockets take over failed: " << asio::error_code(errno, asio::error::get_system_category())
+                        << std::endl;
+            return false;
+        }
+
+        std::vector<int> handles;
+        for (auto cmsg = CMSG_FIRSTHDR(&message); cmsg != nullptr; cmsg = CMSG_NXTHDR(&message, cmsg))
+        {
+            if ((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_RIGHTS))
+            {
+                auto count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                for (std::size_t i = 0; i < count; ++i)
+                {
+                    int handle = -1;
+                    std::memcpy(&handle, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(int));
+                    handles.push_back(handle);
+                }
+            }
+        }
+
+        if ((bytes_received != static_cast<ssize_t>(sizeof(header))) || (header.m_magic != MESSAGE_MAGIC)
+            || (header.m_count != handles.size()) || ((message.msg_flags & MSG_CTRUNC) != 0))
+        {
+            log_error() << "Invalid sockets handoff message" << std::endl;
+            for (auto handle : handles)
+            {
+                ::close(handle);
+            }
+            return false;
+        }
+
+        for (auto handle : handles)
+        {
+            listening_socket socket;
+            socket.m_native_handle = handle;
+            auto endpoint_size = static_cast<socklen_t>(socket.m_endpoint.capacity());
+            if (::getsockname(handle, socket.m_endpoint.data(), &endpoint_size) == 0)
+            {
+                socket.m_endpoint.resize(endpoint_size);
+            }
+            sockets.push_back(socket);
+        }
+        return true;
+    }
+
+    const std::string m_path;
+
+    asio::local::stream_protocol::acceptor m_acceptor;
+    // next process connected to the acceptor, or the previous one we connected to
+    asio::local::stream_protocol::socket m_peer;
+
+    std::function<std::vector<listening_socket>()> m_sockets_provider;
+    std::function<void()> m_handed_over_handler;
+    std::array<char, 1> m_confirmation;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
@@ -0,0 +1,68 @@
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+#include "allocation_counter.hpp"
+
+// Replaced in a translation unit of their own, calls inlined elsewhere would
+// be seen to pair the allocation functions with free().
+
+namespace
+{
+
+// Precedes the allocation, aligned as malloc() aligns it.
+struct alignas(std::max_align_t) allocation_header
+{
+    std::size_t m_size;
+    bool m_counted;
+};
+
+} // namespace
+
+void* operator new(std::size_t size)
+{
+    auto header = static_cast<allocation_header*>(std::malloc(sizeof(allocation_header) + size));
+    if (!header)
+    {
+        throw std::bad_alloc();
+    }
+
+    header->m_size = size;
+    header->m_counted = oct::net::tftp::allocation_counter::add(size);
+    return header + 1;
+}
+
+void* operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    if (!pointer)
+    {
+        return;
+    }
+
+    auto header = static_cast<allocation_header*>(pointer) - 1;
+    if (header->m_counted)
+    {
+        oct::net::tftp::allocation_counter::remove(header->m_size);
+    }
+    std::free(header);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete(void* pointer, std::size_t /*size*/) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete[](void* pointer, std::size_t /*size*/) noexcept
+{
+    operator delete[](pointer);
+}
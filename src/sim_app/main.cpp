@@ -0,0 +1,7 @@
+#include "sim_app.hpp"
+
+int main(int argc, char* argv[])
+{
+    oct::net::tftp::sim_app app(argc, argv);
+    return app.run();
+}
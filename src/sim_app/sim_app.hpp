@@ -0,0 +1,766 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <asio.hpp>
+
+#include "allocation_counter.hpp"
+#include "background_executor.hpp"
+#include "client.hpp"
+#include "handler_allocator.hpp"
+#include "log.hpp"
+#include "make_unique.hpp"
+#include "memory_io.hpp"
+#include "packet.hpp"
+#include "packet_builder.hpp"
+#include "packet_parser.hpp"
+#include "read_connection.hpp"
+#include "server.hpp"
+#include "server_settings.hpp"
+#include "sim_io_manager.hpp"
+#include "sim_network.hpp"
+#include "string_utils.hpp"
+#include "transport.hpp"
+#include "worker_pool.hpp"
+#include "write_connection.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Runs transfers between the server and the client over the simulated network
+// (virtual time, lossy links), checks the files arrive byte exact and reports
+// the goodput and retransmissions. A run is reproduced by its seed. With
+// --count-allocations it fails if the transfers allocate in the steady state,
+// with --footprint it reports the memory kept by the server per transfer.
+class sim_app
+{
+public:
+    static const std::uint16_t SERVER_PORT = 69;
+
+    sim_app(int argc, char* argv[])
+        : m_program_name(argv[0])
+        , m_argc(argc)
+        , m_argv(argv)
+        , m_transfers_count(100)
+        , m_concurrency(1)
+        , m_max_size(256 * 1024)
+        , m_mode("octet")
+        , m_direction("both")
+        , m_block_size(DEFAULT_DATA_SIZE)
+        , m_window_size(DEFAULT_WINDOW_SIZE)
+        , m_timeout_sec(DEFAULT_RETRY_TIMEOUT_SEC)
+        , m_retry_count(DEFAULT_RETRY_COUNTER)
+        , m_seed(1)
+        , m_link()
+        , m_count_allocations(false)
+        , m_footprint_count(0)
+    {
+        // noop
+    }
+
+    int run()
+    {
+        log_level level = log_level::ERROR;
+
+        for (int i = 1; i < m_argc; ++i)
+        {
+            std::string arg = m_argv[i];
+
+            if ((arg == "-h") || (arg == "--help"))
+            {
+                print_usage(std::cout);
+                return EXIT_SUCCESS;
+            }
+            if (arg == "--count-allocations")
+            {
+                m_count_allocations = true;
+                continue;
+            }
+            if (arg.compare(0, 2, "--") != 0)
+            {
+                log_error() << "unexpected argument: " << arg << std::endl;
+                print_usage(std::cerr);
+                return EXIT_FAILURE;
+            }
+            if (i + 1 >= m_argc)
+            {
+                log_error() << "missing value for: " << arg << std::endl;
+                print_usage(std::cerr);
+                return EXIT_FAILURE;
+            }
+
+            std::string value = m_argv[++i];
+            bool known = true;
+            if (!parse_option(arg, value, level, known))
+            {
+                if (known)
+                {
+                    log_error() << "invalid value for " << arg << ": " << value << std::endl;
+                    return EXIT_FAILURE;
+                }
+                log_error() << "unknown option: " << arg << std::endl;
+                print_usage(std::cerr);
+                return EXIT_FAILURE;
+            }
+        }
+
+        logger::set_level(level);
+
+        if (m_count_allocations && (m_concurrency > 1))
+        {
+            // setup of the other transfers would be counted
+            log_error() << "--count-allocations requires --concurrency 1" << std::endl;
+            return EXIT_FAILURE;
+        }
+
+        if (m_footprint_count > 0)
+        {
+            return measure_footprints() ? EXIT_SUCCESS : EXIT_FAILURE;
+        }
+        return simulate() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+private:
+    // allocations counted when the client reported the bytes
+    struct allocation_sample
+    {
+        std::uint64_t m_bytes;
+        std::uint64_t m_allocations;
+    };
+
+    // blocks of the first and last windows set up and complete the transfer
+    static const std::size_t WARM_UP_WINDOWS_COUNT = 2;
+    // operations pending at once in the thread, at most
+    static const std::size_t WARM_UP_HANDLER_BLOCKS_COUNT = 64;
+
+    // requests sent at once, within the receive queue limit of the server socket
+    static const std::size_t FOOTPRINT_BATCH_SIZE = 128;
+    static const std::size_t MAX_FOOTPRINT_COUNT = 1000000;
+    // connections of an address have a port of the ephemeral range each
+    static const std::size_t EPHEMERAL_PORTS_COUNT = 0x10000 - sim_network::FIRST_EPHEMERAL_PORT;
+    // 127.0.0.1 and the following addresses
+    static const std::uint32_t FOOTPRINT_SERVER_ADDRESS = 0x7F000001;
+    // 10.0.0.1 and the following addresses, a peer each
+    static const std::uint32_t FOOTPRINT_PEER_ADDRESS = 0x0A000001;
+    static const std::uint16_t FOOTPRINT_PEER_PORT = 1024;
+
+    struct transfer_state
+    {
+        transfer_state()
+            : m_put(false)
+            , m_content()
+            , m_received()
+            , m_result()
+            , m_intact(false)
+            , m_steady(false)
+            , m_steady_start()
+            , m_steady_end()
+        {
+            // noop
+        }
+
+        bool m_put;
+        std::string m_filename;
+        // released once the transfer is checked
+        sim_io_manager::content_ptr m_content;
+        sim_io_manager::content_ptr m_received;
+        transfer_result m_result;
+        // file arrived byte exact
+        bool m_intact;
+
+        // blocks reported between the first and the last windows
+        bool m_steady;
+        allocation_sample m_steady_start;
+        allocation_sample m_steady_end;
+    };
+
+    bool parse_option(const std::string& arg, const std::string& value, log_level& level, bool& known)
+    {
+        std::uint64_t number = 0;
+
+        if (arg == "--transfers")
+        {
+            return parse_uint64(value, number) && assign(number, m_transfers_count);
+        }
+        if (arg == "--concurrency")
+        {
+            return parse_uint64(value, number) && (number > 0) && assign(number, m_concurrency);
+        }
+        if (arg == "--size")
+        {
+            return parse_uint64(value, number) && assign(number, m_max_size);
+        }
+        if (arg == "--mode")
+        {
+            m_mode = value;
+            return equal_ignore_case(value, "octet") || equal_ignore_case(value, "netascii");
+        }
+        if (arg == "--direction")
+        {
+            m_direction = value;
+            return (value == "get") || (value == "put") || (value == "both");
+        }
+        if (arg == "--blksize")
+        {
+            return parse_uint64(value, number) && (number >= MIN_DATA_SIZE) && (number <= MAX_DATA_SIZE)
+                && assign(number, m_block_size);
+        }
+        if (arg == "--windowsize")
+        {
+            return parse_uint64(value, number) && (number >= 1) && (number <= 0xFFFF)
+                && assign(number, m_window_size);
+        }
+        if (arg == "--timeout")
+        {
+            return parse_uint64(value, number) && (number >= MIN_RETRY_TIMEOUT_SEC)
+                && (number <= MAX_RETRY_TIMEOUT_SEC) && assign(number, m_timeout_sec);
+        }
+        if (arg == "--retries")
+        {
+            return parse_uint64(value, number) && (number >= 1) && (number <= 100) && assign(number, m_retry_count);
+        }
+        if (arg == "--footprint")
+        {
+            return parse_uint64(value, number) && (number > 0) && (number <= MAX_FOOTPRINT_COUNT)
+                && assign(number, m_footprint_count);
+        }
+        if (arg == "--seed")
+        {
+            return parse_uint64(value, number) && (number <= 0xFFFFFFFF) && assign(number, m_seed);
+        }
+        if (arg == "--loss")
+        {
+            return parse_probability(value, m_link.m_loss);
+        }
+        if (arg == "--duplicate")
+        {
+            return parse_probability(value, m_link.m_duplication);
+        }
+        if (arg == "--reorder")
+        {
+            return parse_probability(value, m_link.m_reordering);
+        }
+        if ((arg == "--delay") || (arg == "--jitter") || (arg == "--reorder-delay"))
+        {
+            if (!parse_uint64(value, number))
+            {
+                return false;
+            }
+            auto& delay = (arg == "--delay") ? m_link.m_delay
+                                             : ((arg == "--jitter") ? m_link.m_jitter : m_link.m_reorder_delay);
+            delay = std::chrono::microseconds(number);
+            return true;
+        }
+        if (arg == "--bandwidth")
+        {
+            return parse_uint64(value, m_link.m_bandwidth);
+        }
+        if (arg == "--log-level")
+        {
+            return logger::parse_level(value, level);
+        }
+
+        known = false;
+        return false;
+    }
+
+    template <class T>
+    static bool assign(std::uint64_t number, T& value)
+    {
+        value = static_cast<T>(number);
+        return true;
+    }
+
+    static bool parse_probability(const std::string& str, double& value)
+    {
+        char* end = nullptr;
+        value = std::strtod(str.c_str(), &end);
+        return !str.empty() && (*end == '\0') && (value >= 0.0) && (value <= 1.0);
+    }
+
+    bool simulate()
+    {
+        sim_network& network = sim_network::get();
+        network.configure(m_link, m_seed);
+
+        // files are generated independently of the network draws
+        std::mt19937 random(m_seed);
+
+        worker_pool workers(1);
+        auto& io_context = workers.get_io_context(0);
+
+        sim_io_manager io_manager;
+        server server(io_context, workers, create_settings("127.0.0.1"), io_manager);
+        server.start();
+
+        background_executor executor(1);
+        client client(io_context, executor);
+
+        if (m_count_allocations)
+        {
+            warm_up_handler_memory();
+        }
+
+        // virtual time step while no handler is ready
+        const sim_clock::duration tick = std::chrono::milliseconds(1);
+
+        std::vector<transfer_state> transfers(m_transfers_count);
+        std::size_t started_count = 0;
+        std::size_t completed_count = 0;
+
+        while (completed_count < transfers.size())
+        {
+            while ((started_count < transfers.size()) && (started_count - completed_count < m_concurrency))
+            {
+                auto& transfer = transfers[started_count];
+                transfer.m_put = (m_direction == "put") || ((m_direction == "both") && (started_count % 2 == 1));
+                transfer.m_filename = "file" + std::to_string(started_count);
+                transfer.m_content = generate_content(random);
+
+                start_transfer(client, io_manager, transfer, completed_count);
+                ++started_count;
+            }
+
+            network.run_step(io_context, tick);
+        }
+        auto elapsed = sim_clock::now().time_since_epoch();
+
+        // connections waiting for a lost final ACK are terminated
+        server.stop();
+        while (!network.is_idle())
+        {
+            network.run_step(io_context, tick);
+        }
+        while (io_context.poll() > 0)
+        {
+            // continue
+        }
+
+        bool success = report(transfers, elapsed);
+        if (m_count_allocations)
+        {
+            success &= report_allocations(transfers);
+        }
+        return success;
+    }
+
+    std::shared_ptr<server_settings> create_settings(const std::string& listen_address) const
+    {
+        auto settings = std::make_shared<server_settings>();
+        listen_settings listen;
+        listen.m_address = listen_address;
+        settings->m_listen.push_back(listen);
+        settings->m_server_port = SERVER_PORT;
+        settings->m_max_window_size = std::max(settings->m_max_window_size, m_window_size);
+        settings->m_retry_timeout_sec = m_timeout_sec;
+        settings->m_retry_count = m_retry_count;
+        return settings;
+    }
+
+    sim_io_manager::content_ptr generate_content(std::mt19937& random)
+    {
+        auto content = std::make_shared<std::vector<std::uint8_t>>(random() % (m_max_size + 1));
+        for (auto& byte : *content)
+        {
+            byte = static_cast<std::uint8_t>(random());
+        }
+        return content;
+    }
+
+    void start_transfer(
+        tftp::client& client, sim_io_manager& io_manager, transfer_state& transfer, std::size_t& completed_count)
+    {
+        request request;
+        request.m_type = transfer.m_put ? request_type::PUT : request_type::GET;
+        request.m_host = "127.0.0.1";
+        request.m_port = SERVER_PORT;
+        request.m_remote_filename = transfer.m_filename;
+        request.m_mode = m_mode;
+        request.m_block_size = m_block_size;
+        request.m_window_size = m_window_size;
+        request.m_timeout_sec = m_timeout_sec;
+        request.m_retry_count = m_retry_count;
+
+        auto state = &transfer;
+        auto manager = &io_manager;
+        auto completed = &completed_count;
+        auto handler = [state, manager, completed](const transfer_result& result) {
+            check_transfer(*state, *manager, result);
+            ++*completed;
+        };
+
+        client_transfer::progress_handler progress = nullptr;
+        if (m_count_allocations)
+        {
+            std::uint64_t warm_up_bytes = WARM_UP_WINDOWS_COUNT * m_window_size * m_block_size;
+            std::uint64_t end_bytes = transfer.m_content->size();
+            end_bytes -= std::min(end_bytes, warm_up_bytes);
+            progress = [state, warm_up_bytes, end_bytes](std::uint64_t bytes, std::uint64_t /*total_size*/) {
+                sample_allocations(*state, bytes, warm_up_bytes, end_bytes);
+            };
+        }
+
+        if (transfer.m_put)
+        {
+            client.start_put(request, stdext::make_unique<memory_reader>(transfer.m_content), handler, progress);
+            return;
+        }
+
+        io_manager.add_file(transfer.m_filename, transfer.m_content);
+        auto sink = stdext::make_unique<uncounted_writer>(
+            stdext::make_unique<memory_writer>([state](const chunked_buffer& content) {
+                state->m_received = std::make_shared<const std::vector<std::uint8_t>>(content.to_vector());
+                return true;
+            }));
+        client.start_get(request, std::move(sink), handler, progress);
+    }
+
+    static void sample_allocations(
+        transfer_state& transfer, std::uint64_t bytes, std::uint64_t warm_up_bytes, std::uint64_t end_bytes)
+    {
+        if ((bytes < warm_up_bytes) || (bytes > end_bytes))
+        {
+            return;
+        }
+
+        allocation_sample sample;
+        sample.m_bytes = bytes;
+        sample.m_allocations = allocation_counter::get_count();
+
+        if (!transfer.m_steady)
+        {
+            transfer.m_steady = true;
+            transfer.m_steady_start = sample;
+        }
+        transfer.m_steady_end = sample;
+    }
+
+    // Fills the handler memory of the thread as the peak of pending operations
+    // would, which could be reached only late in the run (e.g. by the sweep of
+    // the connections once a second).
+    static void warm_up_handler_memory()
+    {
+        auto& memory = handler_memory::get_thread_memory();
+        std::vector<void*> blocks;
+        for (std::size_t i = 0; i < WARM_UP_HANDLER_BLOCKS_COUNT; ++i)
+        {
+            blocks.push_back(memory.allocate(handler_memory::SMALL_BLOCK_SIZE));
+            blocks.push_back(memory.allocate(handler_memory::BLOCK_SIZE));
+        }
+        for (std::size_t i = 0; i < blocks.size(); ++i)
+        {
+            memory.deallocate(blocks[i], (i % 2 == 0) ? handler_memory::SMALL_BLOCK_SIZE : handler_memory::BLOCK_SIZE);
+        }
+    }
+
+    static void check_transfer(transfer_state& transfer, sim_io_manager& io_manager, const transfer_result& result)
+    {
+        transfer.m_result = result;
+        if (transfer.m_put)
+        {
+            transfer.m_received = io_manager.find_file(transfer.m_filename);
+        }
+        transfer.m_intact = transfer.m_received && (*transfer.m_received == *transfer.m_content);
+
+        io_manager.remove_file(transfer.m_filename);
+        transfer.m_content.reset();
+        transfer.m_received.reset();
+    }
+
+    static bool report(const std::vector<transfer_state>& transfers, sim_clock::duration elapsed)
+    {
+        std::size_t failed_count = 0;
+        std::size_t corrupted_count = 0;
+        std::uint64_t bytes = 0;
+        std::uint64_t retransmits = 0;
+
+        for (const auto& transfer : transfers)
+        {
+            retransmits += transfer.m_result.m_retransmits;
+            if (!transfer.m_result.is_success())
+            {
+                log_error() << transfer.m_filename << ": " << transfer.m_result.m_message << std::endl;
+                ++failed_count;
+                continue;
+            }
+
+            if (!transfer.m_intact)
+            {
+                log_error() << transfer.m_filename << ": content differs" << std::endl;
+                ++corrupted_count;
+                continue;
+            }
+            bytes += transfer.m_result.m_bytes;
+        }
+
+        auto seconds = std::chrono::duration<double>(elapsed).count();
+        auto& stats = sim_network::get().get_stats();
+
+        std::cout << std::fixed << std::setprecision(3) << "transfers: " << transfers.size() << ", failed "
+                  << failed_count << ", corrupted " << corrupted_count << "\n"
+                  << "bytes: " << bytes << " in " << seconds << " s (virtual)";
+        if (seconds > 0)
+        {
+            // no delay nor bandwidth limit takes no time
+            std::cout << ", goodput " << bytes / seconds / 1024 << " KiB/s";
+        }
+        std::cout << "\n"
+                  << "retransmits: " << retransmits << " (client)\n"
+                  << "datagrams: sent " << stats.m_sent << ", lost " << stats.m_lost << ", duplicated "
+                  << stats.m_duplicated << ", reordered " << stats.m_reordered << ", delivered " << stats.m_delivered
+                  << ", undeliverable " << stats.m_undeliverable << ", overflowed " << stats.m_overflowed
+                  << std::endl;
+
+        return (failed_count == 0) && (corrupted_count == 0);
+    }
+
+    bool report_allocations(const std::vector<transfer_state>& transfers) const
+    {
+        std::uint64_t blocks = 0;
+        std::uint64_t allocations = 0;
+
+        for (const auto& transfer : transfers)
+        {
+            if (transfer.m_steady && transfer.m_result.is_success())
+            {
+                blocks += (transfer.m_steady_end.m_bytes - transfer.m_steady_start.m_bytes) / m_block_size;
+                allocations += transfer.m_steady_end.m_allocations - transfer.m_steady_start.m_allocations;
+            }
+        }
+
+        std::cout << "allocations: " << allocations << " in " << blocks << " steady state blocks";
+        if (blocks > 0)
+        {
+            std::cout << ", " << static_cast<double>(allocations) / blocks << " per block";
+        }
+        std::cout << std::endl;
+
+        if (blocks == 0)
+        {
+            log_error() << "no steady state blocks, files too small" << std::endl;
+            return false;
+        }
+        return allocations == 0;
+    }
+
+    bool measure_footprints() const
+    {
+        std::cout << "sizeof: read_connection " << sizeof(read_connection) << ", write_connection "
+                  << sizeof(write_connection) << " (socket " << sizeof(udp_socket) << ", timer "
+                  << sizeof(transfer_timer) << ", transfer_counters " << sizeof(transfer_counters) << ", window_sender "
+                  << sizeof(window_sender<read_connection>) << ", packet_window " << sizeof(packet_window)
+                  << ", block_receiver " << sizeof(block_receiver<write_connection>) << ")" << std::endl;
+
+        bool success = true;
+        if (m_direction != "put")
+        {
+            success &= measure_footprint(false);
+        }
+        if (m_direction != "get")
+        {
+            success &= measure_footprint(true);
+        }
+        return success;
+    }
+
+    // Starts the transfers from peers which stop responding once the server
+    // sent the first window of a download or acknowledged the first one of an
+    // upload, and reports the heap kept by the server per waiting transfer.
+    // The virtual time is not advanced, so none of them times out.
+    bool measure_footprint(bool put) const
+    {
+        sim_network& network = sim_network::get();
+        network.configure(sim_link_settings(), m_seed);
+
+        worker_pool workers(1);
+        auto& io_context = workers.get_io_context(0);
+
+        // requests are spread over the addresses, so the connection sockets have a port each
+        auto settings = create_settings("0.0.0.0");
+        std::size_t addresses_count = m_footprint_count / EPHEMERAL_PORTS_COUNT + 1;
+
+        // downloads read the first of two windows of a shared file
+        sim_io_manager io_manager;
+        std::size_t file_size = 2 * m_window_size * m_block_size;
+        io_manager.add_file("file", std::make_shared<const std::vector<std::uint8_t>>(file_size));
+
+        server server(io_context, workers, settings, io_manager);
+        server.start();
+        network.run_ready(io_context);
+
+        auto start_bytes = allocation_counter::get_bytes();
+        std::size_t waiting_count = 0;
+
+        for (std::size_t first = 0; first < m_footprint_count; first += FOOTPRINT_BATCH_SIZE)
+        {
+            auto last = std::min(first + FOOTPRINT_BATCH_SIZE, m_footprint_count);
+
+            // peers stand in for the clients, they are not part of the footprint
+            std::vector<std::unique_ptr<sim_socket>> peers;
+            {
+                allocation_counter::uncounted scope;
+                for (auto i = first; i < last; ++i)
+                {
+                    auto server_address = static_cast<std::uint32_t>(FOOTPRINT_SERVER_ADDRESS + i % addresses_count);
+                    asio::ip::udp::endpoint server_endpoint(asio::ip::address_v4(server_address), SERVER_PORT);
+                    peers.push_back(start_peer(io_context, i, put, server_endpoint));
+                }
+            }
+            network.run_ready(io_context);
+
+            {
+                allocation_counter::uncounted scope;
+                for (auto& peer : peers)
+                {
+                    waiting_count += continue_peer(*peer, put) ? 1 : 0;
+                }
+                peers.clear();
+            }
+            network.run_ready(io_context);
+        }
+
+        auto bytes = allocation_counter::get_bytes() - start_bytes;
+        auto window_bytes = put ? 0 : m_window_size * (DATA_HEADER_SIZE + m_block_size);
+        auto connection_size = put ? sizeof(write_connection) : sizeof(read_connection);
+        auto transfer_bytes = static_cast<double>(bytes) / m_footprint_count;
+
+        std::cout << std::fixed << std::setprecision(1) << (put ? "uploads" : "downloads") << ": " << waiting_count
+                  << " of " << m_footprint_count << " waiting, heap " << bytes << " bytes, " << transfer_bytes
+                  << " per transfer (" << (put ? "write_connection " : "read_connection ") << connection_size
+                  << ", window data " << window_bytes << ", other "
+                  << transfer_bytes - static_cast<double>(connection_size + window_bytes) << ")" << std::endl;
+
+        server.stop();
+        network.run_ready(io_context);
+
+        if (waiting_count < m_footprint_count)
+        {
+            log_error() << "transfers not started: " << m_footprint_count - waiting_count << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Sends the request of the transfer from a peer of its own.
+    std::unique_ptr<sim_socket> start_peer(asio::io_context& io_context, std::size_t index, bool put,
+        const asio::ip::udp::endpoint& server_endpoint) const
+    {
+        auto peer = stdext::make_unique<sim_socket>(io_context);
+        asio::error_code ec;
+        peer->open(asio::ip::udp::v4(), ec);
+        peer->bind(asio::ip::udp::endpoint(
+                       asio::ip::address_v4(static_cast<std::uint32_t>(FOOTPRINT_PEER_ADDRESS + index)),
+                       FOOTPRINT_PEER_PORT),
+            ec);
+
+        packet_file_req request;
+        request.m_op = put ? OP_WRQ : OP_RRQ;
+        request.m_filename = put ? "file" + std::to_string(index) : "file";
+        request.m_mode = m_mode;
+        request.m_options[OPTION_BLKSIZE] = std::to_string(m_block_size);
+        request.m_options[OPTION_WINDOWSIZE] = std::to_string(m_window_size);
+        request.m_options[OPTION_TIMEOUT] = std::to_string(m_timeout_sec);
+
+        auto data = packet_builder::build_packet(request);
+        peer->send_to(asio::buffer(data), server_endpoint, 0, ec);
+        return peer;
+    }
+
+    // Acknowledges the OACK of a download or sends the first window of an
+    // upload, false if no OACK was received.
+    bool continue_peer(sim_socket& peer, bool put) const
+    {
+        std::vector<std::uint8_t> buffer(DATA_HEADER_SIZE + MAX_DATA_SIZE);
+        asio::ip::udp::endpoint connection_endpoint;
+        asio::error_code ec;
+        auto size = peer.receive_from(asio::buffer(buffer), connection_endpoint, 0, ec);
+        auto packet = ec ? nullptr : packet_parser::parse_packet(asio::buffer(buffer.data(), size));
+        if (!packet || (packet->m_op != OP_OACK))
+        {
+            return false;
+        }
+
+        if (!put)
+        {
+            packet_ack ack;
+            ack.m_op = OP_ACK;
+            ack.m_block_no = 0;
+            peer.send_to(asio::buffer(packet_builder::build_packet(ack)), connection_endpoint, 0, ec);
+            return !ec;
+        }
+
+        packet_data data;
+        data.m_op = OP_DATA;
+        data.m_data.resize(m_block_size);
+        for (std::size_t i = 1; (i <= m_window_size) && !ec; ++i)
+        {
+            data.m_block_no = static_cast<std::uint16_t>(i);
+            peer.send_to(asio::buffer(packet_builder::build_packet(data)), connection_endpoint, 0, ec);
+        }
+        return !ec;
+    }
+
+    void print_usage(std::ostream& stream) const
+    {
+        stream << "Usage: " << m_program_name << " [options]\n"
+               << "\n"
+               << "Options:\n"
+               << "  -h, --help                  print this message\n"
+               << "  --transfers COUNT           number of transfers (default: 100)\n"
+               << "  --concurrency COUNT         transfers running at once (default: 1)\n"
+               << "  --size BYTES                maximum file size, sizes are random (default: 262144)\n"
+               << "  --mode MODE                 octet or netascii (default: octet)\n"
+               << "  --direction DIRECTION       get, put or both alternately (default: both)\n"
+               << "  --blksize BYTES             requested block size (default: 512)\n"
+               << "  --windowsize BLOCKS         requested window size (default: 1)\n"
+               << "  --timeout SECONDS           retransmission timeout (default: 1)\n"
+               << "  --retries COUNT             transmissions of a packet (default: 5)\n"
+               << "  --seed NUMBER               seed of the files and the link conditions (default: 1)\n"
+               << "  --loss PROBABILITY          datagram loss (default: 0)\n"
+               << "  --duplicate PROBABILITY     datagram duplication (default: 0)\n"
+               << "  --reorder PROBABILITY       datagram held back by the reorder delay (default: 0)\n"
+               << "  --delay MICROSECONDS        one way delay (default: 0)\n"
+               << "  --jitter MICROSECONDS       random delay added to the one way delay (default: 0)\n"
+               << "  --reorder-delay MICROSECONDS\n"
+               << "                              delay of the reordered datagrams (default: 1000)\n"
+               << "  --bandwidth BYTES           bytes per second sent by a socket, 0 unlimited (default: 0)\n"
+               << "  --log-level LEVEL           error, warning, info or debug (default: error)\n"
+               << "  --count-allocations         fail if the transfers allocate memory per block once warmed up\n"
+               << "  --footprint COUNT           report the server memory of COUNT waiting transfers and exit\n";
+    }
+
+    const char* m_program_name;
+    int m_argc;
+    char** m_argv;
+
+    std::size_t m_transfers_count;
+    std::size_t m_concurrency;
+    std::size_t m_max_size;
+    std::string m_mode;
+    std::string m_direction;
+    std::size_t m_block_size;
+    std::uint16_t m_window_size;
+    int m_timeout_sec;
+    int m_retry_count;
+    std::uint32_t m_seed;
+    sim_link_settings m_link;
+    bool m_count_allocations;
+    std::size_t m_footprint_count;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct
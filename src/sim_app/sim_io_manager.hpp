@@ -0,0 +1,114 @@
+#pragma once
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "allocation_counter.hpp"
+#include "io_manager.hpp"
+#include "make_unique.hpp"
+#include "memory_io.hpp"
+#include "netascii_io.hpp"
+#include "string_utils.hpp"
+
+namespace oct
+{
+namespace net
+{
+namespace tftp
+{
+
+// Writes to the peer writer without counting the allocations, the storage of
+// a simulated file is not part of the transfer.
+class uncounted_writer : public writer
+{
+public:
+    explicit uncounted_writer(std::unique_ptr<writer> peer_writer)
+        : m_peer_writer(std::move(peer_writer))
+    {
+        // noop
+    }
+
+    bool is_open() const final
+    {
+        return m_peer_writer->is_open();
+    }
+
+    bool write(const void* buffer, const std::size_t bytes_count) final
+    {
+        allocation_counter::uncounted scope;
+        return m_peer_writer->write(buffer, bytes_count);
+    }
+
+    bool close() final
+    {
+        allocation_counter::uncounted scope;
+        return m_peer_writer->close();
+    }
+
+private:
+    std::unique_ptr<writer> m_peer_writer;
+};
+
+// Serves the files of the simulation and keeps the uploaded ones in memory.
+// Used only by the thread running the simulation.
+class sim_io_manager : public io_manager
+{
+public:
+    typedef std::shared_ptr<const std::vector<std::uint8_t>> content_ptr;
+
+    void add_file(const std::string& filename, content_ptr content)
+    {
+        m_files[filename] = content;
+    }
+
+    // Null if the file does not exist (e.g. its upload is not complete).
+    content_ptr find_file(const std::string& filename) const
+    {
+        auto iter = m_files.find(filename);
+        return (iter != m_files.end()) ? iter->second : nullptr;
+    }
+
+    void remove_file(const std::string& filename)
+    {
+        m_files.erase(filename);
+    }
+
+    std::unique_ptr<reader> create_reader(const std::string& filename, const std::string& mode) final
+    {
+        auto content = find_file(filename);
+        if (!content)
+        {
+            return nullptr;
+        }
+
+        if (equal_ignore_case(mode, "netascii"))
+        {
+            return stdext::make_unique<netascii_encoder<memory_reader>>(content);
+        }
+        return stdext::make_unique<memory_reader>(content);
+    }
+
+    std::unique_ptr<writer> create_writer(const std::string& filename, const std::string& mode) final
+    {
+        memory_writer::commit_handler commit = [this, filename](const chunked_buffer& content) {
+            add_file(filename, std::make_shared<const std::vector<std::uint8_t>>(content.to_vector()));
+            return true;
+        };
+
+        if (equal_ignore_case(mode, "netascii"))
+        {
+            return stdext::make_unique<uncounted_writer>(
+                stdext::make_unique<netascii_decoder<memory_writer>>(std::move(commit)));
+        }
+        return stdext::make_unique<uncounted_writer>(stdext::make_unique<memory_writer>(std::move(commit)));
+    }
+
+private:
+    std::map<std::string, content_ptr> m_files;
+};
+
+} // namespace tftp
+} // namespace net
+} // namespace oct